@@ -0,0 +1,315 @@
+/*
+ * Host simulation of the access log (src/accesslog.c) on an emulated scratch partition.
+ * Replays busy days of sessions (the central resets after every session, the log is re-initialized each time)
+ * and counts flash writes, erases and the page wear. The flash timing of the nRF52840 (41 us per word write,
+ * 85 ms per page erase) gives the flash busy time on the device, it is added to the cycle counter, so the measured
+ * times of the appends (the worker) and of the flushes (the system workqueue) include it.
+ * Power cuts at random times clear the RAM that survives warm resets, some of them interrupt a flash write or
+ * the start of a page. Afterwards the log has to continue: every record in flash is one that was appended, in
+ * order, and only records that were still in RAM (at most one batch per cut) may be missing.
+ *
+ * build: gcc -O2 -Isim/include -Isrc -o accesslog_sim sim/accesslog_sim.c sim/kernel.c src/retained.c src/accesslog.c
+ * usage: ./accesslog_sim [-n sessions per day] [-d days] [-c power cuts] [-s seed] [-v]
+ */
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <storage/flash_map.h>
+#include <sys/crc.h>
+#include "accesslog.h"
+#include "retained.h"
+
+int sim_log = 0;
+
+// scratch partition of the nrf52840_pca10059 board
+#define FLASH_SIZE 0x1e000
+#define PAGE_HEADER 16
+#define RECORDS_PER_PAGE ((DT_FLASH_ERASE_BLOCK_SIZE - PAGE_HEADER) / sizeof(struct accesslog_record))
+// nRF52840 product specification: t_WRITE per 32 bit word, t_ERASEPAGE
+#define WORD_WRITE_US 41
+#define PAGE_ERASE_US 85000
+#define ERASE_CYCLES 10000
+#define MAX_APPENDS 2000000
+#define MAX_CUTS 1000
+
+static u8_t flash[FLASH_SIZE];
+static const struct flash_area area = {DT_FLASH_AREA_IMAGE_SCRATCH_ID, 0, FLASH_SIZE};
+static u32_t page_erases[FLASH_SIZE / DT_FLASH_ERASE_BLOCK_SIZE];
+static u64_t writes = 0, bytes_written = 0, erases = 0;
+
+// power cut during the next flash operation: after this many bytes written (-1: no cut armed)
+static long cut_after = -1;
+static jmp_buf cut;
+
+int flash_area_open(u8_t id, const struct flash_area **fa) {
+    if (id != DT_FLASH_AREA_IMAGE_SCRATCH_ID) {
+        return -ENOENT;
+    }
+    *fa = &area;
+    return 0;
+}
+
+int flash_area_read(const struct flash_area *fa, off_t off, void *dst, size_t len) {
+    if (fa != &area || off < 0 || off + len > FLASH_SIZE) {
+        return -EINVAL;
+    }
+    memcpy(dst, flash + off, len);
+    return 0;
+}
+
+// like NOR flash, writing can only clear bits
+int flash_area_write(const struct flash_area *fa, off_t off, const void *src, size_t len) {
+    if (fa != &area || off < 0 || off + len > FLASH_SIZE || off % 4 || len % 4) {
+        return -EINVAL;
+    }
+    size_t n = cut_after >= 0 && (size_t) cut_after < len ? (size_t) cut_after : len;
+    for (size_t i = 0; i < n; ++i) {
+        flash[off + i] &= ((const u8_t *) src)[i];
+    }
+    writes++;
+    bytes_written += n;
+    sim_busy_ns += (u64_t) n / 4 * WORD_WRITE_US * 1000U;
+    if (n < len) {
+        longjmp(cut, 1);
+    }
+    if (cut_after >= 0) {
+        cut_after -= (long) len;
+    }
+    return 0;
+}
+
+int flash_area_erase(const struct flash_area *fa, off_t off, size_t len) {
+    if (fa != &area || off < 0 || off + len > FLASH_SIZE || off % DT_FLASH_ERASE_BLOCK_SIZE) {
+        return -EINVAL;
+    }
+    memset(flash + off, 0xff, len);
+    for (size_t p = 0; p < len / DT_FLASH_ERASE_BLOCK_SIZE; ++p) {
+        page_erases[off / DT_FLASH_ERASE_BLOCK_SIZE + p]++;
+        erases++;
+        sim_busy_ns += PAGE_ERASE_US * 1000U;
+    }
+    // the cut hits between the erase and the page header
+    if (cut_after == 0) {
+        longjmp(cut, 1);
+    }
+    return 0;
+}
+
+u32_t crc32_ieee(const u8_t *data, size_t len) {
+    u32_t crc = 0xffffffff;
+    for (size_t i = 0; i < len; ++i) {
+        crc ^= data[i];
+        for (int b = 0; b < 8; ++b) {
+            crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+        }
+    }
+    return ~crc;
+}
+
+// the simulated coin address carries the number of the append, so the records can be checked
+static u32_t record_index(const struct accesslog_record *r) {
+    u32_t i;
+    memcpy(&i, r->addr.a.val, sizeof(i));
+    return i;
+}
+
+static u32_t appended = 0;
+static u32_t cut_at[MAX_CUTS];  // appends before each power cut
+static u32_t cuts = 0;
+
+static int failures = 0;
+
+static void check(bool ok, const char *what) {
+    printf("%-60s %s\n", what, ok ? "ok" : "FAIL");
+    if (!ok) {
+        failures++;
+    }
+}
+
+// reads all valid records from the emulated flash, returns the number of records in the ring
+static u32_t read_log(struct accesslog_record *out, u32_t max) {
+    u32_t pages = FLASH_SIZE / DT_FLASH_ERASE_BLOCK_SIZE;
+    u32_t n = 0;
+    for (u32_t p = 0; p < pages; ++p) {
+        for (u32_t i = 0; i < RECORDS_PER_PAGE && n < max; ++i) {
+            struct accesslog_record r;
+            memcpy(&r, flash + p * DT_FLASH_ERASE_BLOCK_SIZE + PAGE_HEADER + i * sizeof(r), sizeof(r));
+            if (r.seq != 0xffffffff && r.crc == crc32_ieee((const u8_t *) &r, offsetof(struct accesslog_record, crc))) {
+                out[n++] = r;
+            }
+        }
+    }
+    return n;
+}
+
+static int by_time(const void *a, const void *b) {
+    s64_t x = *(const s64_t *) a, y = *(const s64_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+static int by_seq(const void *a, const void *b) {
+    u32_t x = ((const struct accesslog_record *) a)->seq, y = ((const struct accesslog_record *) b)->seq;
+    return x < y ? -1 : x > y;
+}
+
+// records in flash are appended ones in order, missing ones were in RAM at a power cut
+static void check_log(void) {
+    static struct accesslog_record log[FLASH_SIZE / sizeof(struct accesslog_record)];
+    u32_t n = read_log(log, ARRAY_SIZE(log));
+    qsort(log, n, sizeof(log[0]), by_seq);
+    bool ordered = true, unique = true;
+    u32_t missing = 0, unexplained = 0, max_gap = 0;
+    for (u32_t i = 1; i < n; ++i) {
+        unique &= log[i].seq != log[i - 1].seq;
+        u32_t a = record_index(&log[i - 1]), b = record_index(&log[i]);
+        ordered &= b > a;
+        for (u32_t m = a + 1; m < b; ++m) {
+            missing++;
+            bool explained = false;
+            for (u32_t c = 0; c < cuts && !explained; ++c) {
+                explained = m < cut_at[c] && m + CONFIG_CENTRAL_ACCESS_LOG_BATCH >= cut_at[c];
+            }
+            unexplained += !explained;
+        }
+        max_gap = MAX(max_gap, b - a - 1);
+    }
+    u32_t oldest = n ? record_index(&log[0]) : 0;
+    printf("flash: %u records (appends %u..%u), %u missing after %u power cuts, largest gap %u\n",
+           n, oldest, n ? record_index(&log[n - 1]) : 0, missing, cuts, max_gap);
+    check(unique, "sequence numbers are unique");
+    check(ordered, "records are in the order they were appended");
+    check(unexplained == 0, "only records in RAM at a power cut are missing");
+    check(n == 0 || appended - 1 - record_index(&log[n - 1]) <= CONFIG_CENTRAL_ACCESS_LOG_BATCH,
+          "at most one batch is not in flash");
+}
+
+int main(int argc, char **argv) {
+    static u32_t per_day = 500, days = 365, power_cuts = 20;
+    unsigned int seed = 1;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:d:c:s:v")) != -1) {
+        switch (opt) {
+            case 'n':
+                per_day = strtoul(optarg, NULL, 10);
+                break;
+            case 'd':
+                days = strtoul(optarg, NULL, 10);
+                break;
+            case 'c':
+                power_cuts = MIN(strtoul(optarg, NULL, 10), MAX_CUTS);
+                break;
+            case 's':
+                seed = strtoul(optarg, NULL, 10);
+                break;
+            case 'v':
+                sim_log = 1;
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-n sessions per day] [-d days] [-c power cuts] [-s seed] [-v]\n",
+                        argv[0]);
+                return 1;
+        }
+    }
+    srand(seed);
+    memset(flash, 0xff, sizeof(flash));
+    sim_power_loss();
+
+    u64_t sessions = (u64_t) per_day * days;
+    if (sessions > MAX_APPENDS) {
+        fprintf(stderr, "at most %u sessions\n", MAX_APPENDS);
+        return 1;
+    }
+    // sessions at random times in the 12 opening hours of each day
+    s64_t day_ms = 24LL * 3600 * 1000;
+    // changed after setjmp(), kept across the longjmp() of a power cut
+    volatile s64_t last = 0;
+    volatile u32_t d, s;
+    s64_t cut_time[MAX_CUTS];
+    for (u32_t c = 0; c < power_cuts; ++c) {
+        cut_time[c] = (s64_t) ((double) rand() / RAND_MAX * (double) days * (double) day_ms);
+    }
+    qsort(cut_time, power_cuts, sizeof(cut_time[0]), by_time);
+    volatile u32_t next_cut = 0;
+    volatile u32_t torn = 0;
+    volatile u64_t append_ns = 0;
+    volatile u32_t max_append_ns = 0;
+
+    if (setjmp(cut)) {
+        goto power_on;
+    }
+    retained_init();
+    accesslog_init();
+    for (d = 0; d < days; ++d) {
+        for (s = 0; s < per_day; ++s) {
+            s64_t t = d * day_ms + 8 * 3600 * 1000LL + (s64_t) ((double) rand() / RAND_MAX * 12 * 3600 * 1000);
+            // sessions of a day are not sorted, the log only sees one after the other
+            t = MAX(t, last + 2000);
+            sim_now += t - last;
+            last = t;
+            while (next_cut < power_cuts && cut_time[next_cut] <= t && cuts < MAX_CUTS) {
+                next_cut++;
+                if (rand() % 2 && cut_after < 0) {
+                    // the cut interrupts the next flash operation
+                    cut_after = (rand() % (CONFIG_CENTRAL_ACCESS_LOG_BATCH * sizeof(struct accesslog_record) / 4)) * 4;
+                } else {
+                    cut_at[cuts++] = appended;
+                    sim_power_loss();
+                    sim_now = 0;
+                    retained_init();
+                    accesslog_init();
+                }
+            }
+            bt_addr_le_t addr = {.type = BT_ADDR_LE_RANDOM};
+            memcpy(addr.a.val, &appended, sizeof(appended));
+            u8_t result = rand() % 10 ? 0 : 1 + rand() % 4;
+            appended++;
+            u32_t start = k_cycle_get_32();
+            accesslog_append(&addr, result, (s8_t) (-40 - rand() % 50), (s8_t) (rand() % 101), 800 + rand() % 400);
+            u32_t ns = k_cycle_get_32() - start;
+            append_ns += ns;
+            if (ns > max_append_ns) {
+                max_append_ns = ns;
+            }
+            // watchdog reset after the session
+            sim_advance(1500);
+            sim_now = 0;
+            retained_init();
+            accesslog_init();
+            continue;
+power_on:
+            // the cut hit a flash write or erase of the append before
+            cut_at[cuts++] = appended;
+            torn++;
+            cut_after = -1;
+            sim_power_loss();
+            sim_now = 0;
+            retained_init();
+            accesslog_init();
+        }
+    }
+    u32_t pages = FLASH_SIZE / DT_FLASH_ERASE_BLOCK_SIZE;
+    u32_t max_erases = 0;
+    for (u32_t p = 0; p < pages; ++p) {
+        max_erases = MAX(max_erases, page_erases[p]);
+    }
+    double per_day_erases = (double) erases / days;
+    double busy_ms = ((double) bytes_written / 4 * WORD_WRITE_US + (double) erases * PAGE_ERASE_US) / 1000 / days;
+    printf("%u sessions in %u days (%u per day), %u pages of %u records, batches of %u\n",
+           (u32_t) sessions, days, per_day, pages, (u32_t) RECORDS_PER_PAGE, CONFIG_CENTRAL_ACCESS_LOG_BATCH);
+    printf("append (worker): mean %.1f us, max %.1f us\n",
+           sessions ? (double) append_ns / (double) sessions / 1000 : 0.0, max_append_ns / 1000.0);
+    printf("flash per day: %.1f writes, %.0f bytes, %.2f page erases, busy %.0f ms on the nRF52840\n",
+           (double) writes / days, (double) bytes_written / days, per_day_erases, busy_ms);
+    printf("unbatched per day: %u writes, %u bytes (one record per session)\n",
+           per_day, per_day * (u32_t) sizeof(struct accesslog_record));
+    printf("page wear: max %u erases, %.1f years to %u cycles per page\n", max_erases,
+           per_day_erases > 0 ? ERASE_CYCLES * pages / per_day_erases / 365 : 0.0, ERASE_CYCLES);
+    printf("power cuts: %u (%u during a flash operation)\n", cuts, torn);
+    struct shell sh;
+    accesslog_print(&sh);
+    check_log();
+    return failures ? 1 : 0;
+}
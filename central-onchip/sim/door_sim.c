@@ -0,0 +1,120 @@
+/*
+ * Host simulation of the door actuation (src/door.c) on an emulated GPIO.
+ * Checks pulse length and lockout window (also across the watchdog reset) and measures the latency
+ * from the start of the validation to the GPIO write on the host.
+ *
+ * build: gcc -O2 -Isim/include -Isrc -o door_sim sim/door_sim.c sim/kernel.c src/retained.c src/cycles.c src/door.c
+ * usage: ./door_sim [-v]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <drivers/gpio.h>
+#include "door.h"
+#include "retained.h"
+#include "cycles.h"
+
+int sim_log = 0;
+
+#define LATENCY_RUNS 10000
+
+static struct device gpio0 = {"GPIO_0"};
+static bool pin_output = false;
+static u32_t pin_value = 0;
+static u32_t pin_writes = 0;
+// cycle counter at the last write that activated the output
+static u32_t pin_active_cycles = 0;
+
+struct device *device_get_binding(const char *name) {
+    return strcmp(name, gpio0.name) ? NULL : &gpio0;
+}
+
+int gpio_pin_configure(struct device *port, u32_t pin, int flags) {
+    if (port != &gpio0 || pin != CONFIG_CENTRAL_DOOR_GPIO_PIN) {
+        return -EINVAL;
+    }
+    pin_output = flags & GPIO_DIR_OUT;
+    return 0;
+}
+
+int gpio_pin_write(struct device *port, u32_t pin, u32_t value) {
+    if (port != &gpio0 || pin != CONFIG_CENTRAL_DOOR_GPIO_PIN) {
+        return -EINVAL;
+    }
+    if (value && !pin_value) {
+        pin_active_cycles = cycles_get();
+    }
+    pin_value = value;
+    pin_writes++;
+    return 0;
+}
+
+static int failures = 0;
+
+static void check(bool ok, const char *what) {
+    printf("%-50s %s\n", what, ok ? "ok" : "FAIL");
+    if (!ok) {
+        failures++;
+    }
+}
+
+static int cmp_u32(const void *a, const void *b) {
+    u32_t x = *(const u32_t *) a, y = *(const u32_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1 && !strcmp(argv[1], "-v")) {
+        sim_log = 1;
+    }
+    retained_init();
+    check(door_init() == 0 && pin_output && pin_value == 0, "init: output, inactive");
+
+    check(door_open(cycles_get()) == 0 && pin_value == 1, "t=0: validated, output active");
+    sim_advance(1000);
+    check(door_open(cycles_get()) == -EBUSY && pin_value == 1, "t=1000: validated during pulse, locked out");
+    sim_advance(CONFIG_CENTRAL_DOOR_PULSE_MS - 1000 - 1);
+    check(pin_value == 1 && door_active(), "t=pulse-1: output still active");
+    sim_advance(1);
+    check(pin_value == 0 && !door_active(), "t=pulse: output released");
+    sim_advance(CONFIG_CENTRAL_DOOR_LOCKOUT_MS - CONFIG_CENTRAL_DOOR_PULSE_MS - 1);
+    check(door_open(cycles_get()) == -EBUSY && pin_value == 0, "t=lockout-1: validated, locked out");
+    sim_advance(1);
+    check(door_open(cycles_get()) == 0 && pin_value == 1, "t=lockout: validated, output active again");
+    sim_advance(CONFIG_CENTRAL_DOOR_LOCKOUT_MS);
+    check(pin_value == 0, "output released");
+
+    // watchdog reset after the pulse, the uptime restarts
+    check(door_open(cycles_get()) == 0, "t=0: validated, output active");
+    sim_advance(CONFIG_CENTRAL_DOOR_PULSE_MS);
+    sim_now = 0;
+    retained_init();
+    check(door_init() == 0 && pin_value == 0, "t=pulse: reset, output inactive");
+    check(door_open(cycles_get()) == -EBUSY, "t=pulse: validated after reset, locked out");
+    sim_advance(CONFIG_CENTRAL_DOOR_LOCKOUT_MS - CONFIG_CENTRAL_DOOR_PULSE_MS);
+    check(door_open(cycles_get()) == 0, "t=lockout: validated after reset, output active");
+    sim_advance(CONFIG_CENTRAL_DOOR_LOCKOUT_MS);
+    // power loss: random RAM must not lock the door out
+    sim_power_loss();
+    sim_now = 0;
+    retained_init();
+    check(door_init() == 0 && door_open(cycles_get()) == 0, "power loss: validated, output active");
+    sim_advance(CONFIG_CENTRAL_DOOR_LOCKOUT_MS);
+
+    // validation start to GPIO write, measured like in check_response()
+    static u32_t latency[LATENCY_RUNS];
+    for (size_t i = 0; i < LATENCY_RUNS; ++i) {
+        u32_t start = cycles_get();
+        door_open(start);
+        latency[i] = pin_active_cycles - start;
+        sim_advance(CONFIG_CENTRAL_DOOR_LOCKOUT_MS);
+    }
+    qsort(latency, LATENCY_RUNS, sizeof(latency[0]), cmp_u32);
+    printf("validation to GPIO write (host): p50 %u ns, p99 %u ns, max %u ns\n",
+           latency[LATENCY_RUNS / 2], latency[LATENCY_RUNS * 99 / 100], latency[LATENCY_RUNS - 1]);
+    struct shell sh;
+    door_print(&sh);
+    return failures ? 1 : 0;
+}
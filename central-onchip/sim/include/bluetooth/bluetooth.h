@@ -0,0 +1,70 @@
+#pragma once
+
+#include <string.h>
+#include <zephyr.h>
+
+typedef struct {
+    u8_t val[6];
+} bt_addr_t;
+
+typedef struct {
+    u8_t type;
+    bt_addr_t a;
+} bt_addr_le_t;
+
+static inline int bt_addr_le_cmp(const bt_addr_le_t *a, const bt_addr_le_t *b) {
+    return memcmp(a, b, sizeof(*a));
+}
+
+static inline void bt_addr_le_copy(bt_addr_le_t *dst, const bt_addr_le_t *src) {
+    memcpy(dst, src, sizeof(*dst));
+}
+
+#define BT_ADDR_LE_PUBLIC 0x00
+#define BT_ADDR_LE_RANDOM 0x01
+#define BT_ID_DEFAULT 0
+
+#define BT_ADDR_IS_RPA(a) (((a)->val[5] & 0xc0) == 0x40)
+#define BT_ADDR_IS_NRPA(a) (((a)->val[5] & 0xc0) == 0x00)
+
+static inline int bt_addr_cmp(const bt_addr_t *a, const bt_addr_t *b) {
+    return memcmp(a, b, sizeof(*a));
+}
+
+static inline void bt_addr_copy(bt_addr_t *dst, const bt_addr_t *src) {
+    memcpy(dst, src, sizeof(*dst));
+}
+
+static inline bool bt_addr_le_is_rpa(const bt_addr_le_t *addr) {
+    return addr->type == BT_ADDR_LE_RANDOM && BT_ADDR_IS_RPA(&addr->a);
+}
+
+// advertisement types of the scan callback
+#define BT_LE_ADV_IND 0x00
+#define BT_LE_ADV_DIRECT_IND 0x01
+#define BT_LE_ADV_SCAN_IND 0x02
+#define BT_LE_ADV_NONCONN_IND 0x03
+#define BT_LE_ADV_SCAN_RSP 0x04
+
+#define BT_DATA_SVC_DATA16 0x16
+
+struct net_buf_simple {
+    u8_t *data;
+    u16_t len;
+    u16_t size;
+};
+
+struct bt_data {
+    u8_t type;
+    u8_t data_len;
+    const u8_t *data;
+};
+
+// implemented by the simulation
+void bt_data_parse(struct net_buf_simple *ad, bool (*func)(struct bt_data *data, void *user_data), void *user_data);
+
+struct bt_conn;
+
+// implemented by the simulation
+struct bt_conn *bt_conn_lookup_addr_le(u8_t id, const bt_addr_le_t *peer);
+void bt_conn_unref(struct bt_conn *conn);
@@ -0,0 +1,7 @@
+#pragma once
+// stand-in for the RPA helpers of the Zephyr BLE stack (subsys/bluetooth/common/rpa.h)
+
+#include <bluetooth/bluetooth.h>
+
+// implemented by the simulation
+bool bt_rpa_irk_matches(const u8_t irk[16], const bt_addr_t *addr);
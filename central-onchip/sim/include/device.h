@@ -0,0 +1,8 @@
+#pragma once
+
+struct device {
+    const char *name;
+};
+
+// provided by the simulation
+struct device *device_get_binding(const char *name);
@@ -0,0 +1,10 @@
+#pragma once
+// emulated GPIO, provided by the simulation
+
+#include <device.h>
+#include <zephyr.h>
+
+#define GPIO_DIR_OUT (1U << 0)
+
+int gpio_pin_configure(struct device *port, u32_t pin, int flags);
+int gpio_pin_write(struct device *port, u32_t pin, u32_t value);
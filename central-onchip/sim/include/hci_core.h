@@ -0,0 +1,7 @@
+#pragma once
+// stand-in for the internal HCI core API of the Zephyr BLE host (subsys/bluetooth/host/hci_core.h)
+
+#include <bluetooth/bluetooth.h>
+
+// implemented by the simulation
+bool bt_addr_le_is_bonded(u8_t id, const bt_addr_le_t *addr);
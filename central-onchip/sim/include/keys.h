@@ -0,0 +1,35 @@
+#pragma once
+// stand-in for the internal key storage of the Zephyr BLE host (subsys/bluetooth/host/keys.h)
+
+#include <bluetooth/bluetooth.h>
+
+#define BT_KEYS_IRK BIT(1)
+#define BT_KEYS_LTK_P256 BIT(5)
+#define BT_KEYS_AUTHENTICATED BIT(0)
+#define BT_KEYS_SC BIT(4)
+#define BT_ENC_KEY_SIZE_MAX 16
+
+struct bt_irk {
+    u8_t val[16];
+    bt_addr_t rpa;
+};
+
+struct bt_ltk {
+    u8_t rand[8];
+    u8_t ediv[2];
+    u8_t val[16];
+};
+
+struct bt_keys {
+    u8_t id;
+    bt_addr_le_t addr;
+    u8_t enc_size;
+    u8_t flags;
+    u16_t keys;
+    struct bt_ltk ltk;
+    struct bt_irk irk;
+};
+
+// implemented by the simulation on a table of CONFIG_BT_MAX_PAIRED keys
+struct bt_keys *bt_keys_find_addr(u8_t id, const bt_addr_le_t *addr);
+struct bt_keys *bt_keys_get_addr(u8_t id, const bt_addr_le_t *addr);
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <stdio.h>
+
+// set by the simulation to print the log of the simulated modules
+extern int sim_log;
+// number of messages at the default log level (info), on the device each one takes a buffer of the deferred log
+extern unsigned long sim_log_msgs;
+
+#define LOG_MODULE_REGISTER(name)
+#define LOG_MODULE_DECLARE(name)
+#define SIM_LOG(...) do { if (sim_log) { printf(__VA_ARGS__); printf("\n"); } } while (0)
+#define SIM_LOG_MSG(...) do { sim_log_msgs++; SIM_LOG(__VA_ARGS__); } while (0)
+#define LOG_ERR(...) SIM_LOG_MSG(__VA_ARGS__)
+#define LOG_WRN(...) SIM_LOG_MSG(__VA_ARGS__)
+#define LOG_INF(...) SIM_LOG_MSG(__VA_ARGS__)
+#define LOG_DBG(...) SIM_LOG(__VA_ARGS__)
@@ -0,0 +1,9 @@
+#pragma once
+
+#include <stdio.h>
+
+struct shell {
+    int unused;
+};
+
+#define shell_print(shell, ...) do { (void) (shell); printf(__VA_ARGS__); printf("\n"); } while (0)
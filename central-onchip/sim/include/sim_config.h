@@ -0,0 +1,35 @@
+#pragma once
+// configuration of the simulated firmware, defaults of prj.conf and Kconfig
+
+// the key store simulation builds with the cache size of keystore.conf
+#ifndef CONFIG_BT_MAX_PAIRED
+#define CONFIG_BT_MAX_PAIRED 50
+#endif
+
+#define CONFIG_CENTRAL_DOOR 1
+#define CONFIG_CENTRAL_DOOR_GPIO_PORT "GPIO_0"
+#define CONFIG_CENTRAL_DOOR_GPIO_PIN 29
+#define CONFIG_CENTRAL_DOOR_PULSE_MS 3000
+#define CONFIG_CENTRAL_DOOR_LOCKOUT_MS 5000
+
+#define CONFIG_CENTRAL_TRACE_EVENTS 1024
+
+// the key store simulation is built with other sizes
+#ifndef CONFIG_CENTRAL_KEYSTORE_UNKNOWN
+#define CONFIG_CENTRAL_KEYSTORE_UNKNOWN 512
+#endif
+
+#define CONFIG_CENTRAL_ACCESS_LOG 1
+#define CONFIG_CENTRAL_ACCESS_LOG_BATCH 16
+#define CONFIG_CENTRAL_ACCESS_LOG_FLUSH_S 600
+
+#define CONFIG_CENTRAL_PROXIMITY 1
+// the proximity simulation is built with other thresholds and with CONFIG_CENTRAL_PROXIMITY_APPROACH
+#ifndef CONFIG_CENTRAL_PROXIMITY_RSSI
+#define CONFIG_CENTRAL_PROXIMITY_RSSI -80
+#endif
+#ifndef CONFIG_CENTRAL_PROXIMITY_SAMPLES
+#define CONFIG_CENTRAL_PROXIMITY_SAMPLES 3
+#endif
+#define CONFIG_CENTRAL_PROXIMITY_ADAPTIVE 1
+#define CONFIG_CENTRAL_PROXIMITY_MARGIN 6
@@ -0,0 +1,20 @@
+#pragma once
+// stand-in for the flash map API, implemented by the simulation on a RAM buffer
+
+#include <zephyr.h>
+
+// image-1 partition of the nrf52840_pca10059 board
+#define DT_FLASH_AREA_IMAGE_1_ID 2
+#define DT_FLASH_AREA_IMAGE_SCRATCH_ID 3
+#define DT_FLASH_ERASE_BLOCK_SIZE 4096
+
+struct flash_area {
+    u8_t fa_id;
+    u32_t fa_off;
+    size_t fa_size;
+};
+
+int flash_area_open(u8_t id, const struct flash_area **fa);
+int flash_area_read(const struct flash_area *fa, off_t off, void *dst, size_t len);
+int flash_area_write(const struct flash_area *fa, off_t off, const void *src, size_t len);
+int flash_area_erase(const struct flash_area *fa, off_t off, size_t len);
@@ -0,0 +1,5 @@
+#pragma once
+
+#include <zephyr.h>
+
+u32_t crc32_ieee(const u8_t *data, size_t len);
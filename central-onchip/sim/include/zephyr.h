@@ -0,0 +1,127 @@
+#pragma once
+// minimal stand-in for the Zephyr kernel API used by the host simulations (implemented in sim/kernel.c)
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "sim_config.h"
+
+typedef int8_t s8_t;
+typedef uint8_t u8_t;
+typedef uint16_t u16_t;
+typedef int16_t s16_t;
+typedef uint32_t u32_t;
+typedef int32_t s32_t;
+typedef int64_t s64_t;
+typedef uint64_t u64_t;
+
+#define ARRAY_SIZE(array) (sizeof(array) / sizeof((array)[0]))
+#define BUILD_ASSERT(expr) _Static_assert(expr, #expr)
+#define ARG_UNUSED(x) (void)(x)
+#define MAX(a, b) (((a) > (b)) ? (a) : (b))
+#define MIN(a, b) (((a) < (b)) ? (a) : (b))
+// kept in a section of its own, so a simulation can overwrite it to emulate a power loss (sim_power_loss())
+#define __noinit __attribute__((__section__("sim_noinit")))
+#define __packed __attribute__((__packed__))
+#define BIT(n) (1UL << (n))
+
+// IS_ENABLED() as in Zephyr: 1 if the macro is defined to 1, else 0
+#define _XXXX1 _YYYY,
+#define IS_ENABLED(config_macro) _IS_ENABLED1(config_macro)
+#define _IS_ENABLED1(config_macro) _IS_ENABLED2(_XXXX##config_macro)
+#define _IS_ENABLED2(one_or_two_args) _IS_ENABLED3(one_or_two_args 1, 0)
+#define _IS_ENABLED3(ignore_this, val, ...) val
+
+#define K_MSEC(ms) (ms)
+#define K_FOREVER (-1)
+#define K_NO_WAIT 0
+
+struct k_work;
+typedef void (*k_work_handler_t)(struct k_work *work);
+
+struct k_work {
+    k_work_handler_t handler;
+};
+
+struct k_delayed_work {
+    struct k_work work;
+    s64_t deadline;
+    bool pending;
+};
+
+// simulated uptime in ms
+extern s64_t sim_now;
+
+s64_t k_uptime_get(void);
+
+// hardware cycle counter, 1 cycle = 1 ns (host monotonic clock plus sim_busy_ns)
+u32_t k_cycle_get_32(void);
+
+// time of emulated hardware (e.g. flash operations on the device) that is added to the cycle counter
+extern u64_t sim_busy_ns;
+#define SYS_CLOCK_HW_CYCLES_TO_NS(cycles) ((u64_t) (cycles))
+
+// the simulations are single threaded
+static inline unsigned int irq_lock(void) {
+    return 0;
+}
+
+static inline void irq_unlock(unsigned int key) {
+    (void) key;
+}
+
+static inline void k_sched_lock(void) {
+}
+
+static inline void k_sched_unlock(void) {
+}
+
+struct k_mutex {
+    int count;
+};
+
+static inline void k_mutex_init(struct k_mutex *mutex) {
+    mutex->count = 0;
+}
+
+static inline int k_mutex_lock(struct k_mutex *mutex, s32_t timeout) {
+    (void) timeout;
+    mutex->count++;
+    return 0;
+}
+
+static inline void k_mutex_unlock(struct k_mutex *mutex) {
+    mutex->count--;
+}
+
+struct k_timer;
+typedef void (*k_timer_expiry_t)(struct k_timer *timer);
+
+struct k_timer {
+    k_timer_expiry_t expiry;
+    s64_t deadline;
+    s32_t period;
+    bool running;
+};
+
+void k_delayed_work_init(struct k_delayed_work *work, k_work_handler_t handler);
+int k_delayed_work_submit(struct k_delayed_work *work, s32_t delay);
+int k_delayed_work_cancel(struct k_delayed_work *work);
+
+void k_timer_init(struct k_timer *timer, k_timer_expiry_t expiry, k_timer_expiry_t stop);
+void k_timer_start(struct k_timer *timer, s32_t duration, s32_t period);
+
+/**
+ * Advances the simulated uptime and runs the delayed work and the timers that expire meanwhile.
+ * @param ms time to advance
+ */
+void sim_advance(s64_t ms);
+
+/**
+ * Fills the RAM that is not initialized on boot (__noinit) with random bytes, like after a power loss.
+ * A warm reset keeps it.
+ */
+void sim_power_loss(void);
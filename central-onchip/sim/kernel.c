@@ -0,0 +1,122 @@
+/*
+ * Simulated kernel for the host simulations: uptime, cycle counter, delayed work and timers.
+ */
+#include <stdlib.h>
+#include <time.h>
+
+#include <zephyr.h>
+
+#define SIM_MAX_WORK 8
+#define SIM_MAX_TIMERS 4
+
+s64_t sim_now = 0;
+u64_t sim_busy_ns = 0;
+unsigned long sim_log_msgs = 0;
+static struct k_delayed_work *works[SIM_MAX_WORK];
+static size_t works_len = 0;
+static struct k_timer *timers[SIM_MAX_TIMERS];
+static size_t timers_len = 0;
+
+s64_t k_uptime_get(void) {
+    return sim_now;
+}
+
+u32_t k_cycle_get_32(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u32_t) ((u64_t) ts.tv_sec * 1000000000U + (u64_t) ts.tv_nsec + sim_busy_ns);
+}
+
+void k_delayed_work_init(struct k_delayed_work *work, k_work_handler_t handler) {
+    work->work.handler = handler;
+    work->pending = false;
+    for (size_t i = 0; i < works_len; ++i) {
+        if (works[i] == work) {
+            return;
+        }
+    }
+    if (works_len < SIM_MAX_WORK) {
+        works[works_len++] = work;
+    }
+}
+
+int k_delayed_work_submit(struct k_delayed_work *work, s32_t delay) {
+    work->deadline = sim_now + delay;
+    work->pending = true;
+    return 0;
+}
+
+int k_delayed_work_cancel(struct k_delayed_work *work) {
+    if (!work->pending) {
+        return -EINVAL;
+    }
+    work->pending = false;
+    return 0;
+}
+
+void k_timer_init(struct k_timer *timer, k_timer_expiry_t expiry, k_timer_expiry_t stop) {
+    (void) stop;
+    timer->expiry = expiry;
+    timer->running = false;
+    for (size_t i = 0; i < timers_len; ++i) {
+        if (timers[i] == timer) {
+            return;
+        }
+    }
+    if (timers_len < SIM_MAX_TIMERS) {
+        timers[timers_len++] = timer;
+    }
+}
+
+void k_timer_start(struct k_timer *timer, s32_t duration, s32_t period) {
+    timer->deadline = sim_now + duration;
+    timer->period = period;
+    timer->running = true;
+}
+
+void sim_advance(s64_t ms) {
+    s64_t end = sim_now + ms;
+    for (;;) {
+        struct k_delayed_work *next = NULL;
+        for (size_t i = 0; i < works_len; ++i) {
+            if (works[i]->pending && works[i]->deadline <= end &&
+                (!next || works[i]->deadline < next->deadline)) {
+                next = works[i];
+            }
+        }
+        struct k_timer *timer = NULL;
+        for (size_t i = 0; i < timers_len; ++i) {
+            if (timers[i]->running && timers[i]->deadline <= end &&
+                (!timer || timers[i]->deadline < timer->deadline)) {
+                timer = timers[i];
+            }
+        }
+        if (timer && (!next || timer->deadline < next->deadline)) {
+            sim_now = timer->deadline > sim_now ? timer->deadline : sim_now;
+            // expiries that were skipped by setting sim_now directly run once
+            do {
+                timer->deadline += timer->period;
+            } while (timer->period > 0 && timer->deadline <= sim_now);
+            timer->running = timer->period > 0;
+            timer->expiry(timer);
+            continue;
+        }
+        if (!next) {
+            break;
+        }
+        sim_now = next->deadline > sim_now ? next->deadline : sim_now;
+        next->pending = false;
+        next->work.handler(&next->work);
+    }
+    sim_now = end;
+}
+
+// start and end of the __noinit section, provided by the linker
+extern char __start_sim_noinit[] __attribute__((weak));
+extern char __stop_sim_noinit[] __attribute__((weak));
+
+void sim_power_loss(void) {
+    for (char *p = __start_sim_noinit; p < __stop_sim_noinit; ++p) {
+        *p = (char) rand();
+    }
+}
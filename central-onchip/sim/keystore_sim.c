@@ -0,0 +1,659 @@
+/*
+ * Host simulation of the flash key store (src/keystore.c) with its RAM cache.
+ * Writes N coins into an emulated image-1 partition and replays button presses of known coins
+ * (a few regulars and many occasional visitors, each press with a fresh RPA) mixed with advertisements
+ * of unknown devices. Like the scan callback, advertisers that are not cached go to keystore_request(),
+ * the simulation is the worker that calls keystore_next() and keystore_resolve().
+ * ah() is AES-128 in software (byte oriented, the key is expanded for every call like tinycrypt), the time of
+ * keystore_resolve() is measured on the host together with its ah() calls and flash reads.
+ * With -u, the advertisers of a busy place (the mix of scan_bench -g) are simulated for some minutes instead: they
+ * come and go and phones rotate their RPA every 15 minutes. The resolutions per second show whether the remembered
+ * unknown advertisers (CONFIG_CENTRAL_KEYSTORE_UNKNOWN, set with -D) cover them; -w is the time of the worker per
+ * resolution, requests are dropped while it is busy.
+ *
+ * build: gcc -O2 -Isim/include -Isrc -DCONFIG_BT_MAX_PAIRED=16 -o keystore_sim sim/keystore_sim.c sim/kernel.c src/retained.c src/keystore.c
+ * usage: ./keystore_sim [-n coins] [-e events] [-s seed] [-v]
+ *        ./keystore_sim -u advertisers [-n coins] [-d minutes] [-w worker ms] [-s seed] [-v]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <storage/flash_map.h>
+#include <sys/crc.h>
+#include <keys.h>
+#include <common/rpa.h>
+#include "keystore.h"
+#include "spaceauth.h"
+#include "digest.h"
+#include "retained.h"
+
+int sim_log = 0;
+
+// size of the image-1 partition (assumed, depends on the board's partition table)
+#define FLASH_SIZE 0x67000
+#define MAX_COINS 5000
+// share of the events from the regulars and from unknown devices (percent)
+#define REGULARS 20
+#define REGULAR_PERCENT 60
+#define UNKNOWN_PERCENT 10
+// an unknown device keeps its RPA for this many advertisements
+#define UNKNOWN_REPEAT 10
+// RF load (-u): share of the advertisers like scan_bench -g (percent), the rest uses non-resolvable addresses
+#define ADV_PHONE_PERCENT 50
+#define ADV_BEACON_PERCENT 20
+#define ADV_STATIC_PERCENT 20
+#define MAX_ADVS 10000
+#define ADV_TICK_MS 10
+// phones rotate their RPA, advertisers leave and others come
+#define ADV_ROTATE_MS (15 * 60000)
+#define ADV_STAY_MIN_MS (5 * 60000)
+#define ADV_STAY_MAX_MS (120 * 60000)
+
+static u8_t flash[FLASH_SIZE];
+static const struct flash_area area = {DT_FLASH_AREA_IMAGE_1_ID, 0, FLASH_SIZE};
+static u32_t flash_bytes_read = 0, flash_reads = 0;
+
+int flash_area_open(u8_t id, const struct flash_area **fa) {
+    if (id != DT_FLASH_AREA_IMAGE_1_ID) {
+        return -ENOENT;
+    }
+    *fa = &area;
+    return 0;
+}
+
+int flash_area_read(const struct flash_area *fa, off_t off, void *dst, size_t len) {
+    if (off < 0 || off + len > fa->fa_size) {
+        return -EINVAL;
+    }
+    memcpy(dst, flash + off, len);
+    flash_reads++;
+    flash_bytes_read += len;
+    return 0;
+}
+
+// like NOR flash, writing can only clear bits
+int flash_area_write(const struct flash_area *fa, off_t off, const void *src, size_t len) {
+    if (off < 0 || off + len > fa->fa_size) {
+        return -EINVAL;
+    }
+    for (size_t i = 0; i < len; ++i) {
+        flash[off + i] &= ((const u8_t *) src)[i];
+    }
+    return 0;
+}
+
+int flash_area_erase(const struct flash_area *fa, off_t off, size_t len) {
+    if (off < 0 || off + len > fa->fa_size || off % DT_FLASH_ERASE_BLOCK_SIZE) {
+        return -EINVAL;
+    }
+    memset(flash + off, 0xff, len);
+    return 0;
+}
+
+u32_t crc32_ieee(const u8_t *data, size_t len) {
+    u32_t crc = 0xffffffff;
+    for (size_t i = 0; i < len; ++i) {
+        crc ^= data[i];
+        for (int b = 0; b < 8; ++b) {
+            crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+        }
+    }
+    return ~crc;
+}
+
+static struct bt_keys key_pool[CONFIG_BT_MAX_PAIRED];
+
+struct bt_keys *bt_keys_find_addr(u8_t id, const bt_addr_le_t *addr) {
+    for (size_t i = 0; i < ARRAY_SIZE(key_pool); ++i) {
+        if (key_pool[i].id == id && !bt_addr_le_cmp(&key_pool[i].addr, addr)) {
+            return &key_pool[i];
+        }
+    }
+    return NULL;
+}
+
+struct bt_keys *bt_keys_get_addr(u8_t id, const bt_addr_le_t *addr) {
+    struct bt_keys *keys = bt_keys_find_addr(id, addr);
+    if (keys) {
+        return keys;
+    }
+    const bt_addr_le_t any = {0};
+    keys = bt_keys_find_addr(id, &any);
+    if (keys) {
+        keys->id = id;
+        bt_addr_le_copy(&keys->addr, addr);
+    }
+    return keys;
+}
+
+// the coin of the current session
+static bt_addr_le_t connected;
+
+struct bt_conn *bt_conn_lookup_addr_le(u8_t id, const bt_addr_le_t *peer) {
+    ARG_UNUSED(id);
+    return bt_addr_le_cmp(&connected, peer) ? NULL : (struct bt_conn *) &connected;
+}
+
+void bt_conn_unref(struct bt_conn *conn) {
+    ARG_UNUSED(conn);
+}
+
+static spacekey_t spacekeys[CONFIG_BT_MAX_PAIRED];
+
+int spacekey_cache(const bt_addr_le_t *addr, const uint8_t *key) {
+    const bt_addr_le_t any = {0};
+    for (size_t i = 0; i < ARRAY_SIZE(spacekeys); ++i) {
+        if (!bt_addr_le_cmp(&spacekeys[i].addr, addr) || !bt_addr_le_cmp(&spacekeys[i].addr, &any)) {
+            bt_addr_le_copy(&spacekeys[i].addr, addr);
+            memcpy(spacekeys[i].key, key, sizeof(spacekeys[i].key));
+            return 0;
+        }
+    }
+    return -ENOSPC;
+}
+
+void spacekey_uncache(const bt_addr_le_t *addr) {
+    for (size_t i = 0; i < ARRAY_SIZE(spacekeys); ++i) {
+        if (!bt_addr_le_cmp(&spacekeys[i].addr, addr)) {
+            memset(&spacekeys[i], 0, sizeof(spacekeys[i]));
+        }
+    }
+}
+
+void digest_invalidate(const bt_addr_le_t *addr) {
+    ARG_UNUSED(addr);
+}
+
+/*
+ * ah() as in the BLE host: AES-128 of the padded prand with the IRK, byte oriented and with the key expanded for
+ * every call like tinycrypt (bt_encrypt_le()), so its time on the host is that of a software AES
+ */
+static u8_t sbox[256];
+
+static u8_t xtime(u8_t x) {
+    return (u8_t) ((x << 1) ^ ((x >> 7) * 0x1b));
+}
+
+static u8_t gf_mul(u8_t a, u8_t b) {
+    u8_t p = 0;
+    for (; b; b >>= 1, a = xtime(a)) {
+        if (b & 1) {
+            p ^= a;
+        }
+    }
+    return p;
+}
+
+static void sbox_init(void) {
+    for (int i = 0; i < 256; ++i) {
+        // multiplicative inverse (x^254), then the affine transformation
+        u8_t inv = 1, x = (u8_t) i;
+        for (int e = 254; e; e >>= 1, x = gf_mul(x, x)) {
+            if (e & 1) {
+                inv = gf_mul(inv, x);
+            }
+        }
+        inv = i ? inv : 0;
+        u8_t s = inv;
+        for (int r = 1; r < 5; ++r) {
+            s ^= (u8_t) ((inv << r) | (inv >> (8 - r)));
+        }
+        sbox[i] = s ^ 0x63;
+    }
+}
+
+static void aes128_encrypt(const u8_t key[16], const u8_t in[16], u8_t out[16]) {
+    u8_t rk[176], st[16], t[16];
+    memcpy(rk, key, 16);
+    u8_t rcon = 1;
+    for (size_t i = 16; i < sizeof(rk); i += 4) {
+        u8_t w[4] = {rk[i - 4], rk[i - 3], rk[i - 2], rk[i - 1]};
+        if (i % 16 == 0) {
+            u8_t w0 = w[0];
+            w[0] = sbox[w[1]] ^ rcon;
+            w[1] = sbox[w[2]];
+            w[2] = sbox[w[3]];
+            w[3] = sbox[w0];
+            rcon = xtime(rcon);
+        }
+        for (size_t j = 0; j < 4; ++j) {
+            rk[i + j] = rk[i + j - 16] ^ w[j];
+        }
+    }
+    for (size_t i = 0; i < 16; ++i) {
+        st[i] = in[i] ^ rk[i];
+    }
+    for (size_t round = 1; round <= 10; ++round) {
+        // sub bytes and shift rows (column major state)
+        for (size_t i = 0; i < 16; ++i) {
+            t[i] = sbox[st[(i + 4 * (i % 4)) % 16]];
+        }
+        for (size_t c = 0; c < 4 && round < 10; ++c) {
+            u8_t *col = &t[4 * c];
+            u8_t all = col[0] ^ col[1] ^ col[2] ^ col[3], c0 = col[0];
+            col[0] ^= all ^ xtime(col[0] ^ col[1]);
+            col[1] ^= all ^ xtime(col[1] ^ col[2]);
+            col[2] ^= all ^ xtime(col[2] ^ col[3]);
+            col[3] ^= all ^ xtime(col[3] ^ c0);
+        }
+        for (size_t i = 0; i < 16; ++i) {
+            st[i] = t[i] ^ rk[16 * round + i];
+        }
+    }
+    memcpy(out, st, 16);
+}
+
+// ah() of the BLE host, bt_encrypt_le() works on byte reversed key and data
+static u32_t ah(const u8_t irk[16], const u8_t prand[3]) {
+    u8_t key[16], data[16] = {0}, res[16];
+    for (size_t i = 0; i < 16; ++i) {
+        key[i] = irk[15 - i];
+    }
+    data[15] = prand[0];
+    data[14] = prand[1];
+    data[13] = prand[2];
+    aes128_encrypt(key, data, res);
+    return res[15] | (res[14] << 8) | (res[13] << 16);
+}
+
+static u32_t ah_calls = 0;
+
+bool bt_rpa_irk_matches(const u8_t irk[16], const bt_addr_t *addr) {
+    ah_calls++;
+    u32_t hash = addr->val[0] | (addr->val[1] << 8) | (addr->val[2] << 16);
+    return ah(irk, &addr->val[3]) == hash;
+}
+
+struct sim_coin {
+    bt_addr_le_t addr;
+    u8_t irk[16], ltk[16], spacekey[32];
+};
+
+static struct sim_coin coins[MAX_COINS];
+
+static void random_bytes(u8_t *out, size_t len) {
+    for (size_t i = 0; i < len; ++i) {
+        out[i] = (u8_t) rand();
+    }
+}
+
+static void make_rpa(const u8_t irk[16], bt_addr_le_t *rpa) {
+    rpa->type = BT_ADDR_LE_RANDOM;
+    random_bytes(&rpa->a.val[3], 3);
+    rpa->a.val[5] = (rpa->a.val[5] & 0x3f) | 0x40;
+    u32_t hash = ah(irk, &rpa->a.val[3]);
+    rpa->a.val[0] = hash;
+    rpa->a.val[1] = hash >> 8;
+    rpa->a.val[2] = hash >> 16;
+}
+
+static int cmp_coin(const void *a, const void *b) {
+    const bt_addr_t *x = &((const struct sim_coin *) a)->addr.a, *y = &((const struct sim_coin *) b)->addr.a;
+    for (int i = 5; i >= 0; --i) {
+        if (x->val[i] != y->val[i]) {
+            return x->val[i] - y->val[i];
+        }
+    }
+    return 0;
+}
+
+static u32_t misses_ah[1 << 20], misses_ns[1 << 20], unknown_ns[1 << 20], event_ns[1 << 21];
+static size_t event_len = 0;
+
+static int cmp_u32(const void *a, const void *b) {
+    u32_t x = *(const u32_t *) a, y = *(const u32_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+static void print_us(const char *what, u32_t *ns, size_t len) {
+    if (!len) {
+        return;
+    }
+    qsort(ns, len, sizeof(ns[0]), cmp_u32);
+    printf("%s: p50 %.1f us, p95 %.1f us, max %.1f us (host)\n", what, ns[len / 2] / 1000.0,
+           ns[len * 95 / 100] / 1000.0, ns[len - 1] / 1000.0);
+}
+
+// the worker has been notified (WORKER_RESOLVE)
+static bool pending = false;
+
+static int sim_pending(void) {
+    pending = true;
+    return 0;
+}
+
+// result of the last resolution by the worker, summed over the events of a continued IRK scan
+static struct {
+    bool done;
+    bool partial; // the scan continues with the next event
+    int err;
+    bt_addr_le_t id;
+    u32_t ns, ah, bytes, reads;
+} resolved;
+static u32_t resolutions = 0;
+
+// the worker: one queued advertiser per notification
+static void sim_worker(void) {
+    struct keystore_request req;
+    if (!pending) {
+        return;
+    }
+    pending = false;
+    if (!keystore_next(&req)) {
+        return;
+    }
+    if (!resolved.partial) {
+        resolved.ns = resolved.ah = resolved.bytes = resolved.reads = 0;
+    }
+    u32_t ah = ah_calls, bytes = flash_bytes_read, reads = flash_reads, start = k_cycle_get_32();
+    int err = keystore_resolve(&req, &resolved.id);
+    u32_t ns = k_cycle_get_32() - start;
+    // time of a worker event (one keystore_resolve() call)
+    if (event_len < ARRAY_SIZE(event_ns)) {
+        event_ns[event_len++] = ns;
+    }
+    resolved.ns += ns;
+    resolved.ah += ah_calls - ah;
+    resolved.bytes += flash_bytes_read - bytes;
+    resolved.reads += flash_reads - reads;
+    resolved.partial = err == -EAGAIN;
+    if (resolved.partial) {
+        return;
+    }
+    resolved.err = err;
+    resolved.done = true;
+    resolutions++;
+}
+
+// a press or an unknown advertisement: the worker handles the notifications until the advertiser is resolved
+static void sim_resolve(void) {
+    while (pending && !resolved.done) {
+        sim_worker();
+    }
+}
+
+static s8_t random_rssi(void) {
+    return (s8_t) (-90 + rand() % 50);
+}
+
+// an advertiser of the RF load (-u), the mix of scan_bench -g
+struct sim_adv {
+    bt_addr_le_t addr;
+    bool connectable, rotates;
+    u32_t interval_ms;
+    s64_t next_ms, rotate_ms, leave_ms;
+};
+
+static void random_adv(struct sim_adv *a, s64_t now) {
+    int kind = rand() % 100;
+    a->addr.type = BT_ADDR_LE_RANDOM;
+    random_bytes(a->addr.a.val, 6);
+    a->rotates = false;
+    if (kind < ADV_PHONE_PERCENT) {
+        // RPA (prand with the top bits 01)
+        a->addr.a.val[5] = (a->addr.a.val[5] & 0x3f) | 0x40;
+        a->connectable = true;
+        a->rotates = true;
+        a->interval_ms = 180 + rand() % 800;
+    } else if (kind < ADV_PHONE_PERCENT + ADV_BEACON_PERCENT) {
+        a->addr.type = BT_ADDR_LE_PUBLIC;
+        a->connectable = false;
+        a->interval_ms = 100 + rand() % 900;
+    } else if (kind < ADV_PHONE_PERCENT + ADV_BEACON_PERCENT + ADV_STATIC_PERCENT) {
+        a->addr.a.val[5] |= 0xc0;
+        a->connectable = true;
+        a->interval_ms = 20 + rand() % 1000;
+    } else {
+        a->addr.a.val[5] &= 0x3f;
+        a->connectable = false;
+        a->interval_ms = 200 + rand() % 800;
+    }
+    a->next_ms = now + rand() % a->interval_ms;
+    a->rotate_ms = now + rand() % ADV_ROTATE_MS;
+    a->leave_ms = now + ADV_STAY_MIN_MS + rand() % (ADV_STAY_MAX_MS - ADV_STAY_MIN_MS);
+}
+
+static struct sim_adv advs[MAX_ADVS];
+
+/*
+ * Advertisers of a busy place for the given minutes: every report of a connectable advertiser that is not a coin
+ * goes to keystore_request() like in the scan callback. The worker takes worker_ms per resolution (0: it keeps up).
+ */
+static int rf_load(size_t n, size_t count, u32_t minutes, u32_t worker_ms) {
+    size_t connectable = 0;
+    for (size_t i = 0; i < count; ++i) {
+        random_adv(&advs[i], 0);
+        connectable += advs[i].connectable;
+    }
+    u32_t reports = 0, requested = 0, minute_res = 0, max_minute = 0, first_minute = 0, steady = 0;
+    s64_t busy_until = 0;
+    u64_t ah_total = 0;
+    size_t ns_len = 0;
+    for (sim_now = 0; sim_now < (s64_t) minutes * 60000; sim_now += ADV_TICK_MS) {
+        for (size_t i = 0; i < count; ++i) {
+            struct sim_adv *a = &advs[i];
+            if (a->leave_ms <= sim_now) {
+                random_adv(a, sim_now);
+                connectable += a->connectable;
+            }
+            if (a->rotates && a->rotate_ms <= sim_now) {
+                random_bytes(a->addr.a.val, 6);
+                a->addr.a.val[5] = (a->addr.a.val[5] & 0x3f) | 0x40;
+                a->rotate_ms += ADV_ROTATE_MS;
+            }
+            if (a->next_ms > sim_now) {
+                continue;
+            }
+            a->next_ms += a->interval_ms;
+            if (!a->connectable) {
+                continue;
+            }
+            reports++;
+            requested += keystore_request(&a->addr, random_rssi());
+            if (!pending || busy_until > sim_now) {
+                continue;
+            }
+            resolved.done = false;
+            sim_worker();
+            if (resolved.done) {
+                minute_res++;
+                ah_total += resolved.ah;
+                if (ns_len < ARRAY_SIZE(unknown_ns)) {
+                    unknown_ns[ns_len++] = resolved.ns;
+                }
+                busy_until = sim_now + worker_ms;
+            }
+        }
+        if ((sim_now + ADV_TICK_MS) % 60000 == 0) {
+            u32_t minute = (u32_t) (sim_now / 60000);
+            if (sim_log) {
+                printf("minute %u: %u resolutions\n", minute, minute_res);
+            }
+            if (!minute) {
+                first_minute = minute_res;
+            }
+            if (minute >= ADV_ROTATE_MS / 60000) {
+                steady += minute_res;
+                max_minute = MAX(max_minute, minute_res);
+            }
+            minute_res = 0;
+        }
+    }
+    u32_t steady_min = minutes > ADV_ROTATE_MS / 60000 ? minutes - ADV_ROTATE_MS / 60000 : 0;
+    printf("coins %zu, advertisers %zu (%zu connectable over the run), %u minutes, worker %u ms per resolution\n",
+           n, count, connectable, minutes, worker_ms);
+    printf("connectable reports %.0f/s, queued %.1f/s\n", reports / (minutes * 60.0), requested / (minutes * 60.0));
+    printf("resolutions/s: first minute %.1f", first_minute / 60.0);
+    if (steady_min) {
+        printf(", after %u minutes mean %.1f, max %.1f", ADV_ROTATE_MS / 60000, steady / (steady_min * 60.0),
+               max_minute / 60.0);
+    }
+    printf(", ah() %.0f/s (mean)\n", ah_total / (minutes * 60.0));
+    print_us("unknown advertiser", unknown_ns, ns_len);
+    struct shell sh;
+    keystore_print(&sh);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    size_t n = 500, events = 100000, load = 0;
+    u32_t minutes = 60, worker_ms = 0;
+    unsigned int seed = 1;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:e:u:d:w:s:v")) != -1) {
+        switch (opt) {
+            case 'n':
+                n = strtoul(optarg, NULL, 10);
+                break;
+            case 'e':
+                events = strtoul(optarg, NULL, 10);
+                break;
+            case 'u':
+                load = strtoul(optarg, NULL, 10);
+                break;
+            case 'd':
+                minutes = strtoul(optarg, NULL, 10);
+                break;
+            case 'w':
+                worker_ms = strtoul(optarg, NULL, 10);
+                break;
+            case 's':
+                seed = strtoul(optarg, NULL, 10);
+                break;
+            case 'v':
+                sim_log = 1;
+                break;
+            default:
+                return 2;
+        }
+    }
+    if (n > MAX_COINS || events > ARRAY_SIZE(misses_ns) || load > MAX_ADVS || !minutes) {
+        return 2;
+    }
+    srand(seed);
+    sbox_init();
+    memset(flash, 0xff, sizeof(flash));
+
+    // static random identity addresses
+    for (size_t i = 0; i < n; ++i) {
+        coins[i].addr.type = BT_ADDR_LE_RANDOM;
+        random_bytes(coins[i].addr.a.val, 6);
+        coins[i].addr.a.val[5] |= 0xc0;
+        random_bytes(coins[i].irk, 16);
+        random_bytes(coins[i].ltk, 16);
+        random_bytes(coins[i].spacekey, 32);
+    }
+    qsort(coins, n, sizeof(coins[0]), cmp_coin);
+    retained_init();
+    keystore_init(sim_pending);
+    if (keystore_erase()) {
+        return 1;
+    }
+    for (size_t i = 0; i < n; ++i) {
+        if (keystore_add(&coins[i].addr, coins[i].irk, coins[i].ltk, coins[i].spacekey)) {
+            printf("keystore_add failed at coin %zu\n", i);
+            return 1;
+        }
+    }
+    if (keystore_commit() || keystore_init(sim_pending)) {
+        return 1;
+    }
+    if (load) {
+        return rf_load(n, load, minutes, worker_ms);
+    }
+
+    size_t known = 0, cached = 0, misses = 0, collisions = 0, failed = 0, unknown_len = 0;
+    u32_t miss_bytes = 0, miss_reads = 0, unknown_ah = 0, unknowns = 0;
+    bt_addr_le_t unknown_rpa = {0};
+    size_t unknown_left = 0;
+    for (size_t i = 0; i < events; ++i) {
+        int kind = rand() % 100;
+        if (kind < UNKNOWN_PERCENT) {
+            if (!unknown_left) {
+                make_rpa(coins[0].irk, &unknown_rpa);
+                // another device: the hash does not match any IRK
+                unknown_rpa.a.val[0] ^= 0x5a;
+                unknown_left = UNKNOWN_REPEAT;
+            }
+            unknown_left--;
+            unknowns++;
+            resolved.done = false;
+            if (keystore_request(&unknown_rpa, random_rssi())) {
+                sim_resolve();
+            }
+            if (!resolved.done) {
+                continue;
+            }
+            if (!resolved.err) {
+                collisions++;
+            }
+            unknown_ah += resolved.ah;
+            unknown_ns[unknown_len++] = resolved.ns;
+            continue;
+        }
+        // regulars are spread over the (sorted) key store
+        size_t c = kind < UNKNOWN_PERCENT + REGULAR_PERCENT ? (rand() % MIN(n, REGULARS)) * (n / MIN(n, REGULARS))
+                                                             : rand() % n;
+        bt_addr_le_t rpa;
+        make_rpa(coins[c].irk, &rpa);
+        known++;
+        // the BLE host resolves against the loaded IRKs first (bonded coin)
+        struct bt_keys *keys = bt_keys_find_addr(BT_ID_DEFAULT, &coins[c].addr);
+        if (keys) {
+            cached++;
+            keystore_touch(&coins[c].addr);
+            bt_addr_le_copy(&connected, &coins[c].addr);
+            continue;
+        }
+        // scan callback, then the worker
+        resolved.done = false;
+        if (keystore_request(&rpa, random_rssi())) {
+            sim_resolve();
+        }
+        if (resolved.done && !resolved.err && bt_addr_le_cmp(&resolved.id, &coins[c].addr)) {
+            // the 24 bit hash of the RPA matched the IRK of another coin first, the pairing would fail
+            collisions++;
+            continue;
+        }
+        if (!resolved.done || resolved.err || !bt_keys_find_addr(BT_ID_DEFAULT, &resolved.id)) {
+            failed++;
+            continue;
+        }
+        misses_ah[misses] = resolved.ah;
+        misses_ns[misses++] = resolved.ns;
+        miss_bytes += resolved.bytes;
+        miss_reads += resolved.reads;
+        bt_addr_le_copy(&connected, &resolved.id);
+    }
+    qsort(misses_ah, misses, sizeof(misses_ah[0]), cmp_u32);
+
+    // identity address lookups (binary search), e.g. after a reset during a session
+    u32_t reads = flash_reads;
+    for (size_t i = 0; i < n; ++i) {
+        struct keystore_request req = {.addr = coins[i].addr};
+        bt_addr_le_t id;
+        if (keystore_resolve(&req, &id)) {
+            failed++;
+        }
+    }
+
+    printf("coins %zu, events %zu (%zu presses, %u unknown advertisements)\n", n, events, known, unknowns);
+    printf("cache hits %zu (%.1f%%), misses %zu, hash collisions %zu, failed %zu\n", cached, 100.0 * cached / known,
+           misses, collisions, failed);
+    if (misses) {
+        printf("RPA miss: ah() p50 %u, p95 %u, max %u, flash %u bytes in %u reads (mean)\n",
+               misses_ah[misses / 2], misses_ah[misses * 95 / 100], misses_ah[misses - 1],
+               miss_bytes / (u32_t) misses, miss_reads / (u32_t) misses);
+    }
+    print_us("RPA miss", misses_ns, misses);
+    printf("unknown RPA: %zu resolved, ah() mean %.1f\n", unknown_len,
+           unknown_len ? (double) unknown_ah / unknown_len : 0.0);
+    print_us("unknown RPA", unknown_ns, unknown_len);
+    print_us("worker event", event_ns, event_len);
+    printf("identity lookup: flash reads mean %.1f\n", n ? (double) (flash_reads - reads) / n : 0.0);
+    struct shell sh;
+    keystore_print(&sh);
+    return failed ? 1 : 0;
+}
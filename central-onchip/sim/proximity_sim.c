@@ -0,0 +1,362 @@
+/*
+ * Host simulation of the proximity policy: coins pressed at the door, coins carried past the building and coins
+ * pressed on a desk nearby compete for the single connection slot of the central.
+ * Uses the proximity policy, scheduler and candidate queue of the firmware (src/proximity.c, src/scheduler.c,
+ * src/candidates.c) in the order of scan_filter() in src/scan.c.
+ *
+ * RSSI traces: log-distance path loss (-55 dBm at 1 m, exponent 2.5), 10 dB more through the outer wall for passers-by
+ * and 6 dB through an inner wall for desk coins,
+ * shadowing as a random walk with 4 dB standard deviation and a correlation time of 1 s, and 4 dB of fast fading
+ * per advertisement. Advertisements below -95 dBm are not received, the scan window covers half of the time.
+ * The coins advertise as in coin/src/adv.c: every 50 ms for 3 s, then every 130 ms until 10 s after the press.
+ *
+ * build: gcc -O2 -Isim/include -Isrc -o proximity_sim sim/proximity_sim.c sim/kernel.c src/retained.c src/proximity.c src/scheduler.c src/candidates.c -lm
+ *        other thresholds: -DCONFIG_CENTRAL_PROXIMITY_RSSI=-70
+ *        trend requirement: -DCONFIG_CENTRAL_PROXIMITY_APPROACH=1
+ * usage: ./proximity_sim [-n door coins] [-p press interval s] [-o passers-by per hour] [-d desk coins]
+ *                        [-m minutes] [-s seed] [-b] [-v]
+ *        -b: baseline without proximity policy (every bonded advertisement is connected or queued)
+ */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "proximity.h"
+#include "retained.h"
+#include "scheduler.h"
+#include "candidates.h"
+
+int sim_log = 0;
+
+#define STEP_MS 10
+#define MAX_COINS 64
+#define ADV_MS 10000
+#define FAST_MS 3000
+#define SCAN_DUTY_PERCENT 50
+#define SENSITIVITY_DBM (-95)
+#define CONNECT_MS 100
+// connection to a coin that stopped advertising or is out of range fails after CONFIG_BT_CREATE_CONN_TIMEOUT
+#define CONNECT_TIMEOUT_MS 3000
+#define SESSION_MS 1500
+// a session over a weak link ends with a deadline timeout
+#define FAILED_SESSION_MS 2500
+#define WALK_M_PER_S 1.3
+
+typedef enum {
+    DOOR = 0,   // pressed at the door (or on the last meters to it)
+    PASSER,     // pressed in a pocket while walking past the building outside
+    DESK,       // pressed on a desk inside, some meters away
+    KINDS
+} kind_t;
+
+static const char *const kind_names[KINDS] = {"door", "passer-by", "desk"};
+static const double wall_db[KINDS] = {0, 10, 6};
+
+struct coin {
+    bt_addr_le_t addr;
+    kind_t kind;
+    s64_t adv_since;   // -1 if not advertising
+    double x, y;       // position relative to the central (m), the door is in front of it (x > 0)
+    double vx, vy;     // velocity (m/s)
+    double stop_x;     // a door coin stops walking here
+    double shadow;     // shadowing (dB)
+};
+
+static struct coin coins[MAX_COINS];
+static size_t n_coins = 0;
+
+static enum {
+    IDLE, CONNECTING, SESSION
+} central = IDLE;
+static struct coin *conn_coin = NULL;
+static s64_t central_until = 0;
+static bool session_ok = false;
+static bool baseline = false;
+
+static u32_t presses[KINDS], served[KINDS], failed[KINDS], lost[KINDS];
+static s64_t slot_ms[KINDS];
+static s64_t slot_since = 0;
+static u32_t waits[100000];
+static u32_t n_waits = 0;
+
+static double gauss(void) {
+    double u = (rand() + 1.0) / (RAND_MAX + 2.0), v = (rand() + 1.0) / (RAND_MAX + 2.0);
+    return sqrt(-2 * log(u)) * cos(2 * M_PI * v);
+}
+
+static double uniform(double lo, double hi) {
+    return lo + (hi - lo) * rand() / (double) RAND_MAX;
+}
+
+// mean RSSI at the current position (without fast fading)
+static double mean_rssi(const struct coin *c) {
+    double d = hypot(c->x, c->y);
+    if (d < 0.3) {
+        d = 0.3;
+    }
+    return -55 - 25 * log10(d) - wall_db[c->kind] + c->shadow;
+}
+
+static struct coin *find_coin(const bt_addr_le_t *addr) {
+    for (size_t i = 0; i < n_coins; ++i) {
+        if (!bt_addr_le_cmp(&coins[i].addr, addr)) {
+            return &coins[i];
+        }
+    }
+    return NULL;
+}
+
+static void press(struct coin *c) {
+    presses[c->kind]++;
+    c->adv_since = sim_now;
+    c->shadow = 4 * gauss();
+    c->vx = c->vy = 0;
+    switch (c->kind) {
+        case DOOR:
+            if (rand() % 10 < 7) {
+                // pressed standing in front of the door
+                c->x = uniform(1.3, 2.5);
+                c->y = uniform(-0.5, 0.5);
+            } else {
+                // pressed on the way to the door
+                c->x = uniform(4, 8);
+                c->y = uniform(-1, 1);
+                c->vx = -WALK_M_PER_S;
+            }
+            c->stop_x = uniform(1.3, 2);
+            break;
+        case PASSER:
+            // on the pavement in front of the building
+            c->x = uniform(6, 15);
+            c->y = uniform(-15, -5);
+            c->vy = WALK_M_PER_S;
+            break;
+        case DESK:
+            // inside, the same desk every time
+            break;
+        default:
+            break;
+    }
+}
+
+static void move(struct coin *c) {
+    double dt = STEP_MS / 1000.0;
+    c->x += c->vx * dt;
+    c->y += c->vy * dt;
+    if (c->kind == DOOR && c->vx < 0 && c->x <= c->stop_x) {
+        c->vx = 0;
+    }
+    // shadowing: first order random walk with a correlation time of 1 s
+    double a = exp(-dt / 1.0);
+    c->shadow = a * c->shadow + sqrt(1 - a * a) * 4 * gauss();
+}
+
+// number of advertising events of a coin in this step (coin/src/adv.c)
+static int adv_events(const struct coin *c) {
+    s64_t t = sim_now - c->adv_since;
+    if (t < FAST_MS) {
+        return rand() % 50 < STEP_MS;
+    }
+    return rand() % 130 < STEP_MS;
+}
+
+static void slot_busy(struct coin *c) {
+    conn_coin = c;
+    slot_since = sim_now;
+}
+
+static void slot_free(void) {
+    slot_ms[conn_coin->kind] += sim_now - slot_since;
+    conn_coin = NULL;
+}
+
+static void connect(struct coin *c) {
+    slot_busy(c);
+    central = CONNECTING;
+    bool reachable = c->adv_since >= 0 && mean_rssi(c) > SENSITIVITY_DBM + 5;
+    central_until = sim_now + (reachable ? CONNECT_MS : CONNECT_TIMEOUT_MS);
+}
+
+// slot is free: next queued candidate (as connect_next() in main.c)
+static void connect_next(void) {
+    struct candidate next;
+    central = IDLE;
+    slot_free();
+    if (candidates_pop(&next)) {
+        connect(find_coin(&next.addr));
+    }
+}
+
+// scan_filter() in src/scan.c for an advertisement of a bonded coin
+static void device_found(struct coin *c, s8_t rssi) {
+    if (!sched_allowed(&c->addr)) {
+        return;
+    }
+    if (central != IDLE) {
+        if (c != conn_coin && (baseline || proximity_admit(&c->addr, rssi))) {
+            candidates_push(&c->addr, rssi);
+        }
+        return;
+    }
+    if (baseline || proximity_admit(&c->addr, rssi)) {
+        connect(c);
+    }
+}
+
+static void end_session(sched_result_t result) {
+    struct coin *c = conn_coin;
+    sched_report(&c->addr, result);
+    proximity_report(&c->addr, result);
+    // the coin goes to sleep when the connection ends
+    c->adv_since = -1;
+    if (result == SCHED_OK) {
+        served[c->kind]++;
+    } else {
+        failed[c->kind]++;
+    }
+    connect_next();
+}
+
+static void step_central(void) {
+    if (central == CONNECTING && sim_now >= central_until) {
+        struct coin *c = conn_coin;
+        if (c->adv_since < 0 || sim_now - c->adv_since > ADV_MS + CONNECT_MS || mean_rssi(c) <= SENSITIVITY_DBM + 5) {
+            end_session(SCHED_FAIL_CONNECT);
+            return;
+        }
+        if (c->kind == DOOR && n_waits < ARRAY_SIZE(waits)) {
+            waits[n_waits++] = (u32_t) (sim_now - c->adv_since);
+        }
+        // the session fails more often the weaker the link is
+        double p_fail = (-80 - mean_rssi(c)) / 15;
+        session_ok = uniform(0, 1) >= p_fail;
+        central = SESSION;
+        central_until = sim_now + (session_ok ? SESSION_MS : FAILED_SESSION_MS);
+    } else if (central == SESSION && sim_now >= central_until) {
+        end_session(session_ok ? SCHED_OK : SCHED_FAIL_VALIDATION);
+    }
+}
+
+static int cmp_u32(const void *a, const void *b) {
+    u32_t x = *(const u32_t *) a, y = *(const u32_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+int main(int argc, char **argv) {
+    int door = 20, press_s = 60, passers_h = 60, desk = 3, minutes = 600, opt;
+    unsigned seed = 1;
+    while ((opt = getopt(argc, argv, "n:p:o:d:m:s:bv")) != -1) {
+        switch (opt) {
+            case 'n':
+                door = atoi(optarg);
+                break;
+            case 'p':
+                press_s = atoi(optarg);
+                break;
+            case 'o':
+                passers_h = atoi(optarg);
+                break;
+            case 'd':
+                desk = atoi(optarg);
+                break;
+            case 'm':
+                minutes = atoi(optarg);
+                break;
+            case 's':
+                seed = (unsigned) atoi(optarg);
+                break;
+            case 'b':
+                baseline = true;
+                break;
+            case 'v':
+                sim_log = 1;
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-n door coins] [-p press interval s] [-o passers-by per hour] "
+                                "[-d desk coins] [-m minutes] [-s seed] [-b] [-v]\n", argv[0]);
+                return 1;
+        }
+    }
+    // passers-by: 8 coins that are pressed passers_h / 8 times per hour each
+    if (door < 1 || desk < 0 || door + desk + 8 > MAX_COINS || press_s < 1 || passers_h < 0) {
+        fprintf(stderr, "invalid arguments\n");
+        return 1;
+    }
+    srand(seed);
+    retained_init();
+    sched_init();
+    proximity_init();
+
+    n_coins = (size_t) (door + desk + 8);
+    for (size_t i = 0; i < n_coins; ++i) {
+        struct coin *c = &coins[i];
+        c->addr.type = 1;
+        c->addr.a.val[0] = (u8_t) i;
+        c->addr.a.val[5] = 0xC0;
+        c->adv_since = -1;
+        c->kind = i < (size_t) door ? DOOR : i < (size_t) (door + desk) ? DESK : PASSER;
+        if (c->kind == DESK) {
+            // office next to the entrance, behind the central
+            c->x = uniform(-12, -5);
+            c->y = uniform(-4, 4);
+        }
+    }
+
+    // per step: door coins every press_s, desk coins every 10 minutes, passers-by passers_h per hour
+    s64_t end = (s64_t) minutes * 60 * 1000;
+    for (sim_now = 0; sim_now < end; sim_now += STEP_MS) {
+        for (size_t i = 0; i < n_coins; ++i) {
+            struct coin *c = &coins[i];
+            if (c->adv_since >= 0 && sim_now - c->adv_since >= ADV_MS && c != conn_coin) {
+                lost[c->kind]++;
+                c->adv_since = -1;
+            }
+            if (c->adv_since < 0 && c != conn_coin) {
+                long period_steps = c->kind == DOOR ? press_s * 1000L / STEP_MS :
+                                    c->kind == DESK ? 600 * 1000L / STEP_MS :
+                                    passers_h ? 8 * 3600 * 1000L / STEP_MS / passers_h : 0;
+                if (period_steps && rand() % period_steps == 0) {
+                    press(c);
+                }
+            }
+            if (c->adv_since >= 0) {
+                move(c);
+            }
+        }
+        step_central();
+        for (size_t i = 0; i < n_coins; ++i) {
+            struct coin *c = &coins[i];
+            if (c->adv_since < 0 || c == conn_coin) {
+                continue;
+            }
+            for (int e = adv_events(c); e > 0; --e) {
+                double rssi = mean_rssi(c) + 4 * gauss();
+                if (rssi >= SENSITIVITY_DBM && rand() % 100 < SCAN_DUTY_PERCENT) {
+                    device_found(c, (s8_t) lround(rssi < -127 ? -127 : rssi));
+                }
+            }
+        }
+    }
+    if (conn_coin) {
+        slot_free();
+    }
+
+    qsort(waits, n_waits, sizeof(waits[0]), cmp_u32);
+    printf("%s: %d door coins (press every %d s), %d passers-by per hour, %d desk coins, %d min\n",
+           baseline ? "baseline" : "proximity", door, press_s, passers_h, desk, minutes);
+    printf("%-10s %8s %8s %8s %8s %10s\n", "", "presses", "served", "failed", "lost", "slot time");
+    for (int k = 0; k < KINDS; ++k) {
+        printf("%-10s %8u %8u %8u %8u %9.1f%%\n", kind_names[k], presses[k], served[k], failed[k], lost[k],
+               100.0 * slot_ms[k] / end);
+    }
+    if (n_waits) {
+        printf("door wait press->connected: p50 %u ms, p95 %u ms, max %u ms\n",
+               waits[n_waits / 2], waits[(n_waits - 1) * 95 / 100], waits[n_waits - 1]);
+    }
+    if (!baseline) {
+        struct shell sh;
+        proximity_print(&sh);
+    }
+    return 0;
+}
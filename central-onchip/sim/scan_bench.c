@@ -0,0 +1,676 @@
+/*
+ * Benchmark of the scan path: feeds the advertising reports of a btsnoop capture through the scan filter of the
+ * firmware (src/scan.c with src/candidates.c, src/scheduler.c and src/proximity.c), as device_found() in main.c
+ * calls it from the BT RX thread for every advertisement. The connection slot is busy for SESSION_MS after a coin
+ * was connected, meanwhile advertisements of bonded coins go to the candidate queue. A connected coin stops
+ * advertising, its reports are dropped until it pauses for SERVED_GAP_MS (the next button press).
+ * Reports callbacks per second, time per callback, log messages (on the device each one takes a buffer of the
+ * deferred log and is formatted later by the log thread) and heap allocations.
+ *
+ * The host resolves RPAs of bonded coins before the scan callback is called, the coins of a synthetic capture
+ * advertise with their identity address. That resolution (one ah() per bonded IRK for every RPA) is not part of
+ * the measured callback, its number of ah() calls is reported separately.
+ *
+ * build: gcc -O2 -Isim/include -Isrc -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc -o scan_bench sim/scan_bench.c sim/kernel.c src/retained.c src/scan.c src/candidates.c src/scheduler.c src/proximity.c
+ * usage: ./scan_bench [-k coins] [-r repeats] [-l] <btsnoop file>   replay a capture (H4, H1 or btmon format)
+ *        ./scan_bench -g [-n advertisers] [-c coins] [-d seconds] [-s seed] [-k coins] > file   write a synthetic capture
+ *        -k: bonded coins, one address per line like prod/coins.txt (written by -g)
+ *        -l: format the log messages (into /dev/null, the report goes to stderr)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <logging/log.h>
+#include <keys.h>
+#include <hci_core.h>
+#include "scan.h"
+#include "scheduler.h"
+#include "candidates.h"
+#include "proximity.h"
+#include "retained.h"
+
+int sim_log = 0;
+
+#define MAX_REPORTS 2000000
+#define MAX_ADV_DATA 31
+// connection slot busy after a coin was connected (encryption, discovery, challenge, response)
+#define SESSION_MS 1500
+#define SERVED_GAP_MS 2000
+#define MAX_SERVED 64
+// offset of the btsnoop timestamps (us since year 0) to the unix epoch
+#define BTSNOOP_EPOCH 0x00E03AB44A676000ULL
+#define BTSNOOP_H1 1001
+#define BTSNOOP_H4 1002
+#define BTSNOOP_MONITOR 2001
+
+// share of the other advertisers (percent): phones with RPAs, beacons with public addresses, random static devices
+#define PHONE_PERCENT 50
+#define BEACON_PERCENT 20
+#define STATIC_PERCENT 20
+// the rest uses non-resolvable private addresses
+// a pressed coin advertises fast for 3 s, then slow (coin/src/adv.c) until it is connected
+#define FAST_MS 3000
+#define COIN_ADV_MS 6000
+// every coin is pressed about once in this time (at most once per capture)
+#define PRESS_INTERVAL_S 60
+
+enum addr_class {
+    CLASS_COIN = 0,
+    CLASS_PUBLIC,
+    CLASS_STATIC,
+    CLASS_RPA,
+    CLASS_NRPA,
+    CLASSES
+};
+
+static const char *const class_names[] = {"bonded coin", "public", "random static", "RPA", "non-resolvable"};
+
+struct report {
+    u32_t time_ms;
+    bt_addr_le_t addr;
+    u8_t type;
+    s8_t rssi;
+    u8_t len;
+    u8_t data[MAX_ADV_DATA];
+};
+
+static struct report *reports;
+static size_t reports_len = 0;
+
+/*
+ * heap allocations while the callbacks run
+ */
+static bool counting = false;
+static unsigned long allocs = 0, alloc_bytes = 0;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size) {
+    if (counting) {
+        allocs++;
+        alloc_bytes += size;
+    }
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t n, size_t size) {
+    if (counting) {
+        allocs++;
+        alloc_bytes += n * size;
+    }
+    return __real_calloc(n, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+    if (counting) {
+        allocs++;
+        alloc_bytes += size;
+    }
+    return __real_realloc(ptr, size);
+}
+
+/*
+ * keys of the host: bt_addr_le_is_bonded() searches CONFIG_BT_MAX_PAIRED entries like the Zephyr host
+ */
+static struct bt_keys key_pool[CONFIG_BT_MAX_PAIRED];
+static size_t bonded = 0;
+
+bool bt_addr_le_is_bonded(u8_t id, const bt_addr_le_t *addr) {
+    for (size_t i = 0; i < ARRAY_SIZE(key_pool); ++i) {
+        if (key_pool[i].id == id && !bt_addr_le_cmp(&key_pool[i].addr, addr)) {
+            return key_pool[i].keys != 0;
+        }
+    }
+    return false;
+}
+
+// as in the Zephyr host (subsys/bluetooth/host/hci_core.c)
+void bt_data_parse(struct net_buf_simple *ad, bool (*func)(struct bt_data *data, void *user_data), void *user_data) {
+    while (ad->len > 1) {
+        struct bt_data data;
+        u8_t len = ad->data[0];
+        ad->data++;
+        ad->len--;
+        if (len == 0U) {
+            return;
+        }
+        if (len > ad->len) {
+            return;
+        }
+        data.type = ad->data[0];
+        data.data_len = len - 1;
+        data.data = ad->data + 1;
+        if (!func(&data, user_data)) {
+            return;
+        }
+        ad->data += len;
+        ad->len -= len;
+    }
+}
+
+static enum addr_class addr_class(const bt_addr_le_t *addr) {
+    if (bt_addr_le_is_bonded(BT_ID_DEFAULT, addr)) {
+        return CLASS_COIN;
+    }
+    if (addr->type == BT_ADDR_LE_PUBLIC) {
+        return CLASS_PUBLIC;
+    }
+    switch (addr->a.val[5] >> 6) {
+        case 3:
+            return CLASS_STATIC;
+        case 1:
+            return CLASS_RPA;
+        default:
+            return CLASS_NRPA;
+    }
+}
+
+static int parse_addr(const char *str, bt_addr_le_t *addr) {
+    unsigned int b[6];
+    if (sscanf(str, "%2x:%2x:%2x:%2x:%2x:%2x", &b[5], &b[4], &b[3], &b[2], &b[1], &b[0]) != 6) {
+        return -EINVAL;
+    }
+    addr->type = BT_ADDR_LE_RANDOM;
+    for (size_t i = 0; i < 6; ++i) {
+        addr->a.val[i] = (u8_t) b[i];
+    }
+    return 0;
+}
+
+static void load_coins(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        perror(path);
+        exit(2);
+    }
+    char line[256];
+    size_t skipped = 0;
+    while (fgets(line, sizeof(line), f)) {
+        bt_addr_le_t addr;
+        if (parse_addr(line, &addr)) {
+            continue;
+        }
+        if (bonded == ARRAY_SIZE(key_pool)) {
+            skipped++;
+            continue;
+        }
+        key_pool[bonded].id = BT_ID_DEFAULT;
+        bt_addr_le_copy(&key_pool[bonded].addr, &addr);
+        key_pool[bonded].keys = BT_KEYS_IRK | BT_KEYS_LTK_P256;
+        bonded++;
+    }
+    fclose(f);
+    if (skipped) {
+        fprintf(stderr, "%zu coins do not fit into CONFIG_BT_MAX_PAIRED (%d) and are treated as unknown\n",
+                skipped, CONFIG_BT_MAX_PAIRED);
+    }
+}
+
+static u32_t get_be32(const u8_t *p) {
+    return ((u32_t) p[0] << 24) | ((u32_t) p[1] << 16) | ((u32_t) p[2] << 8) | p[3];
+}
+
+static u64_t get_be64(const u8_t *p) {
+    return ((u64_t) get_be32(p) << 32) | get_be32(p + 4);
+}
+
+// parses an HCI event, keeps the LE advertising reports
+static void parse_event(const u8_t *evt, size_t len, u32_t time_ms) {
+    if (len < 4 || evt[0] != 0x3e || evt[2] != 0x02 || (size_t) evt[1] + 2 > len) {
+        return;
+    }
+    const u8_t *p = evt + 4, *end = evt + 2 + evt[1];
+    // reports are parsed in sequence like the Zephyr host does
+    for (u8_t i = 0; i < evt[3]; ++i) {
+        if (p + 9 > end || p + 10 + p[8] > end || reports_len == MAX_REPORTS) {
+            return;
+        }
+        struct report *r = &reports[reports_len++];
+        r->time_ms = time_ms;
+        r->type = p[0];
+        r->addr.type = p[1] & 0x01; // resolved addresses (0x02, 0x03) count as their identity type
+        memcpy(r->addr.a.val, p + 2, 6);
+        r->len = MIN(p[8], MAX_ADV_DATA);
+        memcpy(r->data, p + 9, r->len);
+        r->rssi = (s8_t) p[9 + p[8]];
+        p += 10 + p[8];
+    }
+}
+
+static void load_capture(const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        perror(path);
+        exit(2);
+    }
+    u8_t header[16];
+    if (fread(header, 1, sizeof(header), f) != sizeof(header) || memcmp(header, "btsnoop\0", 8)) {
+        fprintf(stderr, "%s: not a btsnoop file\n", path);
+        exit(2);
+    }
+    u32_t datalink = get_be32(header + 12);
+    if (datalink != BTSNOOP_H1 && datalink != BTSNOOP_H4 && datalink != BTSNOOP_MONITOR) {
+        fprintf(stderr, "%s: unsupported datalink type %u\n", path, datalink);
+        exit(2);
+    }
+    u64_t start = 0;
+    u8_t rec[24];
+    static u8_t pkt[65536];
+    while (fread(rec, 1, sizeof(rec), f) == sizeof(rec)) {
+        u32_t len = get_be32(rec + 4), flags = get_be32(rec + 8);
+        u64_t ts = get_be64(rec + 16);
+        if (len > sizeof(pkt) || fread(pkt, 1, len, f) != len) {
+            break;
+        }
+        if (!start) {
+            start = ts;
+        }
+        u32_t time_ms = (u32_t) ((ts - start) / 1000);
+        if (datalink == BTSNOOP_H4 && len > 1 && pkt[0] == 0x04) {
+            parse_event(pkt + 1, len - 1, time_ms);
+        } else if (datalink == BTSNOOP_H1 && (flags & 0x03) == 0x03) {
+            parse_event(pkt, len, time_ms);
+        } else if (datalink == BTSNOOP_MONITOR && (flags & 0xffff) == 0x0003) {
+            parse_event(pkt, len, time_ms);
+        }
+    }
+    fclose(f);
+}
+
+/*
+ * synthetic capture
+ */
+static void put_be32(u32_t v) {
+    u8_t b[4] = {v >> 24, v >> 16, v >> 8, v};
+    fwrite(b, 1, sizeof(b), stdout);
+}
+
+static void write_report(u64_t time_us, u8_t type, const bt_addr_le_t *addr, const u8_t *data, u8_t len, s8_t rssi) {
+    u8_t pkt[2 + 12 + MAX_ADV_DATA];
+    pkt[0] = 0x04;
+    pkt[1] = 0x3e;
+    pkt[2] = 12 + len;
+    pkt[3] = 0x02;
+    pkt[4] = 1;
+    pkt[5] = type;
+    pkt[6] = addr->type;
+    memcpy(pkt + 7, addr->a.val, 6);
+    pkt[13] = len;
+    memcpy(pkt + 14, data, len);
+    pkt[14 + len] = (u8_t) rssi;
+    u32_t pkt_len = 15 + len;
+    u64_t ts = BTSNOOP_EPOCH + time_us;
+    put_be32(pkt_len);
+    put_be32(pkt_len);
+    put_be32(0x03); // received event
+    put_be32(0);
+    put_be32((u32_t) (ts >> 32));
+    put_be32((u32_t) ts);
+    fwrite(pkt, 1, pkt_len, stdout);
+}
+
+struct advertiser {
+    bt_addr_le_t addr;
+    u8_t type;
+    u8_t data[MAX_ADV_DATA];
+    u8_t len;
+    u32_t interval_ms;
+    s8_t rssi;
+    bool coin;
+    u32_t pressed_ms;
+    u64_t next_us;
+};
+
+static void random_addr(bt_addr_le_t *addr, u8_t type, u8_t top) {
+    addr->type = type;
+    for (size_t i = 0; i < 6; ++i) {
+        addr->a.val[i] = (u8_t) rand();
+    }
+    if (type == BT_ADDR_LE_RANDOM) {
+        addr->a.val[5] = (addr->a.val[5] & 0x3f) | top;
+    }
+}
+
+static void fill_data(struct advertiser *a, const u8_t *head, u8_t head_len, u8_t len) {
+    memcpy(a->data, head, head_len);
+    for (u8_t i = head_len; i < len; ++i) {
+        a->data[i] = (u8_t) rand();
+    }
+    a->len = len;
+}
+
+// coin: flags, 16 bit UUIDs and the battery service data (coin/src/main.c)
+static const u8_t coin_data[] = {0x02, 0x01, 0x06, 0x07, 0x03, 0x00, 0x18, 0x01, 0x18, 0x0f, 0x18,
+                                 0x04, 0x16, 0x0f, 0x18, 0x64};
+// phone: flags and 26 bytes of manufacturer data
+static const u8_t phone_head[] = {0x02, 0x01, 0x1a, 0x1b, 0xff, 0x4c, 0x00};
+// beacon: flags and an iBeacon frame
+static const u8_t beacon_head[] = {0x02, 0x01, 0x06, 0x1a, 0xff, 0x4c, 0x00, 0x02, 0x15};
+// wearable: flags, 16 bit UUIDs (heart rate, battery) and a complete name
+static const u8_t wearable_head[] = {0x02, 0x01, 0x06, 0x05, 0x03, 0x0d, 0x18, 0x0f, 0x18, 0x09, 0x09};
+
+static void generate(size_t count, size_t coins, u32_t seconds, const char *coins_path) {
+    struct advertiser *adv = calloc(count + coins, sizeof(*adv));
+    FILE *k = coins_path ? fopen(coins_path, "w") : NULL;
+    if (coins_path && !k) {
+        perror(coins_path);
+        exit(2);
+    }
+    for (size_t i = 0; i < count + coins; ++i) {
+        struct advertiser *a = &adv[i];
+        a->rssi = (s8_t) (-40 - rand() % 55);
+        unsigned int kind = (unsigned int) rand() % 100;
+        if (i >= count) {
+            // coins are pressed at a random time, they advertise with their identity (resolved by the host)
+            a->coin = true;
+            random_addr(&a->addr, BT_ADDR_LE_RANDOM, 0xc0);
+            memcpy(a->data, coin_data, sizeof(coin_data));
+            a->data[sizeof(coin_data) - 1] = (u8_t) (50 + rand() % 51);
+            a->len = sizeof(coin_data);
+            a->pressed_ms = (u32_t) rand() % (MAX(seconds, PRESS_INTERVAL_S) * 1000);
+            a->next_us = (u64_t) a->pressed_ms * 1000;
+            if (k) {
+                fprintf(k, "%02X:%02X:%02X:%02X:%02X:%02X\n", a->addr.a.val[5], a->addr.a.val[4],
+                        a->addr.a.val[3], a->addr.a.val[2], a->addr.a.val[1], a->addr.a.val[0]);
+            }
+            continue;
+        } else if (kind < PHONE_PERCENT) {
+            random_addr(&a->addr, BT_ADDR_LE_RANDOM, 0x40);
+            a->type = BT_LE_ADV_IND;
+            fill_data(a, phone_head, sizeof(phone_head), 31);
+            a->interval_ms = 180 + rand() % 800;
+        } else if (kind < PHONE_PERCENT + BEACON_PERCENT) {
+            random_addr(&a->addr, BT_ADDR_LE_PUBLIC, 0);
+            a->type = BT_LE_ADV_NONCONN_IND;
+            fill_data(a, beacon_head, sizeof(beacon_head), 30);
+            a->interval_ms = 100 + rand() % 900;
+        } else if (kind < PHONE_PERCENT + BEACON_PERCENT + STATIC_PERCENT) {
+            random_addr(&a->addr, BT_ADDR_LE_RANDOM, 0xc0);
+            a->type = BT_LE_ADV_IND;
+            fill_data(a, wearable_head, sizeof(wearable_head), 20);
+            a->interval_ms = 20 + rand() % 1000;
+        } else {
+            random_addr(&a->addr, BT_ADDR_LE_RANDOM, 0x00);
+            a->type = BT_LE_ADV_NONCONN_IND;
+            fill_data(a, phone_head, sizeof(phone_head), 12 + rand() % 20);
+            a->interval_ms = 200 + rand() % 800;
+        }
+        a->next_us = (u64_t) (rand() % (a->interval_ms * 1000));
+    }
+    if (k) {
+        fclose(k);
+    }
+
+    fwrite("btsnoop\0", 1, 8, stdout);
+    put_be32(1);
+    put_be32(BTSNOOP_H4);
+    u64_t end_us = (u64_t) seconds * 1000000;
+    for (;;) {
+        struct advertiser *next = NULL;
+        for (size_t i = 0; i < count + coins; ++i) {
+            if (adv[i].next_us < end_us && (!next || adv[i].next_us < next->next_us)) {
+                next = &adv[i];
+            }
+        }
+        if (!next) {
+            break;
+        }
+        u64_t now = next->next_us;
+        // advertising events are delayed by 0 - 10 ms (advDelay)
+        u32_t delay_us = (u32_t) rand() % 10000;
+        s8_t rssi = (s8_t) (next->rssi + rand() % 7 - 3);
+        if (!next->coin) {
+            write_report(now, next->type, &next->addr, next->data, next->len, rssi);
+            next->next_us = now + next->interval_ms * 1000 + delay_us;
+            continue;
+        }
+        u32_t since = (u32_t) (now / 1000) - next->pressed_ms;
+        write_report(now, BT_LE_ADV_IND, &next->addr, next->data, next->len, rssi);
+        next->next_us = now + (since < FAST_MS ? 45000 : 125000) + delay_us;
+        if (since >= COIN_ADV_MS) {
+            next->next_us = end_us;
+        }
+    }
+    free(adv);
+}
+
+/*
+ * replay
+ */
+struct served {
+    bt_addr_le_t addr;
+    s64_t last_seen;
+    bool active;
+};
+
+static struct served served[MAX_SERVED];
+static size_t served_next = 0;
+
+static void serve(const bt_addr_le_t *addr, s64_t now) {
+    bt_addr_le_copy(&served[served_next].addr, addr);
+    served[served_next].last_seen = now;
+    served[served_next].active = true;
+    served_next = (served_next + 1) % MAX_SERVED;
+}
+
+// true if the report comes from a coin that was connected and would not advertise anymore
+static bool was_served(const bt_addr_le_t *addr, s64_t now) {
+    for (size_t i = 0; i < MAX_SERVED; ++i) {
+        if (served[i].active && !bt_addr_le_cmp(&served[i].addr, addr)) {
+            if (now - served[i].last_seen > SERVED_GAP_MS) {
+                served[i].active = false;
+                return false;
+            }
+            served[i].last_seen = now;
+            return true;
+        }
+    }
+    return false;
+}
+
+static int cmp_u32(const void *a, const void *b) {
+    u32_t x = *(const u32_t *) a, y = *(const u32_t *) b;
+    return (x > y) - (x < y);
+}
+
+static int cmp_addr(const void *a, const void *b) {
+    return bt_addr_le_cmp(a, b);
+}
+
+// cost of taking the time around a callback
+static u32_t timer_overhead(void) {
+    u32_t best = UINT32_MAX;
+    for (int i = 0; i < 100000; ++i) {
+        u32_t start = k_cycle_get_32();
+        u32_t ns = k_cycle_get_32() - start;
+        best = MIN(best, ns);
+    }
+    return best;
+}
+
+int main(int argc, char **argv) {
+    int opt;
+    bool gen = false;
+    size_t count = 2000, coins = 20;
+    u32_t seconds = 10, repeats = 5;
+    const char *coins_path = NULL;
+    unsigned int seed = 1;
+    while ((opt = getopt(argc, argv, "gn:c:d:s:k:r:l")) != -1) {
+        switch (opt) {
+            case 'g':
+                gen = true;
+                break;
+            case 'n':
+                count = strtoul(optarg, NULL, 0);
+                break;
+            case 'c':
+                coins = strtoul(optarg, NULL, 0);
+                break;
+            case 'd':
+                seconds = strtoul(optarg, NULL, 0);
+                break;
+            case 's':
+                seed = strtoul(optarg, NULL, 0);
+                break;
+            case 'k':
+                coins_path = optarg;
+                break;
+            case 'r':
+                repeats = strtoul(optarg, NULL, 0);
+                break;
+            case 'l':
+                sim_log = 1;
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-k coins] [-r repeats] [-l] <btsnoop file>\n"
+                                "       %s -g [-n advertisers] [-c coins] [-d seconds] [-s seed] [-k coins] > file\n",
+                        argv[0], argv[0]);
+                return 2;
+        }
+    }
+    if (gen) {
+        srand(seed);
+        generate(count, coins, seconds ? seconds : 1, coins_path);
+        return 0;
+    }
+    if (optind >= argc || !repeats) {
+        fprintf(stderr, "no capture given\n");
+        return 2;
+    }
+    if (coins_path) {
+        load_coins(coins_path);
+    }
+    reports = malloc(MAX_REPORTS * sizeof(*reports));
+    load_capture(argv[optind]);
+    if (!reports_len) {
+        fprintf(stderr, "no advertising reports in %s\n", argv[optind]);
+        return 2;
+    }
+
+    FILE *out = stdout;
+    static char log_buf[BUFSIZ];
+    if (sim_log) {
+        // the log is formatted into /dev/null, stdio must not allocate its buffer while counting
+        out = stderr;
+        if (!freopen("/dev/null", "w", stdout)) {
+            perror("/dev/null");
+            return 2;
+        }
+        setvbuf(stdout, log_buf, _IOFBF, sizeof(log_buf));
+    }
+
+    // advertisers and reports per address class
+    bt_addr_le_t *addrs = malloc(reports_len * sizeof(*addrs));
+    size_t rpa_reports = 0;
+    for (size_t i = 0; i < reports_len; ++i) {
+        bt_addr_le_copy(&addrs[i], &reports[i].addr);
+        rpa_reports += bt_addr_le_is_rpa(&reports[i].addr);
+    }
+    qsort(addrs, reports_len, sizeof(*addrs), cmp_addr);
+    size_t advertisers = 0;
+    for (size_t i = 0; i < reports_len; ++i) {
+        advertisers += !i || bt_addr_le_cmp(&addrs[i], &addrs[i - 1]);
+    }
+    free(addrs);
+    u32_t duration_ms = reports[reports_len - 1].time_ms + 1;
+
+    size_t total = 0, dropped = 0;
+    u32_t *times = malloc(reports_len * repeats * sizeof(*times));
+    u64_t class_ns[CLASSES] = {0};
+    size_t class_reports[CLASSES] = {0};
+    unsigned long class_logs[CLASSES] = {0};
+    size_t results[3] = {0};
+    u32_t overhead = timer_overhead();
+
+    retained_init();
+    sched_init();
+    proximity_init();
+    bt_addr_le_t busy;
+    bool slot_busy = false;
+    s64_t busy_until = 0;
+    counting = true;
+    for (u32_t r = 0; r < repeats; ++r) {
+        for (size_t i = 0; i < reports_len; ++i) {
+            struct report *rep = &reports[i];
+            s64_t now = (s64_t) r * duration_ms + rep->time_ms;
+            if (now > sim_now) {
+                sim_advance(now - sim_now);
+            }
+            // end of the session: next queued candidate or scanning again (connect_next() in main.c)
+            if (slot_busy && now >= busy_until) {
+                sched_report(&busy, SCHED_OK);
+                struct candidate next;
+                slot_busy = candidates_pop(&next);
+                if (slot_busy) {
+                    bt_addr_le_copy(&busy, &next.addr);
+                    busy_until = now + SESSION_MS;
+                    serve(&busy, now);
+                }
+            }
+            if (was_served(&rep->addr, now)) {
+                dropped++;
+                continue;
+            }
+            enum addr_class c = addr_class(&rep->addr);
+            struct net_buf_simple ad = {rep->data, rep->len, rep->len};
+            bt_addr_le_t coin;
+            s8_t battery;
+            unsigned long logs = sim_log_msgs;
+            u32_t start = k_cycle_get_32();
+            scan_result_t res = scan_filter(&rep->addr, rep->rssi, rep->type, &ad, slot_busy ? &busy : NULL, &coin,
+                                            &battery);
+            u32_t ns = k_cycle_get_32() - start;
+            ns = ns > overhead ? ns - overhead : 0;
+            times[total++] = ns;
+            class_ns[c] += ns;
+            class_reports[c]++;
+            class_logs[c] += sim_log_msgs - logs;
+            results[res]++;
+            if (res == SCAN_CONNECT) {
+                bt_addr_le_copy(&busy, &coin);
+                slot_busy = true;
+                busy_until = now + SESSION_MS;
+                serve(&busy, now);
+            }
+        }
+    }
+    counting = false;
+    fflush(stdout);
+
+    u64_t sum = 0;
+    for (size_t i = 0; i < total; ++i) {
+        sum += times[i];
+    }
+    qsort(times, total, sizeof(*times), cmp_u32);
+    double mean = (double) sum / (double) total;
+    double rate = reports_len * 1000.0 / duration_ms;
+    fprintf(out, "capture: %zu reports from %zu advertisers in %.1f s (%.0f reports/s), %zu bonded coins\n",
+            reports_len, advertisers, duration_ms / 1000.0, rate, bonded);
+    fprintf(out, "callbacks: %zu (%u passes, %zu reports of connected coins dropped), %s\n", total, repeats, dropped,
+            sim_log ? "log messages formatted" : "log messages counted, not formatted");
+    fprintf(out, "time per callback: mean %.0f ns, p50 %u ns, p99 %u ns, max %u ns (timer overhead %u ns subtracted)\n",
+            mean, times[total / 2], times[total * 99 / 100], times[total - 1], overhead);
+    fprintf(out, "callbacks per second: %.0f, load at the capture rate: %.3f%% of the host CPU\n",
+            mean > 0 ? 1e9 / mean : 0.0, rate * mean / 1e7);
+    fprintf(out, "log messages: %lu (%.2f per callback), heap allocations: %lu (%lu bytes)\n",
+            sim_log_msgs, (double) sim_log_msgs / (double) total, allocs, alloc_bytes);
+    fprintf(out, "decisions: %zu ignored, %zu queued, %zu connected\n",
+            results[SCAN_IGNORE], results[SCAN_QUEUED], results[SCAN_CONNECT]);
+    fprintf(out, "%-16s %10s %10s %10s\n", "address", "callbacks", "mean ns", "log/cb");
+    for (size_t c = 0; c < CLASSES; ++c) {
+        if (class_reports[c]) {
+            fprintf(out, "%-16s %10zu %10.0f %10.2f\n", class_names[c], class_reports[c],
+                    (double) class_ns[c] / (double) class_reports[c],
+                    (double) class_logs[c] / (double) class_reports[c]);
+        }
+    }
+    fprintf(out, "RPA resolution by the host before the callback: %zu reports with RPA x %zu IRKs = %zu ah() per pass\n",
+            rpa_reports, bonded, rpa_reports * bonded);
+    free(times);
+    free(reports);
+    return 0;
+}
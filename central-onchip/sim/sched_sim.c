@@ -0,0 +1,246 @@
+/*
+ * Host simulation of the connection scheduling: many good coins and one misbehaving coin
+ * compete for the single connection slot of the central.
+ * Uses the scheduler and candidate queue of the firmware (src/scheduler.c, src/candidates.c).
+ *
+ * build: gcc -O2 -Isim/include -Isrc -o sched_sim sim/sched_sim.c sim/kernel.c src/retained.c src/scheduler.c src/candidates.c
+ * usage: ./sched_sim [-n good coins] [-m minutes] [-p mean seconds between presses] [-s seed] [-b] [-v]
+ *        -b: baseline without scheduler (no backoff, no quarantine, queue in order of first sighting)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "scheduler.h"
+#include "candidates.h"
+#include "retained.h"
+
+int sim_log = 0;
+
+#define STEP_MS 10
+#define MAX_COINS 64
+// probability that an advertising coin is received during one step (about every 100 ms)
+#define SEEN_PERCENT 10
+// coin advertises for this long after a button press (coin session module)
+#define ADV_MS 10000
+#define CONNECT_MS 100
+// connection to a coin that stopped advertising fails after CONFIG_BT_CREATE_CONN_TIMEOUT
+#define CONNECT_TIMEOUT_MS 3000
+// successful session (encryption, discovery, challenge, response)
+#define SESSION_MS 1500
+// misbehaving coin: invalid response after all phases, then advertises again
+#define BAD_SESSION_MS 2500
+#define BAD_READVERTISE_MS 200
+
+struct coin {
+    bt_addr_le_t addr;
+    bool bad;
+    s64_t adv_since;   // -1 if not advertising
+    s64_t adv_until;
+};
+
+static struct coin coins[MAX_COINS];
+static size_t n_coins = 0;
+
+static enum {
+    IDLE, CONNECTING, SESSION
+} central = IDLE;
+static struct coin *conn_coin = NULL;
+static s64_t central_until = 0;
+static bool baseline = false;
+
+static u32_t served = 0, lost = 0, bad_sessions = 0;
+static s64_t bad_slot_ms = 0;
+static u32_t waits[100000];
+
+static void report(struct coin *c, sched_result_t result) {
+    if (!baseline) {
+        sched_report(&c->addr, result);
+    }
+}
+
+static bool allowed(struct coin *c) {
+    return baseline || sched_allowed(&c->addr);
+}
+
+static struct coin *find_coin(const bt_addr_le_t *addr) {
+    for (size_t i = 0; i < n_coins; ++i) {
+        if (!bt_addr_le_cmp(&coins[i].addr, addr)) {
+            return &coins[i];
+        }
+    }
+    return NULL;
+}
+
+static void connect(struct coin *c) {
+    conn_coin = c;
+    central = CONNECTING;
+    central_until = sim_now + (c->adv_since >= 0 ? CONNECT_MS : CONNECT_TIMEOUT_MS);
+}
+
+// slot is free: next queued candidate (as connect_next() in main.c)
+static void connect_next(void) {
+    struct candidate next;
+    central = IDLE;
+    conn_coin = NULL;
+    if (candidates_pop(&next)) {
+        connect(find_coin(&next.addr));
+    }
+}
+
+static void device_found(struct coin *c) {
+    if (central != IDLE) {
+        if (c != conn_coin && allowed(c)) {
+            candidates_push(&c->addr, -50);
+        }
+        return;
+    }
+    if (allowed(c)) {
+        connect(c);
+    }
+}
+
+static void step_central(void) {
+    if (central == CONNECTING && sim_now >= central_until) {
+        struct coin *c = conn_coin;
+        if (c->adv_since < 0) {
+            report(c, SCHED_FAIL_CONNECT);
+            connect_next();
+            return;
+        }
+        central = SESSION;
+        central_until = sim_now + (c->bad ? BAD_SESSION_MS : SESSION_MS);
+        if (!c->bad) {
+            if (served < ARRAY_SIZE(waits)) {
+                waits[served] = (u32_t) (sim_now - c->adv_since);
+            }
+            served++;
+        }
+    } else if (central == SESSION && sim_now >= central_until) {
+        struct coin *c = conn_coin;
+        if (c->bad) {
+            bad_sessions++;
+            bad_slot_ms += BAD_SESSION_MS + CONNECT_MS;
+            report(c, SCHED_FAIL_VALIDATION);
+            c->adv_since = sim_now + BAD_READVERTISE_MS;
+            c->adv_until = INT64_MAX;
+        } else {
+            report(c, SCHED_OK);
+            c->adv_since = -1;
+        }
+        connect_next();
+    }
+}
+
+static int cmp_u32(const void *a, const void *b) {
+    u32_t x = *(const u32_t *) a, y = *(const u32_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+int main(int argc, char **argv) {
+    int good = 20, minutes = 60, press_s = 60, opt;
+    unsigned seed = 1;
+    while ((opt = getopt(argc, argv, "n:m:p:s:bv")) != -1) {
+        switch (opt) {
+            case 'n':
+                good = atoi(optarg);
+                break;
+            case 'm':
+                minutes = atoi(optarg);
+                break;
+            case 'p':
+                press_s = atoi(optarg);
+                break;
+            case 's':
+                seed = (unsigned) atoi(optarg);
+                break;
+            case 'b':
+                baseline = true;
+                break;
+            case 'v':
+                sim_log = 1;
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-n good coins] [-m minutes] [-p press interval s] [-s seed] [-b] [-v]\n",
+                        argv[0]);
+                return 1;
+        }
+    }
+    if (good < 1 || good >= MAX_COINS || press_s < 1) {
+        fprintf(stderr, "invalid arguments\n");
+        return 1;
+    }
+    srand(seed);
+    retained_init();
+    sched_init();
+
+    n_coins = (size_t) good + 1;
+    for (size_t i = 0; i < n_coins; ++i) {
+        coins[i].addr.type = 1;
+        coins[i].addr.a.val[0] = (u8_t) i;
+        coins[i].addr.a.val[5] = 0xC0;
+        coins[i].adv_since = -1;
+    }
+    // the last coin misbehaves and advertises all the time
+    struct coin *bad = &coins[n_coins - 1];
+    bad->bad = true;
+    bad->adv_since = 0;
+    bad->adv_until = INT64_MAX;
+
+    u32_t presses = 0;
+    size_t order[MAX_COINS];
+    for (sim_now = 0; sim_now < (s64_t) minutes * 60 * 1000; sim_now += STEP_MS) {
+        for (size_t i = 0; i < n_coins; ++i) {
+            struct coin *c = &coins[i];
+            if (c->bad || c == conn_coin) {
+                continue;
+            }
+            if (c->adv_since >= 0 && sim_now >= c->adv_until) {
+                lost++;
+                c->adv_since = -1;
+            }
+            if (c->adv_since < 0 && rand() % (press_s * 1000 / STEP_MS) == 0) {
+                presses++;
+                c->adv_since = sim_now;
+                c->adv_until = sim_now + ADV_MS;
+            }
+        }
+        step_central();
+        // advertisements are received in random order
+        for (size_t i = 0; i < n_coins; ++i) {
+            order[i] = i;
+        }
+        for (size_t i = n_coins - 1; i > 0; --i) {
+            size_t j = (size_t) rand() % (i + 1), t = order[i];
+            order[i] = order[j];
+            order[j] = t;
+        }
+        for (size_t i = 0; i < n_coins; ++i) {
+            struct coin *c = &coins[order[i]];
+            if (c->adv_since >= 0 && c->adv_since <= sim_now && c != conn_coin && rand() % 100 < SEEN_PERCENT) {
+                device_found(c);
+            }
+        }
+    }
+
+    size_t n = served < ARRAY_SIZE(waits) ? served : ARRAY_SIZE(waits);
+    qsort(waits, n, sizeof(waits[0]), cmp_u32);
+    uint64_t sum = 0;
+    for (size_t i = 0; i < n; ++i) {
+        sum += waits[i];
+    }
+    printf("%s: %d good coins + 1 misbehaving, %d min, press every %d s per coin\n",
+           baseline ? "baseline" : "scheduler", good, minutes, press_s);
+    printf("presses %u, served %u (%.1f/min), lost %u\n", presses, served, served / (double) minutes, lost);
+    if (n) {
+        printf("wait press->connected: mean %llu ms, p50 %u ms, p95 %u ms, max %u ms\n",
+               (unsigned long long) (sum / n), waits[n / 2], waits[(n - 1) * 95 / 100], waits[n - 1]);
+    }
+    printf("misbehaving coin: %u sessions, %.1f%% of the time\n", bad_sessions,
+           100.0 * bad_slot_ms / ((double) minutes * 60 * 1000));
+    if (!baseline) {
+        struct shell sh;
+        sched_print(&sh);
+    }
+    return 0;
+}
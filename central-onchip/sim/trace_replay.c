@@ -0,0 +1,358 @@
+/*
+ * Replays a session trace of the central (`trace dump`, src/trace.h) against the host build of its
+ * session logic: the deadlines (src/deadline.c) and the scheduler (src/scheduler.c) see the recorded
+ * events with their recorded timing, the same calls are made as in main.c.
+ * Reports the phase latencies of every session and where the current build decides differently than
+ * the recording central: a deadline that would expire in a session that succeeded is a regression.
+ *
+ * build: gcc -O2 -Isim/include -Isrc -o trace_replay sim/trace_replay.c sim/kernel.c src/retained.c src/trace.c src/deadline.c src/scheduler.c
+ * usage: ./trace_replay [-q] <dump file>   replay a trace (output of `trace dump`, other lines are ignored)
+ *        ./trace_replay -g                 print a synthetic trace (normal, slow, failing and interrupted sessions)
+ *        -q: only print the summary
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "trace.h"
+#include "retained.h"
+#include "deadline.h"
+#include "scheduler.h"
+
+int sim_log = 0;
+
+#define MAX_SESSIONS 4096
+
+struct session {
+    bt_addr_le_t addr;
+    bool active;
+    u32_t adv, connected;   // trace clock
+    u32_t phase_start;
+    deadline_phase_t phase; // as derived from the events
+    u32_t phase_ms[DEADLINE_PHASES];
+    u16_t waited;
+    s32_t recorded_timeout, replayed_timeout; // phase or -1
+    sched_result_t result;
+    bool blocked;           // the scheduler of this build would not have connected the coin
+};
+
+static struct session s;
+static u32_t latency[DEADLINE_PHASES + 1][MAX_SESSIONS];
+static size_t latency_len[DEADLINE_PHASES + 1];
+static u32_t sessions = 0, interrupted = 0, regressions = 0, relaxed = 0, blocked = 0, mismatches = 0;
+static bool quiet = false;
+
+static void replay_timeout(deadline_phase_t phase) {
+    if (s.active && s.replayed_timeout < 0) {
+        s.replayed_timeout = phase;
+    }
+}
+
+static void add_latency(size_t i, u32_t ms) {
+    if (latency_len[i] < MAX_SESSIONS) {
+        latency[i][latency_len[i]++] = ms;
+    }
+}
+
+// phase changes as in main.c
+static void enter(deadline_phase_t phase, u32_t now, sched_result_t result) {
+    if (phase <= s.phase && s.phase != DEADLINE_IDLE) {
+        return;
+    }
+    if (s.phase < DEADLINE_PHASES) {
+        s.phase_ms[s.phase] = now - s.phase_start;
+    }
+    s.phase = phase;
+    s.phase_start = now;
+    s.result = result;
+    if (phase < DEADLINE_PHASES) {
+        deadline_enter(phase);
+    }
+}
+
+static void print_addr(const bt_addr_le_t *addr) {
+    printf("[%02X:%02X:%02X:%02X:%02X:%02X]", addr->a.val[5], addr->a.val[4], addr->a.val[3],
+           addr->a.val[2], addr->a.val[1], addr->a.val[0]);
+}
+
+static void end_session(u32_t now, int recorded_result, const char *end) {
+    if (s.phase < DEADLINE_PHASES) {
+        s.phase_ms[s.phase] = now - s.phase_start;
+    }
+    deadline_cancel();
+    sched_report(&s.addr, s.result);
+    sessions++;
+    bool regression = recorded_result == SCHED_OK && s.replayed_timeout >= 0;
+    regressions += regression;
+    relaxed += s.recorded_timeout >= 0 && s.replayed_timeout < 0;
+    blocked += s.blocked;
+    mismatches += recorded_result >= 0 && recorded_result != (int) s.result;
+    if (recorded_result == SCHED_OK) {
+        for (size_t i = 0; i < DEADLINE_PHASES; ++i) {
+            add_latency(i, s.phase_ms[i]);
+        }
+        add_latency(DEADLINE_PHASES, s.waited);
+    }
+    if (!quiet || regression) {
+        printf("%10u ms ", s.connected);
+        print_addr(&s.addr);
+        printf(" wait %5u, phases %4u %4u %4u %4u ms, %s", s.waited, s.phase_ms[0], s.phase_ms[1],
+               s.phase_ms[2], s.phase_ms[3], end);
+        if (s.recorded_timeout >= 0) {
+            printf(", recorded timeout %s", deadline_phase_name(s.recorded_timeout));
+        }
+        if (s.replayed_timeout >= 0) {
+            printf(", replayed timeout %s", deadline_phase_name(s.replayed_timeout));
+        }
+        if (s.blocked) {
+            printf(", blocked by scheduler");
+        }
+        printf("%s\n", regression ? "  REGRESSION" : "");
+    }
+    memset(&s, 0, sizeof(s));
+    s.phase = DEADLINE_IDLE;
+}
+
+static void replay(const struct trace_event *e) {
+    // the trace clock continues across resets, it only restarts with `trace clear`
+    if (e->time > sim_now) {
+        sim_advance(e->time - sim_now);
+    }
+    const bt_addr_le_t *addr = (const bt_addr_le_t *) e->data;
+    switch (e->type) {
+        case TRACE_BOOT:
+            if (s.active) {
+                interrupted++;
+                end_session(e->time, -1, "interrupted by reset");
+            }
+            break;
+        case TRACE_ADV:
+            s.adv = e->time;
+            s.blocked = !sched_allowed(addr);
+            break;
+        case TRACE_CONNECT:
+            if (e->a) {
+                bt_addr_le_copy(&s.addr, addr);
+                s.result = SCHED_FAIL_CONNECT;
+                sched_report(addr, SCHED_FAIL_CONNECT);
+                break;
+            }
+            bt_addr_le_copy(&s.addr, addr);
+            s.active = true;
+            s.connected = e->time;
+            s.waited = e->b;
+            s.recorded_timeout = s.replayed_timeout = -1;
+            s.phase = DEADLINE_IDLE;
+            enter(DEADLINE_ENCRYPT, e->time, SCHED_FAIL_SECURITY);
+            break;
+        case TRACE_SECURITY:
+            if (e->a == 4 && !e->b && e->data[0] == 16) {
+                enter(DEADLINE_DISCOVER, e->time, SCHED_FAIL_DISCOVERY);
+            }
+            break;
+        case TRACE_DISCOVER:
+            if (e->a == TRACE_DISCOVER_CCC && e->b) {
+                enter(DEADLINE_CHALLENGE, e->time, SCHED_FAIL_DISCOVERY);
+            }
+            break;
+        case TRACE_WRITE:
+            if (!e->a) {
+                enter(DEADLINE_RESPONSE, e->time, SCHED_FAIL_VALIDATION);
+            }
+            break;
+        case TRACE_VALIDATE:
+            if (s.phase < DEADLINE_PHASES) {
+                s.phase_ms[s.phase] = e->time - s.phase_start;
+                s.phase = DEADLINE_IDLE;
+            }
+            deadline_done();
+            if (e->a) {
+                s.result = SCHED_OK;
+            }
+            break;
+        case TRACE_TIMEOUT:
+            if (s.recorded_timeout < 0) {
+                s.recorded_timeout = e->a;
+            }
+            break;
+        case TRACE_DISCONNECT:
+            if (s.active) {
+                char end[32];
+                snprintf(end, sizeof(end), "reason %u", e->a);
+                end_session(e->time, e->b, end);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+static int cmp_u32(const void *a, const void *b) {
+    u32_t x = *(const u32_t *) a, y = *(const u32_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+static int parse_hex(const char *str, u8_t *out, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        unsigned int byte;
+        if (sscanf(str + 2 * i, "%2x", &byte) != 1) {
+            return -EINVAL;
+        }
+        out[i] = (u8_t) byte;
+    }
+    return 0;
+}
+
+// synthetic trace: the events main.c records, with typical and pathological timing
+static void session(const bt_addr_le_t *addr, u32_t encrypt, u32_t discover, u32_t response, bool valid,
+                    deadline_phase_t timeout_phase) {
+    u32_t phase_ms[] = {encrypt, discover, 60, response};
+    trace_record(TRACE_ADV, (u8_t) -60, 0, addr);
+    sim_advance(150);
+    trace_record(TRACE_CONNECT, 0, 150, addr);
+    for (size_t phase = 0; phase < DEADLINE_PHASES; ++phase) {
+        if (phase == timeout_phase) {
+            sim_advance(1500);
+            trace_record(TRACE_TIMEOUT, phase, 0, NULL);
+            sim_advance(40);
+            trace_record(TRACE_DISCONNECT, 0x13, SCHED_FAIL_SECURITY + (phase < 3 ? phase : 2), addr);
+            return;
+        }
+        sim_advance(phase_ms[phase]);
+        if (phase == DEADLINE_ENCRYPT) {
+            u8_t key_size = 16;
+            trace_record_data(TRACE_SECURITY, 4, 0, &key_size, 1);
+        } else if (phase == DEADLINE_DISCOVER) {
+            for (u8_t step = TRACE_DISCOVER_SERVICE; step <= TRACE_DISCOVER_CCC; ++step) {
+                trace_record(TRACE_DISCOVER, step, 10 + step, NULL);
+            }
+            trace_record(TRACE_SUBSCRIBE, 0, 0, NULL);
+        } else if (phase == DEADLINE_CHALLENGE) {
+            trace_record(TRACE_WRITE, 0, 0, NULL);
+        } else {
+            trace_record(TRACE_NOTIFY, 0, 20, NULL);
+            trace_record(TRACE_READ, 0, 32, NULL);
+            trace_record(TRACE_VALIDATE, valid, 900, NULL);
+        }
+    }
+    sim_advance(100);
+    trace_record(TRACE_DISCONNECT, 0x16, valid ? SCHED_OK : SCHED_FAIL_VALIDATION, addr);
+}
+
+static void generate(void) {
+    bt_addr_le_t coins[8];
+    for (size_t i = 0; i < ARRAY_SIZE(coins); ++i) {
+        coins[i].type = BT_ADDR_LE_RANDOM;
+        for (size_t j = 0; j < 6; ++j) {
+            coins[i].a.val[j] = (u8_t) (0x11 * (i + 1) + j);
+        }
+        coins[i].a.val[5] |= 0xc0;
+    }
+    srand(1);
+    retained_init();
+    trace_clear();
+    trace_init();
+    for (size_t i = 0; i < 80; ++i) {
+        sim_advance(5000 + rand() % 60000);
+        const bt_addr_le_t *addr = &coins[rand() % 6];
+        u32_t encrypt = 150 + rand() % 200, discover = 500 + rand() % 500, response = 300 + rand() % 300;
+        if (i % 50 == 49) {
+            // slow coin: discovery close to the default budget
+            session(addr, encrypt, 1400, response, true, DEADLINE_IDLE);
+        } else if (i % 40 == 39) {
+            session(addr, encrypt, discover, response, true, DEADLINE_DISCOVER);
+        } else {
+            session(addr, encrypt, discover, response, true, DEADLINE_IDLE);
+        }
+        if (i % 70 == 69) {
+            // watchdog reset during a session
+            trace_record(TRACE_ADV, (u8_t) -70, 0, &coins[7]);
+            trace_record(TRACE_CONNECT, 0, 100, &coins[7]);
+            sim_advance(300);
+            // the uptime restarts with the reset
+            sim_now = 0;
+            retained_init();
+            trace_init();
+        }
+    }
+    // a coin with a wrong spacekey, pressed repeatedly
+    for (size_t i = 0; i < 4; ++i) {
+        session(&coins[6], 200, 600, 400, false, DEADLINE_IDLE);
+        sim_advance(1500);
+    }
+    struct shell sh;
+    trace_dump(&sh);
+}
+
+int main(int argc, char **argv) {
+    int opt;
+    while ((opt = getopt(argc, argv, "gqv")) != -1) {
+        switch (opt) {
+            case 'g':
+                generate();
+                return 0;
+            case 'q':
+                quiet = true;
+                break;
+            case 'v':
+                sim_log = 1;
+                break;
+            default:
+                return 2;
+        }
+    }
+    if (optind >= argc) {
+        fprintf(stderr, "usage: %s [-q] <dump file> | -g\n", argv[0]);
+        return 2;
+    }
+    FILE *f = strcmp(argv[optind], "-") ? fopen(argv[optind], "r") : stdin;
+    if (!f) {
+        perror(argv[optind]);
+        return 2;
+    }
+    retained_init();
+    deadline_init(replay_timeout);
+    sched_init();
+    memset(&s, 0, sizeof(s));
+    s.phase = DEADLINE_IDLE;
+
+    char line[256];
+    size_t events = 0;
+    while (fgets(line, sizeof(line), f)) {
+        // the serial output may contain color codes and prompts
+        const char *hex = strstr(line, "trace ");
+        struct trace_event e;
+        if (!hex || strlen(hex + 6) < 2 * sizeof(e) || parse_hex(hex + 6, (u8_t *) &e, sizeof(e))) {
+            continue;
+        }
+        replay(&e);
+        events++;
+    }
+    if (f != stdin) {
+        fclose(f);
+    }
+
+    printf("events %zu, sessions %u (%u interrupted by a reset)\n", events, sessions, interrupted);
+    printf("regressions (successful session, replayed timeout): %u\n", regressions);
+    printf("recorded timeouts that would not expire now: %u\n", relaxed);
+    printf("sessions the scheduler would not connect: %u\n", blocked);
+    printf("sessions with a different replayed result: %u\n", mismatches);
+    const char *names[] = {"encrypt", "discover", "challenge", "response", "adv to connect"};
+    printf("successful sessions:\n");
+    for (size_t i = 0; i <= DEADLINE_PHASES; ++i) {
+        size_t n = latency_len[i];
+        if (!n) {
+            continue;
+        }
+        qsort(latency[i], n, sizeof(latency[i][0]), cmp_u32);
+        printf("  %-15s p50 %5u ms, p95 %5u ms, max %5u ms\n", names[i], latency[i][n / 2],
+               latency[i][n * 95 / 100], latency[i][n - 1]);
+    }
+    struct shell sh;
+    printf("deadlines after replay:\n");
+    deadline_print(&sh);
+    printf("scheduler after replay:\n");
+    sched_print(&sh);
+    return regressions ? 1 : 0;
+}
@@ -0,0 +1,343 @@
+#include "accesslog.h"
+#include "retained.h"
+#include <storage/flash_map.h>
+#include <sys/crc.h>
+#include <logging/log.h>
+#include <string.h>
+
+LOG_MODULE_REGISTER(accesslog);
+
+// the scratch partition is unused, the central is not updated over the air (no MCUboot)
+#define ACCESSLOG_AREA_ID DT_FLASH_AREA_IMAGE_SCRATCH_ID
+#define ACCESSLOG_PAGE_SIZE DT_FLASH_ERASE_BLOCK_SIZE
+#define ACCESSLOG_MAGIC 0x31474f4c // "LOG1"
+#define ACCESSLOG_RAM_MAGIC 0x314d4152 // "RAM1"
+#define ACCESSLOG_EMPTY 0xffffffff
+
+/*
+ * The log is a ring of pages, each with a header and RECORDS_PER_PAGE records. When the current page is full,
+ * the next one (the oldest) is erased, so all pages wear evenly. Records of a page have consecutive sequence numbers.
+ */
+struct accesslog_page {
+    u32_t magic;
+    u32_t page_seq;  // pages started since the log was erased, the newest page has the highest
+    u32_t first_seq; // sequence number of the first record
+    u32_t crc;       // crc32_ieee over the header up to here
+} __packed;
+
+#define RECORDS_PER_PAGE ((ACCESSLOG_PAGE_SIZE - sizeof(struct accesslog_page)) / sizeof(struct accesslog_record))
+#define PAGE_OFFSET(p) ((off_t) (p) * ACCESSLOG_PAGE_SIZE)
+#define RECORD_OFFSET(p, i) (PAGE_OFFSET(p) + sizeof(struct accesslog_page) + (i) * sizeof(struct accesslog_record))
+
+static const struct flash_area *fa = NULL;
+static struct k_mutex lock;
+static struct k_delayed_work flush_work;
+static u32_t pages = 0;
+static u32_t page = 0;      // page that is written
+static u32_t page_seq = 0;
+static u32_t page_first = 0;
+static u32_t used = 0;      // records in the current page, including damaged ones
+static u32_t damaged = 0;   // records of the current page with a wrong CRC (torn writes)
+
+// unwritten records, counters and the log clock live in RAM that is not cleared on boot,
+// the watchdog resets the central after sessions
+static struct {
+    u32_t magic;
+    u32_t next_seq;
+    u32_t offset_s; // log clock minus the retained clock (s)
+    bool clock_set;
+    u16_t pending;
+    u32_t flushes;
+    u32_t erases;
+    u32_t dropped;
+    u32_t last_flush_us;
+    u32_t max_flush_us;
+    struct accesslog_record records[CONFIG_CENTRAL_ACCESS_LOG_BATCH];
+} ram __noinit;
+
+static u32_t crc_of(const void *data, size_t len) {
+    return crc32_ieee((const u8_t *) data, len);
+}
+
+static bool read_page(u32_t p, struct accesslog_page *hdr) {
+    if (flash_area_read(fa, PAGE_OFFSET(p), hdr, sizeof(*hdr))) {
+        return false;
+    }
+    return hdr->magic == ACCESSLOG_MAGIC && hdr->crc == crc_of(hdr, offsetof(struct accesslog_page, crc));
+}
+
+static bool record_valid(const struct accesslog_record *r) {
+    return r->seq != ACCESSLOG_EMPTY && r->crc == crc_of(r, offsetof(struct accesslog_record, crc));
+}
+
+static u32_t clock_now(void) {
+    return ram.offset_s + (u32_t) (retained_now() / 1000);
+}
+
+// erases a page and starts it with the given sequence number
+static int start_page(u32_t p, u32_t seq, u32_t new_page_seq) {
+    int err = flash_area_erase(fa, PAGE_OFFSET(p), ACCESSLOG_PAGE_SIZE);
+    if (err) {
+        LOG_ERR("erasing page %u failed (err %d)", p, err);
+        return err;
+    }
+    ram.erases++;
+    struct accesslog_page hdr = {
+            .magic = ACCESSLOG_MAGIC,
+            .page_seq = new_page_seq,
+            .first_seq = seq,
+    };
+    hdr.crc = crc_of(&hdr, offsetof(struct accesslog_page, crc));
+    err = flash_area_write(fa, PAGE_OFFSET(p), &hdr, sizeof(hdr));
+    if (err) {
+        LOG_ERR("writing page header %u failed (err %d)", p, err);
+        return err;
+    }
+    page = p;
+    page_seq = new_page_seq;
+    page_first = seq;
+    used = 0;
+    damaged = 0;
+    return 0;
+}
+
+// writes the batch on the system workqueue, so the worker does not wait for the flash with the next session
+static void flush_handler(struct k_work *work) {
+    ARG_UNUSED(work);
+    (void) accesslog_flush();
+}
+
+int accesslog_init(void) {
+    k_mutex_init(&lock);
+    k_delayed_work_init(&flush_work, flush_handler);
+    bool ram_valid = retained_restored() && ram.magic == ACCESSLOG_RAM_MAGIC &&
+                     ram.pending <= CONFIG_CENTRAL_ACCESS_LOG_BATCH;
+    if (!ram_valid) {
+        (void) memset(&ram, 0, sizeof(ram));
+        ram.magic = ACCESSLOG_RAM_MAGIC;
+    }
+    int err = flash_area_open(ACCESSLOG_AREA_ID, &fa);
+    if (err) {
+        LOG_ERR("Cannot open access log flash area (err %d)", err);
+        fa = NULL;
+        return err;
+    }
+    pages = fa->fa_size / ACCESSLOG_PAGE_SIZE;
+
+    // newest page: the valid one with the highest page sequence number
+    bool found = false;
+    struct accesslog_page hdr;
+    for (u32_t p = 0; p < pages; ++p) {
+        if (read_page(p, &hdr) && (!found || hdr.page_seq > page_seq)) {
+            found = true;
+            page = p;
+            page_seq = hdr.page_seq;
+            page_first = hdr.first_seq;
+        }
+    }
+    u32_t last_time = 0;
+    if (found) {
+        // records are appended, the first empty slot ends the page
+        used = 0;
+        damaged = 0;
+        struct accesslog_record r;
+        while (used < RECORDS_PER_PAGE && !flash_area_read(fa, RECORD_OFFSET(page, used), &r, sizeof(r)) &&
+               r.seq != ACCESSLOG_EMPTY) {
+            if (record_valid(&r)) {
+                last_time = r.time;
+            } else {
+                damaged++;
+            }
+            used++;
+        }
+    } else {
+        LOG_INF("formatting access log (%u pages of %u records)", pages, (u32_t) RECORDS_PER_PAGE);
+        err = start_page(0, ram.next_seq, 0);
+        if (err) {
+            fa = NULL;
+            return err;
+        }
+    }
+
+    // records that were written before the reset are dropped from RAM
+    u32_t flash_next = page_first + used;
+    u16_t keep = 0;
+    for (u16_t i = 0; i < ram.pending; ++i) {
+        if (ram.records[i].seq >= flash_next && record_valid(&ram.records[i])) {
+            ram.records[keep++] = ram.records[i];
+        }
+    }
+    ram.pending = keep;
+    // after a power loss the records in RAM are gone, their sequence numbers are skipped:
+    // the gap shows the host that records may be missing, and no number is used for two records
+    ram.next_seq = MAX(ram.next_seq, flash_next + (ram_valid || !found ? 0 : CONFIG_CENTRAL_ACCESS_LOG_BATCH));
+    // the log clock continues with the retained clock (warm reset) or from the last record (power on)
+    if (!ram_valid) {
+        ram.offset_s = last_time - (u32_t) (retained_now() / 1000);
+        ram.clock_set = false;
+    }
+    // the central resets after every session, so old records are also written at boot
+    if (ram.pending == CONFIG_CENTRAL_ACCESS_LOG_BATCH ||
+        (ram.pending && clock_now() - ram.records[0].time >= CONFIG_CENTRAL_ACCESS_LOG_FLUSH_S)) {
+        (void) accesslog_flush();
+    }
+    LOG_INF("access log: page %u, %u records used, next %u, %u pending", page, used, ram.next_seq, ram.pending);
+    return 0;
+}
+
+int accesslog_flush(void) {
+    if (!fa) {
+        return -ENODEV;
+    }
+    k_mutex_lock(&lock, K_FOREVER);
+    u32_t start = k_cycle_get_32();
+    int err = 0;
+    u16_t done = 0;
+    while (done < ram.pending) {
+        if (used == RECORDS_PER_PAGE) {
+            err = start_page((page + 1) % pages, ram.records[done].seq, page_seq + 1);
+            if (err) {
+                break;
+            }
+        }
+        u16_t n = (u16_t) MIN((u32_t) (ram.pending - done), RECORDS_PER_PAGE - used);
+        err = flash_area_write(fa, RECORD_OFFSET(page, used), &ram.records[done], n * sizeof(ram.records[0]));
+        if (err) {
+            LOG_ERR("writing %u records failed (err %d)", n, err);
+            break;
+        }
+        used += n;
+        done += n;
+    }
+    if (done) {
+        // keep what could not be written for the next flush
+        memmove(ram.records, ram.records + done, (ram.pending - done) * sizeof(ram.records[0]));
+        ram.pending -= done;
+        ram.flushes++;
+        ram.last_flush_us = (u32_t) (SYS_CLOCK_HW_CYCLES_TO_NS(k_cycle_get_32() - start) / 1000U);
+        ram.max_flush_us = MAX(ram.max_flush_us, ram.last_flush_us);
+    }
+    k_mutex_unlock(&lock);
+    return err;
+}
+
+void accesslog_append(const bt_addr_le_t *addr, u8_t result, s8_t rssi, s8_t battery, u16_t latency_ms) {
+    k_mutex_lock(&lock, K_FOREVER);
+    // the deferred flush of the full batch did not run or failed
+    if (ram.pending == CONFIG_CENTRAL_ACCESS_LOG_BATCH && accesslog_flush()) {
+        // flash is broken, the oldest unwritten record makes room
+        memmove(ram.records, ram.records + 1, (ram.pending - 1) * sizeof(ram.records[0]));
+        ram.pending--;
+        ram.dropped++;
+    }
+    struct accesslog_record *r = &ram.records[ram.pending];
+    r->seq = ram.next_seq++;
+    r->time = clock_now();
+    bt_addr_le_copy(&r->addr, addr);
+    r->result = result | (ram.clock_set ? ACCESSLOG_CLOCK_SET : 0);
+    r->rssi = rssi;
+    r->battery = battery;
+    r->latency_ms = latency_ms;
+    r->crc = crc_of(r, offsetof(struct accesslog_record, crc));
+    ram.pending++;
+    if (ram.pending == CONFIG_CENTRAL_ACCESS_LOG_BATCH ||
+        r->time - ram.records[0].time >= CONFIG_CENTRAL_ACCESS_LOG_FLUSH_S) {
+        k_delayed_work_submit(&flush_work, K_NO_WAIT);
+    }
+    k_mutex_unlock(&lock);
+}
+
+void accesslog_set_clock(u32_t unix_s) {
+    ram.offset_s = unix_s - (u32_t) (retained_now() / 1000);
+    ram.clock_set = true;
+}
+
+int accesslog_erase(void) {
+    if (!fa) {
+        return -ENODEV;
+    }
+    k_mutex_lock(&lock, K_FOREVER);
+    int err = accesslog_flush();
+    for (u32_t p = 0; !err && p < pages; ++p) {
+        err = flash_area_erase(fa, PAGE_OFFSET(p), ACCESSLOG_PAGE_SIZE);
+    }
+    if (!err) {
+        err = start_page(0, ram.next_seq, 0);
+    }
+    k_mutex_unlock(&lock);
+    return err;
+}
+
+static void print_record(const struct shell *shell, const struct accesslog_record *r) {
+    static const char hex[] = "0123456789ABCDEF";
+    const u8_t *raw = (const u8_t *) r;
+    char line[2 * sizeof(*r) + 1];
+    for (size_t j = 0; j < sizeof(*r); ++j) {
+        line[2 * j] = hex[raw[j] >> 4];
+        line[2 * j + 1] = hex[raw[j] & 0xf];
+    }
+    line[sizeof(line) - 1] = 0;
+    shell_print(shell, "log %s", line);
+}
+
+void accesslog_dump(const struct shell *shell, u32_t since) {
+    if (!fa) {
+        shell_print(shell, "accesslog: no flash area");
+        return;
+    }
+    shell_print(shell, "accesslog: next %u, %u pending, clock %u%s", ram.next_seq, ram.pending, clock_now(),
+                ram.clock_set ? " (unix)" : "");
+    // pages in ring order from the oldest to the current one, one record at a time under the lock,
+    // so the worker is not blocked while the shell prints
+    for (u32_t i = 1; i <= pages; ++i) {
+        k_mutex_lock(&lock, K_FOREVER);
+        u32_t p = (page + i) % pages;
+        u32_t count = p == page ? used : RECORDS_PER_PAGE;
+        struct accesslog_page hdr;
+        bool skip = !read_page(p, &hdr) || hdr.page_seq > page_seq || hdr.first_seq + count <= since;
+        k_mutex_unlock(&lock);
+        for (u32_t j = 0; !skip && j < count; ++j) {
+            struct accesslog_record r;
+            k_mutex_lock(&lock, K_FOREVER);
+            // the page may have been erased for new records meanwhile
+            bool ok = !flash_area_read(fa, RECORD_OFFSET(p, j), &r, sizeof(r)) && record_valid(&r) &&
+                      r.seq >= hdr.first_seq;
+            k_mutex_unlock(&lock);
+            if (ok && r.seq >= since) {
+                print_record(shell, &r);
+            }
+        }
+    }
+    for (u16_t i = 0;; ++i) {
+        struct accesslog_record r;
+        k_mutex_lock(&lock, K_FOREVER);
+        bool ok = i < ram.pending;
+        if (ok) {
+            r = ram.records[i];
+        }
+        k_mutex_unlock(&lock);
+        if (!ok) {
+            break;
+        }
+        if (r.seq >= since) {
+            print_record(shell, &r);
+        }
+    }
+}
+
+void accesslog_print(const struct shell *shell) {
+    if (!fa) {
+        shell_print(shell, "no access log flash area");
+        return;
+    }
+    shell_print(shell, "%u pages of %u records, page %u with %u records (%u damaged), next record %u, "
+                       "%u of %u in RAM",
+                pages, (u32_t) RECORDS_PER_PAGE, page, used, damaged, ram.next_seq, ram.pending,
+                CONFIG_CENTRAL_ACCESS_LOG_BATCH);
+    // every page is erased once per round through the ring
+    shell_print(shell, "pages started %u (about %u erases per page), flushes %u, erases %u, dropped %u, "
+                       "flush last %u us, max %u us",
+                page_seq + 1, page_seq / pages + 1, ram.flushes, ram.erases, ram.dropped, ram.last_flush_us,
+                ram.max_flush_us);
+    shell_print(shell, "clock %u s%s", clock_now(), ram.clock_set ? " (unix time)" : " (not set by the host)");
+}
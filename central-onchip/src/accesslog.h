@@ -0,0 +1,76 @@
+#pragma once
+
+#include <zephyr.h>
+#include <bluetooth/bluetooth.h>
+#include <shell/shell.h>
+
+// flag in the result of a record: the time is unix time (the host set the clock), else seconds of the log clock
+#define ACCESSLOG_CLOCK_SET 0x80
+
+/**
+ * One access log record. Dumped as hex of its bytes (little endian), prod/fetch_log.py shares this layout.
+ */
+struct accesslog_record {
+    u32_t seq;          // sequence number, continues across pages and resets
+    u32_t time;         // s of the log clock
+    bt_addr_le_t addr;  // identity address of the coin
+    u8_t result;        // session result (sched_result_t) and ACCESSLOG_CLOCK_SET
+    s8_t rssi;          // rssi of the advertisement that was connected
+    s8_t battery;       // battery level from the advertisement in percent, -1 if unknown
+    u16_t latency_ms;   // first advertisement to validation (or to the end of a failed session)
+    u32_t crc;          // crc32_ieee over the record up to here
+} __packed;
+
+BUILD_ASSERT(sizeof(struct accesslog_record) == 24);
+
+/**
+ * Finds the newest page of the log in flash (formats the area if there is none) and restores the records
+ * and the log clock that were kept in RAM across a warm reset.
+ * @return 0 on success, error code of the flash area
+ */
+int accesslog_init(void);
+
+/**
+ * Appends a record of a session. Records are collected in RAM and written to flash in batches of
+ * CONFIG_CENTRAL_ACCESS_LOG_BATCH or when the oldest one is older than CONFIG_CENTRAL_ACCESS_LOG_FLUSH_S,
+ * by a work item on the system workqueue. Writes flash only if that flush did not empty the batch (broken flash),
+ * must not be called from the BT RX thread.
+ * @param addr identity address of the coin
+ * @param result session result
+ * @param rssi rssi of the connected advertisement
+ * @param battery battery level in percent, -1 if unknown
+ * @param latency_ms first advertisement to validation or to the end of the session
+ */
+void accesslog_append(const bt_addr_le_t *addr, u8_t result, s8_t rssi, s8_t battery, u16_t latency_ms);
+
+/**
+ * Writes all records from RAM to flash, erasing the oldest page when the current one is full.
+ * @return 0 on success, error code of the flash area
+ */
+int accesslog_flush(void);
+
+/**
+ * Sets the log clock to unix time, following records are marked with ACCESSLOG_CLOCK_SET.
+ * @param unix_s seconds since 1970
+ */
+void accesslog_set_clock(u32_t unix_s);
+
+/**
+ * Erases the whole log, sequence numbers continue.
+ * @return 0 on success, error code of the flash area
+ */
+int accesslog_erase(void);
+
+/**
+ * Prints all records starting at a sequence number as hex lines (`log <hex>`) for prod/fetch_log.py,
+ * preceded by a summary line. Records that are still in RAM are included.
+ * @param shell shell to be used for printing.
+ * @param since first sequence number
+ */
+void accesslog_dump(const struct shell *shell, u32_t since);
+
+/**
+ * Prints size and position of the log, flush counters and the page wear.
+ * @param shell shell to be used for printing.
+ */
+void accesslog_print(const struct shell *shell);
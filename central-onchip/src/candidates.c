@@ -0,0 +1,105 @@
+#include "candidates.h"
+#include <zephyr.h>
+#include <logging/log.h>
+
+#include "scheduler.h"
+
+LOG_MODULE_REGISTER(candidates);
+
+// only accessed from the BT RX thread (scan and connection callbacks), shell access is read-only
+static struct candidate queue[CANDIDATES_MAX];
+static size_t queue_len = 0;
+
+static void remove_at(size_t i) {
+    --queue_len;
+    for (; i < queue_len; ++i) {
+        queue[i] = queue[i + 1];
+    }
+}
+
+static void drop_stale(s64_t now) {
+    size_t i = 0;
+    while (i < queue_len) {
+        if (now - queue[i].last_seen > CANDIDATES_MAX_AGE_MS) {
+            LOG_DBG("dropping stale candidate %u", (u32_t) i);
+            remove_at(i);
+        } else {
+            ++i;
+        }
+    }
+}
+
+void candidates_push(const bt_addr_le_t *addr, s8_t rssi) {
+    s64_t now = k_uptime_get();
+    for (size_t i = 0; i < queue_len; ++i) {
+        if (!bt_addr_le_cmp(&queue[i].addr, addr)) {
+            queue[i].last_seen = now;
+            queue[i].rssi = rssi;
+            return;
+        }
+    }
+    drop_stale(now);
+    if (queue_len == CANDIDATES_MAX) {
+        size_t oldest = 0;
+        for (size_t i = 1; i < queue_len; ++i) {
+            if (queue[i].last_seen < queue[oldest].last_seen) {
+                oldest = i;
+            }
+        }
+        remove_at(oldest);
+    }
+    struct candidate *c = &queue[queue_len++];
+    bt_addr_le_copy(&c->addr, addr);
+    c->first_seen = now;
+    c->last_seen = now;
+    c->rssi = rssi;
+    LOG_INF("Queued candidate: [%02X:%02X:%02X:%02X:%02X:%02X] (RSSI %d)",
+            addr->a.val[5], addr->a.val[4], addr->a.val[3],
+            addr->a.val[2], addr->a.val[1], addr->a.val[0], rssi);
+}
+
+bool candidates_pop(struct candidate *out) {
+    drop_stale(k_uptime_get());
+    // coins that were served least recently first, entries are appended in order of first sighting
+    size_t best = CANDIDATES_MAX;
+    s64_t best_served = 0;
+    size_t i = 0;
+    while (i < queue_len) {
+        if (!sched_allowed(&queue[i].addr)) {
+            remove_at(i);
+            continue;
+        }
+        s64_t served = sched_last_served(&queue[i].addr);
+        if (best == CANDIDATES_MAX || served < best_served) {
+            best = i;
+            best_served = served;
+        }
+        ++i;
+    }
+    if (best == CANDIDATES_MAX) {
+        return false;
+    }
+    *out = queue[best];
+    remove_at(best);
+    return true;
+}
+
+void candidates_remove(const bt_addr_le_t *addr) {
+    for (size_t i = 0; i < queue_len; ++i) {
+        if (!bt_addr_le_cmp(&queue[i].addr, addr)) {
+            remove_at(i);
+            return;
+        }
+    }
+}
+
+void candidates_print(const struct shell *shell) {
+    s64_t now = k_uptime_get();
+    for (size_t i = 0; i < queue_len; ++i) {
+        const bt_addr_le_t *addr = &queue[i].addr;
+        shell_print(shell, "[%02X:%02X:%02X:%02X:%02X:%02X] RSSI %d, first seen %u ms ago, last seen %u ms ago",
+                    addr->a.val[5], addr->a.val[4], addr->a.val[3],
+                    addr->a.val[2], addr->a.val[1], addr->a.val[0], queue[i].rssi,
+                    (u32_t) (now - queue[i].first_seen), (u32_t) (now - queue[i].last_seen));
+    }
+}
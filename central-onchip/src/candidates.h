@@ -0,0 +1,46 @@
+#pragma once
+
+#include <bluetooth/bluetooth.h>
+#include <shell/shell.h>
+
+#define CANDIDATES_MAX 4
+// candidates that have not been seen for this long are dropped (coin stopped advertising)
+#define CANDIDATES_MAX_AGE_MS 2000
+
+/**
+ * Bonded coin that advertised while the connection slot was busy.
+ */
+struct candidate {
+    bt_addr_le_t addr;
+    s64_t first_seen;
+    s64_t last_seen;
+    s8_t rssi;
+};
+
+/**
+ * Adds a coin to the candidate queue or refreshes its entry.
+ * If the queue is full, the entry that was not seen for the longest time is replaced.
+ * @param addr address of the coin
+ * @param rssi rssi of the advertisement
+ */
+void candidates_push(const bt_addr_le_t *addr, s8_t rssi);
+
+/**
+ * Removes the next candidate from the queue: the one served least recently by the scheduler,
+ * then the one seen first. Stale candidates and candidates in backoff are dropped.
+ * @param out the candidate
+ * @return true if a candidate was found
+ */
+bool candidates_pop(struct candidate *out);
+
+/**
+ * Removes a coin from the candidate queue (e.g. because it is connected now).
+ * @param addr address of the coin
+ */
+void candidates_remove(const bt_addr_le_t *addr);
+
+/**
+ * Prints all queued candidates.
+ * @param shell shell to be used for printing.
+ */
+void candidates_print(const struct shell *shell);
@@ -0,0 +1,31 @@
+#include "cycles.h"
+#ifdef CONFIG_CPU_CORTEX_M4
+#include <arch/arm/cortex_m/cmsis.h>
+#endif
+
+#ifdef CONFIG_CPU_CORTEX_M4
+void cycles_init(void) {
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNT_ENA_Msk;
+}
+
+u32_t cycles_get(void) {
+    return DWT->CYCCNT;
+}
+
+u64_t cycles_to_ns(u32_t cycles) {
+    return (u64_t) cycles * 1000U / (SystemCoreClock / 1000000U);
+}
+#else
+void cycles_init(void) {
+}
+
+u32_t cycles_get(void) {
+    return k_cycle_get_32();
+}
+
+u64_t cycles_to_ns(u32_t cycles) {
+    return SYS_CLOCK_HW_CYCLES_TO_NS(cycles);
+}
+#endif
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <zephyr.h>
+
+/**
+ * Starts the cycle counter for the timing statistics, called first in main().
+ * The kernel cycle counter of the nRF52 runs at 32768 Hz (about 30 us steps), the DWT cycle counter of the
+ * Cortex-M4 counts CPU cycles (64 MHz). Differences are valid for about a minute (the DWT counter wraps after 67 s).
+ */
+void cycles_init(void);
+
+/**
+ * @return cycle counter
+ */
+u32_t cycles_get(void);
+
+/**
+ * @param cycles difference of two cycles_get() values
+ * @return ns
+ */
+u64_t cycles_to_ns(u32_t cycles);
@@ -0,0 +1,162 @@
+#include "deadline.h"
+#include "retained.h"
+#include <logging/log.h>
+#include <string.h>
+
+LOG_MODULE_REGISTER(deadline);
+
+/*
+ * Budgets are derived from the latency of the last sessions: twice the 95th percentile,
+ * but at least a few connection intervals (50ms max) and at most the default budget.
+ * Default budgets are about twice the latency of a session over the initial connection parameters:
+ * encryption ~4 connection events, discovery 4 discover requests + subscribe,
+ * challenge 64B as prepared writes (4 prepare + 1 execute request), response indication + 1 read.
+ * Together they stay below the previous 5 s session timeout.
+ * A timeout counts as a sample at the default budget: otherwise a budget that shrank below the latency
+ * of the link (e.g. a coin moving away) would only ever collect timeouts and never grow again.
+ */
+#define DEADLINE_FLOOR_MS 250
+#define DEADLINE_SAMPLES 32
+#define DEADLINE_MIN_SAMPLES 8
+#define DEADLINE_MAGIC 0x444c4e31 // "DLN1"
+
+static const struct {
+    const char *name;
+    u16_t default_ms;
+} phase_info[] = {
+        [DEADLINE_ENCRYPT] = {"encrypt", 500},
+        [DEADLINE_DISCOVER] = {"discover", 1500},
+        [DEADLINE_CHALLENGE] = {"challenge", 1000},
+        [DEADLINE_RESPONSE] = {"response", 1000},
+};
+BUILD_ASSERT(ARRAY_SIZE(phase_info) == DEADLINE_PHASES);
+
+// statistics live in RAM that is not cleared on boot, the watchdog resets the central after sessions
+static struct {
+    u32_t magic;
+    u16_t samples[DEADLINE_PHASES][DEADLINE_SAMPLES];
+    u8_t next[DEADLINE_PHASES];
+    u8_t count[DEADLINE_PHASES];
+    u32_t timeouts[DEADLINE_PHASES];
+} stats __noinit;
+
+static deadline_phase_t phase = DEADLINE_IDLE;
+static s64_t phase_start_ms = 0;
+static void (*expired_cb)(deadline_phase_t phase) = NULL;
+static struct k_delayed_work deadline_timer;
+
+// percentile (0..100) of the recorded latencies of a phase
+static u16_t percentile(deadline_phase_t p, u8_t pct) {
+    u16_t sorted[DEADLINE_SAMPLES];
+    size_t n = stats.count[p];
+    if (!n) {
+        return 0;
+    }
+    memcpy(sorted, stats.samples[p], n * sizeof(sorted[0]));
+    for (size_t i = 1; i < n; ++i) {
+        u16_t v = sorted[i];
+        size_t j = i;
+        for (; j > 0 && sorted[j - 1] > v; --j) {
+            sorted[j] = sorted[j - 1];
+        }
+        sorted[j] = v;
+    }
+    return sorted[(n - 1) * pct / 100];
+}
+
+static u32_t budget_ms(deadline_phase_t p) {
+    if (stats.count[p] < DEADLINE_MIN_SAMPLES) {
+        return phase_info[p].default_ms;
+    }
+    u32_t budget = 2U * percentile(p, 95);
+    if (budget < DEADLINE_FLOOR_MS) {
+        budget = DEADLINE_FLOOR_MS;
+    }
+    if (budget > phase_info[p].default_ms) {
+        budget = phase_info[p].default_ms;
+    }
+    return budget;
+}
+
+// add a latency sample of a phase
+static void add_sample(deadline_phase_t p, s64_t latency) {
+    stats.samples[p][stats.next[p]] = latency > UINT16_MAX ? UINT16_MAX : (u16_t) latency;
+    stats.next[p] = (stats.next[p] + 1) % DEADLINE_SAMPLES;
+    if (stats.count[p] < DEADLINE_SAMPLES) {
+        stats.count[p]++;
+    }
+}
+
+// record the latency of the current phase
+static void record(s64_t now) {
+    if (phase == DEADLINE_IDLE) {
+        return;
+    }
+    add_sample(phase, now - phase_start_ms);
+}
+
+// deadline timer callback function
+static void deadline_expired(struct k_work *work) {
+    ARG_UNUSED(work);
+    deadline_phase_t expired = phase;
+    if (expired == DEADLINE_IDLE) {
+        return;
+    }
+    stats.timeouts[expired]++;
+    phase = DEADLINE_IDLE;
+    LOG_ERR("%s phase took longer than %u ms", phase_info[expired].name, budget_ms(expired));
+    add_sample(expired, phase_info[expired].default_ms);
+    if (expired_cb) {
+        expired_cb(expired);
+    }
+}
+
+void deadline_init(void (*expired_fn)(deadline_phase_t phase)) {
+    expired_cb = expired_fn;
+    k_delayed_work_init(&deadline_timer, deadline_expired);
+    if (!retained_restored() || stats.magic != DEADLINE_MAGIC) {
+        (void) memset(&stats, 0, sizeof(stats));
+        stats.magic = DEADLINE_MAGIC;
+    }
+    // a corrupted ring position must not index out of bounds
+    for (size_t i = 0; i < DEADLINE_PHASES; ++i) {
+        if (stats.next[i] >= DEADLINE_SAMPLES || stats.count[i] > DEADLINE_SAMPLES) {
+            stats.next[i] = 0;
+            stats.count[i] = 0;
+        }
+    }
+}
+
+void deadline_enter(deadline_phase_t next) {
+    if (next >= DEADLINE_PHASES || (phase != DEADLINE_IDLE && next <= phase)) {
+        return;
+    }
+    s64_t now = k_uptime_get();
+    record(now);
+    phase = next;
+    phase_start_ms = now;
+    k_delayed_work_submit(&deadline_timer, K_MSEC(budget_ms(next)));
+}
+
+void deadline_done(void) {
+    k_delayed_work_cancel(&deadline_timer);
+    record(k_uptime_get());
+    phase = DEADLINE_IDLE;
+}
+
+void deadline_cancel(void) {
+    k_delayed_work_cancel(&deadline_timer);
+    phase = DEADLINE_IDLE;
+}
+
+const char *deadline_phase_name(deadline_phase_t p) {
+    return p < DEADLINE_PHASES ? phase_info[p].name : "idle";
+}
+
+void deadline_print(const struct shell *shell) {
+    for (size_t i = 0; i < DEADLINE_PHASES; ++i) {
+        shell_print(shell, "%-9s budget %4u ms, p50 %4u ms, p95 %4u ms (%u samples), timeouts %u",
+                    phase_info[i].name, budget_ms(i), percentile(i, 50), percentile(i, 95),
+                    stats.count[i], stats.timeouts[i]);
+    }
+}
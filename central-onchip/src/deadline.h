@@ -0,0 +1,51 @@
+#pragma once
+
+#include <zephyr.h>
+#include <shell/shell.h>
+
+/**
+ * Phases of an authentication session, each one has its own deadline.
+ */
+typedef enum deadline_phase_t {
+    DEADLINE_ENCRYPT = 0,   // connected, waiting for encryption
+    DEADLINE_DISCOVER,      // encrypted, discovering the auth service and subscribing
+    DEADLINE_CHALLENGE,     // writing the challenge
+    DEADLINE_RESPONSE,      // waiting for the indication and reading the response
+    DEADLINE_PHASES,
+    DEADLINE_IDLE = DEADLINE_PHASES
+} deadline_phase_t;
+
+/**
+ * Initializes the deadline timer and the latency statistics (kept across the watchdog reset).
+ * @param expired_fn function called (from the system workqueue) when a phase takes too long
+ */
+void deadline_init(void (*expired_fn)(deadline_phase_t phase));
+
+/**
+ * Records the latency of the current phase and arms the deadline of the next one.
+ * Phases only advance, entering the current or an earlier phase is ignored.
+ * @param phase next phase
+ */
+void deadline_enter(deadline_phase_t phase);
+
+/**
+ * Records the latency of the last phase and disarms the deadline (session completed).
+ */
+void deadline_done(void);
+
+/**
+ * Disarms the deadline without recording the latency of the current phase (session aborted).
+ */
+void deadline_cancel(void);
+
+/**
+ * @param phase session phase
+ * @return name of the phase
+ */
+const char *deadline_phase_name(deadline_phase_t phase);
+
+/**
+ * Prints budget, latency percentiles and timeout counter of every phase.
+ * @param shell shell to be used for printing.
+ */
+void deadline_print(const struct shell *shell);
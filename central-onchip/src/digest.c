@@ -0,0 +1,207 @@
+#include "digest.h"
+#include <keys.h> //use of internal keys API for bt_keys etc.
+#include <logging/log.h>
+
+#include "spaceauth.h"
+#include "blake2.h"
+#ifdef CONFIG_CENTRAL_KEYSTORE
+#include "keystore.h"
+#endif
+
+LOG_MODULE_REGISTER(digest);
+
+static uint8_t bucket_digests[DIGEST_BUCKETS][DIGEST_LEN] = {{0}};
+static uint16_t dirty_buckets = 0xFFFF;
+BUILD_ASSERT(DIGEST_BUCKETS <= 16);
+
+static size_t addr_bucket(const bt_addr_le_t *addr) {
+    return addr->a.val[0] % DIGEST_BUCKETS;
+}
+
+#ifndef CONFIG_CENTRAL_KEYSTORE
+// addresses of one bucket (bonds and spacekeys), sorted
+static bt_addr_le_t bucket_addrs[2 * CONFIG_BT_MAX_PAIRED];
+static size_t bucket_len = 0;
+
+// compare addresses in printed order (most significant byte first)
+static int addr_order(const bt_addr_le_t *a, const bt_addr_le_t *b) {
+    for (int i = 5; i >= 0; --i) {
+        if (a->a.val[i] != b->a.val[i]) {
+            return a->a.val[i] - b->a.val[i];
+        }
+    }
+    return 0;
+}
+
+// insert address into the sorted bucket list (no duplicates)
+static void bucket_insert(const bt_addr_le_t *addr) {
+    size_t i = 0;
+    while (i < bucket_len && addr_order(&bucket_addrs[i], addr) < 0) {
+        ++i;
+    }
+    if ((i < bucket_len && !addr_order(&bucket_addrs[i], addr)) || bucket_len == ARRAY_SIZE(bucket_addrs)) {
+        return;
+    }
+    memmove(&bucket_addrs[i + 1], &bucket_addrs[i], (bucket_len - i) * sizeof(bt_addr_le_t));
+    bt_addr_le_copy(&bucket_addrs[i], addr);
+    ++bucket_len;
+}
+
+static void collect_bond(struct bt_keys *keys, void *data) {
+    size_t bucket = *(size_t *) data;
+    if (addr_bucket(&keys->addr) == bucket) {
+        bucket_insert(&keys->addr);
+    }
+}
+
+static void collect_spacekey(const spacekey_t *key, void *data) {
+    size_t bucket = *(size_t *) data;
+    if (addr_bucket(&key->addr) == bucket) {
+        bucket_insert(&key->addr);
+    }
+}
+
+static void collect_bucket(size_t bucket) {
+    bucket_len = 0;
+    bt_keys_foreach(BT_KEYS_ALL, collect_bond, &bucket);
+    spacekeys_foreach(collect_spacekey, &bucket);
+}
+
+// digest of addr|IRK|LTK|spacekey, missing keys are hashed as zeroes
+static void coin_digest(const bt_addr_le_t *addr, uint8_t *out) {
+    uint8_t record[6 + 16 + 16 + 32] = {0};
+    for (size_t i = 0; i < 6; ++i) {
+        record[i] = addr->a.val[5 - i];
+    }
+    struct bt_keys *keys = bt_keys_find_addr(BT_ID_DEFAULT, addr);
+    if (keys) {
+        memcpy(record + 6, keys->irk.val, 16);
+        memcpy(record + 22, keys->ltk.val, 16);
+    }
+    // derived spacekeys count like registered ones, revoked coins hash as zeroes
+    (void) spacekey_get(addr, record + 38);
+    blake2s(out, DIGEST_LEN, record, sizeof(record), NULL, 0);
+    (void) memset(record, 0, sizeof(record));
+}
+
+#endif
+
+#ifdef CONFIG_CENTRAL_KEYSTORE
+static void print_digest(const struct shell *shell, const char *prefix, const uint8_t *digest);
+
+// with the key store, coins are read from flash (already in address order) instead of the RAM tables
+static void keystore_coin_digest(const struct keystore_coin *coin, uint8_t *out) {
+    uint8_t record[6 + 16 + 16 + 32];
+    for (size_t i = 0; i < 6; ++i) {
+        record[i] = coin->addr.a.val[5 - i];
+    }
+    memcpy(record + 6, coin->irk, 16);
+    memcpy(record + 22, coin->ltk, 16);
+    memcpy(record + 38, coin->spacekey, 32);
+    blake2s(out, DIGEST_LEN, record, sizeof(record), NULL, 0);
+    (void) memset(record, 0, sizeof(record));
+}
+
+struct keystore_bucket {
+    size_t bucket;
+    blake2s_state *state;
+    const struct shell *shell;
+};
+
+static void keystore_bucket_func(const struct keystore_coin *coin, void *data) {
+    struct keystore_bucket *b = data;
+    uint8_t digest[DIGEST_LEN];
+    if (addr_bucket(&coin->addr) != b->bucket) {
+        return;
+    }
+    keystore_coin_digest(coin, digest);
+    if (b->state) {
+        blake2s_update(b->state, digest, DIGEST_LEN);
+    }
+    if (b->shell) {
+        char prefix[24];
+        snprintk(prefix, sizeof(prefix), "[%02X:%02X:%02X:%02X:%02X:%02X] ",
+                 coin->addr.a.val[5], coin->addr.a.val[4], coin->addr.a.val[3],
+                 coin->addr.a.val[2], coin->addr.a.val[1], coin->addr.a.val[0]);
+        print_digest(b->shell, prefix, digest);
+    }
+}
+#endif
+
+static void update_bucket(size_t bucket) {
+    if (!(dirty_buckets & BIT(bucket))) {
+        return;
+    }
+    blake2s_state state;
+    blake2s_init(&state, DIGEST_LEN);
+#ifdef CONFIG_CENTRAL_KEYSTORE
+    struct keystore_bucket b = {.bucket = bucket, .state = &state, .shell = NULL};
+    keystore_foreach(keystore_bucket_func, &b);
+#else
+    uint8_t digest[DIGEST_LEN];
+    collect_bucket(bucket);
+    for (size_t i = 0; i < bucket_len; ++i) {
+        coin_digest(&bucket_addrs[i], digest);
+        blake2s_update(&state, digest, DIGEST_LEN);
+    }
+#endif
+    blake2s_final(&state, bucket_digests[bucket], DIGEST_LEN);
+    dirty_buckets &= ~BIT(bucket);
+}
+
+void digest_invalidate(const bt_addr_le_t *addr) {
+    if (addr) {
+        dirty_buckets |= BIT(addr_bucket(addr));
+    } else {
+        dirty_buckets = 0xFFFF;
+    }
+}
+
+void digest_get(uint8_t *out) {
+    for (size_t i = 0; i < DIGEST_BUCKETS; ++i) {
+        update_bucket(i);
+    }
+    blake2s(out, DIGEST_LEN, bucket_digests, sizeof(bucket_digests), NULL, 0);
+}
+
+static void print_digest(const struct shell *shell, const char *prefix, const uint8_t *digest) {
+    char hex[2 * DIGEST_LEN + 1];
+    for (size_t i = 0; i < DIGEST_LEN; ++i) {
+        snprintk(&hex[2 * i], 3, "%02X", digest[i]);
+    }
+    shell_print(shell, "%s%s", prefix, hex);
+}
+
+void digest_print(const struct shell *shell) {
+    uint8_t digest[DIGEST_LEN];
+    char prefix[16];
+    digest_get(digest);
+    print_digest(shell, "digest: ", digest);
+    for (size_t i = 0; i < DIGEST_BUCKETS; ++i) {
+        snprintk(prefix, sizeof(prefix), "bucket %u: ", i);
+        print_digest(shell, prefix, bucket_digests[i]);
+    }
+}
+
+int digest_print_bucket(const struct shell *shell, size_t bucket) {
+    if (bucket >= DIGEST_BUCKETS) {
+        return -EINVAL;
+    }
+#ifdef CONFIG_CENTRAL_KEYSTORE
+    struct keystore_bucket b = {.bucket = bucket, .state = NULL, .shell = shell};
+    keystore_foreach(keystore_bucket_func, &b);
+#else
+    uint8_t digest[DIGEST_LEN];
+    char prefix[24];
+    collect_bucket(bucket);
+    for (size_t i = 0; i < bucket_len; ++i) {
+        const bt_addr_le_t *addr = &bucket_addrs[i];
+        snprintk(prefix, sizeof(prefix), "[%02X:%02X:%02X:%02X:%02X:%02X] ",
+                 addr->a.val[5], addr->a.val[4], addr->a.val[3],
+                 addr->a.val[2], addr->a.val[1], addr->a.val[0]);
+        coin_digest(addr, digest);
+        print_digest(shell, prefix, digest);
+    }
+#endif
+    return 0;
+}
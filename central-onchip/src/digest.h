@@ -0,0 +1,36 @@
+#pragma once
+
+#include <bluetooth/bluetooth.h>
+#include <shell/shell.h>
+
+#define DIGEST_BUCKETS 16
+#define DIGEST_LEN 32
+
+/**
+ * Marks the bucket of the given address as changed, its digest is recomputed on the next request.
+ * @param addr changed address, NULL to invalidate all buckets
+ */
+void digest_invalidate(const bt_addr_le_t *addr);
+
+/**
+ * Computes the digest over the whole coin table (addresses, IRKs, LTKs and spacekeys).
+ * It is the BLAKE2s hash of the bucket digests. A bucket digest is the BLAKE2s hash of the coin digests
+ * of all coins in the bucket (ordered by address), a coin digest is the BLAKE2s hash of addr|IRK|LTK|spacekey.
+ * Coins are assigned to buckets by the last 4 bits of their address.
+ * @param out output buffer (DIGEST_LEN bytes)
+ */
+void digest_get(uint8_t *out);
+
+/**
+ * Prints the table digest and all bucket digests.
+ * @param shell shell to be used for printing.
+ */
+void digest_print(const struct shell *shell);
+
+/**
+ * Prints the coin digests of all coins in a bucket.
+ * @param shell shell to be used for printing.
+ * @param bucket bucket index
+ * @return 0 on success, -EINVAL on invalid bucket index
+ */
+int digest_print_bucket(const struct shell *shell, size_t bucket);
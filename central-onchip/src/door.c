@@ -0,0 +1,96 @@
+#include "door.h"
+#include "retained.h"
+#include "cycles.h"
+#include <device.h>
+#include <drivers/gpio.h>
+#include <logging/log.h>
+#include <string.h>
+
+LOG_MODULE_REGISTER(door);
+
+#define DOOR_ACTIVE (IS_ENABLED(CONFIG_CENTRAL_DOOR_ACTIVE_LOW) ? 0 : 1)
+#define DOOR_MAGIC 0x524f4431 // "DOR1"
+#define DOOR_LOCKOUT_MS MAX(CONFIG_CENTRAL_DOOR_LOCKOUT_MS, CONFIG_CENTRAL_DOOR_PULSE_MS)
+
+static struct device *door_dev = NULL;
+static struct k_delayed_work pulse_timer;
+static bool pulse_active = false;
+
+/*
+ * Lives in RAM that is not cleared on boot, the watchdog resets the central after sessions and must not
+ * end the lockout early. The lockout is a time of the retained clock, it continues across the reset.
+ */
+static struct {
+    u32_t magic;
+    s64_t lockout_until;
+    u32_t pulses;
+    u32_t lockouts;
+} persist __noinit;
+
+static u32_t last_latency_ns = 0;
+static u32_t max_latency_ns = 0;
+
+// pulse timer callback function, ends the pulse
+static void pulse_end(struct k_work *work) {
+    ARG_UNUSED(work);
+    gpio_pin_write(door_dev, CONFIG_CENTRAL_DOOR_GPIO_PIN, !DOOR_ACTIVE);
+    pulse_active = false;
+    LOG_INF("door output released");
+}
+
+int door_init(void) {
+    if (!retained_restored() || persist.magic != DOOR_MAGIC ||
+        persist.lockout_until > retained_now() + DOOR_LOCKOUT_MS) {
+        (void) memset(&persist, 0, sizeof(persist));
+        persist.magic = DOOR_MAGIC;
+    }
+    k_delayed_work_init(&pulse_timer, pulse_end);
+    door_dev = device_get_binding(CONFIG_CENTRAL_DOOR_GPIO_PORT);
+    if (!door_dev) {
+        LOG_ERR("Cannot get door GPIO device");
+        return -ENODEV;
+    }
+    // set the inactive level before enabling the output to avoid a glitch
+    gpio_pin_write(door_dev, CONFIG_CENTRAL_DOOR_GPIO_PIN, !DOOR_ACTIVE);
+    gpio_pin_configure(door_dev, CONFIG_CENTRAL_DOOR_GPIO_PIN, GPIO_DIR_OUT);
+    gpio_pin_write(door_dev, CONFIG_CENTRAL_DOOR_GPIO_PIN, !DOOR_ACTIVE);
+    return 0;
+}
+
+int door_open(u32_t validated_cycles) {
+    if (!door_dev) {
+        return -ENODEV;
+    }
+    s64_t now = retained_now();
+    if (now < persist.lockout_until) {
+        persist.lockouts++;
+        LOG_INF("door locked out for %u ms", (u32_t) (persist.lockout_until - now));
+        return -EBUSY;
+    }
+    gpio_pin_write(door_dev, CONFIG_CENTRAL_DOOR_GPIO_PIN, DOOR_ACTIVE);
+    u32_t latency_ns = (u32_t) cycles_to_ns(cycles_get() - validated_cycles);
+
+    pulse_active = true;
+    persist.lockout_until = now + DOOR_LOCKOUT_MS;
+    k_delayed_work_submit(&pulse_timer, K_MSEC(CONFIG_CENTRAL_DOOR_PULSE_MS));
+
+    persist.pulses++;
+    last_latency_ns = latency_ns;
+    if (latency_ns > max_latency_ns) {
+        max_latency_ns = latency_ns;
+    }
+    LOG_INF("door opened: %u us after validation start", latency_ns / 1000U);
+    return 0;
+}
+
+bool door_active(void) {
+    return pulse_active;
+}
+
+void door_print(const struct shell *shell) {
+    shell_print(shell, "door output %s %u (%s), pulse %u ms, lockout %u ms",
+                CONFIG_CENTRAL_DOOR_GPIO_PORT, CONFIG_CENTRAL_DOOR_GPIO_PIN,
+                pulse_active ? "active" : "inactive", CONFIG_CENTRAL_DOOR_PULSE_MS, CONFIG_CENTRAL_DOOR_LOCKOUT_MS);
+    shell_print(shell, "pulses %u, lockouts %u, latency last %u us, max %u us",
+                persist.pulses, persist.lockouts, last_latency_ns / 1000U, max_latency_ns / 1000U);
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <zephyr.h>
+#include <shell/shell.h>
+
+/**
+ * Configures the door output (inactive) and restores the lockout window (kept across the watchdog reset).
+ * @return 0 on success, -ENODEV if the GPIO controller is missing
+ */
+int door_init(void);
+
+/**
+ * Pulses the door output for CONFIG_CENTRAL_DOOR_PULSE_MS, unless a pulse started less than
+ * CONFIG_CENTRAL_DOOR_LOCKOUT_MS ago. Called directly from the response validation.
+ * @param validated_cycles cycles_get() when the response was received (start of validation),
+ *                         used to measure the validation-to-actuation latency
+ * @return 0 when the door output was pulsed, -EBUSY during the lockout window, -ENODEV without GPIO
+ */
+int door_open(u32_t validated_cycles);
+
+/**
+ * @return true while the door output is active (the central must not be reset)
+ */
+bool door_active(void);
+
+/**
+ * Prints the number of pulses and lockouts and the validation-to-actuation latency.
+ * @param shell shell to be used for printing.
+ */
+void door_print(const struct shell *shell);
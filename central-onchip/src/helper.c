@@ -7,15 +7,35 @@
 #include <storage/flash_map.h>
 #include <keys.h> //use of internal keys API for bt_keys etc.
 #include <settings.h> //use of internal bt settings API
+#include <hci_core.h> //use of internal hci API for bt_dev
 // stdlib includes
 #include <stdlib.h>
 #include <ctype.h>
 // own includes
 #include "spaceauth.h"
+#include "digest.h"
+#include "deadline.h"
+#include "candidates.h"
+#include "scheduler.h"
+#include "trace.h"
+#include "worker.h"
+#ifdef CONFIG_CENTRAL_DOOR
+#include "door.h"
+#endif
+#ifdef CONFIG_CENTRAL_KEYSTORE
+#include "keystore.h"
+#endif
+#ifdef CONFIG_CENTRAL_ACCESS_LOG
+#include "accesslog.h"
+#endif
+#ifdef CONFIG_CENTRAL_PROXIMITY
+#include "proximity.h"
+#endif
 
 LOG_MODULE_REGISTER(helper);
 
 static bool ble_stack_running = false;
+static bool settings_loaded = false;
 
 int parse_addr(const char *addr, bt_addr_le_t *result) {
     if (strlen(addr) != 17) {
@@ -75,6 +95,8 @@ static int cmd_settings_load(const struct shell *shell, size_t argc, char **argv
         return -1;
     }
     settings_load();
+    settings_loaded = true;
+    digest_invalidate(NULL);
     shell_info(shell, "done");
     return 0;
 }
@@ -139,7 +161,12 @@ static int cmd_coin_add(const struct shell *shell, size_t argc, char **argv) {
     };
     uint8_t spacekey[32] = {0};
 
+#ifdef CONFIG_CENTRAL_DERIVED_KEYS
+    // without a spacekey, the coin uses the key derived from the master key
+    if (argc != 4 && argc != 5) {
+#else
     if (argc != 5) {
+#endif
         shell_error(shell, "incorrect number of arguments");
         return EINVAL;
     }
@@ -165,23 +192,30 @@ static int cmd_coin_add(const struct shell *shell, size_t argc, char **argv) {
         return ret;
     }
     LOG_DBG("valid LTK");
-    // space key
-    ret = parse_hex(argv[4], 32, spacekey);
-    if (ret) {
-        shell_error(shell, "invalid spacekey");
-        return ret;
-    }
-    LOG_DBG("valid space key");
+    if (argc == 5) {
+        // space key
+        ret = parse_hex(argv[4], 32, spacekey);
+        if (ret) {
+            shell_error(shell, "invalid spacekey");
+            return ret;
+        }
+        LOG_DBG("valid space key");
 
-    ret = spacekey_add(&keys.addr, spacekey);
-    if (ret) {
-        shell_error(shell, "spacekey_add failed with %i", ret);
-        return ret;
+        ret = spacekey_add(&keys.addr, spacekey);
+        if (ret) {
+            shell_error(shell, "spacekey_add failed with %i", ret);
+            return ret;
+        }
+    } else {
+        // derived-key mode without spacekey: drop a random spacekey the coin had before
+        (void) spacekey_del(&keys.addr);
     }
     char key[BT_SETTINGS_KEY_MAX];
     bt_settings_encode_key(key, sizeof(key), "keys", &keys.addr, NULL);
     bt_keys_store(&keys);
     settings_load_subtree(key);
+    // IRK or LTK of the coin may have changed, also in derived-key mode without a spacekey
+    digest_invalidate(&keys.addr);
     shell_info(shell, "done");
     return 0;
 }
@@ -206,25 +240,272 @@ static int cmd_coin_del(const struct shell *shell, size_t argc, char **argv) {
     }
     LOG_DBG("valid address");
 
+    digest_invalidate(&addr);
     ret = bt_unpair(BT_ID_DEFAULT, &addr);
     if (ret) {
         shell_error(shell, "could not unpair this address (err %d)", ret);
         //LEAVE OUT 'return ret;' DELIBERATELY
     }
     spacekey_del(&addr);
+#ifdef CONFIG_CENTRAL_DERIVED_KEYS
+    // a coin without bond cannot authenticate, its generation entry is not needed anymore
+    spacegen_set(&addr, 0);
+#endif
     shell_info(shell, "done");
     return 0;
 }
 /* Creating subcommands (level 1 command) array for command "coin". */
 SHELL_STATIC_SUBCMD_SET_CREATE(sub_coin,
+#ifdef CONFIG_CENTRAL_DERIVED_KEYS
+                               SHELL_CMD(add, NULL, "usage: coin add <addr> <irk> <ltk> [spacekey]",
+                                         cmd_coin_add),
+#else
                                SHELL_CMD(add, NULL, "usage: coin add <addr> <irk> <ltk> <spacekey>",
                                          cmd_coin_add),
+#endif
                                SHELL_CMD(del, NULL, "usage: coin del <addr> ", cmd_coin_del),
                                SHELL_SUBCMD_SET_END
 );
 /* Creating root (level 0) command "coin" */
 SHELL_CMD_REGISTER(coin, &sub_coin, "commands to manage coins", NULL);
 
+#ifdef CONFIG_CENTRAL_KEYSTORE
+/**
+ * command to start writing a new key store (erases the current one)
+ */
+static int cmd_keystore_erase(const struct shell *shell, size_t argc, char **argv) {
+    ARG_UNUSED(argc);
+    ARG_UNUSED(argv);
+    if (ble_stack_running) {
+        shell_error(shell, "BLE stack already running!");
+        return -1;
+    }
+    int ret = keystore_erase();
+    if (ret) {
+        shell_error(shell, "keystore_erase failed with %i", ret);
+        return ret;
+    }
+    shell_info(shell, "done");
+    return 0;
+}
+
+/**
+ * command to append a coin to the key store that is being written
+ * coins have to be added in address order
+ */
+static int cmd_keystore_add(const struct shell *shell, size_t argc, char **argv) {
+    if (ble_stack_running) {
+        shell_error(shell, "BLE stack already running!");
+        return -1;
+    }
+    bt_addr_le_t addr;
+    uint8_t irk[16], ltk[16], spacekey[32];
+
+#ifdef CONFIG_CENTRAL_DERIVED_KEYS
+    if (argc != 4 && argc != 5) {
+#else
+    if (argc != 5) {
+#endif
+        shell_error(shell, "incorrect number of arguments");
+        return EINVAL;
+    }
+    int ret = parse_addr(argv[1], &addr);
+    if (ret) {
+        shell_error(shell, "invalid address");
+        return ret;
+    }
+    ret = parse_hex(argv[2], 16, irk);
+    if (ret) {
+        shell_error(shell, "invalid IRK");
+        return ret;
+    }
+    ret = parse_hex(argv[3], 16, ltk);
+    if (ret) {
+        shell_error(shell, "invalid LTK");
+        return ret;
+    }
+#ifdef CONFIG_CENTRAL_DERIVED_KEYS
+    if (argc == 4) {
+        // the record stores the derived key, so the session cache does not need the master key
+        ret = spacekey_get(&addr, spacekey);
+        if (ret) {
+            shell_error(shell, "spacekey_get failed with %i", ret);
+            return ret;
+        }
+    } else {
+        ret = parse_hex(argv[4], 32, spacekey);
+    }
+#else
+    ret = parse_hex(argv[4], 32, spacekey);
+#endif
+    if (ret) {
+        shell_error(shell, "invalid spacekey");
+        return ret;
+    }
+    ret = keystore_add(&addr, irk, ltk, spacekey);
+    (void) memset(spacekey, 0, sizeof(spacekey));
+    (void) memset(ltk, 0, sizeof(ltk));
+    if (ret) {
+        shell_error(shell, "keystore_add failed with %i", ret);
+        return ret;
+    }
+    shell_info(shell, "done");
+    return 0;
+}
+
+/**
+ * command to finish writing the key store
+ */
+static int cmd_keystore_commit(const struct shell *shell, size_t argc, char **argv) {
+    ARG_UNUSED(argc);
+    ARG_UNUSED(argv);
+    if (ble_stack_running) {
+        shell_error(shell, "BLE stack already running!");
+        return -1;
+    }
+    int ret = keystore_commit();
+    if (ret) {
+        shell_error(shell, "keystore_commit failed with %i", ret);
+        return ret;
+    }
+    shell_info(shell, "done");
+    return 0;
+}
+
+/**
+ * command to delete a coin from the key store
+ */
+static int cmd_keystore_del(const struct shell *shell, size_t argc, char **argv) {
+    if (ble_stack_running) {
+        shell_error(shell, "BLE stack already running!");
+        return -1;
+    }
+    bt_addr_le_t addr;
+    if (argc != 2) {
+        shell_error(shell, "incorrect number of arguments");
+        return EINVAL;
+    }
+    int ret = parse_addr(argv[1], &addr);
+    if (ret) {
+        shell_error(shell, "invalid address");
+        return ret;
+    }
+    ret = keystore_del(&addr);
+    if (ret) {
+        shell_error(shell, "coin not in key store");
+        return ret;
+    }
+#ifdef CONFIG_CENTRAL_DERIVED_KEYS
+    spacegen_set(&addr, 0);
+#endif
+    shell_info(shell, "done");
+    return 0;
+}
+/* Creating subcommands (level 1 command) array for command "keystore". */
+SHELL_STATIC_SUBCMD_SET_CREATE(sub_keystore,
+                               SHELL_CMD(erase, NULL, "start writing a new key store", cmd_keystore_erase),
+#ifdef CONFIG_CENTRAL_DERIVED_KEYS
+                               SHELL_CMD(add, NULL, "usage: keystore add <addr> <irk> <ltk> [spacekey]",
+                                         cmd_keystore_add),
+#else
+                               SHELL_CMD(add, NULL, "usage: keystore add <addr> <irk> <ltk> <spacekey>",
+                                         cmd_keystore_add),
+#endif
+                               SHELL_CMD(commit, NULL, "finish writing the key store", cmd_keystore_commit),
+                               SHELL_CMD(del, NULL, "usage: keystore del <addr>", cmd_keystore_del),
+                               SHELL_SUBCMD_SET_END
+);
+/* Creating root (level 0) command "keystore" */
+SHELL_CMD_REGISTER(keystore, &sub_keystore, "commands to manage the flash key store", NULL);
+#endif
+
+#ifdef CONFIG_CENTRAL_DERIVED_KEYS
+/**
+ * command to set the master key that spacekeys are derived from
+ */
+static int cmd_space_master(const struct shell *shell, size_t argc, char **argv) {
+    if (ble_stack_running) {
+        shell_error(shell, "BLE stack already running!");
+        return -1;
+    }
+    uint8_t master[32];
+    if (argc != 2) {
+        shell_error(shell, "incorrect number of arguments");
+        return EINVAL;
+    }
+    int ret = parse_hex(argv[1], 32, master);
+    if (ret) {
+        shell_error(shell, "invalid master key");
+        return ret;
+    }
+    ret = spacemaster_set(master);
+    (void) memset(master, 0, sizeof(master));
+    if (ret) {
+        shell_error(shell, "spacemaster_set failed with %i", ret);
+        return ret;
+    }
+    shell_info(shell, "done");
+    return 0;
+}
+
+// helper function for cmd_space_gen and cmd_space_revoke
+static int space_gen_set(const struct shell *shell, const char *addr_str, u16_t generation) {
+    if (ble_stack_running) {
+        shell_error(shell, "BLE stack already running!");
+        return -1;
+    }
+    bt_addr_le_t addr;
+    int ret = parse_addr(addr_str, &addr);
+    if (ret) {
+        shell_error(shell, "invalid address");
+        return ret;
+    }
+    ret = spacegen_set(&addr, generation);
+    if (ret) {
+        shell_error(shell, "spacegen_set failed with %i", ret);
+        return ret;
+    }
+    shell_info(shell, "done");
+    return 0;
+}
+
+/**
+ * command to set the generation of a coin (after its spacekey was renewed)
+ */
+static int cmd_space_gen(const struct shell *shell, size_t argc, char **argv) {
+    if (argc != 3) {
+        shell_error(shell, "incorrect number of arguments");
+        return EINVAL;
+    }
+    unsigned long generation = strtoul(argv[2], NULL, 10);
+    if (generation >= SPACEGEN_REVOKED) {
+        shell_error(shell, "invalid generation");
+        return EINVAL;
+    }
+    return space_gen_set(shell, argv[1], (u16_t) generation);
+}
+
+/**
+ * command to revoke the derived spacekey of a coin
+ */
+static int cmd_space_revoke(const struct shell *shell, size_t argc, char **argv) {
+    if (argc != 2) {
+        shell_error(shell, "incorrect number of arguments");
+        return EINVAL;
+    }
+    return space_gen_set(shell, argv[1], SPACEGEN_REVOKED);
+}
+/* Creating subcommands (level 1 command) array for command "space". */
+SHELL_STATIC_SUBCMD_SET_CREATE(sub_space,
+                               SHELL_CMD(master, NULL, "usage: space master <key>", cmd_space_master),
+                               SHELL_CMD(gen, NULL, "usage: space gen <addr> <generation>", cmd_space_gen),
+                               SHELL_CMD(revoke, NULL, "usage: space revoke <addr>", cmd_space_revoke),
+                               SHELL_SUBCMD_SET_END
+);
+/* Creating root (level 0) command "space" */
+SHELL_CMD_REGISTER(space, &sub_space, "commands to manage derived spacekeys", NULL);
+#endif
+
 /**
  * command to print all registered spacekeys
  */
@@ -232,6 +513,9 @@ static int cmd_print_spacekeys(const struct shell *shell, size_t argc, char **ar
     ARG_UNUSED(argc);
     ARG_UNUSED(argv);
     spacekeys_print(shell);
+#ifdef CONFIG_CENTRAL_DERIVED_KEYS
+    spacegen_print(shell);
+#endif
     shell_info(shell, "done");
     return 0;
 }
@@ -255,13 +539,281 @@ static int cmd_print_bonds(const struct shell *shell, size_t argc, char **argv)
     return 0;
 }
 
+/**
+ * command to print the digest of the coin table and its buckets
+ * (or the coin digests of one bucket)
+ * loads settings first if neither the BLE stack nor a settings load did that yet
+ */
+static int cmd_print_digest(const struct shell *shell, size_t argc, char **argv) {
+    if (!ble_stack_running && !settings_loaded) {
+        settings_load();
+        settings_loaded = true;
+        digest_invalidate(NULL);
+    }
+    shell_print(shell, "ble: %s", ble_stack_running ? "running" : "stopped");
+    if (bt_dev.id_count) {
+        const bt_addr_le_t *id = &bt_dev.id_addr[BT_ID_DEFAULT];
+        shell_print(shell, "id: %02X:%02X:%02X:%02X:%02X:%02X",
+                    id->a.val[5], id->a.val[4], id->a.val[3], id->a.val[2], id->a.val[1], id->a.val[0]);
+    }
+#ifdef CONFIG_CENTRAL_KEYSTORE
+    shell_print(shell, "keystore: %u", (u32_t) keystore_count());
+#endif
+#ifdef CONFIG_CENTRAL_DERIVED_KEYS
+    // tells the sync tool that this central derives spacekeys
+    uint8_t fingerprint[8];
+    if (spacemaster_fingerprint(fingerprint)) {
+        shell_print(shell, "master: none");
+    } else {
+        shell_print(shell, "master: %02X%02X%02X%02X%02X%02X%02X%02X", fingerprint[0], fingerprint[1],
+                    fingerprint[2], fingerprint[3], fingerprint[4], fingerprint[5], fingerprint[6], fingerprint[7]);
+    }
+#endif
+    if (argc == 2) {
+        int ret = digest_print_bucket(shell, strtoul(argv[1], NULL, 10));
+        if (ret) {
+            shell_error(shell, "invalid bucket");
+            return ret;
+        }
+    } else {
+        digest_print(shell);
+    }
+    shell_info(shell, "done");
+    return 0;
+}
+
+/**
+ * command to print the deadline budget, latency percentiles and timeouts of every session phase
+ */
+static int cmd_print_deadlines(const struct shell *shell, size_t argc, char **argv) {
+    ARG_UNUSED(argc);
+    ARG_UNUSED(argv);
+    deadline_print(shell);
+    shell_info(shell, "done");
+    return 0;
+}
+
+/**
+ * command to print the coins queued for the next connection
+ */
+static int cmd_print_candidates(const struct shell *shell, size_t argc, char **argv) {
+    ARG_UNUSED(argc);
+    ARG_UNUSED(argv);
+    candidates_print(shell);
+    shell_info(shell, "done");
+    return 0;
+}
+
+/**
+ * command to print the session outcome counters and the coins in backoff or quarantine
+ */
+static int cmd_print_sched(const struct shell *shell, size_t argc, char **argv) {
+    ARG_UNUSED(argc);
+    ARG_UNUSED(argv);
+    sched_print(shell);
+    shell_info(shell, "done");
+    return 0;
+}
+
+/**
+ * command to print the size of the session trace
+ */
+static int cmd_print_trace(const struct shell *shell, size_t argc, char **argv) {
+    ARG_UNUSED(argc);
+    ARG_UNUSED(argv);
+    trace_print(shell);
+    shell_info(shell, "done");
+    return 0;
+}
+
+/**
+ * command to print the authentication worker statistics and the run time of the BT response callbacks
+ */
+static int cmd_print_worker(const struct shell *shell, size_t argc, char **argv) {
+    ARG_UNUSED(argc);
+    ARG_UNUSED(argv);
+    worker_print(shell);
+    shell_info(shell, "done");
+    return 0;
+}
+
+#ifdef CONFIG_CENTRAL_PROXIMITY
+/**
+ * command to print the RSSI threshold, gated and admitted advertisements and the tracked coins
+ */
+static int cmd_print_proximity(const struct shell *shell, size_t argc, char **argv) {
+    ARG_UNUSED(argc);
+    ARG_UNUSED(argv);
+    proximity_print(shell);
+    shell_info(shell, "done");
+    return 0;
+}
+#endif
+
+#ifdef CONFIG_CENTRAL_KEYSTORE
+/**
+ * command to print key store size, cache usage and miss latency
+ */
+static int cmd_print_keystore(const struct shell *shell, size_t argc, char **argv) {
+    ARG_UNUSED(argc);
+    ARG_UNUSED(argv);
+    keystore_print(shell);
+    shell_info(shell, "done");
+    return 0;
+}
+#endif
+
+#ifdef CONFIG_CENTRAL_ACCESS_LOG
+/**
+ * command to print access log position, flushes and page wear
+ */
+static int cmd_print_accesslog(const struct shell *shell, size_t argc, char **argv) {
+    ARG_UNUSED(argc);
+    ARG_UNUSED(argv);
+    accesslog_print(shell);
+    shell_info(shell, "done");
+    return 0;
+}
+#endif
+
+#ifdef CONFIG_CENTRAL_DOOR
+/**
+ * command to print door output configuration, pulse counters and actuation latency
+ */
+static int cmd_print_door(const struct shell *shell, size_t argc, char **argv) {
+    ARG_UNUSED(argc);
+    ARG_UNUSED(argv);
+    door_print(shell);
+    shell_info(shell, "done");
+    return 0;
+}
+#endif
+
 SHELL_STATIC_SUBCMD_SET_CREATE(sub_stats,
                                SHELL_CMD(spacekey, NULL, "prints space keys", cmd_print_spacekeys),
                                SHELL_CMD(bonds, NULL, "prints bonds", cmd_print_bonds),
+                               SHELL_CMD_ARG(digest, NULL, "usage: stats digest [bucket]", cmd_print_digest, 1, 1),
+                               SHELL_CMD(deadlines, NULL, "prints session phase deadlines and timeouts",
+                                         cmd_print_deadlines),
+                               SHELL_CMD(candidates, NULL, "prints coins queued for the next connection",
+                                         cmd_print_candidates),
+                               SHELL_CMD(sched, NULL, "prints session outcomes and coins in backoff",
+                                         cmd_print_sched),
+                               SHELL_CMD(trace, NULL, "prints number of recorded session events", cmd_print_trace),
+                               SHELL_CMD(worker, NULL, "prints worker queue and BT callback run times",
+                                         cmd_print_worker),
+#ifdef CONFIG_CENTRAL_PROXIMITY
+                               SHELL_CMD(proximity, NULL, "prints RSSI threshold and gated advertisements",
+                                         cmd_print_proximity),
+#endif
+#ifdef CONFIG_CENTRAL_KEYSTORE
+                               SHELL_CMD(keystore, NULL, "prints key store size, cache usage and miss latency",
+                                         cmd_print_keystore),
+#endif
+#ifdef CONFIG_CENTRAL_ACCESS_LOG
+                               SHELL_CMD(accesslog, NULL, "prints access log position, flushes and page wear",
+                                         cmd_print_accesslog),
+#endif
+#ifdef CONFIG_CENTRAL_DOOR
+                               SHELL_CMD(door, NULL, "prints door output state, pulses and latency", cmd_print_door),
+#endif
                                SHELL_SUBCMD_SET_END
 );
 SHELL_CMD_REGISTER(stats, &sub_stats, "commands to print internal state", NULL);
 
+/**
+ * command to dump the session trace for the host tools
+ */
+static int cmd_trace_dump(const struct shell *shell, size_t argc, char **argv) {
+    ARG_UNUSED(argc);
+    ARG_UNUSED(argv);
+    trace_dump(shell);
+    shell_info(shell, "done");
+    return 0;
+}
+
+/**
+ * command to clear the session trace
+ */
+static int cmd_trace_clear(const struct shell *shell, size_t argc, char **argv) {
+    ARG_UNUSED(argc);
+    ARG_UNUSED(argv);
+    trace_clear();
+    shell_info(shell, "done");
+    return 0;
+}
+/* Creating subcommands (level 1 command) array for command "trace". */
+SHELL_STATIC_SUBCMD_SET_CREATE(sub_trace,
+                               SHELL_CMD(dump, NULL, "dump all recorded session events as hex", cmd_trace_dump),
+                               SHELL_CMD(clear, NULL, "clear the session trace", cmd_trace_clear),
+                               SHELL_SUBCMD_SET_END
+);
+/* Creating root (level 0) command "trace" */
+SHELL_CMD_REGISTER(trace, &sub_trace, "commands to read the session trace", NULL);
+
+#ifdef CONFIG_CENTRAL_ACCESS_LOG
+/**
+ * command to dump the access log records starting at a sequence number for the host tools
+ */
+static int cmd_accesslog_dump(const struct shell *shell, size_t argc, char **argv) {
+    u32_t since = argc > 1 ? strtoul(argv[1], NULL, 10) : 0;
+    accesslog_dump(shell, since);
+    shell_info(shell, "done");
+    return 0;
+}
+
+/**
+ * command to set the clock of the access log to unix time
+ */
+static int cmd_accesslog_clock(const struct shell *shell, size_t argc, char **argv) {
+    ARG_UNUSED(argc);
+    accesslog_set_clock(strtoul(argv[1], NULL, 10));
+    shell_info(shell, "done");
+    return 0;
+}
+
+/**
+ * command to write the records that are still in RAM to flash
+ */
+static int cmd_accesslog_flush(const struct shell *shell, size_t argc, char **argv) {
+    ARG_UNUSED(argc);
+    ARG_UNUSED(argv);
+    int err = accesslog_flush();
+    if (err) {
+        shell_error(shell, "flush failed (err %d)", err);
+        return err;
+    }
+    shell_info(shell, "done");
+    return 0;
+}
+
+/**
+ * command to erase the access log
+ */
+static int cmd_accesslog_erase(const struct shell *shell, size_t argc, char **argv) {
+    ARG_UNUSED(argc);
+    ARG_UNUSED(argv);
+    int err = accesslog_erase();
+    if (err) {
+        shell_error(shell, "erase failed (err %d)", err);
+        return err;
+    }
+    shell_info(shell, "done");
+    return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(sub_accesslog,
+                               SHELL_CMD_ARG(dump, NULL, "usage: accesslog dump [first sequence number]",
+                                             cmd_accesslog_dump, 1, 1),
+                               SHELL_CMD_ARG(clock, NULL, "usage: accesslog clock <unix time>",
+                                             cmd_accesslog_clock, 2, 0),
+                               SHELL_CMD(flush, NULL, "write the records in RAM to flash", cmd_accesslog_flush),
+                               SHELL_CMD(erase, NULL, "erase the access log", cmd_accesslog_erase),
+                               SHELL_SUBCMD_SET_END
+);
+SHELL_CMD_REGISTER(accesslog, &sub_accesslog, "commands to read the access log", NULL);
+#endif
+
 /**
  * command to set addr and IRK of central
  */
@@ -0,0 +1,564 @@
+#include "keystore.h"
+#include <storage/flash_map.h>
+#include <sys/crc.h>
+#include <keys.h> //use of internal keys API for bt_keys etc.
+#include <common/rpa.h> //use of internal rpa API for bt_rpa_irk_matches
+#include <logging/log.h>
+
+#include "spaceauth.h"
+#include "digest.h"
+#include "retained.h"
+
+LOG_MODULE_REGISTER(keystore);
+
+// the image-1 (MCUboot secondary slot) partition is unused, the central is not updated over the air
+#define KEYSTORE_AREA_ID DT_FLASH_AREA_IMAGE_1_ID
+#define KEYSTORE_PAGE_SIZE DT_FLASH_ERASE_BLOCK_SIZE
+#define KEYSTORE_MAGIC 0x3154534b // "KST1"
+#define KEYSTORE_VALID 0x3159454b // "KEY1"
+#define KEYSTORE_DELETED 0x00000000
+// advertisers waiting for the resolution by the worker, the strongest ones are kept
+#define KEYSTORE_REQUESTS 8
+// IRKs checked per worker event, about 128 ah() (AES-128) calls
+#define KEYSTORE_SCAN_RECORDS 128
+// unknown advertisers are remembered in sets of 8 by address while they are seen (the usual RPA rotation period)
+#define UNKNOWN_WAYS 8
+#define UNKNOWN_SETS (CONFIG_CENTRAL_KEYSTORE_UNKNOWN / UNKNOWN_WAYS)
+#define UNKNOWN_AGE_MIN 15
+#define UNKNOWN_EMPTY 0xff // address type of an unused entry
+#define UNKNOWN_MAGIC 0x314b4e55 // "UNK1"
+
+struct keystore_header {
+    u32_t magic;
+    u32_t count;
+    u32_t record_size;
+    u32_t crc; // crc32_ieee over magic..record_size
+} __packed;
+
+#define RECORD_OFFSET(i) (sizeof(struct keystore_header) + (i) * sizeof(struct keystore_coin))
+
+static const struct flash_area *fa = NULL;
+static struct keystore_header header = {0};
+static bool valid = false;
+
+// write state between keystore_erase and keystore_commit
+static bool writing = false;
+static u32_t erased_until = 0;
+static bt_addr_le_t last_added;
+
+// RAM cache: the coins that currently have BLE keys and a spacekey loaded
+static struct {
+    bt_addr_le_t addr;
+    u32_t last_used;
+    bool used;
+} cache[CONFIG_BT_MAX_PAIRED];
+static u32_t use_counter = 0;
+
+// address that did not resolve, 9 bytes
+struct unknown_entry {
+    bt_addr_le_t addr;
+    u16_t minute; // retained clock in minutes (modulo 2^16, 45 days) when it was last seen
+} __packed;
+
+/*
+ * Lives in RAM that is not cleared on boot, the watchdog resets the central after sessions and the devices
+ * nearby would be resolved again after every session. The retained clock continues across the reset.
+ * Entries are added by the worker with the scheduler locked, the BT RX thread only updates the minute of an entry.
+ */
+static struct {
+    u32_t magic;
+    struct unknown_entry sets[UNKNOWN_SETS][UNKNOWN_WAYS];
+} unknowns __noinit;
+
+static struct keystore_request requests[KEYSTORE_REQUESTS];
+static size_t requests_len = 0;
+// the worker has been notified and has not called keystore_next() yet
+static bool requested = false;
+static int (*pending_cb)(void) = NULL;
+
+static u32_t hits = 0, misses = 0, neg_hits = 0, unknown = 0, evictions = 0, dropped = 0;
+static u32_t last_miss_us = 0, max_miss_us = 0;
+
+static u32_t record_crc(const struct keystore_coin *coin) {
+    return crc32_ieee((const u8_t *) &coin->addr, offsetof(struct keystore_coin, crc) -
+                                                  offsetof(struct keystore_coin, addr));
+}
+
+// reads a record, returns true if it is a valid (not deleted) coin
+static bool read_record(size_t i, struct keystore_coin *coin) {
+    if (flash_area_read(fa, RECORD_OFFSET(i), coin, sizeof(*coin))) {
+        return false;
+    }
+    return coin->state == KEYSTORE_VALID && coin->crc == record_crc(coin);
+}
+
+// compare addresses in printed order (most significant byte first)
+static int addr_order(const bt_addr_le_t *a, const bt_addr_le_t *b) {
+    for (int i = 5; i >= 0; --i) {
+        if (a->a.val[i] != b->a.val[i]) {
+            return a->a.val[i] - b->a.val[i];
+        }
+    }
+    return 0;
+}
+
+// binary search by identity address, returns the record index or -ENOENT
+static int find(const bt_addr_le_t *addr, struct keystore_coin *coin) {
+    size_t lo = 0, hi = valid ? header.count : 0;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (flash_area_read(fa, RECORD_OFFSET(mid), coin, sizeof(*coin))) {
+            return -EIO;
+        }
+        int order = addr_order(&coin->addr, addr);
+        if (!order) {
+            return (coin->state == KEYSTORE_VALID && coin->crc == record_crc(coin)) ? (int) mid : -ENOENT;
+        }
+        if (order < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return -ENOENT;
+}
+
+static u16_t clock_min(void) {
+    return (u16_t) (retained_now() / 60000);
+}
+
+static void unknowns_clear(void) {
+    k_sched_lock();
+    (void) memset(&unknowns.sets, UNKNOWN_EMPTY, sizeof(unknowns.sets));
+    k_sched_unlock();
+}
+
+// set of an address, the first bytes of an RPA are its hash
+static struct unknown_entry *unknown_set(const bt_addr_le_t *addr) {
+    u32_t h = addr->type;
+    for (size_t i = 0; i < sizeof(addr->a.val); ++i) {
+        h = h * 31U + addr->a.val[i];
+    }
+    return unknowns.sets[h % UNKNOWN_SETS];
+}
+
+static bool unknown_fresh(const struct unknown_entry *e, u16_t now) {
+    return e->addr.type != UNKNOWN_EMPTY && (u16_t) (now - e->minute) < UNKNOWN_AGE_MIN;
+}
+
+// returns true if the address did not resolve and has been seen recently, it stays while it is seen
+static bool unknown_find(const bt_addr_le_t *addr) {
+    struct unknown_entry *set = unknown_set(addr);
+    u16_t now = clock_min();
+    for (size_t i = 0; i < UNKNOWN_WAYS; ++i) {
+        if (unknown_fresh(&set[i], now) && !bt_addr_le_cmp(&set[i].addr, addr)) {
+            set[i].minute = now;
+            return true;
+        }
+    }
+    return false;
+}
+
+// remember an address that did not resolve, replacing the entry of its set that was not seen for the longest time
+static void unknown_add(const bt_addr_le_t *addr) {
+    k_sched_lock();
+    struct unknown_entry *set = unknown_set(addr);
+    u16_t now = clock_min();
+    struct unknown_entry *victim = &set[0];
+    for (size_t i = 0; i < UNKNOWN_WAYS; ++i) {
+        if (!unknown_fresh(&set[i], now) || !bt_addr_le_cmp(&set[i].addr, addr)) {
+            victim = &set[i];
+            break;
+        }
+        if ((u16_t) (now - set[i].minute) > (u16_t) (now - victim->minute)) {
+            victim = &set[i];
+        }
+    }
+    bt_addr_le_copy(&victim->addr, addr);
+    victim->minute = now;
+    k_sched_unlock();
+}
+
+// remove a coin from the RAM cache: BLE keys (without touching the settings storage) and spacekey
+static void uncache(size_t i) {
+    struct bt_keys *keys = bt_keys_find_addr(BT_ID_DEFAULT, &cache[i].addr);
+    if (keys) {
+        (void) memset(keys, 0, sizeof(*keys));
+    }
+    spacekey_uncache(&cache[i].addr);
+    cache[i].used = false;
+}
+
+// free the cache entry of the least recently used coin that is not connected
+static size_t evict(void) {
+    size_t victim = ARRAY_SIZE(cache);
+    for (size_t i = 0; i < ARRAY_SIZE(cache); ++i) {
+        if (!cache[i].used) {
+            return i;
+        }
+        struct bt_conn *conn = bt_conn_lookup_addr_le(BT_ID_DEFAULT, &cache[i].addr);
+        if (conn) {
+            bt_conn_unref(conn);
+            continue;
+        }
+        if (victim == ARRAY_SIZE(cache) || cache[i].last_used < cache[victim].last_used) {
+            victim = i;
+        }
+    }
+    if (victim < ARRAY_SIZE(cache)) {
+        uncache(victim);
+        evictions++;
+    }
+    return victim;
+}
+
+// mark a cached coin as recently used, returns false if it is not cached
+static bool touch(const bt_addr_le_t *id) {
+    for (size_t i = 0; i < ARRAY_SIZE(cache); ++i) {
+        if (cache[i].used && !bt_addr_le_cmp(&cache[i].addr, id)) {
+            cache[i].last_used = ++use_counter;
+            return true;
+        }
+    }
+    return false;
+}
+
+static int cache_coin(const struct keystore_coin *coin, const bt_addr_t *rpa) {
+    struct bt_keys *keys = bt_keys_find_addr(BT_ID_DEFAULT, &coin->addr);
+    if (!keys) {
+        size_t slot = evict();
+        if (slot == ARRAY_SIZE(cache)) {
+            return -ENOMEM;
+        }
+        keys = bt_keys_get_addr(BT_ID_DEFAULT, &coin->addr);
+        if (!keys) {
+            return -ENOMEM;
+        }
+        if (spacekey_cache(&coin->addr, coin->spacekey)) {
+            (void) memset(keys, 0, sizeof(*keys));
+            return -ENOMEM;
+        }
+        keys->keys = BT_KEYS_IRK | BT_KEYS_LTK_P256;
+        keys->flags = BT_KEYS_AUTHENTICATED | BT_KEYS_SC;
+        keys->enc_size = BT_ENC_KEY_SIZE_MAX;
+        memcpy(keys->irk.val, coin->irk, sizeof(keys->irk.val));
+        memcpy(keys->ltk.val, coin->ltk, sizeof(keys->ltk.val));
+        bt_addr_le_copy(&cache[slot].addr, &coin->addr);
+        cache[slot].used = true;
+    }
+    if (rpa) {
+        bt_addr_copy(&keys->irk.rpa, rpa);
+    }
+    touch(&coin->addr);
+    return 0;
+}
+
+int keystore_init(int (*pending_fn)(void)) {
+    pending_cb = pending_fn;
+    if (!retained_restored() || unknowns.magic != UNKNOWN_MAGIC) {
+        unknowns.magic = UNKNOWN_MAGIC;
+        unknowns_clear();
+    }
+    int err = flash_area_open(KEYSTORE_AREA_ID, &fa);
+    if (err) {
+        LOG_ERR("cannot open key store partition (err %d)", err);
+        return err;
+    }
+    valid = !flash_area_read(fa, 0, &header, sizeof(header)) && header.magic == KEYSTORE_MAGIC &&
+            header.record_size == sizeof(struct keystore_coin) &&
+            header.crc == crc32_ieee((const u8_t *) &header, offsetof(struct keystore_header, crc)) &&
+            header.count <= (fa->fa_size - sizeof(header)) / sizeof(struct keystore_coin);
+    if (!valid) {
+        LOG_WRN("no valid key store");
+        return -ENOENT;
+    }
+    LOG_INF("key store with %u records", header.count);
+    return 0;
+}
+
+// notifies the worker once while requests are queued
+static void notify(void) {
+    if (requested || !requests_len || !pending_cb) {
+        return;
+    }
+    requested = true;
+    if (pending_cb()) {
+        // notified again with the next request
+        requested = false;
+    }
+}
+
+bool keystore_request(const bt_addr_le_t *addr, s8_t rssi) {
+    // non-resolvable private addresses are never coins
+    if (!valid || (addr->type == BT_ADDR_LE_RANDOM && BT_ADDR_IS_NRPA(&addr->a))) {
+        return false;
+    }
+    if (unknown_find(addr)) {
+        neg_hits++;
+        return false;
+    }
+    size_t slot = requests_len;
+    for (size_t i = 0; i < requests_len; ++i) {
+        if (!bt_addr_le_cmp(&requests[i].addr, addr)) {
+            requests[i].rssi = rssi;
+            return true;
+        }
+        if (slot == requests_len || requests[i].rssi < requests[slot].rssi) {
+            slot = i;
+        }
+    }
+    if (requests_len < KEYSTORE_REQUESTS) {
+        slot = requests_len++;
+    } else {
+        // the worker is behind, the weaker advertiser is dropped
+        dropped++;
+        if (rssi <= requests[slot].rssi) {
+            return false;
+        }
+    }
+    requests[slot] = (struct keystore_request) {.rssi = rssi};
+    bt_addr_le_copy(&requests[slot].addr, addr);
+    notify();
+    return true;
+}
+
+// queues a request again to continue its IRK scan, like keystore_request() but from the worker
+static void requeue(const struct keystore_request *req) {
+    // the BT RX thread queues advertisers while scanning
+    k_sched_lock();
+    size_t slot = requests_len;
+    for (size_t i = 0; i < requests_len; ++i) {
+        if (!bt_addr_le_cmp(&requests[i].addr, &req->addr)) {
+            // queued again meanwhile, keep the newer RSSI
+            slot = i;
+            break;
+        }
+        if (slot == requests_len || requests[i].rssi < requests[slot].rssi) {
+            slot = i;
+        }
+    }
+    if (slot < requests_len && !bt_addr_le_cmp(&requests[slot].addr, &req->addr)) {
+        requests[slot].next = req->next;
+        requests[slot].us = req->us;
+    } else if (requests_len < KEYSTORE_REQUESTS) {
+        requests[requests_len++] = *req;
+    } else {
+        dropped++;
+        if (req->rssi > requests[slot].rssi) {
+            requests[slot] = *req;
+        }
+    }
+    notify();
+    k_sched_unlock();
+}
+
+bool keystore_next(struct keystore_request *req) {
+    k_sched_lock();
+    requested = false;
+    bool found = requests_len > 0;
+    if (found) {
+        size_t best = 0;
+        for (size_t i = 1; i < requests_len; ++i) {
+            if (requests[i].rssi > requests[best].rssi) {
+                best = i;
+            }
+        }
+        *req = requests[best];
+        requests[best] = requests[--requests_len];
+        // one advertiser per notification, events of a session that are posted meanwhile are handled before the next
+        notify();
+    }
+    k_sched_unlock();
+    return found;
+}
+
+int keystore_resolve(struct keystore_request *req, bt_addr_le_t *id) {
+    if (!valid) {
+        return -ENOENT;
+    }
+    const bt_addr_le_t *addr = &req->addr;
+    bool rpa = bt_addr_le_is_rpa(addr);
+    u32_t start = k_cycle_get_32();
+    struct keystore_coin coin;
+    int found = -ENOENT;
+    if (rpa) {
+        // only state and IRK are read for the resolution, the rest when the IRK matches
+        size_t end = MIN(header.count, (size_t) req->next + KEYSTORE_SCAN_RECORDS);
+        size_t i;
+        for (i = req->next; i < end; ++i) {
+            if (flash_area_read(fa, RECORD_OFFSET(i), &coin, offsetof(struct keystore_coin, ltk))) {
+                i = header.count;
+                break;
+            }
+            if (coin.state == KEYSTORE_VALID && bt_rpa_irk_matches(coin.irk, &addr->a) &&
+                read_record(i, &coin)) {
+                found = (int) i;
+                break;
+            }
+        }
+        if (found < 0 && i < header.count) {
+            req->next = (u16_t) i;
+            req->us += (u32_t) (SYS_CLOCK_HW_CYCLES_TO_NS(k_cycle_get_32() - start) / 1000U);
+            requeue(req);
+            return -EAGAIN;
+        }
+    } else {
+        found = find(addr, &coin);
+    }
+    u32_t us = req->us + (u32_t) (SYS_CLOCK_HW_CYCLES_TO_NS(k_cycle_get_32() - start) / 1000U);
+    if (found < 0) {
+        unknown++;
+        unknown_add(addr);
+        return -ENOENT;
+    }
+    misses++;
+    last_miss_us = us;
+    max_miss_us = MAX(max_miss_us, us);
+    LOG_INF("resolved [%02X:%02X:%02X:%02X:%02X:%02X] from flash in %u us",
+            coin.addr.a.val[5], coin.addr.a.val[4], coin.addr.a.val[3],
+            coin.addr.a.val[2], coin.addr.a.val[1], coin.addr.a.val[0], us);
+    // the BT RX thread looks up the keys while scanning
+    k_sched_lock();
+    int err = cache_coin(&coin, rpa ? &addr->a : NULL);
+    k_sched_unlock();
+    bt_addr_le_copy(id, &coin.addr);
+    (void) memset(&coin, 0, sizeof(coin));
+    return err;
+}
+
+void keystore_touch(const bt_addr_le_t *id) {
+    if (touch(id)) {
+        hits++;
+    }
+}
+
+void keystore_foreach(void (*func)(const struct keystore_coin *coin, void *data), void *data) {
+    struct keystore_coin coin;
+    for (size_t i = 0; valid && i < header.count; ++i) {
+        if (read_record(i, &coin)) {
+            func(&coin, data);
+        }
+    }
+    (void) memset(&coin, 0, sizeof(coin));
+}
+
+int keystore_erase(void) {
+    if (!fa) {
+        return -ENODEV;
+    }
+    for (size_t i = 0; i < ARRAY_SIZE(cache); ++i) {
+        if (cache[i].used) {
+            uncache(i);
+        }
+    }
+    valid = false;
+    writing = true;
+    header.count = 0;
+    erased_until = 0;
+    unknowns_clear();
+    digest_invalidate(NULL);
+    // the other pages are erased while the records are written
+    int err = flash_area_erase(fa, 0, KEYSTORE_PAGE_SIZE);
+    if (!err) {
+        erased_until = KEYSTORE_PAGE_SIZE;
+    }
+    return err;
+}
+
+int keystore_add(const bt_addr_le_t *addr, const u8_t *irk, const u8_t *ltk, const u8_t *spacekey) {
+    if (!writing) {
+        return -EPERM;
+    }
+    if (header.count && addr_order(&last_added, addr) >= 0) {
+        return -EINVAL;
+    }
+    u32_t end = RECORD_OFFSET(header.count + 1);
+    if (end > fa->fa_size) {
+        return -ENOSPC;
+    }
+    while (erased_until < end) {
+        int err = flash_area_erase(fa, erased_until, KEYSTORE_PAGE_SIZE);
+        if (err) {
+            return err;
+        }
+        erased_until += KEYSTORE_PAGE_SIZE;
+    }
+    struct keystore_coin coin = {.state = KEYSTORE_VALID};
+    bt_addr_le_copy(&coin.addr, addr);
+    coin.reserved = 0xff;
+    memcpy(coin.irk, irk, sizeof(coin.irk));
+    memcpy(coin.ltk, ltk, sizeof(coin.ltk));
+    memcpy(coin.spacekey, spacekey, sizeof(coin.spacekey));
+    coin.crc = record_crc(&coin);
+    int err = flash_area_write(fa, RECORD_OFFSET(header.count), &coin, sizeof(coin));
+    (void) memset(&coin, 0, sizeof(coin));
+    if (err) {
+        return err;
+    }
+    header.count++;
+    bt_addr_le_copy(&last_added, addr);
+    return 0;
+}
+
+int keystore_commit(void) {
+    if (!writing) {
+        return -EPERM;
+    }
+    header.magic = KEYSTORE_MAGIC;
+    header.record_size = sizeof(struct keystore_coin);
+    header.crc = crc32_ieee((const u8_t *) &header, offsetof(struct keystore_header, crc));
+    int err = flash_area_write(fa, 0, &header, sizeof(header));
+    if (err) {
+        return err;
+    }
+    writing = false;
+    valid = true;
+    digest_invalidate(NULL);
+    LOG_INF("key store with %u records written", header.count);
+    return 0;
+}
+
+int keystore_del(const bt_addr_le_t *addr) {
+    struct keystore_coin coin;
+    int i = find(addr, &coin);
+    (void) memset(&coin, 0, sizeof(coin));
+    if (i < 0) {
+        return i;
+    }
+    // clearing bits of a written word does not need an erase
+    const u32_t deleted = KEYSTORE_DELETED;
+    int err = flash_area_write(fa, RECORD_OFFSET(i), &deleted, sizeof(deleted));
+    if (err) {
+        return err;
+    }
+    for (size_t c = 0; c < ARRAY_SIZE(cache); ++c) {
+        if (cache[c].used && !bt_addr_le_cmp(&cache[c].addr, addr)) {
+            uncache(c);
+        }
+    }
+    digest_invalidate(addr);
+    return 0;
+}
+
+size_t keystore_count(void) {
+    return valid ? header.count : 0;
+}
+
+void keystore_print(const struct shell *shell) {
+    size_t cached = 0;
+    for (size_t i = 0; i < ARRAY_SIZE(cache); ++i) {
+        cached += cache[i].used;
+    }
+    shell_print(shell, "records %u (%s), flash %u of %u bytes",
+                (u32_t) keystore_count(), valid ? "valid" : (writing ? "writing" : "invalid"),
+                (u32_t) RECORD_OFFSET(keystore_count()), fa ? (u32_t) fa->fa_size : 0U);
+    shell_print(shell, "cache %u of %u coins, RAM %u bytes (keys %u, spacekeys %u, index %u, unknown advertisers %u)",
+                (u32_t) cached, (u32_t) ARRAY_SIZE(cache),
+                (u32_t) (ARRAY_SIZE(cache) * (sizeof(struct bt_keys) + sizeof(spacekey_t)) + sizeof(cache) +
+                         sizeof(requests) + sizeof(unknowns)),
+                (u32_t) (ARRAY_SIZE(cache) * sizeof(struct bt_keys)), (u32_t) (ARRAY_SIZE(cache) * sizeof(spacekey_t)),
+                (u32_t) (sizeof(cache) + sizeof(requests)), (u32_t) sizeof(unknowns));
+    shell_print(shell, "hits %u, misses %u, unknown %u (%u remembered), evictions %u, dropped requests %u",
+                hits, misses, unknown, neg_hits, evictions, dropped);
+    shell_print(shell, "miss latency last %u us, max %u us", last_miss_us, max_miss_us);
+}
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <zephyr.h>
+#include <bluetooth/bluetooth.h>
+#include <shell/shell.h>
+
+/**
+ * Coin record of the flash key store.
+ * The store is a header followed by the records, sorted by address (printed order, most significant byte first).
+ * Deleted records keep their place, only their state word is cleared.
+ */
+struct keystore_coin {
+    u32_t state;
+    bt_addr_le_t addr;
+    u8_t reserved;
+    u8_t irk[16];
+    u8_t ltk[16];
+    u8_t spacekey[32];
+    u32_t crc; // crc32_ieee over addr..spacekey
+} __packed;
+
+BUILD_ASSERT(sizeof(struct keystore_coin) == 80);
+
+/**
+ * Advertiser that waits for the resolution from the flash key store.
+ */
+struct keystore_request {
+    bt_addr_le_t addr;
+    s8_t rssi;
+    u16_t next; // record the IRK scan continues at
+    u32_t us;   // time of the resolution so far
+};
+
+/**
+ * Opens the key store partition and checks the header, restores the unknown advertisers
+ * (kept across the watchdog reset).
+ * @param pending_fn called (from the BT RX thread) when requests are waiting for keystore_next(),
+ *                   returns 0 if the worker has been notified
+ * @return 0 on success, -ENOENT if there is no valid key store
+ */
+int keystore_init(int (*pending_fn)(void));
+
+/**
+ * Queues an advertiser that is not in the RAM cache for the resolution by the worker.
+ * Called from the BT RX thread for every such advertisement, it does not read flash: addresses that did not
+ * resolve and were seen in the last 15 minutes, and non-resolvable private addresses are not queued.
+ * If the queue is full, the advertiser with the weakest RSSI is dropped.
+ * @param addr advertiser address (RPA or identity address)
+ * @param rssi rssi of the advertisement
+ * @return true if the advertiser is queued (or already was)
+ */
+bool keystore_request(const bt_addr_le_t *addr, s8_t rssi);
+
+/**
+ * Removes the queued advertiser with the strongest RSSI, called by the worker for every notification.
+ * If more advertisers are queued, the worker is notified again.
+ * @param req output request
+ * @return true if an advertiser was queued
+ */
+bool keystore_next(struct keystore_request *req);
+
+/**
+ * Resolves an advertiser from the flash key store and loads its keys into the RAM cache
+ * (BLE bonds and spacekeys), replacing the least recently used coin if the cache is full.
+ * RPAs are resolved against the stored IRKs, at most KEYSTORE_SCAN_RECORDS (128) per call: if there are more,
+ * the request is queued again and the scan continues with a later notification, so the events of a session
+ * do not wait for the whole scan. Identity addresses are looked up by binary search.
+ * Addresses that do not resolve are remembered for keystore_request().
+ * Reads flash, called by the worker.
+ * @param req request from keystore_next()
+ * @param id output identity address of the coin
+ * @return 0 if the coin is in the key store, -ENOENT if not, -EAGAIN if the scan continues later
+ */
+int keystore_resolve(struct keystore_request *req, bt_addr_le_t *id);
+
+/**
+ * Marks a cached coin as recently used.
+ * @param id identity address of the coin
+ */
+void keystore_touch(const bt_addr_le_t *id);
+
+/**
+ * Calls a function for every stored (not deleted) coin, in address order.
+ * @param func function to call
+ * @param data user data passed to func
+ */
+void keystore_foreach(void (*func)(const struct keystore_coin *coin, void *data), void *data);
+
+/**
+ * Starts writing a new key store, the current one is erased.
+ * @return 0 on success, negative error code of the flash driver otherwise
+ */
+int keystore_erase(void);
+
+/**
+ * Appends a coin to the key store that is being written. Coins have to be added in address order.
+ * @param addr identity address of the coin
+ * @param irk identity resolving key (16 bytes)
+ * @param ltk long-term key (16 bytes)
+ * @param spacekey spacekey (32 bytes)
+ * @return 0 on success, -EINVAL if out of order, -ENOSPC if the partition is full, -EPERM without keystore_erase
+ */
+int keystore_add(const bt_addr_le_t *addr, const u8_t *irk, const u8_t *ltk, const u8_t *spacekey);
+
+/**
+ * Finishes writing the key store (writes the header).
+ * @return 0 on success, -EPERM without keystore_erase
+ */
+int keystore_commit(void);
+
+/**
+ * Deletes a coin from the key store (and from the RAM cache).
+ * @param addr identity address of the coin
+ * @return 0 on success, -ENOENT if the coin is not stored
+ */
+int keystore_del(const bt_addr_le_t *addr);
+
+/**
+ * @return number of records in the key store (including deleted ones)
+ */
+size_t keystore_count(void);
+
+/**
+ * Prints size, memory footprint, cache usage, counters and miss latency.
+ * @param shell shell to be used for printing.
+ */
+void keystore_print(const struct shell *shell);
@@ -12,33 +12,35 @@
 #define LED1B_PORT DT_GPIO_LEDS_LED1_BLUE_GPIOS_CONTROLLER
 #define LED1B DT_GPIO_LEDS_LED1_BLUE_GPIOS_PIN
 
+// bindings are looked up once, device_get_binding() searches the device list by name
+static struct device *led0_dev;
+static struct device *led1r_dev;
+static struct device *led1g_dev;
+static struct device *led1b_dev;
+
 void leds_init() {
     // LED0 SETUP
-    struct device *dev = device_get_binding(LED0_PORT);
-    gpio_pin_configure(dev, LED0, GPIO_DIR_OUT);
-    gpio_pin_write(dev, LED0, 1);
+    led0_dev = device_get_binding(LED0_PORT);
+    gpio_pin_configure(led0_dev, LED0, GPIO_DIR_OUT);
+    gpio_pin_write(led0_dev, LED0, 1);
     // LED1 SETUP
-    dev = device_get_binding(LED1R_PORT);
-    gpio_pin_configure(dev, LED1R, GPIO_DIR_OUT);
-    gpio_pin_write(dev, LED1R, 1);
-    dev = device_get_binding(LED1G_PORT);
-    gpio_pin_configure(dev, LED1G, GPIO_DIR_OUT);
-    gpio_pin_write(dev, LED1G, 1);
-    dev = device_get_binding(LED1B_PORT);
-    gpio_pin_configure(dev, LED1B, GPIO_DIR_OUT);
-    gpio_pin_write(dev, LED1B, 1);
+    led1r_dev = device_get_binding(LED1R_PORT);
+    gpio_pin_configure(led1r_dev, LED1R, GPIO_DIR_OUT);
+    gpio_pin_write(led1r_dev, LED1R, 1);
+    led1g_dev = device_get_binding(LED1G_PORT);
+    gpio_pin_configure(led1g_dev, LED1G, GPIO_DIR_OUT);
+    gpio_pin_write(led1g_dev, LED1G, 1);
+    led1b_dev = device_get_binding(LED1B_PORT);
+    gpio_pin_configure(led1b_dev, LED1B, GPIO_DIR_OUT);
+    gpio_pin_write(led1b_dev, LED1B, 1);
 }
 
 void led0_set(uint8_t on) {
-    struct device *dev = device_get_binding(LED0_PORT);
-    gpio_pin_write(dev, LED0, 1 - on);
+    gpio_pin_write(led0_dev, LED0, 1 - on);
 }
 
 void led1_set(uint8_t r_on, uint8_t b_on, uint8_t g_on) {
-    struct device *dev = device_get_binding(LED1R_PORT);
-    gpio_pin_write(dev, LED1R, 1 - r_on);
-    dev = device_get_binding(LED1G_PORT);
-    gpio_pin_write(dev, LED1G, 1 - b_on);
-    dev = device_get_binding(LED1B_PORT);
-    gpio_pin_write(dev, LED1B, 1 - g_on);
+    gpio_pin_write(led1r_dev, LED1R, 1 - r_on);
+    gpio_pin_write(led1g_dev, LED1G, 1 - b_on);
+    gpio_pin_write(led1b_dev, LED1B, 1 - g_on);
 }
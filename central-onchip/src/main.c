@@ -7,11 +7,30 @@
 #include <shell/shell.h>
 #include <drivers/watchdog.h>
 #include <zephyr.h>
-#include <hci_core.h> //use of internal hci API for 'bt_addr_le_is_bonded(id, addr)'
 // own includes
 #include "spaceauth.h"
 #include "helper.h"
 #include "leds.h"
+#include "deadline.h"
+#include "candidates.h"
+#include "scheduler.h"
+#include "trace.h"
+#include "scan.h"
+#include "worker.h"
+#include "retained.h"
+#include "cycles.h"
+#ifdef CONFIG_CENTRAL_DOOR
+#include "door.h"
+#endif
+#ifdef CONFIG_CENTRAL_KEYSTORE
+#include "keystore.h"
+#endif
+#ifdef CONFIG_CENTRAL_ACCESS_LOG
+#include "accesslog.h"
+#endif
+#ifdef CONFIG_CENTRAL_PROXIMITY
+#include "proximity.h"
+#endif
 
 LOG_MODULE_REGISTER(app);
 
@@ -81,12 +100,10 @@ static struct bt_conn_cb conn_callbacks = {
         .security_changed = security_changed_cb,
 };
 
-static struct k_delayed_work timeout_timer = {{0}};
-
-// timeout function to kill connections that take too long
-static void timeout(struct k_work *work) {
-    ARG_UNUSED(work);
-    LOG_ERR("TIMEOUT REACHED");
+// deadline function to kill connections that take too long in one phase
+static void timeout(deadline_phase_t phase) {
+    LOG_ERR("TIMEOUT REACHED (%s)", deadline_phase_name(phase));
+    trace_record(TRACE_TIMEOUT, phase, 0, NULL);
     if (default_conn) {
         bt_conn_disconnect(default_conn, BT_HCI_ERR_REMOTE_USER_TERM_CONN);
     }
@@ -106,30 +123,96 @@ static struct k_timer watchdog_timer;
 
 static void watchdog_timer_expiry_function(struct k_timer *timer_id) {
     ARG_UNUSED(timer_id);
-    if (!i_want_to_die) {
+    bool feed = !i_want_to_die;
+#ifdef CONFIG_CENTRAL_DOOR
+    // a reset would end the door pulse early
+    feed = feed || door_active();
+#endif
+    if (feed) {
         wdt_feed(wdt, wdt_channel_id);
     }
 }
 
-// helper function for advertisement data parser
-const static size_t BT_ADV_BLVL_IDX = 2;
+#define BT_LE_CONN_PARAM_LOW_TIMEOUT BT_LE_CONN_PARAM(BT_GAP_INIT_CONN_INT_MIN, \
+                          BT_GAP_INIT_CONN_INT_MAX, \
+                          0, 100)
+
+// scanning during a connection: without duplicate filter, so queued candidates are kept fresh
+#define BT_LE_SCAN_BACKGROUND BT_LE_SCAN_PARAM(BT_HCI_LE_SCAN_PASSIVE, \
+                          BT_HCI_LE_SCAN_FILTER_DUP_DISABLE, \
+                          BT_GAP_SCAN_FAST_INTERVAL, \
+                          BT_GAP_SCAN_FAST_WINDOW)
+
+#ifdef CONFIG_CENTRAL_PROXIMITY
+// the RSSI of a coin is smoothed over several advertisements, the duplicate filter only reports the first one
+#define BT_LE_SCAN_IDLE BT_LE_SCAN_BACKGROUND
+#else
+#define BT_LE_SCAN_IDLE BT_LE_SCAN_PASSIVE
+#endif
+
+// uptime when the coin of the current connection was seen first
+static s64_t conn_first_seen = 0;
+// rssi and battery level of the advertisement that was connected (battery -1 if unknown)
+static s8_t conn_rssi = 0;
+static s8_t conn_battery = -1;
+// outcome of the current session as far as the BT callbacks know it, advanced with every completed phase
+// (whether the response was valid is only known to the worker)
+static sched_result_t session_result = SCHED_FAIL_CONNECT;
+// result of the response validation of the current session (SCHED_RESULTS if none), only used by the worker
+static sched_result_t validation_result = SCHED_RESULTS;
+// first advertisement to the validation of the response, only used by the worker
+static u16_t validation_latency_ms = 0;
 
-bool ad_parse_func(struct bt_data *data, void *user_data) {
-    int16_t *batt = user_data;
-    if (data->type == BT_DATA_SVC_DATA16) {
-        // check if this is service data for this battery service (uuid = 0x180f, one byte of data)
-        if (data->data_len != 3 || data->data[0] != 0x0f || data->data[1] != 0x18) {
-            return true;
-        }
-        *batt = data->data[BT_ADV_BLVL_IDX];
-        return false; // stop parsing, found what we wanted
+/**
+ * connects to a coin
+ * scanning has to be stopped before (bt_conn_create_le fails while scanning)
+ * @param addr address of the coin
+ * @param first_seen uptime when its first advertisement was received
+ * @param rssi rssi of the advertisement
+ * @param battery battery level from the advertisement, -1 if unknown
+ * @return true if the connection is being established
+ */
+static bool connect_coin(const bt_addr_le_t *addr, s64_t first_seen, s8_t rssi, s8_t battery) {
+    default_conn = bt_conn_create_le(addr, BT_LE_CONN_PARAM_LOW_TIMEOUT);
+    if (!default_conn) {
+        LOG_ERR("Couldn't connect to [%02X:%02X:%02X:%02X:%02X:%02X]",
+                addr->a.val[5], addr->a.val[4], addr->a.val[3],
+                addr->a.val[2], addr->a.val[1], addr->a.val[0]);
+        return false;
     }
+    conn_first_seen = first_seen;
+    conn_rssi = rssi;
+    conn_battery = battery;
+    session_result = SCHED_FAIL_CONNECT;
+    LOG_DBG("Now, the connected callback should be called...");
     return true;
 }
 
-#define BT_LE_CONN_PARAM_LOW_TIMEOUT BT_LE_CONN_PARAM(BT_GAP_INIT_CONN_INT_MIN, \
-                          BT_GAP_INIT_CONN_INT_MAX, \
-                          0, 100)
+/**
+ * called when the connection slot is free again
+ * connects to the next queued candidate or continues scanning
+ * @return true if a queued candidate is being connected
+ */
+static bool connect_next(void) {
+    int err = bt_le_scan_stop();
+    if (err && err != -EALREADY) {
+        LOG_ERR("Couldn't stop scanning: %i", err);
+    } else {
+        struct candidate next;
+        while (candidates_pop(&next)) {
+            LOG_INF("Connecting queued candidate (waiting for %u ms)",
+                    (u32_t) (k_uptime_get() - next.first_seen));
+            if (connect_coin(&next.addr, next.first_seen, next.rssi, -1)) {
+                return true;
+            }
+        }
+    }
+    err = bt_le_scan_start(BT_LE_SCAN_IDLE, device_found);
+    if (err) {
+        LOG_ERR("Scanning failed to start (err %d)", err);
+    }
+    return false;
+}
 
 /**
  * command to start up the BLE stack
@@ -171,7 +254,7 @@ static void bt_ready_cb(int err) {
         settings_load();
     }
 
-    err = bt_le_scan_start(BT_LE_SCAN_PASSIVE, device_found);
+    err = bt_le_scan_start(BT_LE_SCAN_IDLE, device_found);
 
     if (err) {
         LOG_ERR("Scanning failed to start (err %d)", err);
@@ -192,49 +275,37 @@ static void bt_ready_cb(int err) {
 static void device_found(const bt_addr_le_t *addr, s8_t rssi, u8_t type,
                          struct net_buf_simple *ad) {
 
-    if (default_conn) {
-        LOG_ERR("Already have a pending connection!");
-        return;
-    }
-    LOG_INF("Device found: [%02X:%02X:%02X:%02X:%02X:%02X] (RSSI %d) (TYPE %u) "
-            "(BONDED %u)",
-            addr->a.val[5], addr->a.val[4], addr->a.val[3],
-            addr->a.val[2], addr->a.val[1], addr->a.val[0],
-            rssi, type, bt_addr_le_is_bonded(BT_ID_DEFAULT, addr));
-
-    /* We're only interested in directed connectable events from bonded devices*/
-    if ((type != BT_LE_ADV_DIRECT_IND && type != BT_LE_ADV_IND) ||
-        !bt_addr_le_is_bonded(BT_ID_DEFAULT, addr)) {
+    bt_addr_le_t coin;
+    s8_t battery;
+    if (scan_filter(addr, rssi, type, ad, default_conn ? bt_conn_get_dst(default_conn) : NULL, &coin, &battery) !=
+        SCAN_CONNECT) {
         return;
     }
-
-    // read battery level from advertising data if available
-    int8_t blvl = -1;
-    bt_data_parse(ad, ad_parse_func, &blvl);
-    if (blvl >= 0) {
-        LOG_INF("Battery Level: %i%%", blvl);
-    }
+    addr = &coin;
 
     LOG_DBG("Connecting to device...");
+    trace_record(TRACE_ADV, (u8_t) rssi, type, addr);
 
+    s64_t now = k_uptime_get();
+#ifdef CONFIG_CENTRAL_PROXIMITY
+    // the latency includes the advertisements that were gated
+    now = proximity_first_seen(addr, now);
+#endif
     int err = bt_le_scan_stop();
     if (err) {
         LOG_ERR("Couldn't stop scanning: %i", err);
-        err = bt_le_scan_start(BT_LE_SCAN_PASSIVE, device_found);
+        err = bt_le_scan_start(BT_LE_SCAN_IDLE, device_found);
         if (err) {
             LOG_ERR("Scanning failed to start (err %d)", err);
         }
         return;
     }
-    default_conn = bt_conn_create_le(addr, BT_LE_CONN_PARAM_LOW_TIMEOUT);
-    if (!default_conn) {
-        LOG_ERR("Couldn't connect: %i", err);
-        err = bt_le_scan_start(BT_LE_SCAN_PASSIVE, device_found);
+    if (!connect_coin(addr, now, rssi, battery)) {
+        err = bt_le_scan_start(BT_LE_SCAN_IDLE, device_found);
         if (err) {
             LOG_ERR("Scanning failed to start (err %d)", err);
         }
     }
-    LOG_DBG("Now, the connected callback should be called...");
 }
 
 // conn callbacks definition
@@ -248,6 +319,8 @@ static void device_found(const bt_addr_le_t *addr, s8_t rssi, u8_t type,
 static void connected_cb(struct bt_conn *conn, u8_t err) {
     security_established = false;
     const bt_addr_le_t *addr = bt_conn_get_dst(conn);
+    u32_t waited = (u32_t) (k_uptime_get() - conn_first_seen);
+    trace_record(TRACE_CONNECT, err, (u16_t) MIN(waited, UINT16_MAX), addr);
 
     if (err) {
         LOG_ERR("Failed to connect to [%02X:%02X:%02X:%02X:%02X:%02X] (%u)",
@@ -260,25 +333,42 @@ static void connected_cb(struct bt_conn *conn, u8_t err) {
         }
         default_conn = NULL;
 
-        int error = bt_le_scan_start(BT_LE_SCAN_PASSIVE, device_found);
-        if (error) {
-            LOG_ERR("Scanning failed to start (err %d)", error);
-        }
+        // reported by the worker, in order with the sessions before
+        struct worker_event event = {.type = WORKER_DISCONNECTED, .result = SCHED_FAIL_CONNECT, .reason = 0};
+        bt_addr_le_copy(&event.addr, addr);
+        event.rssi = conn_rssi;
+        event.battery = conn_battery;
+        event.latency_ms = (u16_t) MIN(waited, UINT16_MAX);
+        (void) worker_post(&event);
+        connect_next();
         return;
     }
     if (conn != default_conn) {
         LOG_ERR("New unhandled connection!");
         return;
     }
-    led0_set(0);
-    led1_set(1, 0, 0);
+    struct worker_event event = {.type = WORKER_CONNECTED};
+    bt_addr_le_copy(&event.addr, addr);
+    (void) worker_post(&event);
 
-    // set up timeout
-    k_delayed_work_submit(&timeout_timer, K_SECONDS(5));
+    // set up deadline of the first phase
+    deadline_enter(DEADLINE_ENCRYPT);
+    session_result = SCHED_FAIL_SECURITY;
 
-    LOG_INF("Connected: [%02X:%02X:%02X:%02X:%02X:%02X]",
+    LOG_INF("Connected: [%02X:%02X:%02X:%02X:%02X:%02X] (%u ms after first advertisement)",
             addr->a.val[5], addr->a.val[4], addr->a.val[3],
-            addr->a.val[2], addr->a.val[1], addr->a.val[0]);
+            addr->a.val[2], addr->a.val[1], addr->a.val[0], waited);
+
+#ifdef CONFIG_CENTRAL_KEYSTORE
+    keystore_touch(addr);
+#endif
+
+    // keep scanning during the session to queue the next coins
+    candidates_remove(addr);
+    int scan_err = bt_le_scan_start(BT_LE_SCAN_BACKGROUND, device_found);
+    if (scan_err) {
+        LOG_ERR("Background scanning failed to start (err %d)", scan_err);
+    }
 
     int ret = bt_conn_set_security(conn, BT_SECURITY_L4);
     if (ret) {
@@ -298,8 +388,12 @@ static void security_changed_cb(struct bt_conn *conn, bt_security_t level,
                                 enum bt_security_err err) {
     if (!security_established && conn == default_conn) {
         LOG_DBG("Security changed: level %u", level);
+        u8_t key_size = bt_conn_enc_key_size(conn);
+        trace_record_data(TRACE_SECURITY, level, err, &key_size, sizeof(key_size));
         if (err == 0 && level == 4 && bt_conn_enc_key_size(conn) == 16) {
             security_established = true;
+            deadline_enter(DEADLINE_DISCOVER);
+            session_result = SCHED_FAIL_DISCOVERY;
             LOG_DBG("Starting Discovery...");
             memcpy(&uuid_128, UUID_AUTH_SERVICE, sizeof(uuid_128));
             discover_params.uuid = &uuid_128.uuid;
@@ -318,6 +412,20 @@ static void security_changed_cb(struct bt_conn *conn, bt_security_t level,
 }
 
 
+// step of the GATT discovery for the trace, derived from the searched UUID
+static u8_t discover_step(const struct bt_gatt_discover_params *params) {
+    if (!params->uuid) {
+        return TRACE_DISCOVER_CCC;
+    } else if (!bt_uuid_cmp(params->uuid, UUID_AUTH_SERVICE)) {
+        return TRACE_DISCOVER_SERVICE;
+    } else if (!bt_uuid_cmp(params->uuid, UUID_AUTH_CHALLENGE)) {
+        return TRACE_DISCOVER_CHALLENGE;
+    } else if (!bt_uuid_cmp(params->uuid, UUID_AUTH_RESPONSE)) {
+        return TRACE_DISCOVER_RESPONSE;
+    }
+    return TRACE_DISCOVER_CCC;
+}
+
 /**
  * gets called multiple times during GATT discovery when new handles are found etc.
  * @param conn current connection
@@ -330,8 +438,12 @@ static u8_t discover_func(struct bt_conn *conn,
                           struct bt_gatt_discover_params *params) {
     int err;
 
-    if (attr) {
+    if (!attr) {
+        // discovery ended without finding the attribute
+        trace_record(TRACE_DISCOVER, discover_step(params), 0, NULL);
+    } else {
         LOG_DBG("[ATTRIBUTE] handle %u", attr->handle);
+        trace_record(TRACE_DISCOVER, discover_step(params), attr->handle, NULL);
 
         if (!bt_uuid_cmp(params->uuid, UUID_AUTH_SERVICE)) {
             LOG_DBG("found auth service handle %u", attr->handle);
@@ -382,6 +494,7 @@ static u8_t discover_func(struct bt_conn *conn,
             subscribe_params.notify = notify_func;
 
             err = bt_gatt_subscribe(default_conn, &subscribe_params);
+            trace_record(TRACE_SUBSCRIBE, (u8_t) -err, 0, NULL);
             if (err && err != -EALREADY) {
                 LOG_ERR("Subscribe failed (err %d)", err);
                 bt_conn_disconnect(default_conn, BT_HCI_ERR_REMOTE_USER_TERM_CONN);
@@ -399,6 +512,7 @@ static u8_t discover_func(struct bt_conn *conn,
                 return BT_GATT_ITER_STOP;
             }
             LOG_DBG("Writing challenge");
+            deadline_enter(DEADLINE_CHALLENGE);
             write_params.func = write_completed_func;
             write_params.handle = auth_challenge_chr_value_handle;
             write_params.length = 64;
@@ -426,24 +540,31 @@ static void write_completed_func(struct bt_conn *conn, u8_t err,
     ARG_UNUSED(conn);
     ARG_UNUSED(params);
     LOG_DBG("Write complete: err %u", err);
+    trace_record(TRACE_WRITE, err, 0, NULL);
+    if (!err) {
+        deadline_enter(DEADLINE_RESPONSE);
+        session_result = SCHED_FAIL_VALIDATION;
+    }
     (void) memset(&write_params, 0, sizeof(write_params));
 }
 
 /**
- * check if current response is valid
- * critical section!
- * cleans up and disconnects afterwards.
+ * hands the complete response over to the worker for validation
+ * the BT RX thread does not hash, the worker disconnects after the validation.
  * @param conn current connection
  */
 static void check_response(struct bt_conn *conn) {
-    if (spaceauth_validate(bt_conn_get_dst(conn), challenge, response) == 0) {
-        LOG_INF("KEY AUTHENTICATED. OPEN DOOR PLEASE.");
-        led0_set(1);
-        led1_set(1, 1, 1);
-    }
+    deadline_done();
+    struct worker_event event = {.type = WORKER_RESPONSE};
+    bt_addr_le_copy(&event.addr, bt_conn_get_dst(conn));
+    event.latency_ms = (u16_t) MIN((u32_t) (k_uptime_get() - conn_first_seen), UINT16_MAX);
+    memcpy(event.challenge, challenge, sizeof(challenge));
+    memcpy(event.response, response, sizeof(response));
     (void) memset(challenge, 0, sizeof(challenge));
     (void) memset(response, 0, sizeof(response));
-    bt_conn_disconnect(default_conn, BT_HCI_ERR_REMOTE_USER_TERM_CONN);
+    if (worker_post(&event)) {
+        bt_conn_disconnect(conn, BT_HCI_ERR_REMOTE_USER_TERM_CONN);
+    }
 }
 
 /**
@@ -455,10 +576,9 @@ static void check_response(struct bt_conn *conn) {
  * @param length
  * @return
  */
-static u8_t notify_func(struct bt_conn *conn,
-                        struct bt_gatt_subscribe_params *params,
-                        const void *data, u16_t length) {
-    ARG_UNUSED(conn);
+static u8_t handle_notify(struct bt_conn *conn,
+                          struct bt_gatt_subscribe_params *params,
+                          const void *data, u16_t length) {
     if (!data) {
         LOG_DBG("[UNSUBSCRIBED]");
         params->value_handle = 0U;
@@ -466,7 +586,7 @@ static u8_t notify_func(struct bt_conn *conn,
     }
 
     LOG_DBG("[NOTIFICATION] data %p length %u", data, length);
-    LOG_HEXDUMP_DBG(data, length, "Received data");
+    trace_record(TRACE_NOTIFY, 0, length, NULL);
     if (length <= sizeof(response)) {
         LOG_INF("Coin notified that response is ready.");
         memcpy(response, data, length);
@@ -499,12 +619,14 @@ static u8_t notify_func(struct bt_conn *conn,
  * @param length length of data
  * @return BT_GATT_ITER_STOP when finished reading, else BT_GATT_ITER_CONTINUE
  */
-static u8_t read_completed_func(struct bt_conn *conn, u8_t err,
-                                struct bt_gatt_read_params *params,
-                                const void *data, u16_t length) {
+static u8_t handle_read(struct bt_conn *conn, u8_t err,
+                        struct bt_gatt_read_params *params,
+                        const void *data, u16_t length) {
+    if (data || err) {
+        trace_record(TRACE_READ, err, params->single.offset + (data ? length : 0), NULL);
+    }
     if (data) {
         LOG_DBG("Read complete: err %u length %u offset %u", err, length, params->single.offset);
-        LOG_HEXDUMP_DBG(data, length, "Received data");
         if (params->single.handle == auth_response_chr_value_handle) {
             if (params->single.offset + length <= sizeof(response)) {
                 memcpy(response + params->single.offset, data, length);
@@ -523,6 +645,25 @@ static u8_t read_completed_func(struct bt_conn *conn, u8_t err,
     return BT_GATT_ITER_CONTINUE;
 }
 
+// response callbacks with their run time in the BT RX thread
+static u8_t notify_func(struct bt_conn *conn,
+                        struct bt_gatt_subscribe_params *params,
+                        const void *data, u16_t length) {
+    u32_t start = cycles_get();
+    u8_t ret = handle_notify(conn, params, data, length);
+    worker_rx_time(WORKER_RX_NOTIFY, start);
+    return ret;
+}
+
+static u8_t read_completed_func(struct bt_conn *conn, u8_t err,
+                                struct bt_gatt_read_params *params,
+                                const void *data, u16_t length) {
+    u32_t start = cycles_get();
+    u8_t ret = handle_read(conn, err, params, data, length);
+    worker_rx_time(WORKER_RX_READ, start);
+    return ret;
+}
+
 /**
  * gets called when an existing connection ended
  * does cleanup and continue scanning
@@ -530,24 +671,30 @@ static u8_t read_completed_func(struct bt_conn *conn, u8_t err,
  * @param reason reason to kill connection
  */
 static void disconnected_cb(struct bt_conn *conn, u8_t reason) {
-    led0_set(0);
-    led1_set(0, 0, 0);
-
-    i_want_to_die = true;
-
     const bt_addr_le_t *addr = bt_conn_get_dst(conn);
+    struct worker_event event = {.type = WORKER_DISCONNECTED, .result = WORKER_NO_SESSION, .reason = reason};
+    bt_addr_le_copy(&event.addr, addr);
 
-    int err;
     if (conn != default_conn) {
+        (void) worker_post(&event);
         LOG_ERR("Disconnected from unknown connection");
+        i_want_to_die = true;
         return;
     }
+    // the worker decides the outcome (it validated the response) and reports the session after the validation
+    u32_t session_ms = (u32_t) (k_uptime_get() - conn_first_seen);
+    event.result = session_result;
+    event.rssi = conn_rssi;
+    event.battery = conn_battery;
+    event.latency_ms = (u16_t) MIN(session_ms, UINT16_MAX);
+    (void) worker_post(&event);
+
     LOG_INF("Disconnected: [%02X:%02X:%02X:%02X:%02X:%02X] (reason %u)",
             addr->a.val[5], addr->a.val[4], addr->a.val[3],
             addr->a.val[2], addr->a.val[1], addr->a.val[0],
             reason);
 
-    k_delayed_work_cancel(&timeout_timer);
+    deadline_cancel();
 
     if (default_conn) {
         bt_conn_unref(default_conn);
@@ -555,16 +702,173 @@ static void disconnected_cb(struct bt_conn *conn, u8_t reason) {
 
     default_conn = NULL;
 
-    err = bt_le_scan_start(BT_LE_SCAN_PASSIVE, device_found);
-    if (err) {
-        LOG_ERR("Scanning failed to start (err %d)", err);
+    // the watchdog resets the central after the last queued session
+    if (!connect_next()) {
+        i_want_to_die = true;
+    }
+}
+
+/**
+ * validates a response, called by the worker
+ * opens the door and disconnects the coin afterwards.
+ * @param event response event with the challenge and the response
+ */
+static void validate_response(struct worker_event *event) {
+    LOG_HEXDUMP_DBG(event->response, sizeof(event->response), "Received data");
+    u32_t validation_start = cycles_get();
+    bool valid = spaceauth_validate(&event->addr, event->challenge, event->response) == 0;
+    u32_t validation_us = (u32_t) (cycles_to_ns(cycles_get() - validation_start) / 1000U);
+    trace_record(TRACE_VALIDATE, valid, (u16_t) MIN(validation_us, UINT16_MAX), NULL);
+    // also when the coin disconnected meanwhile: its WORKER_DISCONNECTED event is handled after this one
+    validation_result = valid ? SCHED_OK : SCHED_FAIL_VALIDATION;
+    u32_t handled_ms = (u32_t) (cycles_to_ns(cycles_get() - event->posted) / 1000000U);
+    validation_latency_ms = (u16_t) MIN(event->latency_ms + handled_ms, UINT16_MAX);
+    if (valid) {
+#ifdef CONFIG_CENTRAL_DOOR
+        door_open(validation_start);
+#else
+        ARG_UNUSED(validation_start);
+#endif
+        LOG_INF("KEY AUTHENTICATED. OPEN DOOR PLEASE.");
+        led0_set(1);
+        led1_set(1, 1, 1);
+    }
+    struct bt_conn *conn = bt_conn_lookup_addr_le(BT_ID_DEFAULT, &event->addr);
+    if (conn) {
+        bt_conn_disconnect(conn, BT_HCI_ERR_REMOTE_USER_TERM_CONN);
+        bt_conn_unref(conn);
+    }
+}
+
+#ifdef CONFIG_CENTRAL_KEYSTORE
+// connects coins that were resolved by the worker, from the system workqueue (cooperative like the BT RX thread)
+static struct k_work resolved_work;
+
+static void connect_resolved(struct k_work *work) {
+    ARG_UNUSED(work);
+    if (!default_conn) {
+        connect_next();
+    }
+}
+
+// called by keystore_request() in the BT RX thread
+static int resolve_pending(void) {
+    struct worker_event event = {.type = WORKER_RESOLVE};
+    return worker_post(&event);
+}
+
+/**
+ * resolves the next queued advertiser from the flash key store, called by the worker
+ * a resolved coin is queued as candidate: the scan reports its address only once (duplicate filter).
+ * With CONFIG_CENTRAL_PROXIMITY, the scan reports every advertisement and the host resolves the next ones
+ * with the cached IRK, the proximity gate decides as for any bonded coin.
+ */
+static void resolve_next(void) {
+    struct keystore_request req;
+    bt_addr_le_t id;
+    if (!keystore_next(&req) || keystore_resolve(&req, &id)) {
+        return;
+    }
+#ifndef CONFIG_CENTRAL_PROXIMITY
+    // the BT RX thread uses the candidate queue while scanning
+    k_sched_lock();
+    candidates_push(&id, req.rssi);
+    k_sched_unlock();
+    k_work_submit(&resolved_work);
+#endif
+}
+#endif
+
+/**
+ * reports the outcome of a session to the scheduler, the proximity gate, the trace and the access log
+ * called by the worker, after the validation of the response of the session (events are handled in order).
+ * @param event WORKER_DISCONNECTED event of the session
+ */
+static void report_session(struct worker_event *event) {
+    sched_result_t result = event->result;
+    u16_t latency_ms = event->latency_ms;
+    if (validation_result != SCHED_RESULTS) {
+        result = validation_result;
+        if (result == SCHED_OK) {
+            latency_ms = validation_latency_ms;
+        }
+    }
+    validation_result = SCHED_RESULTS;
+
+    // the BT RX thread reads the scheduler and the proximity gate while scanning
+    k_sched_lock();
+    sched_report(&event->addr, result);
+#ifdef CONFIG_CENTRAL_PROXIMITY
+    if (event->reason) {
+        proximity_report(&event->addr, result);
+    }
+#endif
+    k_sched_unlock();
+    if (event->reason) {
+        trace_record(TRACE_DISCONNECT, event->reason, result, &event->addr);
+    }
+#ifdef CONFIG_CENTRAL_ACCESS_LOG
+    accesslog_append(&event->addr, result, event->rssi, event->battery, latency_ms);
+#else
+    ARG_UNUSED(latency_ms);
+#endif
+}
+
+/**
+ * handles the events of the BT callbacks, in the worker thread (CONFIG_CENTRAL_AUTH_WORKER)
+ * hashing, LEDs and the door output are kept out of the BT RX thread.
+ * @param event event posted by a BT callback
+ */
+static void handle_event(struct worker_event *event) {
+    switch (event->type) {
+        case WORKER_CONNECTED:
+            validation_result = SCHED_RESULTS;
+            led0_set(0);
+            led1_set(1, 0, 0);
+            break;
+        case WORKER_RESPONSE:
+            validate_response(event);
+            break;
+        case WORKER_DISCONNECTED:
+            led0_set(0);
+            led1_set(0, 0, 0);
+            if (event->result != WORKER_NO_SESSION) {
+                report_session(event);
+            }
+            break;
+#ifdef CONFIG_CENTRAL_KEYSTORE
+        case WORKER_RESOLVE:
+            resolve_next();
+            break;
+#endif
+        default:
+            break;
     }
 }
 
 void main(void) {
+    // first, the modules below continue with the retained clock and time with the cycle counter
+    retained_init();
+    cycles_init();
     spaceauth_init();
     leds_init();
-    k_delayed_work_init(&timeout_timer, timeout);
+    worker_init(handle_event);
+    deadline_init(timeout);
+    sched_init();
+#ifdef CONFIG_CENTRAL_PROXIMITY
+    proximity_init();
+#endif
+    trace_init();
+#ifdef CONFIG_CENTRAL_DOOR
+    door_init();
+#endif
+#ifdef CONFIG_CENTRAL_KEYSTORE
+    k_work_init(&resolved_work, connect_resolved);
+    keystore_init(resolve_pending);
+#endif
+#ifdef CONFIG_CENTRAL_ACCESS_LOG
+    accesslog_init();
+#endif
 
     // install watchdog
     wdt = device_get_binding(DT_WDT_0_NAME);
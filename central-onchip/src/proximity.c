@@ -0,0 +1,204 @@
+#include "proximity.h"
+#include "retained.h"
+#include <zephyr.h>
+#include <logging/log.h>
+#include <string.h>
+
+LOG_MODULE_REGISTER(proximity);
+
+/*
+ * The RSSI of a coin is smoothed with two exponential moving averages in 1/16 dB:
+ * a fast one (weight 1/4, about the last 7 advertisements) that is compared with the threshold
+ * and a slow one (weight 1/16) that lags behind, the fast one is below it when the coin moves away.
+ */
+#define PROXIMITY_FAST_SHIFT 2
+#define PROXIMITY_SLOW_SHIFT 4
+// the fast average may be this much below the slow one before the coin counts as moving away (dB)
+#define PROXIMITY_TREND_TOLERANCE 2
+// the adaptive threshold follows the 10th percentile of the last sessions, minus a margin
+#define PROXIMITY_SESSIONS 32
+#define PROXIMITY_MIN_SESSIONS 8
+#define PROXIMITY_PERCENTILE 10
+// the adaptive threshold never gets stricter than this (dBm)
+#define PROXIMITY_CEILING (-50)
+#define PROXIMITY_MAGIC 0x50525831 // "PRX1"
+
+typedef enum prox_gate_t {
+    PROX_GATE_SAMPLES = 0,  // not enough advertisements yet
+    PROX_GATE_WEAK,         // smoothed RSSI below the threshold
+    PROX_GATE_RECEDING,     // smoothed RSSI falling (only with CONFIG_CENTRAL_PROXIMITY_APPROACH)
+    PROX_GATES
+} prox_gate_t;
+
+struct tracked_coin {
+    bt_addr_le_t addr;
+    bool used;
+    bool admitted;
+    u8_t samples;
+    s8_t admitted_rssi;
+    s16_t fast;
+    s16_t slow;
+    s64_t first_seen;
+    s64_t last_seen;
+};
+
+// only accessed from the BT RX thread (scan and connection callbacks), shell access is read-only
+static struct tracked_coin coins[PROXIMITY_COINS];
+
+// counters and the RSSI of the last sessions live in RAM that is not cleared on boot,
+// the watchdog resets the central after sessions
+static struct {
+    u32_t magic;
+    u32_t admitted;
+    u32_t gated[PROX_GATES];
+    s8_t sessions[PROXIMITY_SESSIONS];
+    u8_t next;
+    u8_t count;
+    s8_t threshold;
+} persist __noinit;
+
+// find the coin, starting over if it was not seen for a while, optionally replacing the least recently seen one
+static struct tracked_coin *find(const bt_addr_le_t *addr, s64_t now, bool create) {
+    struct tracked_coin *victim = NULL;
+    for (size_t i = 0; i < ARRAY_SIZE(coins); ++i) {
+        struct tracked_coin *c = &coins[i];
+        if (c->used && !bt_addr_le_cmp(&c->addr, addr)) {
+            if (now - c->last_seen > PROXIMITY_MAX_AGE_MS) {
+                c->samples = 0;
+                c->admitted = false;
+                c->first_seen = now;
+            }
+            return c;
+        }
+        if (!victim || (victim->used && (!c->used || c->last_seen < victim->last_seen))) {
+            victim = c;
+        }
+    }
+    if (!create) {
+        return NULL;
+    }
+    (void) memset(victim, 0, sizeof(*victim));
+    bt_addr_le_copy(&victim->addr, addr);
+    victim->used = true;
+    victim->first_seen = now;
+    return victim;
+}
+
+// percentile (0..100) of the smoothed RSSI of the last successful sessions
+static s8_t percentile(u8_t pct) {
+    s8_t sorted[PROXIMITY_SESSIONS];
+    size_t n = persist.count;
+    memcpy(sorted, persist.sessions, n * sizeof(sorted[0]));
+    for (size_t i = 1; i < n; ++i) {
+        s8_t v = sorted[i];
+        size_t j = i;
+        for (; j > 0 && sorted[j - 1] > v; --j) {
+            sorted[j] = sorted[j - 1];
+        }
+        sorted[j] = v;
+    }
+    return sorted[(n - 1) * pct / 100];
+}
+
+static void update_threshold(void) {
+    s8_t threshold = CONFIG_CENTRAL_PROXIMITY_RSSI;
+    if (persist.count >= PROXIMITY_MIN_SESSIONS) {
+        threshold = (s8_t) MAX(percentile(PROXIMITY_PERCENTILE) - CONFIG_CENTRAL_PROXIMITY_MARGIN, threshold);
+        threshold = MIN(threshold, PROXIMITY_CEILING);
+    }
+    if (threshold != persist.threshold) {
+        LOG_INF("RSSI threshold %d dBm -> %d dBm", persist.threshold, threshold);
+        persist.threshold = threshold;
+    }
+}
+
+void proximity_init(void) {
+    if (!retained_restored() || persist.magic != PROXIMITY_MAGIC || persist.count > PROXIMITY_SESSIONS || persist.next >= PROXIMITY_SESSIONS) {
+        (void) memset(&persist, 0, sizeof(persist));
+        persist.magic = PROXIMITY_MAGIC;
+        persist.threshold = CONFIG_CENTRAL_PROXIMITY_RSSI;
+    }
+    // the configuration may have changed since the last boot
+    update_threshold();
+}
+
+bool proximity_admit(const bt_addr_le_t *addr, s8_t rssi) {
+    s64_t now = k_uptime_get();
+    struct tracked_coin *c = find(addr, now, true);
+    s16_t sample = (s16_t) (rssi * 16);
+    if (!c->samples) {
+        c->fast = sample;
+        c->slow = sample;
+    } else {
+        c->fast += (sample - c->fast) / (1 << PROXIMITY_FAST_SHIFT);
+        c->slow += (sample - c->slow) / (1 << PROXIMITY_SLOW_SHIFT);
+    }
+    if (c->samples < UINT8_MAX) {
+        c->samples++;
+    }
+    c->last_seen = now;
+
+    prox_gate_t gate = PROX_GATES;
+    if (c->samples < CONFIG_CENTRAL_PROXIMITY_SAMPLES) {
+        gate = PROX_GATE_SAMPLES;
+    } else if (c->fast < persist.threshold * 16) {
+        gate = PROX_GATE_WEAK;
+    } else if (IS_ENABLED(CONFIG_CENTRAL_PROXIMITY_APPROACH) && c->fast < c->slow - PROXIMITY_TREND_TOLERANCE * 16) {
+        gate = PROX_GATE_RECEDING;
+    }
+    if (gate != PROX_GATES) {
+        persist.gated[gate]++;
+        return false;
+    }
+    persist.admitted++;
+    if (!c->admitted) {
+        c->admitted = true;
+        LOG_DBG("admitted after %u advertisements (RSSI %d dBm)", c->samples, c->fast / 16);
+    }
+    c->admitted_rssi = (s8_t) (c->fast / 16);
+    return true;
+}
+
+s64_t proximity_first_seen(const bt_addr_le_t *addr, s64_t now) {
+    struct tracked_coin *c = find(addr, now, false);
+    return c && c->samples ? c->first_seen : now;
+}
+
+void proximity_report(const bt_addr_le_t *addr, sched_result_t result) {
+    struct tracked_coin *c = find(addr, k_uptime_get(), false);
+    if (!c || !c->admitted || result != SCHED_OK) {
+        return;
+    }
+    // the coin stops advertising after a successful session, the next button press starts over
+    c->used = false;
+    if (IS_ENABLED(CONFIG_CENTRAL_PROXIMITY_ADAPTIVE)) {
+        persist.sessions[persist.next] = c->admitted_rssi;
+        persist.next = (persist.next + 1) % PROXIMITY_SESSIONS;
+        if (persist.count < PROXIMITY_SESSIONS) {
+            persist.count++;
+        }
+        update_threshold();
+    }
+}
+
+void proximity_print(const struct shell *shell) {
+    s64_t now = k_uptime_get();
+    shell_print(shell, "RSSI threshold %d dBm (configured %d dBm, %u sessions%s)", persist.threshold,
+                CONFIG_CENTRAL_PROXIMITY_RSSI, persist.count,
+                IS_ENABLED(CONFIG_CENTRAL_PROXIMITY_ADAPTIVE) ? "" : ", not adaptive");
+    shell_print(shell, "admitted advertisements: %u, gated: %u (too few %u, too weak %u, receding %u)",
+                persist.admitted,
+                persist.gated[PROX_GATE_SAMPLES] + persist.gated[PROX_GATE_WEAK] + persist.gated[PROX_GATE_RECEDING],
+                persist.gated[PROX_GATE_SAMPLES], persist.gated[PROX_GATE_WEAK], persist.gated[PROX_GATE_RECEDING]);
+    for (size_t i = 0; i < ARRAY_SIZE(coins); ++i) {
+        const struct tracked_coin *c = &coins[i];
+        if (!c->used || now - c->last_seen > PROXIMITY_MAX_AGE_MS) {
+            continue;
+        }
+        const bt_addr_le_t *addr = &c->addr;
+        shell_print(shell, "[%02X:%02X:%02X:%02X:%02X:%02X] RSSI %d dBm, trend %d dB, %u advertisements, %s",
+                    addr->a.val[5], addr->a.val[4], addr->a.val[3],
+                    addr->a.val[2], addr->a.val[1], addr->a.val[0],
+                    c->fast / 16, (c->fast - c->slow) / 16, c->samples, c->admitted ? "admitted" : "gated");
+    }
+}
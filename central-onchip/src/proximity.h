@@ -0,0 +1,47 @@
+#pragma once
+
+#include <bluetooth/bluetooth.h>
+#include <shell/shell.h>
+
+#include "scheduler.h"
+
+// coins whose RSSI is tracked at the same time, the one not seen for the longest time is replaced
+#define PROXIMITY_COINS 8
+// tracking of a coin restarts when it was not seen for this long (next button press)
+#define PROXIMITY_MAX_AGE_MS 2000
+
+/**
+ * Initializes the counters and the adaptive threshold (kept across the watchdog reset).
+ */
+void proximity_init(void);
+
+/**
+ * Feeds the RSSI of an advertisement of a bonded coin into its smoothed RSSI and decides if the coin is close
+ * enough to be connected or queued: at least CONFIG_CENTRAL_PROXIMITY_SAMPLES advertisements were received,
+ * the smoothed RSSI reaches the threshold and, with CONFIG_CENTRAL_PROXIMITY_APPROACH, it is not falling.
+ * @param addr identity address of the coin
+ * @param rssi rssi of the advertisement
+ * @return true if the coin is admitted, false if the advertisement is gated
+ */
+bool proximity_admit(const bt_addr_le_t *addr, s8_t rssi);
+
+/**
+ * @param addr identity address of the coin
+ * @param now current uptime
+ * @return uptime of the first advertisement of the coin since it started advertising, now if it is not tracked
+ */
+s64_t proximity_first_seen(const bt_addr_le_t *addr, s64_t now);
+
+/**
+ * Records the outcome of a session. With CONFIG_CENTRAL_PROXIMITY_ADAPTIVE, the smoothed RSSI at which
+ * successful sessions were admitted moves the threshold.
+ * @param addr identity address of the coin
+ * @param result outcome of the session
+ */
+void proximity_report(const bt_addr_le_t *addr, sched_result_t result);
+
+/**
+ * Prints the threshold, the gated and admitted advertisements and the tracked coins.
+ * @param shell shell to be used for printing.
+ */
+void proximity_print(const struct shell *shell);
@@ -0,0 +1,48 @@
+#include "retained.h"
+
+#define RETAINED_MAGIC 0x31544552 // "RET1"
+// the clock loses at most this much with every reset
+#define RETAINED_SAVE_MS 100
+
+/*
+ * Lives in RAM that is not cleared on boot, the watchdog resets the central after sessions. The uptime restarts
+ * with every reset, so the clock continues from the last saved time. The scheduler, the door lockout, the key store,
+ * the trace and the access log all use this clock, so they agree on the time of the reset.
+ */
+static struct {
+    u32_t magic;
+    s64_t clock_ms;
+} retained __noinit;
+
+static s64_t epoch = 0;
+static bool restored = false;
+static struct k_timer save_timer;
+
+static void save(struct k_timer *timer) {
+    ARG_UNUSED(timer);
+    (void) retained_now();
+}
+
+void retained_init(void) {
+    restored = retained.magic == RETAINED_MAGIC && retained.clock_ms >= 0;
+    if (!restored) {
+        retained.magic = RETAINED_MAGIC;
+        retained.clock_ms = 0;
+    }
+    epoch = retained.clock_ms;
+    k_timer_init(&save_timer, save, NULL);
+    k_timer_start(&save_timer, K_MSEC(RETAINED_SAVE_MS), K_MSEC(RETAINED_SAVE_MS));
+}
+
+bool retained_restored(void) {
+    return restored;
+}
+
+s64_t retained_now(void) {
+    // called from the BT RX thread, the workqueues and the save timer, the 64 bit store must not be torn
+    unsigned int key = irq_lock();
+    retained.clock_ms = epoch + k_uptime_get();
+    s64_t now = retained.clock_ms;
+    irq_unlock(key);
+    return now;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <zephyr.h>
+
+/**
+ * Restores the retained clock (kept across the watchdog reset) and starts saving it periodically.
+ * Called first in main(), before the modules that keep state in RAM that is not cleared on boot.
+ */
+void retained_init(void);
+
+/**
+ * @return true if the RAM that is not cleared on boot survived the last reset (warm reset) and the retained clock
+ *         continues, false after a power loss: the modules start over with their retained state
+ */
+bool retained_restored(void);
+
+/**
+ * @return ms of the retained clock, it continues across the watchdog reset and starts at 0 after a power loss
+ */
+s64_t retained_now(void);
@@ -0,0 +1,102 @@
+#include "scan.h"
+#include <zephyr.h>
+#include <logging/log.h>
+#include <hci_core.h> //use of internal hci API for 'bt_addr_le_is_bonded(id, addr)'
+
+#include "candidates.h"
+#include "scheduler.h"
+#ifdef CONFIG_CENTRAL_PROXIMITY
+#include "proximity.h"
+#endif
+#ifdef CONFIG_CENTRAL_KEYSTORE
+#include "keystore.h"
+#endif
+
+// logs as part of the app module, sync_central.py parses "app: Battery Level"
+LOG_MODULE_DECLARE(app);
+
+// position of the battery level in the service data (after the 16 bit UUID)
+#define BT_ADV_BLVL_IDX 2
+
+// helper function for advertisement data parser
+static bool ad_parse_func(struct bt_data *data, void *user_data) {
+    s8_t *batt = user_data;
+    if (data->type == BT_DATA_SVC_DATA16) {
+        // check if this is service data for this battery service (uuid = 0x180f, one byte of data)
+        if (data->data_len != 3 || data->data[0] != 0x0f || data->data[1] != 0x18) {
+            return true;
+        }
+        *batt = (s8_t) data->data[BT_ADV_BLVL_IDX];
+        return false; // stop parsing, found what we wanted
+    }
+    return true;
+}
+
+// sync_central.py parses "app: Device found"
+static void log_found(const bt_addr_le_t *addr, s8_t rssi, u8_t type, bool bonded) {
+    LOG_INF("Device found: [%02X:%02X:%02X:%02X:%02X:%02X] (RSSI %d) (TYPE %u) "
+            "(BONDED %u)",
+            addr->a.val[5], addr->a.val[4], addr->a.val[3],
+            addr->a.val[2], addr->a.val[1], addr->a.val[0],
+            rssi, type, bonded);
+}
+
+scan_result_t scan_filter(const bt_addr_le_t *addr, s8_t rssi, u8_t type, struct net_buf_simple *ad,
+                          const bt_addr_le_t *busy, bt_addr_le_t *coin, s8_t *battery) {
+    bool connectable = type == BT_LE_ADV_DIRECT_IND || type == BT_LE_ADV_IND;
+    bool bonded = bt_addr_le_is_bonded(BT_ID_DEFAULT, addr);
+#ifdef CONFIG_CENTRAL_KEYSTORE
+    // coins that are not in the RAM cache are resolved from the flash key store by the worker,
+    // which queues them as candidates
+    if (!bonded && connectable && keystore_request(addr, rssi)) {
+        return SCAN_RESOLVING;
+    }
+#endif
+
+    if (busy) {
+        // connection slot is busy, remember bonded coins for later
+        if (connectable && bonded && bt_addr_le_cmp(addr, busy) && sched_allowed(addr)) {
+#ifdef CONFIG_CENTRAL_PROXIMITY
+            if (!proximity_admit(addr, rssi)) {
+                return SCAN_IGNORE;
+            }
+#endif
+            candidates_push(addr, rssi);
+            return SCAN_QUEUED;
+        }
+        return SCAN_IGNORE;
+    }
+#ifndef CONFIG_CENTRAL_PROXIMITY
+    log_found(addr, rssi, type, bonded);
+#endif
+
+    /* We're only interested in directed connectable events from bonded devices*/
+    if (!connectable || !bonded) {
+        return SCAN_IGNORE;
+    }
+
+    // coins in backoff or quarantine after failed sessions have to wait
+    if (!sched_allowed(addr)) {
+        LOG_DBG("Coin is in backoff");
+        return SCAN_IGNORE;
+    }
+
+#ifdef CONFIG_CENTRAL_PROXIMITY
+    // coins passing by or lying on a desk nearby are not connected
+    if (!proximity_admit(addr, rssi)) {
+        return SCAN_IGNORE;
+    }
+    // scanning without duplicate filter reports every advertisement, only the admitted coin is logged
+    log_found(addr, rssi, type, bonded);
+#endif
+
+    // read battery level from advertising data if available
+    s8_t blvl = -1;
+    bt_data_parse(ad, ad_parse_func, &blvl);
+    if (blvl >= 0) {
+        LOG_INF("Battery Level: %i%%", blvl);
+    }
+    bt_addr_le_copy(coin, addr);
+    *battery = blvl;
+    return SCAN_CONNECT;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <bluetooth/bluetooth.h>
+
+/**
+ * Decision about an advertisement.
+ */
+typedef enum scan_result_t {
+    SCAN_IGNORE = 0,    // not a bonded coin, not connectable, in backoff or not close enough
+    SCAN_QUEUED,        // bonded coin queued as candidate, the connection slot is busy
+    SCAN_CONNECT,       // bonded coin that should be connected now
+    SCAN_RESOLVING,     // not in the RAM cache, queued for the resolution from the flash key store
+} scan_result_t;
+
+/**
+ * Filters an advertisement of the scan callback: bonded coins are connected or queued, everything else is ignored.
+ * With CONFIG_CENTRAL_PROXIMITY, only coins whose smoothed RSSI passes the proximity policy are connected or queued.
+ * Logs the advertisement and the battery level from the service data of the coin.
+ * @param addr address of the advertiser
+ * @param rssi rssi of the advertisement
+ * @param type type of the advertisement
+ * @param ad advertisement data
+ * @param busy address of the connected coin, NULL if the connection slot is free
+ * @param coin identity address of the coin to be connected (only set for SCAN_CONNECT)
+ * @param battery battery level in percent from the advertisement, -1 if unknown (only set for SCAN_CONNECT)
+ * @return decision
+ */
+scan_result_t scan_filter(const bt_addr_le_t *addr, s8_t rssi, u8_t type, struct net_buf_simple *ad,
+                          const bt_addr_le_t *busy, bt_addr_le_t *coin, s8_t *battery);
@@ -0,0 +1,139 @@
+#include "scheduler.h"
+#include "retained.h"
+#include <zephyr.h>
+#include <logging/log.h>
+#include <string.h>
+
+LOG_MODULE_REGISTER(sched);
+
+// backoff after the first failure, doubled with every further consecutive failure
+#define SCHED_BACKOFF_MS 1000
+// consecutive failures after which a coin is quarantined
+#define SCHED_QUARANTINE_FAILURES 4
+#define SCHED_QUARANTINE_MS (5 * 60 * 1000)
+#define SCHED_MAGIC 0x53434831 // "SCH1"
+
+struct coin_history {
+    bt_addr_le_t addr;
+    bool used;
+    u8_t failures;
+    s64_t blocked_until;
+    s64_t last_served;
+};
+
+/*
+ * Lives in RAM that is not cleared on boot, the watchdog resets the central after sessions.
+ * Times are of the retained clock, it continues across the reset.
+ */
+static struct {
+    u32_t magic;
+    struct coin_history coins[CONFIG_BT_MAX_PAIRED];
+    u32_t results[SCHED_RESULTS];
+    u32_t skipped;
+    u32_t quarantines;
+} persist __noinit;
+
+static const char *const result_names[] = {
+        [SCHED_OK] = "ok",
+        [SCHED_FAIL_CONNECT] = "connect",
+        [SCHED_FAIL_SECURITY] = "security",
+        [SCHED_FAIL_DISCOVERY] = "discovery",
+        [SCHED_FAIL_VALIDATION] = "validation",
+};
+BUILD_ASSERT(ARRAY_SIZE(result_names) == SCHED_RESULTS);
+
+static s64_t sched_now(void) {
+    return retained_now();
+}
+
+// find the history of a coin, optionally replacing the least recently served entry
+static struct coin_history *find(const bt_addr_le_t *addr, bool create) {
+    struct coin_history *victim = NULL;
+    for (size_t i = 0; i < ARRAY_SIZE(persist.coins); ++i) {
+        struct coin_history *h = &persist.coins[i];
+        if (h->used && !bt_addr_le_cmp(&h->addr, addr)) {
+            return h;
+        }
+        if (!victim || (victim->used && (!h->used || h->last_served < victim->last_served))) {
+            victim = h;
+        }
+    }
+    if (!create) {
+        return NULL;
+    }
+    (void) memset(victim, 0, sizeof(*victim));
+    bt_addr_le_copy(&victim->addr, addr);
+    victim->used = true;
+    return victim;
+}
+
+void sched_init(void) {
+    if (!retained_restored() || persist.magic != SCHED_MAGIC) {
+        (void) memset(&persist, 0, sizeof(persist));
+        persist.magic = SCHED_MAGIC;
+    }
+}
+
+bool sched_allowed(const bt_addr_le_t *addr) {
+    struct coin_history *h = find(addr, false);
+    if (h && h->blocked_until > sched_now()) {
+        persist.skipped++;
+        return false;
+    }
+    return true;
+}
+
+s64_t sched_last_served(const bt_addr_le_t *addr) {
+    struct coin_history *h = find(addr, false);
+    return h ? h->last_served : 0;
+}
+
+void sched_report(const bt_addr_le_t *addr, sched_result_t result) {
+    if (result >= SCHED_RESULTS) {
+        return;
+    }
+    s64_t now = sched_now();
+    struct coin_history *h = find(addr, true);
+    persist.results[result]++;
+    h->last_served = now;
+    if (result == SCHED_OK) {
+        h->failures = 0;
+        h->blocked_until = 0;
+        return;
+    }
+    h->failures++;
+    if (h->failures >= SCHED_QUARANTINE_FAILURES) {
+        // the next failure after the quarantine quarantines again
+        h->failures = SCHED_QUARANTINE_FAILURES - 1;
+        h->blocked_until = now + SCHED_QUARANTINE_MS;
+        persist.quarantines++;
+        LOG_WRN("[%02X:%02X:%02X:%02X:%02X:%02X] quarantined after %s failure",
+                addr->a.val[5], addr->a.val[4], addr->a.val[3],
+                addr->a.val[2], addr->a.val[1], addr->a.val[0], result_names[result]);
+    } else {
+        h->blocked_until = now + (SCHED_BACKOFF_MS << (h->failures - 1));
+        LOG_INF("[%02X:%02X:%02X:%02X:%02X:%02X] %s failure %u, backoff %u ms",
+                addr->a.val[5], addr->a.val[4], addr->a.val[3],
+                addr->a.val[2], addr->a.val[1], addr->a.val[0], result_names[result],
+                h->failures, SCHED_BACKOFF_MS << (h->failures - 1));
+    }
+}
+
+void sched_print(const struct shell *shell) {
+    s64_t now = sched_now();
+    for (size_t i = 0; i < SCHED_RESULTS; ++i) {
+        shell_print(shell, "%-10s %u", result_names[i], persist.results[i]);
+    }
+    shell_print(shell, "skipped advertisements: %u, quarantines: %u", persist.skipped, persist.quarantines);
+    for (size_t i = 0; i < ARRAY_SIZE(persist.coins); ++i) {
+        const struct coin_history *h = &persist.coins[i];
+        if (!h->used || !h->failures) {
+            continue;
+        }
+        const bt_addr_le_t *addr = &h->addr;
+        shell_print(shell, "[%02X:%02X:%02X:%02X:%02X:%02X] failures %u, blocked for %u ms",
+                    addr->a.val[5], addr->a.val[4], addr->a.val[3],
+                    addr->a.val[2], addr->a.val[1], addr->a.val[0], h->failures,
+                    h->blocked_until > now ? (u32_t) (h->blocked_until - now) : 0);
+    }
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <bluetooth/bluetooth.h>
+#include <shell/shell.h>
+
+/**
+ * Outcome of a session, the failure is the phase the session got stuck in.
+ */
+typedef enum sched_result_t {
+    SCHED_OK = 0,
+    SCHED_FAIL_CONNECT,     // connection could not be established
+    SCHED_FAIL_SECURITY,    // encryption failed or timed out
+    SCHED_FAIL_DISCOVERY,   // GATT discovery or challenge write failed or timed out
+    SCHED_FAIL_VALIDATION,  // no response or invalid response
+    SCHED_RESULTS
+} sched_result_t;
+
+/**
+ * Initializes the per-coin history (kept across the watchdog reset).
+ */
+void sched_init(void);
+
+/**
+ * Checks if a coin may be connected or queued now (not in backoff or quarantine).
+ * @param addr address of the coin
+ * @return true if the coin may be connected
+ */
+bool sched_allowed(const bt_addr_le_t *addr);
+
+/**
+ * @param addr address of the coin
+ * @return time (scheduler clock) of the last session of the coin, 0 if it was never connected
+ */
+s64_t sched_last_served(const bt_addr_le_t *addr);
+
+/**
+ * Records the outcome of a session.
+ * Failures put the coin into exponential backoff, repeated failures into quarantine. Success clears both.
+ * @param addr address of the coin
+ * @param result outcome of the session
+ */
+void sched_report(const bt_addr_le_t *addr, sched_result_t result);
+
+/**
+ * Prints the counters and all coins with failures.
+ * @param shell shell to be used for printing.
+ */
+void sched_print(const struct shell *shell);
@@ -3,17 +3,37 @@
 #include "spaceauth.h"
 #include <settings/settings.h>
 #include <tinycrypt/utils.h>
+#include <sys/byteorder.h>
 
 #include <logging/log.h>
 
 LOG_MODULE_REGISTER(space);
 
 #include "blake2.h"
+#include "digest.h"
 
-static spacekey_t keys[CONFIG_BT_MAX_PAIRED] = {{{0}}};
+#if defined(CONFIG_CENTRAL_DERIVED_KEYS) && !defined(CONFIG_CENTRAL_KEYSTORE)
+// only coins with a random spacekey are registered, all others are derived
+#define SPACEKEYS_MAX CONFIG_CENTRAL_DERIVED_KEYS_EXPLICIT
+#else
+#define SPACEKEYS_MAX CONFIG_BT_MAX_PAIRED
+#endif
+
+static spacekey_t keys[SPACEKEYS_MAX] = {{{0}}};
 static const bt_addr_t NO_ADDR = {0};
 static size_t largest_index_used = 0;
 
+#ifdef CONFIG_CENTRAL_DERIVED_KEYS
+typedef struct spacegen_t {
+    bt_addr_le_t addr;
+    u16_t generation;
+} spacegen_t;
+
+static uint8_t master_key[BLAKE2S_KEYBYTES];
+static bool master_set = false;
+static spacegen_t gens[CONFIG_CENTRAL_DERIVED_KEYS_TABLE] = {{{0}}};
+#endif
+
 void spacekeys_print(const struct shell *shell) {
     for (size_t i = 0; i <= largest_index_used; ++i) {
         if (bt_addr_cmp(&NO_ADDR, &keys[i].addr.a) != 0) {
@@ -25,6 +45,14 @@ void spacekeys_print(const struct shell *shell) {
     }
 }
 
+void spacekeys_foreach(void (*func)(const spacekey_t *key, void *data), void *data) {
+    for (size_t i = 0; i <= largest_index_used; ++i) {
+        if (bt_addr_cmp(&NO_ADDR, &keys[i].addr.a) != 0) {
+            func(&keys[i], data);
+        }
+    }
+}
+
 static void space_settings_encode_key(char *path, size_t path_size, const bt_addr_le_t *addr) {
     snprintk(path, path_size, "space/%02x%02x%02x%02x%02x%02x%u",
              addr->a.val[5], addr->a.val[4], addr->a.val[3],
@@ -58,7 +86,7 @@ static spacekey_t *spacekey_lookup_add(const bt_addr_le_t *addr) {
     if (result) {
         return result;
     }
-    for (size_t i = 0; i < CONFIG_BT_MAX_PAIRED; ++i) {
+    for (size_t i = 0; i < SPACEKEYS_MAX; ++i) {
         if (!bt_addr_cmp(&NO_ADDR, &keys[i].addr.a)) {
             largest_index_used = MAX(i, largest_index_used);
             return &keys[i];
@@ -76,11 +104,66 @@ spacekey_t *spacekey_lookup(const bt_addr_le_t *addr) {
     return NULL;
 }
 
+#ifdef CONFIG_CENTRAL_DERIVED_KEYS
+static spacegen_t *spacegen_lookup(const bt_addr_le_t *addr) {
+    for (size_t i = 0; i < ARRAY_SIZE(gens); ++i) {
+        if (!bt_addr_le_cmp(addr, &gens[i].addr)) {
+            return &gens[i];
+        }
+    }
+    return NULL;
+}
+
+// puts a generation into the table (RAM only), generation 0 frees the entry
+static int spacegen_load(const bt_addr_le_t *addr, u16_t generation) {
+    spacegen_t *entry = spacegen_lookup(addr);
+    if (!entry && generation) {
+        bt_addr_le_t none = {0};
+        entry = spacegen_lookup(&none);
+        if (!entry) {
+            return -ENOSPC;
+        }
+    }
+    if (entry) {
+        if (generation) {
+            bt_addr_le_copy(&entry->addr, addr);
+            entry->generation = generation;
+        } else {
+            (void) memset(entry, 0, sizeof(*entry));
+        }
+    }
+    digest_invalidate(addr);
+    return 0;
+}
+
+static u16_t spacegen_get(const bt_addr_le_t *addr) {
+    spacegen_t *entry = spacegen_lookup(addr);
+    return entry ? entry->generation : 0;
+}
+#endif
+
 static int space_settings_set(const char *key, size_t len_rd,
                               settings_read_cb read_cb, void *cb_arg) {
     ARG_UNUSED(len_rd);
     const char *next;
 
+#ifdef CONFIG_CENTRAL_DERIVED_KEYS
+    if (settings_name_steq(key, "master", &next) && !next) {
+        ssize_t len = read_cb(cb_arg, master_key, sizeof(master_key));
+        master_set = len == sizeof(master_key);
+        digest_invalidate(NULL);
+        return (len < 0) ? len : 0;
+    }
+    if (settings_name_steq(key, "gen", &next) && next) {
+        bt_addr_le_t addr;
+        u16_t generation;
+        if (space_settings_decode_key(next, &addr) ||
+            read_cb(cb_arg, &generation, sizeof(generation)) != sizeof(generation)) {
+            return -EINVAL;
+        }
+        return spacegen_load(&addr, generation);
+    }
+#endif
     settings_name_next(key, &next);
     if (!next) {
         bt_addr_le_t addr;
@@ -90,6 +173,7 @@ static int space_settings_set(const char *key, size_t len_rd,
                 return -ENOSPC;
             }
             ssize_t len = read_cb(cb_arg, slot->key, BLAKE2S_KEYBYTES);
+            digest_invalidate(&addr);
             if (!len) {
                 memset(&slot->addr, 0, sizeof(slot->addr));
                 return 0;
@@ -125,6 +209,7 @@ int spacekey_add(const bt_addr_le_t *addr, const uint8_t *key) {
     }
     memcpy(&slot->addr, addr, sizeof(bt_addr_le_t));
     memcpy(slot->key, key, BLAKE2S_KEYBYTES);
+    digest_invalidate(addr);
     settings_save_one(path, key, BLAKE2S_KEYBYTES);
     return 0;
 }
@@ -141,16 +226,125 @@ int spacekey_del(const bt_addr_le_t *addr) {
     space_settings_encode_key(path, sizeof(path), addr);
     settings_delete(path);
     memset(&slot->addr, 0, sizeof(slot->addr));
+    digest_invalidate(addr);
     return 0;
 }
 
-int spaceauth_validate(const bt_addr_le_t *addr, const uint8_t *challenge, const uint8_t *response) {
-    spacekey_t *slot = spacekey_lookup(addr);
+int spacekey_cache(const bt_addr_le_t *addr, const uint8_t *key) {
+    spacekey_t *slot = spacekey_lookup_add(addr);
     if (!slot) {
+        return -ENOSPC;
+    }
+    memcpy(&slot->addr, addr, sizeof(bt_addr_le_t));
+    memcpy(slot->key, key, BLAKE2S_KEYBYTES);
+    return 0;
+}
+
+void spacekey_uncache(const bt_addr_le_t *addr) {
+    spacekey_t *slot = spacekey_lookup(addr);
+    if (slot) {
+        (void) memset(slot, 0, sizeof(*slot));
+    }
+}
+
+#ifdef CONFIG_CENTRAL_DERIVED_KEYS
+int spacekey_derive(const bt_addr_le_t *addr, u16_t generation, uint8_t *key) {
+    if (!master_set) {
+        return -ENOENT;
+    }
+    uint8_t msg[6 + 4];
+    for (size_t i = 0; i < 6; ++i) {
+        msg[i] = addr->a.val[5 - i];
+    }
+    sys_put_le32(generation, msg + 6);
+    blake2s(key, BLAKE2S_OUTBYTES, msg, sizeof(msg), master_key, sizeof(master_key));
+    return 0;
+}
+
+int spacemaster_set(const uint8_t *key) {
+    memcpy(master_key, key, sizeof(master_key));
+    master_set = true;
+    digest_invalidate(NULL);
+    return settings_save_one("space/master", master_key, sizeof(master_key));
+}
+
+int spacemaster_fingerprint(uint8_t *out) {
+    if (!master_set) {
         return -ENOENT;
     }
+    blake2s(out, 8, master_key, sizeof(master_key), NULL, 0);
+    return 0;
+}
+
+int spacegen_set(const bt_addr_le_t *addr, u16_t generation) {
+    if (!bt_addr_cmp(&addr->a, &NO_ADDR)) {
+        return -EINVAL;
+    }
+    int err = spacegen_load(addr, generation);
+    if (err) {
+        return err;
+    }
+    char path[24];
+    snprintk(path, sizeof(path), "space/gen/%02x%02x%02x%02x%02x%02x%u",
+             addr->a.val[5], addr->a.val[4], addr->a.val[3],
+             addr->a.val[2], addr->a.val[1], addr->a.val[0],
+             addr->type);
+    return generation ? settings_save_one(path, &generation, sizeof(generation)) : settings_delete(path);
+}
+
+void spacegen_print(const struct shell *shell) {
+    uint8_t fingerprint[8];
+    if (spacemaster_fingerprint(fingerprint)) {
+        shell_print(shell, "master: none");
+    } else {
+        shell_print(shell, "master: %02X%02X%02X%02X%02X%02X%02X%02X", fingerprint[0], fingerprint[1],
+                    fingerprint[2], fingerprint[3], fingerprint[4], fingerprint[5], fingerprint[6], fingerprint[7]);
+    }
+    for (size_t i = 0; i < ARRAY_SIZE(gens); ++i) {
+        if (gens[i].generation) {
+            const bt_addr_le_t *addr = &gens[i].addr;
+            if (gens[i].generation == SPACEGEN_REVOKED) {
+                shell_print(shell, "[%02X:%02X:%02X:%02X:%02X:%02X] revoked",
+                            addr->a.val[5], addr->a.val[4], addr->a.val[3],
+                            addr->a.val[2], addr->a.val[1], addr->a.val[0]);
+            } else {
+                shell_print(shell, "[%02X:%02X:%02X:%02X:%02X:%02X] generation %u",
+                            addr->a.val[5], addr->a.val[4], addr->a.val[3],
+                            addr->a.val[2], addr->a.val[1], addr->a.val[0], gens[i].generation);
+            }
+        }
+    }
+}
+#endif
+
+int spacekey_get(const bt_addr_le_t *addr, uint8_t *key) {
+#ifdef CONFIG_CENTRAL_DERIVED_KEYS
+    u16_t generation = spacegen_get(addr);
+    if (generation == SPACEGEN_REVOKED) {
+        return -EACCES;
+    }
+#endif
+    spacekey_t *slot = spacekey_lookup(addr);
+    if (slot) {
+        memcpy(key, slot->key, BLAKE2S_KEYBYTES);
+        return 0;
+    }
+#ifdef CONFIG_CENTRAL_DERIVED_KEYS
+    return spacekey_derive(addr, generation, key);
+#else
+    return -ENOENT;
+#endif
+}
+
+int spaceauth_validate(const bt_addr_le_t *addr, const uint8_t *challenge, const uint8_t *response) {
+    uint8_t key[BLAKE2S_KEYBYTES];
+    int err = spacekey_get(addr, key);
+    if (err) {
+        return err;
+    }
     uint8_t correct_response[BLAKE2S_OUTBYTES];
-    blake2s(correct_response, BLAKE2S_OUTBYTES, challenge, BLAKE2S_BLOCKBYTES, slot->key, BLAKE2S_KEYBYTES);
+    blake2s(correct_response, BLAKE2S_OUTBYTES, challenge, BLAKE2S_BLOCKBYTES, key, BLAKE2S_KEYBYTES);
+    (void) memset(key, 0, sizeof(key));
     if (!_compare(response, correct_response, BLAKE2S_OUTBYTES)) {
         LOG_HEXDUMP_DBG(challenge, BLAKE2S_BLOCKBYTES, "challenge");
         LOG_HEXDUMP_DBG(response, BLAKE2S_OUTBYTES, "response");
@@ -15,6 +15,13 @@ typedef struct spacekey_t {
  */
 void spacekeys_print(const struct shell *shell);
 
+/**
+ * Calls a function for every registered spacekey.
+ * @param func function to call
+ * @param data user data passed to func
+ */
+void spacekeys_foreach(void (*func)(const spacekey_t *key, void *data), void *data);
+
 /**
  * For a given address, look up the spacekey struct.
  * @param addr given address
@@ -37,6 +44,72 @@ int spacekey_add(const bt_addr_le_t *addr, const uint8_t *key);
  */
 int spacekey_del(const bt_addr_le_t *addr);
 
+/**
+ * Puts a spacekey into RAM only (key store cache), it is not saved to settings.
+ * @param addr given address
+ * @param key spacekey array
+ * @return 0 on success, -ENOSPC if buffer is full
+ */
+int spacekey_cache(const bt_addr_le_t *addr, const uint8_t *key);
+
+/**
+ * Removes a spacekey from RAM only (key store cache).
+ * @param addr given address
+ */
+void spacekey_uncache(const bt_addr_le_t *addr);
+
+/**
+ * Gets the spacekey of a coin: the registered one if there is one, otherwise (with CONFIG_CENTRAL_DERIVED_KEYS)
+ * the one derived from the master key and the generation of the coin.
+ * @param addr given address
+ * @param key output buffer (32 bytes)
+ * @return 0 on success, -ENOENT if there is no spacekey, -EACCES if the coin is revoked
+ */
+int spacekey_get(const bt_addr_le_t *addr, uint8_t *key);
+
+#ifdef CONFIG_CENTRAL_DERIVED_KEYS
+// generation value of revoked coins
+#define SPACEGEN_REVOKED 0xFFFF
+
+/**
+ * Derives a spacekey from the master key: BLAKE2s keyed with the master key over the identity address
+ * (6 bytes, most significant first) and the generation (4 bytes, little endian).
+ * @param addr identity address of the coin
+ * @param generation generation of the coin
+ * @param key output buffer (32 bytes)
+ * @return 0 on success, -ENOENT if there is no master key
+ */
+int spacekey_derive(const bt_addr_le_t *addr, u16_t generation, uint8_t *key);
+
+/**
+ * Sets and saves the master key, all derived spacekeys change.
+ * @param key master key (32 bytes)
+ * @return 0 on success
+ */
+int spacemaster_set(const uint8_t *key);
+
+/**
+ * Computes the fingerprint of the master key (BLAKE2s with 8 bytes output), used to compare it with the host.
+ * @param out output buffer (8 bytes)
+ * @return 0 on success, -ENOENT if there is no master key
+ */
+int spacemaster_fingerprint(uint8_t *out);
+
+/**
+ * Sets and saves the generation of a coin. Generation 0 is the default and takes no table entry.
+ * @param addr identity address of the coin
+ * @param generation new generation, SPACEGEN_REVOKED to revoke the coin
+ * @return 0 on success, -ENOSPC if the table is full
+ */
+int spacegen_set(const bt_addr_le_t *addr, u16_t generation);
+
+/**
+ * Prints the master key fingerprint and the generation and revocation table.
+ * @param shell shell to be used for printing.
+ */
+void spacegen_print(const struct shell *shell);
+#endif
+
 /**
  * Validates a response to a challenge with the spacekey of the given address.
  * @param addr given address
@@ -0,0 +1,102 @@
+#include "trace.h"
+#include "retained.h"
+#include <logging/log.h>
+#include <string.h>
+
+LOG_MODULE_REGISTER(trace);
+
+#define TRACE_MAGIC 0x31435254 // "TRC1"
+
+BUILD_ASSERT((CONFIG_CENTRAL_TRACE_EVENTS & (CONFIG_CENTRAL_TRACE_EVENTS - 1)) == 0);
+
+/*
+ * Lives in RAM that is not cleared on boot, the watchdog resets the central after sessions.
+ * The trace clock is the retained clock since the last clear, so it continues across the reset.
+ */
+static struct {
+    u32_t magic;
+    s64_t cleared_ms; // retained clock of the last clear
+    u32_t head; // number of events recorded since the last clear
+    u16_t boots;
+    struct trace_event events[CONFIG_CENTRAL_TRACE_EVENTS];
+} persist __noinit;
+
+static const char *const type_names[] = {
+        [TRACE_BOOT] = "boot",
+        [TRACE_ADV] = "adv",
+        [TRACE_CONNECT] = "connect",
+        [TRACE_SECURITY] = "security",
+        [TRACE_DISCOVER] = "discover",
+        [TRACE_SUBSCRIBE] = "subscribe",
+        [TRACE_WRITE] = "write",
+        [TRACE_NOTIFY] = "notify",
+        [TRACE_READ] = "read",
+        [TRACE_VALIDATE] = "validate",
+        [TRACE_TIMEOUT] = "timeout",
+        [TRACE_DISCONNECT] = "disconnect",
+};
+BUILD_ASSERT(ARRAY_SIZE(type_names) == TRACE_TYPES);
+
+void trace_init(void) {
+    if (!retained_restored() || persist.magic != TRACE_MAGIC) {
+        trace_clear();
+    }
+    persist.boots++;
+    trace_record(TRACE_BOOT, 0, persist.boots, NULL);
+}
+
+void trace_record_data(trace_type_t type, u8_t a, u16_t b, const void *data, size_t len) {
+    // events come from the BT RX thread and the system workqueue (deadlines)
+    unsigned int key = irq_lock();
+    struct trace_event *event = &persist.events[persist.head % CONFIG_CENTRAL_TRACE_EVENTS];
+    event->time = (u32_t) (retained_now() - persist.cleared_ms);
+    event->type = type;
+    event->a = a;
+    event->b = b;
+    (void) memset(event->data, 0, sizeof(event->data));
+    if (data) {
+        memcpy(event->data, data, MIN(len, sizeof(event->data)));
+    }
+    persist.head++;
+    irq_unlock(key);
+}
+
+void trace_record(trace_type_t type, u8_t a, u16_t b, const bt_addr_le_t *addr) {
+    trace_record_data(type, a, b, addr, sizeof(*addr));
+}
+
+const char *trace_type_name(trace_type_t type) {
+    return type < TRACE_TYPES ? type_names[type] : "unknown";
+}
+
+void trace_clear(void) {
+    unsigned int key = irq_lock();
+    (void) memset(&persist, 0, sizeof(persist));
+    persist.magic = TRACE_MAGIC;
+    persist.cleared_ms = retained_now();
+    irq_unlock(key);
+}
+
+void trace_dump(const struct shell *shell) {
+    u32_t head = persist.head;
+    u32_t count = MIN(head, CONFIG_CENTRAL_TRACE_EVENTS);
+    shell_print(shell, "trace: %u events, %u lost, %u boots", count, head - count, persist.boots);
+    for (u32_t i = head - count; i != head; ++i) {
+        const u8_t *raw = (const u8_t *) &persist.events[i % CONFIG_CENTRAL_TRACE_EVENTS];
+        char line[2 * sizeof(struct trace_event) + 1];
+        for (size_t j = 0; j < sizeof(struct trace_event); ++j) {
+            static const char hex[] = "0123456789ABCDEF";
+            line[2 * j] = hex[raw[j] >> 4];
+            line[2 * j + 1] = hex[raw[j] & 0xf];
+        }
+        line[sizeof(line) - 1] = 0;
+        shell_print(shell, "trace %s", line);
+    }
+}
+
+void trace_print(const struct shell *shell) {
+    u32_t count = MIN(persist.head, CONFIG_CENTRAL_TRACE_EVENTS);
+    shell_print(shell, "events %u of %u (%u bytes), lost %u, boots %u, clock %u ms",
+                count, CONFIG_CENTRAL_TRACE_EVENTS, (u32_t) sizeof(persist), persist.head - count, persist.boots,
+                (u32_t) (retained_now() - persist.cleared_ms));
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <zephyr.h>
+#include <bluetooth/bluetooth.h>
+#include <shell/shell.h>
+
+/**
+ * Events of the session trace.
+ */
+typedef enum trace_type_t {
+    TRACE_BOOT = 0,     // central started (b: boot counter)
+    TRACE_ADV,          // advertisement of a bonded coin that is connected (addr, a: rssi, b: advertisement type)
+    TRACE_CONNECT,      // connection established or failed (addr, a: HCI error, b: ms since first advertisement)
+    TRACE_SECURITY,     // security changed (a: level, b: security error, data[0]: key size)
+    TRACE_DISCOVER,     // attribute discovered or discovery failed (a: step, b: handle, data[0]: error)
+    TRACE_SUBSCRIBE,    // subscribed to the response indication (a: error)
+    TRACE_WRITE,        // challenge written (a: ATT error)
+    TRACE_NOTIFY,       // response indication received (b: length)
+    TRACE_READ,         // part of the response read (a: ATT error, b: offset + length)
+    TRACE_VALIDATE,     // response validated (a: 1 if valid, b: validation time in us)
+    TRACE_TIMEOUT,      // deadline expired (a: phase)
+    TRACE_DISCONNECT,   // disconnected (addr, a: HCI reason, b: session result)
+    TRACE_TYPES
+} trace_type_t;
+
+/**
+ * Steps of the GATT discovery recorded with TRACE_DISCOVER.
+ */
+enum trace_discover_step {
+    TRACE_DISCOVER_SERVICE = 0,
+    TRACE_DISCOVER_CHALLENGE,
+    TRACE_DISCOVER_RESPONSE,
+    TRACE_DISCOVER_CCC,
+};
+
+/**
+ * One trace record. Dumped as hex of its bytes (little endian), the host tools share this layout.
+ */
+struct trace_event {
+    u32_t time; // ms of the trace clock, continues across resets
+    u8_t type;
+    u8_t a;
+    u16_t b;
+    u8_t data[8]; // address (type and 6 bytes) or event specific data
+} __packed;
+
+BUILD_ASSERT(sizeof(struct trace_event) == 16);
+
+/**
+ * Continues the trace clock and recording after a reset (the buffer survives warm resets) and records TRACE_BOOT.
+ */
+void trace_init(void);
+
+/**
+ * Records an event.
+ * @param type event type
+ * @param a small argument
+ * @param b argument
+ * @param addr address of the coin, NULL if the event has none
+ */
+void trace_record(trace_type_t type, u8_t a, u16_t b, const bt_addr_le_t *addr);
+
+/**
+ * Records an event with event specific data.
+ * @param type event type
+ * @param a small argument
+ * @param b argument
+ * @param data event specific data (up to 8 bytes)
+ * @param len length of data
+ */
+void trace_record_data(trace_type_t type, u8_t a, u16_t b, const void *data, size_t len);
+
+/**
+ * @return name of an event type
+ */
+const char *trace_type_name(trace_type_t type);
+
+/**
+ * Clears the trace.
+ */
+void trace_clear(void);
+
+/**
+ * Prints all events as hex lines (`trace <hex>`) for the host tools, preceded by a summary line.
+ * @param shell shell to be used for printing.
+ */
+void trace_dump(const struct shell *shell);
+
+/**
+ * Prints number of recorded and overwritten events and the number of boots.
+ * @param shell shell to be used for printing.
+ */
+void trace_print(const struct shell *shell);
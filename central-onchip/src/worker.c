@@ -0,0 +1,142 @@
+#include "worker.h"
+#include "retained.h"
+#include "cycles.h"
+#include <logging/log.h>
+#include <string.h>
+
+LOG_MODULE_REGISTER(worker);
+
+#define WORKER_MAGIC 0x57524b32 // "WRK2"
+// statistics of the inline build are not mixed up with the ones of the worker build
+#define WORKER_MODE_MAGIC (WORKER_MAGIC ^ IS_ENABLED(CONFIG_CENTRAL_AUTH_WORKER))
+
+#ifdef CONFIG_CENTRAL_AUTH_WORKER
+K_MSGQ_DEFINE(worker_msgq, sizeof(struct worker_event), CONFIG_CENTRAL_AUTH_WORKER_QUEUE, 4);
+#endif
+
+static const char *const event_names[] = {
+        [WORKER_CONNECTED] = "connected",
+        [WORKER_RESPONSE] = "response",
+        [WORKER_DISCONNECTED] = "disconnected",
+        [WORKER_RESOLVE] = "resolve",
+};
+BUILD_ASSERT(ARRAY_SIZE(event_names) == WORKER_EVENT_TYPES);
+
+static const char *const rx_names[] = {
+        [WORKER_RX_NOTIFY] = "notify",
+        [WORKER_RX_READ] = "read",
+};
+BUILD_ASSERT(ARRAY_SIZE(rx_names) == WORKER_RX_TYPES);
+
+struct timing {
+    u32_t count;
+    u32_t max_ns;
+    u64_t total_ns;
+};
+
+// statistics live in RAM that is not cleared on boot, the watchdog resets the central after sessions
+static struct {
+    u32_t magic;
+    u32_t posted;
+    u32_t dropped;
+    u32_t peak;
+    struct timing wait;
+    struct timing handled[WORKER_EVENT_TYPES];
+    struct timing rx[WORKER_RX_TYPES];
+} stats __noinit;
+
+static void (*handler)(struct worker_event *event) = NULL;
+
+static void timing_add(struct timing *t, u32_t ns) {
+    t->count++;
+    t->total_ns += ns;
+    t->max_ns = MAX(t->max_ns, ns);
+}
+
+static u32_t elapsed_ns(u32_t start_cycles) {
+    return (u32_t) cycles_to_ns(cycles_get() - start_cycles);
+}
+
+static void handle(struct worker_event *event) {
+    u32_t start = cycles_get();
+    timing_add(&stats.wait, (u32_t) cycles_to_ns(start - event->posted));
+    if (handler) {
+        handler(event);
+    }
+    if (event->type < WORKER_EVENT_TYPES) {
+        timing_add(&stats.handled[event->type], elapsed_ns(start));
+    }
+    (void) memset(event, 0, sizeof(*event));
+}
+
+#ifdef CONFIG_CENTRAL_AUTH_WORKER
+static void worker_thread(void *p1, void *p2, void *p3) {
+    ARG_UNUSED(p1);
+    ARG_UNUSED(p2);
+    ARG_UNUSED(p3);
+    struct worker_event event;
+    for (;;) {
+        if (!k_msgq_get(&worker_msgq, &event, K_FOREVER)) {
+            handle(&event);
+        }
+    }
+}
+
+K_THREAD_DEFINE(worker_tid, CONFIG_CENTRAL_AUTH_WORKER_STACK_SIZE, worker_thread, NULL, NULL, NULL,
+                CONFIG_CENTRAL_AUTH_WORKER_PRIORITY, 0, K_NO_WAIT);
+#endif
+
+void worker_init(void (*handler_fn)(struct worker_event *event)) {
+    if (!retained_restored() || stats.magic != WORKER_MODE_MAGIC) {
+        (void) memset(&stats, 0, sizeof(stats));
+        stats.magic = WORKER_MODE_MAGIC;
+    }
+    handler = handler_fn;
+}
+
+int worker_post(struct worker_event *event) {
+    event->posted = cycles_get();
+    stats.posted++;
+#ifdef CONFIG_CENTRAL_AUTH_WORKER
+    int err = k_msgq_put(&worker_msgq, event, K_NO_WAIT);
+    (void) memset(event, 0, sizeof(*event));
+    if (err) {
+        stats.dropped++;
+        LOG_ERR("worker queue full, event dropped");
+        return -ENOMSG;
+    }
+    stats.peak = MAX(stats.peak, k_msgq_num_used_get(&worker_msgq));
+#else
+    handle(event);
+#endif
+    return 0;
+}
+
+void worker_rx_time(worker_rx_t rx, u32_t start_cycles) {
+    timing_add(&stats.rx[rx], elapsed_ns(start_cycles));
+}
+
+static void print_timing(const struct shell *shell, const char *name, const struct timing *t) {
+    shell_print(shell, "%-13s %6u %9u %9u", name, t->count,
+                t->count ? (u32_t) (t->total_ns / t->count / 1000U) : 0, t->max_ns / 1000U);
+}
+
+void worker_print(const struct shell *shell) {
+#ifdef CONFIG_CENTRAL_AUTH_WORKER
+    shell_print(shell, "worker thread, queue %u of %u (peak %u), posted %u, dropped %u",
+                k_msgq_num_used_get(&worker_msgq), CONFIG_CENTRAL_AUTH_WORKER_QUEUE, stats.peak, stats.posted,
+                stats.dropped);
+#else
+    shell_print(shell, "inline in the BT RX thread, posted %u", stats.posted);
+#endif
+    shell_print(shell, "%-13s %6s %9s %9s", "", "count", "mean us", "max us");
+    print_timing(shell, "queue wait", &stats.wait);
+    for (size_t i = 0; i < WORKER_EVENT_TYPES; ++i) {
+        print_timing(shell, event_names[i], &stats.handled[i]);
+    }
+    for (size_t i = 0; i < WORKER_RX_TYPES; ++i) {
+        char name[16];
+        snprintk(name, sizeof(name), "rx %s", rx_names[i]);
+        print_timing(shell, name, &stats.rx[i]);
+    }
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <zephyr.h>
+#include <bluetooth/bluetooth.h>
+#include <shell/shell.h>
+
+/**
+ * Events posted by the BT callbacks, handled in order by the authentication worker.
+ */
+typedef enum worker_event_type_t {
+    WORKER_CONNECTED = 0,   // connection to a coin established
+    WORKER_RESPONSE,        // response completely received, has to be validated
+    WORKER_DISCONNECTED,    // connection ended
+    WORKER_RESOLVE,         // advertisers wait for the resolution from the flash key store (keystore_next())
+    WORKER_EVENT_TYPES
+} worker_event_type_t;
+
+// result of a WORKER_DISCONNECTED event that did not end a session (unknown connection)
+#define WORKER_NO_SESSION 0xff
+
+struct worker_event {
+    u8_t type;
+    bt_addr_le_t addr;
+    u32_t posted;           // cycles_get() when the event was posted
+    u8_t challenge[64];     // only WORKER_RESPONSE
+    u8_t response[32];      // only WORKER_RESPONSE
+    u8_t result;            // only WORKER_DISCONNECTED: result of the completed phases (sched_result_t) or
+                            // WORKER_NO_SESSION, the worker replaces it with the result of the validation
+    u8_t reason;            // only WORKER_DISCONNECTED: HCI disconnect reason, 0 if the connection failed
+    s8_t rssi;              // only WORKER_DISCONNECTED: rssi of the connected advertisement
+    s8_t battery;           // only WORKER_DISCONNECTED: battery level in percent, -1 if unknown
+    u16_t latency_ms;       // first advertisement to the response (WORKER_RESPONSE) or to the disconnect
+};
+
+/**
+ * BT callbacks whose run time is measured.
+ */
+typedef enum worker_rx_t {
+    WORKER_RX_NOTIFY = 0,   // response indication
+    WORKER_RX_READ,         // rest of the response read
+    WORKER_RX_TYPES
+} worker_rx_t;
+
+/**
+ * Sets the handler of the events and restores the statistics (kept across the watchdog reset).
+ * @param handler_fn called for every event, in the worker thread (CONFIG_CENTRAL_AUTH_WORKER)
+ *                   or directly in the posting BT callback
+ */
+void worker_init(void (*handler_fn)(struct worker_event *event));
+
+/**
+ * Posts an event to the worker without blocking. The event is cleared afterwards, so the challenge and
+ * response do not stay on the stack of the caller.
+ * @param event event to be handled
+ * @return 0 on success, -ENOMSG if the queue is full (the event is dropped)
+ */
+int worker_post(struct worker_event *event);
+
+/**
+ * Records the run time of a BT callback.
+ * @param rx callback
+ * @param start_cycles cycles_get() at the start of the callback
+ */
+void worker_rx_time(worker_rx_t rx, u32_t start_cycles);
+
+/**
+ * Prints mode, queue usage, handling times and the run time of the BT callbacks.
+ * @param shell shell to be used for printing.
+ */
+void worker_print(const struct shell *shell);
@@ -0,0 +1,160 @@
+#include <zephyr.h>
+#include <bluetooth/gatt.h>
+
+#include "blake2.h"
+#include "swarm.h"
+#include "auth.h"
+
+#include <logging/log.h>
+
+LOG_MODULE_REGISTER(auth);
+
+// same service as the coin firmware (coin/src/spaceauth.c)
+static struct bt_uuid_128 auth_service_uuid = BT_UUID_INIT_128(
+        0xee, 0x8a, 0xcb, 0x07, 0x8d, 0xe1, 0xfc, 0x3b,
+        0xfe, 0x8e, 0x69, 0x22, 0x41, 0xbe, 0x87, 0x66);
+
+static struct bt_uuid_128 auth_challenge_uuid = BT_UUID_INIT_128(
+        0xd5, 0x12, 0x7b, 0x77, 0xce, 0xba, 0xa7, 0xb1,
+        0x86, 0x9a, 0x90, 0x47, 0x02, 0xc9, 0x3d, 0x95);
+
+static struct bt_uuid_128 auth_response_uuid = BT_UUID_INIT_128(
+        0x06, 0x3f, 0x0b, 0x51, 0xbf, 0x48, 0x4f, 0x95,
+        0x92, 0xd7, 0x28, 0x5c, 0xd6, 0xfd, 0xd2, 0x2f);
+
+static uint8_t challenge[BLAKE2S_BLOCKBYTES] = {0};
+static uint8_t response[BLAKE2S_OUTBYTES] = {0};
+
+static u16_t ccc_value;
+static struct bt_conn *session_conn = NULL;
+static u8_t session_coin = 0;
+static bool response_ready = false;
+static s64_t delivered_ms = 0; // when the central had the full response, 0 if not yet
+static struct k_delayed_work slow_work;
+
+static void ccc_cfg_changed(const struct bt_gatt_attr *attr, u16_t value) {
+    ARG_UNUSED(attr);
+    ccc_value = value;
+}
+
+static void indicate_cb(struct bt_conn *conn, const struct bt_gatt_attr *attr,
+                        u8_t err);
+
+static struct bt_gatt_indicate_params ind_params = {.data=response, .len=BLAKE2S_OUTBYTES, .attr=NULL, .func=&indicate_cb};
+
+static void indicate_cb(struct bt_conn *conn, const struct bt_gatt_attr *attr,
+                        u8_t err) {
+    ARG_UNUSED(attr);
+    ARG_UNUSED(conn);
+    if (err != 0U) {
+        LOG_ERR("indication fail: %i", err);
+    } else if (ind_params.len == BLAKE2S_OUTBYTES) {
+        // otherwise the central reads the rest
+        delivered_ms = k_uptime_get();
+    }
+}
+
+static ssize_t write_challenge(struct bt_conn *conn,
+                               const struct bt_gatt_attr *attr,
+                               const void *buf, u16_t len,
+                               u16_t offset, u8_t flags);
+
+static ssize_t read_response(struct bt_conn *conn,
+                             const struct bt_gatt_attr *attr,
+                             void *buf, u16_t len,
+                             u16_t offset) {
+    if (!response_ready) {
+        // a stalled coin never answers
+        return BT_GATT_ERR(BT_ATT_ERR_UNLIKELY);
+    }
+    ssize_t ret = bt_gatt_attr_read(conn, attr, buf, len, offset, response, BLAKE2S_OUTBYTES);
+    if (ret >= 0 && offset + ret == BLAKE2S_OUTBYTES) {
+        delivered_ms = k_uptime_get();
+    }
+    return ret;
+}
+
+BT_GATT_SERVICE_DEFINE(auth_svc,
+                       BT_GATT_PRIMARY_SERVICE(&auth_service_uuid),
+                       BT_GATT_CHARACTERISTIC(&auth_challenge_uuid.uuid, BT_GATT_CHRC_WRITE | BT_GATT_CHRC_AUTH,
+                                              BT_GATT_PERM_WRITE_AUTHEN | BT_GATT_PERM_WRITE_ENCRYPT,
+                                              NULL, write_challenge, challenge),
+                       BT_GATT_CHARACTERISTIC(&auth_response_uuid.uuid, BT_GATT_CHRC_READ | BT_GATT_CHRC_INDICATE,
+                                              BT_GATT_PERM_READ_AUTHEN | BT_GATT_PERM_READ_ENCRYPT,
+                                              read_response, NULL, response),
+                       BT_GATT_CCC(ccc_cfg_changed)
+);
+
+static const size_t INDICATION_PROTOCOL_OVERHEAD = 3;
+static const size_t AUTH_RESPONSE_CHR_VALUE_HANDLE = 4;
+
+static void respond(void) {
+    const struct swarm_coin *coin = &swarm_coins[session_coin];
+    uint8_t key[BLAKE2S_KEYBYTES];
+    memcpy(key, coin->spacekey, sizeof(key));
+    if (coin->fault == SWARM_FAULT_WRONG_KEY) {
+        key[0] ^= 0x01;
+    }
+    blake2s(response, BLAKE2S_OUTBYTES, challenge, BLAKE2S_BLOCKBYTES, key, BLAKE2S_KEYBYTES);
+    response_ready = true;
+    if (ccc_value == BT_GATT_CCC_INDICATE && session_conn) {
+        ind_params.attr = &auth_svc.attrs[AUTH_RESPONSE_CHR_VALUE_HANDLE];
+        u16_t mtu = bt_gatt_get_mtu(session_conn);
+        ind_params.len = MIN(mtu - INDICATION_PROTOCOL_OVERHEAD, BLAKE2S_OUTBYTES);
+        if (bt_gatt_indicate(NULL, &ind_params) != 0) {
+            LOG_ERR("indication failed to start");
+        }
+    }
+}
+
+static void slow_respond(struct k_work *work) {
+    ARG_UNUSED(work);
+    respond();
+}
+
+static ssize_t write_challenge(struct bt_conn *conn,
+                               const struct bt_gatt_attr *attr,
+                               const void *buf, u16_t len,
+                               u16_t offset, u8_t flags) {
+    ARG_UNUSED(conn);
+    ARG_UNUSED(attr);
+    ARG_UNUSED(flags);
+    if (offset + len > BLAKE2S_BLOCKBYTES) {
+        return BT_GATT_ERR(BT_ATT_ERR_INVALID_OFFSET);
+    }
+
+    memcpy(challenge + offset, buf, len);
+
+    if (offset + len == BLAKE2S_BLOCKBYTES) {
+        switch (swarm_coins[session_coin].fault) {
+            case SWARM_FAULT_STALL:
+                break;
+            case SWARM_FAULT_SLOW:
+                k_delayed_work_submit(&slow_work, K_MSEC(CONFIG_SWARM_SLOW_RESPONSE_MS));
+                break;
+            default:
+                respond();
+                break;
+        }
+    }
+
+    return len;
+}
+
+void auth_init(void) {
+    k_delayed_work_init(&slow_work, slow_respond);
+}
+
+void auth_begin(struct bt_conn *conn, u8_t coin) {
+    session_conn = conn;
+    session_coin = coin;
+    response_ready = false;
+    delivered_ms = 0;
+    (void) memset(response, 0, sizeof(response));
+}
+
+s64_t auth_end(void) {
+    k_delayed_work_cancel(&slow_work);
+    session_conn = NULL;
+    return delivered_ms;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <bluetooth/conn.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Initialize the Space Authentication Service shared by all coins of the swarm.
+ * The service answers with the spacekey (and the fault) of the coin the current connection belongs to.
+ */
+void auth_init(void);
+
+/**
+ * Start a session of a coin.
+ * @param conn connection of the coin
+ * @param coin index of the coin (its BT identity)
+ */
+void auth_begin(struct bt_conn *conn, u8_t coin);
+
+/**
+ * End the current session.
+ * @return uptime (ms) when the central had the full response, 0 if it never got it
+ */
+s64_t auth_end(void);
+
+#ifdef __cplusplus
+}
+#endif
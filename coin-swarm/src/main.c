@@ -0,0 +1,244 @@
+#include <zephyr.h>
+#include <math.h>
+#include <random/rand32.h>
+
+#include <bluetooth/bluetooth.h>
+#include <bluetooth/conn.h>
+#include <bluetooth/hci.h>
+
+#include <logging/log.h>
+
+LOG_MODULE_REGISTER(app);
+
+#ifdef CONFIG_ARCH_POSIX
+#include <posix_board_if.h>
+#endif
+
+#include "swarm.h"
+#include "provision.h"
+#include "auth.h"
+#include "report.h"
+
+// same advertising data as the coin firmware (battery level 100%)
+static const struct bt_data ad[] = {
+        BT_DATA_BYTES(BT_DATA_FLAGS, (BT_LE_AD_GENERAL | BT_LE_AD_NO_BREDR)),
+        BT_DATA_BYTES(BT_DATA_UUID16_ALL, 0x00, 0x18, 0x01, 0x18, 0x0f, 0x18),
+        BT_DATA_BYTES(BT_DATA_SVC_DATA16, 0x0f, 0x18, 100)
+};
+
+/*
+ * A coin is either sleeping until its next arrival, waiting (advertising in its slots) or in session.
+ * Only one coin can be connected at a time, like the central (CONFIG_BT_MAX_CONN=1).
+ */
+static struct {
+    s64_t next_arrival_ms;
+    s64_t arrival_ms; // 0 if not waiting
+} coins[CONFIG_BT_ID_MAX];
+
+static struct bt_conn *session_conn = NULL;
+static u8_t session_coin = 0;
+static int adv_coin = -1; // coin advertising in the current slot, -1 if none
+static u32_t arrivals = 0;
+static bool finished = false;
+
+static struct k_delayed_work slot_work;
+static struct k_delayed_work report_work;
+
+static s64_t next_arrival(s64_t now) {
+#if defined(CONFIG_SWARM_ARRIVAL_PERIODIC)
+    return now + CONFIG_SWARM_ARRIVAL_INTERVAL_MS;
+#elif defined(CONFIG_SWARM_ARRIVAL_BURST)
+    return (now / CONFIG_SWARM_ARRIVAL_INTERVAL_MS + 1) * CONFIG_SWARM_ARRIVAL_INTERVAL_MS;
+#else
+    // exponentially distributed, so arrivals of all coins form a Poisson process
+    float u = (float) (sys_rand32_get() >> 8) / (float) (1 << 24);
+    return now + (s64_t) (-logf(1.0f - u) * CONFIG_SWARM_ARRIVAL_INTERVAL_MS);
+#endif
+}
+
+static void finish(void) {
+    finished = true;
+    report_print();
+#ifdef CONFIG_ARCH_POSIX
+    posix_exit(0);
+#endif
+}
+
+// coin is done with this arrival (session ended or gave up), it comes back later
+static void depart(u8_t coin, report_result_t result, s64_t end_ms) {
+    report_result(coin, result, (u32_t) (end_ms - coins[coin].arrival_ms));
+    coins[coin].arrival_ms = 0;
+    coins[coin].next_arrival_ms = next_arrival(k_uptime_get());
+    if (CONFIG_SWARM_ARRIVALS && arrivals >= CONFIG_SWARM_ARRIVALS) {
+        for (size_t i = 0; i < swarm_coin_count; ++i) {
+            if (coins[i].arrival_ms) {
+                return;
+            }
+        }
+        finish();
+    }
+}
+
+static void adv_stop(void) {
+    if (adv_coin >= 0) {
+        bt_le_adv_stop();
+        adv_coin = -1;
+    }
+}
+
+/**
+ * slot timer callback function
+ * handles arrivals and give-ups and lets the next waiting coin advertise
+ * @param work
+ */
+static void slot(struct k_work *work) {
+    ARG_UNUSED(work);
+    if (finished) {
+        return;
+    }
+    s64_t now = k_uptime_get();
+    for (size_t i = 0; i < swarm_coin_count; ++i) {
+        if (!coins[i].arrival_ms && now >= coins[i].next_arrival_ms &&
+            (!CONFIG_SWARM_ARRIVALS || arrivals < CONFIG_SWARM_ARRIVALS)) {
+            coins[i].arrival_ms = now;
+            arrivals++;
+            report_arrival(i);
+        } else if (coins[i].arrival_ms && !(session_conn && session_coin == i) &&
+                   now - coins[i].arrival_ms > CONFIG_SWARM_GIVE_UP_MS) {
+            depart(i, REPORT_GAVE_UP, now);
+        }
+    }
+    if (!session_conn) {
+        // round robin over the waiting coins
+        int next = -1;
+        for (size_t n = 1; n <= swarm_coin_count; ++n) {
+            size_t i = (adv_coin + n + swarm_coin_count) % swarm_coin_count;
+            if (coins[i].arrival_ms) {
+                next = i;
+                break;
+            }
+        }
+        adv_stop();
+        if (next >= 0) {
+            struct bt_le_adv_param param = {
+                    .id = next,
+                    .options = BT_LE_ADV_OPT_CONNECTABLE,
+                    .interval_min = BT_GAP_ADV_FAST_INT_MIN_1,
+                    .interval_max = BT_GAP_ADV_FAST_INT_MAX_1,
+            };
+            int err = bt_le_adv_start(&param, ad, ARRAY_SIZE(ad), NULL, 0);
+            if (err) {
+                LOG_ERR("advertising of coin %d failed to start (err %d)", next, err);
+            } else {
+                adv_coin = next;
+            }
+        }
+    }
+    k_delayed_work_submit(&slot_work, K_MSEC(CONFIG_SWARM_ROTATE_MS));
+}
+
+static void report_timeout(struct k_work *work) {
+    ARG_UNUSED(work);
+    if (!finished) {
+        report_print();
+        k_delayed_work_submit(&report_work, K_SECONDS(CONFIG_SWARM_REPORT_INTERVAL_S));
+    }
+}
+
+/**
+ * gets called when connected to the central
+ * @param conn connection
+ * @param err error connecting
+ */
+static void connected(struct bt_conn *conn, u8_t err) {
+    // connectable advertising ends with the connection
+    adv_coin = -1;
+    if (err) {
+        LOG_ERR("connection failed (err %u)", err);
+        return;
+    }
+    struct bt_conn_info info;
+    bt_conn_get_info(conn, &info);
+    if (info.id >= swarm_coin_count || !coins[info.id].arrival_ms) {
+        LOG_ERR("connection of an unknown coin (id %u)", info.id);
+        bt_conn_disconnect(conn, BT_HCI_ERR_REMOTE_USER_TERM_CONN);
+        return;
+    }
+    session_conn = bt_conn_ref(conn);
+    session_coin = info.id;
+    auth_begin(conn, session_coin);
+    LOG_INF("coin %u connected after %u ms", session_coin,
+            (u32_t) (k_uptime_get() - coins[session_coin].arrival_ms));
+    int ret = bt_conn_set_security(conn, BT_SECURITY_L4);
+    if (ret) {
+        LOG_ERR("Kill connection: insufficient security %i", ret);
+        bt_conn_disconnect(conn, BT_HCI_ERR_REMOTE_USER_TERM_CONN);
+    }
+}
+
+/**
+ * gets called when disconnected from central
+ * ends the arrival of the connected coin
+ * @param conn
+ * @param reason
+ */
+static void disconnected(struct bt_conn *conn, u8_t reason) {
+    if (conn != session_conn) {
+        return;
+    }
+    s64_t delivered_ms = auth_end();
+    LOG_INF("coin %u disconnected (reason %u)", session_coin, reason);
+    bt_conn_unref(session_conn);
+    session_conn = NULL;
+    if (delivered_ms) {
+        depart(session_coin, REPORT_ANSWERED, delivered_ms);
+    } else {
+        depart(session_coin, REPORT_FAILED, k_uptime_get());
+    }
+}
+
+// collection of connection callbacks
+static struct bt_conn_cb conn_callbacks = {
+        .connected = connected,
+        .disconnected = disconnected,
+};
+
+/**
+ * gets called when the BLE stack is initialized
+ * @param err error while initializing
+ */
+static void bt_ready(int err) {
+    if (err) {
+        LOG_ERR("bluetooth init failed (err %d)", err);
+        return;
+    }
+    if (provision_load() != 0) {
+        return;
+    }
+    s64_t now = k_uptime_get();
+    for (size_t i = 0; i < swarm_coin_count; ++i) {
+#if defined(CONFIG_SWARM_ARRIVAL_PERIODIC)
+        // spread the coins over the interval
+        coins[i].next_arrival_ms = now + i * CONFIG_SWARM_ARRIVAL_INTERVAL_MS / swarm_coin_count;
+#elif defined(CONFIG_SWARM_ARRIVAL_BURST)
+        coins[i].next_arrival_ms = now;
+#else
+        coins[i].next_arrival_ms = next_arrival(now);
+#endif
+    }
+    k_delayed_work_submit(&slot_work, K_NO_WAIT);
+    k_delayed_work_submit(&report_work, K_SECONDS(CONFIG_SWARM_REPORT_INTERVAL_S));
+}
+
+void main(void) {
+    k_delayed_work_init(&slot_work, slot);
+    k_delayed_work_init(&report_work, report_timeout);
+    auth_init();
+
+    LOG_INF("turning BLE on");
+    if (bt_enable(bt_ready) != 0) {
+        return;
+    }
+    bt_conn_cb_register(&conn_callbacks);
+    bt_conn_auth_cb_register(NULL);
+}
@@ -0,0 +1,61 @@
+#include <zephyr.h>
+#include <settings/settings.h>
+
+#include <hci_core.h> //use of internal hci API for bt_dev
+#include <keys.h> //use of internal keys API for bt_keys
+
+#include "swarm.h"
+#include "provision.h"
+
+#include <logging/log.h>
+
+LOG_MODULE_REGISTER(provision);
+
+#include SWARM_COINS_INC
+
+const size_t swarm_coin_count = ARRAY_SIZE(swarm_coins);
+
+BUILD_ASSERT_MSG(ARRAY_SIZE(swarm_coins) <= CONFIG_BT_ID_MAX, "more coins than BT identities");
+BUILD_ASSERT_MSG(ARRAY_SIZE(swarm_coins) <= CONFIG_BT_MAX_PAIRED, "more coins than bond slots");
+
+static const char *const fault_names[] = {
+        [SWARM_FAULT_NONE] = "none",
+        [SWARM_FAULT_WRONG_KEY] = "wrong key",
+        [SWARM_FAULT_STALL] = "stall",
+        [SWARM_FAULT_SLOW] = "slow",
+};
+
+const char *swarm_fault_name(swarm_fault_t fault) {
+    return fault < SWARM_FAULTS ? fault_names[fault] : "unknown";
+}
+
+int provision_load(void) {
+    for (size_t i = 0; i < swarm_coin_count; ++i) {
+        const struct swarm_coin *coin = &swarm_coins[i];
+
+        // identity (what the bt settings handler does for "bt/id" and "bt/irk")
+        bt_addr_le_copy(&bt_dev.id_addr[i], &coin->addr);
+        memcpy(bt_dev.irk[i], coin->irk, sizeof(coin->irk));
+
+        // bond with the central, one per identity (what the bt settings handler does for "bt/keys/<addr>")
+        struct bt_keys *keys = bt_keys_get_addr(i, &swarm_central.addr);
+        if (!keys) {
+            LOG_ERR("no free slot for central keys of coin %u", (u32_t) i);
+            return -ENOMEM;
+        }
+        keys->keys = BT_KEYS_IRK | BT_KEYS_LTK_P256;
+        keys->flags = BT_KEYS_AUTHENTICATED | BT_KEYS_SC;
+        keys->enc_size = BT_ENC_KEY_SIZE_MAX;
+        memcpy(keys->irk.val, swarm_central.irk, sizeof(swarm_central.irk));
+        memcpy(keys->ltk.val, coin->ltk, sizeof(coin->ltk));
+
+        LOG_INF("coin %u: [%02X:%02X:%02X:%02X:%02X:%02X] fault: %s", (u32_t) i,
+                coin->addr.a.val[5], coin->addr.a.val[4], coin->addr.a.val[3],
+                coin->addr.a.val[2], coin->addr.a.val[1], coin->addr.a.val[0], swarm_fault_name(coin->fault));
+    }
+    bt_dev.id_count = swarm_coin_count;
+
+    LOG_INF("provisioned %u coins", (u32_t) swarm_coin_count);
+    // let the bt settings handler finish the stack initialization
+    return settings_commit();
+}
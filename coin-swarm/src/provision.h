@@ -0,0 +1,16 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Create one BT identity per coin of the swarm and its bond with the central.
+ * Like the key record of the coin, this replaces settings_load().
+ * @return 0 on success, -ENOMEM if the stack has too few identities or bond slots.
+ */
+int provision_load(void);
+
+#ifdef __cplusplus
+}
+#endif
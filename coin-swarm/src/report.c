@@ -0,0 +1,113 @@
+#include <zephyr.h>
+#include <stdlib.h>
+
+#include "swarm.h"
+#include "report.h"
+
+#include <logging/log.h>
+
+LOG_MODULE_REGISTER(report);
+
+static const char *const result_names[] = {
+        [REPORT_ANSWERED] = "answered",
+        [REPORT_FAILED] = "failed",
+        [REPORT_GAVE_UP] = "gave up",
+};
+
+static struct {
+    u32_t arrivals;
+    u32_t results[REPORT_RESULTS];
+} coins[CONFIG_BT_ID_MAX];
+
+// unlock latencies of coins without fault, the newest CONFIG_SWARM_LATENCY_SAMPLES
+static u32_t latencies[CONFIG_SWARM_LATENCY_SAMPLES];
+static u32_t latency_count = 0;
+
+void report_arrival(u8_t coin) {
+    coins[coin].arrivals++;
+}
+
+void report_result(u8_t coin, report_result_t result, u32_t latency_ms) {
+    coins[coin].results[result]++;
+    if (result == REPORT_ANSWERED && swarm_coins[coin].fault == SWARM_FAULT_NONE) {
+        latencies[latency_count++ % CONFIG_SWARM_LATENCY_SAMPLES] = latency_ms;
+    }
+    LOG_DBG("coin %u: %s after %u ms", coin, result_names[result], latency_ms);
+}
+
+static int compare_u32(const void *a, const void *b) {
+    u32_t x = *(const u32_t *) a, y = *(const u32_t *) b;
+    return (x > y) - (x < y);
+}
+
+static void print_latencies(void) {
+    static u32_t sorted[CONFIG_SWARM_LATENCY_SAMPLES];
+    u32_t n = MIN(latency_count, CONFIG_SWARM_LATENCY_SAMPLES);
+    if (!n) {
+        LOG_INF("unlock latency: no samples");
+        return;
+    }
+    memcpy(sorted, latencies, n * sizeof(sorted[0]));
+    qsort(sorted, n, sizeof(sorted[0]), compare_u32);
+    LOG_INF("unlock latency (%u samples): p50 %u ms, p95 %u ms, p99 %u ms, max %u ms", n,
+            sorted[n * 50 / 100], sorted[n * 95 / 100], sorted[n * 99 / 100], sorted[n - 1]);
+}
+
+/*
+ * Jain's fairness index of the unlock ratio (unlocks per arrival) of the coins without fault:
+ * 1.0 if every coin gets through equally often, 1/n if one coin gets all unlocks.
+ */
+static void print_fairness(void) {
+    u32_t n = 0;
+    float sum = 0, sum_sq = 0, min = 1, max = 0;
+    for (size_t i = 0; i < swarm_coin_count; ++i) {
+        if (swarm_coins[i].fault != SWARM_FAULT_NONE || !coins[i].arrivals) {
+            continue;
+        }
+        float ratio = (float) coins[i].results[REPORT_ANSWERED] / (float) coins[i].arrivals;
+        sum += ratio;
+        sum_sq += ratio * ratio;
+        min = MIN(min, ratio);
+        max = MAX(max, ratio);
+        n++;
+    }
+    if (!n || sum_sq == 0) {
+        LOG_INF("fairness: no unlocks");
+        return;
+    }
+    LOG_INF("fairness (Jain, %u coins): %u.%03u, unlock ratio min %u%%, max %u%%", n,
+            (u32_t) (sum * sum / (n * sum_sq)), (u32_t) (1000 * sum * sum / (n * sum_sq)) % 1000,
+            (u32_t) (100 * min), (u32_t) (100 * max));
+}
+
+void report_print(void) {
+    u32_t elapsed_s = (u32_t) (k_uptime_get() / 1000);
+    u32_t unlocks = 0;
+    for (size_t i = 0; i < swarm_coin_count; ++i) {
+        if (swarm_coins[i].fault == SWARM_FAULT_NONE) {
+            unlocks += coins[i].results[REPORT_ANSWERED];
+        }
+    }
+    LOG_INF("after %u s: %u unlocks, %u.%u per minute", elapsed_s, unlocks,
+            elapsed_s ? unlocks * 60 / elapsed_s : 0, elapsed_s ? unlocks * 600 / elapsed_s % 10 : 0);
+    print_latencies();
+    for (swarm_fault_t f = SWARM_FAULT_NONE; f < SWARM_FAULTS; ++f) {
+        u32_t arrivals = 0, results[REPORT_RESULTS] = {0};
+        for (size_t i = 0; i < swarm_coin_count; ++i) {
+            if (swarm_coins[i].fault != f) {
+                continue;
+            }
+            arrivals += coins[i].arrivals;
+            for (size_t r = 0; r < REPORT_RESULTS; ++r) {
+                results[r] += coins[i].results[r];
+            }
+        }
+        if (arrivals) {
+            LOG_INF("fault %s: %u arrivals, %u %s, %u %s, %u %s", swarm_fault_name(f), arrivals,
+                    results[REPORT_ANSWERED], result_names[REPORT_ANSWERED],
+                    results[REPORT_FAILED], result_names[REPORT_FAILED],
+                    results[REPORT_GAVE_UP], result_names[REPORT_GAVE_UP]);
+        }
+    }
+    print_fairness();
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <zephyr/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Outcome of one arrival of a coin.
+ */
+typedef enum report_result_t {
+    REPORT_ANSWERED = 0, // the central got the full response (an unlock for coins without fault)
+    REPORT_FAILED,       // connected, but disconnected before the central had the response
+    REPORT_GAVE_UP,      // not connected within CONFIG_SWARM_GIVE_UP_MS
+    REPORT_RESULTS
+} report_result_t;
+
+/**
+ * Record that a coin started advertising.
+ * @param coin index of the coin
+ */
+void report_arrival(u8_t coin);
+
+/**
+ * Record the outcome of an arrival.
+ * @param coin index of the coin
+ * @param result outcome
+ * @param latency_ms time from arrival to the full response (REPORT_ANSWERED) or to the end of the arrival
+ */
+void report_result(u8_t coin, report_result_t result, u32_t latency_ms);
+
+/**
+ * Log unlock throughput, latency percentiles, outcomes per fault and the fairness between the coins.
+ */
+void report_print(void);
+
+#ifdef __cplusplus
+}
+#endif
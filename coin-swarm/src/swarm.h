@@ -0,0 +1,53 @@
+#pragma once
+
+#include <zephyr/types.h>
+#include <bluetooth/bluetooth.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Faulty behaviour of an emulated coin.
+ */
+typedef enum swarm_fault_t {
+    SWARM_FAULT_NONE = 0,
+    SWARM_FAULT_WRONG_KEY, // response computed with a wrong spacekey
+    SWARM_FAULT_STALL,     // challenge accepted, but never answered
+    SWARM_FAULT_SLOW,      // response indicated after CONFIG_SWARM_SLOW_RESPONSE_MS
+    SWARM_FAULTS
+} swarm_fault_t;
+
+/**
+ * Keys of an emulated coin, the same as in its coins.txt line.
+ * The index in swarm_coins is the BT identity the coin advertises with.
+ */
+struct swarm_coin {
+    bt_addr_le_t addr;
+    u8_t irk[16];
+    u8_t ltk[16];
+    u8_t spacekey[32];
+    swarm_fault_t fault;
+};
+
+/**
+ * Identity of the central the coins are bonded to (central.txt).
+ */
+struct swarm_central {
+    bt_addr_le_t addr;
+    u8_t irk[16];
+};
+
+extern const struct swarm_coin swarm_coins[];
+extern const size_t swarm_coin_count;
+extern const struct swarm_central swarm_central;
+
+/**
+ * @param fault fault of a coin
+ * @return human-readable name of the fault
+ */
+const char *swarm_fault_name(swarm_fault_t fault);
+
+#ifdef __cplusplus
+}
+#endif
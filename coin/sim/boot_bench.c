@@ -0,0 +1,446 @@
+/*
+ * Host benchmark of the key loading at boot: the fixed key record (src/keyrecord.c, CONFIG_COIN_KEY_RECORD) against
+ * settings_load() on the FCB storage partition that prod/gen_bond.py writes.
+ * The key record path is the firmware source. The settings path is an emulation of what Zephyr 2.1 does on the coin:
+ * fcb_init() reads every sector header and walks the active sector to its end (CRC-8 of every entry),
+ * settings_load() walks all entries again, reads each name, looks up the handler ("bt", "space") and lets it parse
+ * the rest of the name and read the value. Both paths read from an emulated storage partition in RAM and end with
+ * settings_commit().
+ * Only the key loading is emulated: bt_enable(), the controller and the clock start-up are the same for both paths
+ * and are not part of the numbers.
+ *
+ * build: gcc -O2 -Isim/include -Isrc -o boot_bench sim/boot_bench.c src/keyrecord.c
+ * usage: ./boot_bench [-n boots] [-s stale entries] [-v]
+ *        -s: superseded entries before the live ones (a partition that was rewritten, default: 0 as from gen_bond.py)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <settings/settings.h>
+#include <storage/flash_map.h>
+#include <sys/crc.h>
+#include <hci_core.h>
+#include <keys.h>
+
+#include "keyrecord.h"
+#include "spaceauth.h"
+
+int sim_log = 0;
+
+// storage partition of the nrf52_coin board, FCB sectors are flash pages
+#define STORAGE_SIZE 0x6000
+#define SECTOR_SIZE 0x1000
+#define FCB_HEADER_SIZE 8
+#define FCB_MAGIC 0xc0ffeeee
+// read buffer of the FCB and the settings line functions
+#define READ_CHUNK 32
+
+/*
+ * emulated flash, counting the reads
+ */
+static u8_t storage[STORAGE_SIZE];
+static const struct flash_area storage_area = {DT_FLASH_AREA_STORAGE_ID, 0x32000, STORAGE_SIZE};
+static unsigned long flash_reads = 0, flash_bytes = 0;
+
+int flash_area_open(u8_t id, const struct flash_area **fa) {
+    if (id != DT_FLASH_AREA_STORAGE_ID) {
+        return -ENOENT;
+    }
+    *fa = &storage_area;
+    return 0;
+}
+
+int flash_area_read(const struct flash_area *fa, off_t off, void *dst, size_t len) {
+    if (off < 0 || off + len > fa->fa_size) {
+        return -EINVAL;
+    }
+    flash_reads++;
+    flash_bytes += len;
+    memcpy(dst, storage + off, len);
+    return 0;
+}
+
+void flash_area_close(const struct flash_area *fa) {
+    ARG_UNUSED(fa);
+}
+
+u32_t crc32_ieee(const u8_t *data, size_t len) {
+    u32_t crc = 0xffffffff;
+    for (size_t i = 0; i < len; ++i) {
+        crc ^= data[i];
+        for (int b = 0; b < 8; ++b) {
+            crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+        }
+    }
+    return ~crc;
+}
+
+// CRC-8-CCITT with initial value 0xff, as in fcb_elem_crc8() and gen_bond.py
+static u8_t crc8_ccitt(u8_t val, const u8_t *data, size_t len) {
+    for (size_t i = 0; i < len; ++i) {
+        val ^= data[i];
+        for (int b = 0; b < 8; ++b) {
+            val = (val & 0x80) ? (u8_t) ((val << 1) ^ 0x07) : (u8_t) (val << 1);
+        }
+    }
+    return val;
+}
+
+/*
+ * state the keys are loaded into
+ */
+struct bt_dev bt_dev;
+static struct bt_keys central_keys;
+static u8_t spacekey[32];
+static unsigned long commits = 0;
+
+struct bt_keys *bt_keys_get_addr(u8_t id, const bt_addr_le_t *addr) {
+    central_keys.id = id;
+    bt_addr_le_copy(&central_keys.addr, addr);
+    return &central_keys;
+}
+
+void space_auth_set_key(const uint8_t *key) {
+    memcpy(spacekey, key, sizeof(spacekey));
+}
+
+int settings_commit(void) {
+    commits++;
+    return 0;
+}
+
+/*
+ * keys of the benchmark coin
+ */
+static const bt_addr_le_t coin_addr = {1, {{0x11, 0x22, 0x33, 0x44, 0x55, 0xc6}}};
+static const bt_addr_le_t central_addr = {1, {{0xa1, 0xb2, 0xc3, 0xd4, 0xe5, 0xf6}}};
+static const u8_t coin_irk[16] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16};
+static const u8_t central_irk[16] = {16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1};
+static const u8_t ltk[16] = {0x42, 0x42, 0x42, 0x42, 0x42, 0x42, 0x42, 0x42, 0x42, 0x42, 0x42, 0x42, 0x42, 0x42};
+static const u8_t key[32] = {0x5a, 0x5a, 0x5a, 0x5a, 0x5a, 0x5a, 0x5a, 0x5a, 0x5a, 0x5a, 0x5a, 0x5a, 0x5a, 0x5a};
+
+// bt/keys value as written by gen_bond.py: enc_size, flags, keys, padding, rand, ediv, LTK, IRK, RPA
+#define BT_KEYS_VALUE_LEN 52
+#define BT_KEYS_LTK_OFF 14
+#define BT_KEYS_IRK_OFF 30
+
+/*
+ * FCB storage partition as written by gen_bond.py (periph_storage_partition())
+ */
+static size_t fcb_append(size_t off, const char *name, const u8_t *value, size_t value_len) {
+    size_t name_len = strlen(name);
+    size_t len = name_len + 1 + value_len;
+    u8_t *p = storage + off;
+    size_t hdr = len < 0x80 ? 1 : 2;
+    if (hdr == 1) {
+        p[0] = (u8_t) len;
+    } else {
+        p[0] = (u8_t) ((len & 0x7f) | 0x80);
+        p[1] = (u8_t) (len >> 7);
+    }
+    memcpy(p + hdr, name, name_len);
+    p[hdr + name_len] = '=';
+    memcpy(p + hdr + name_len + 1, value, value_len);
+    p[hdr + len] = crc8_ccitt(0xff, p, hdr + len);
+    return off + hdr + len + 1;
+}
+
+static void write_fcb_partition(int stale) {
+    memset(storage, 0xff, sizeof(storage));
+    const u8_t header[FCB_HEADER_SIZE] = {0xee, 0xee, 0xff, 0xc0, 0x01, 0xff, 0x00, 0x00};
+    memcpy(storage, header, sizeof(header));
+    size_t off = FCB_HEADER_SIZE;
+
+    u8_t id[7];
+    id[0] = coin_addr.type;
+    memcpy(id + 1, coin_addr.a.val, 6);
+    u8_t keys[BT_KEYS_VALUE_LEN] = {0x10, 0x11, '"', 0x00};
+    memcpy(keys + BT_KEYS_LTK_OFF, ltk, sizeof(ltk));
+    memcpy(keys + BT_KEYS_IRK_OFF, central_irk, sizeof(central_irk));
+    char keys_name[32];
+    snprintf(keys_name, sizeof(keys_name), "bt/keys/%02x%02x%02x%02x%02x%02x%u", central_addr.a.val[5],
+             central_addr.a.val[4], central_addr.a.val[3], central_addr.a.val[2], central_addr.a.val[1],
+             central_addr.a.val[0], central_addr.type);
+
+    // superseded values (e.g. CCC or keys rewritten by the stack) are walked like the live ones
+    for (int i = 0; i < stale; ++i) {
+        off = fcb_append(off, keys_name, keys, sizeof(keys));
+    }
+    off = fcb_append(off, "bt/id", id, sizeof(id));
+    off = fcb_append(off, "bt/irk", coin_irk, sizeof(coin_irk));
+    off = fcb_append(off, keys_name, keys, sizeof(keys));
+    fcb_append(off, "space/key", key, sizeof(key));
+}
+
+static void write_key_record(void) {
+    memset(storage, 0xff, sizeof(storage));
+    struct key_record record = {.magic = KEY_RECORD_MAGIC, .version = KEY_RECORD_VERSION};
+    memset(record.reserved, 0, sizeof(record.reserved));
+    bt_addr_le_copy(&record.id_addr, &coin_addr);
+    memcpy(record.id_irk, coin_irk, sizeof(coin_irk));
+    bt_addr_le_copy(&record.central_addr, &central_addr);
+    memcpy(record.central_irk, central_irk, sizeof(central_irk));
+    memcpy(record.ltk, ltk, sizeof(ltk));
+    memcpy(record.spacekey, key, sizeof(key));
+    record.crc = crc32_ieee((const u8_t *) &record, offsetof(struct key_record, crc));
+    memcpy(storage, &record, sizeof(record));
+}
+
+/*
+ * emulation of the FCB backend of the settings subsystem
+ */
+struct fcb_entry {
+    size_t sector;
+    size_t off;      // offset of the data in the partition
+    size_t len;
+};
+
+// reads the entry at off, checks its CRC-8 in chunks like fcb_elem_crc8(), false at the end of the sector
+static bool fcb_read_entry(size_t sector, size_t off, struct fcb_entry *entry) {
+    u8_t buf[READ_CHUNK];
+    size_t base = sector * SECTOR_SIZE;
+    if (off + 2 > SECTOR_SIZE || flash_area_read(&storage_area, base + off, buf, 2)) {
+        return false;
+    }
+    if (buf[0] == 0xff) {
+        return false;
+    }
+    size_t hdr = (buf[0] & 0x80) ? 2 : 1;
+    size_t len = (buf[0] & 0x80) ? ((buf[0] & 0x7f) | (buf[1] << 7)) : buf[0];
+    u8_t crc = crc8_ccitt(0xff, buf, hdr);
+    for (size_t done = 0; done < len; done += READ_CHUNK) {
+        size_t n = MIN(READ_CHUNK, len - done);
+        flash_area_read(&storage_area, base + off + hdr + done, buf, n);
+        crc = crc8_ccitt(crc, buf, n);
+    }
+    u8_t stored = 0;
+    flash_area_read(&storage_area, base + off + hdr + len, &stored, 1);
+    entry->sector = sector;
+    entry->off = base + off + hdr;
+    entry->len = len;
+    return stored == crc;
+}
+
+static size_t fcb_next(const struct fcb_entry *entry) {
+    return entry->off + entry->len + 1 - entry->sector * SECTOR_SIZE;
+}
+
+static bool fcb_sector_valid(size_t sector) {
+    u32_t magic;
+    flash_area_read(&storage_area, sector * SECTOR_SIZE, &magic, sizeof(magic));
+    return magic == FCB_MAGIC;
+}
+
+// fcb_init(): sector headers, then the active sector is walked to find the write position
+static int fcb_init_emulated(void) {
+    size_t active = 0;
+    bool found = false;
+    for (size_t s = 0; s < STORAGE_SIZE / SECTOR_SIZE; ++s) {
+        u8_t header[FCB_HEADER_SIZE];
+        flash_area_read(&storage_area, s * SECTOR_SIZE, header, sizeof(header));
+        if (fcb_sector_valid(s)) {
+            active = s;
+            found = true;
+        }
+    }
+    if (!found) {
+        return -ENOENT;
+    }
+    struct fcb_entry entry;
+    size_t off = FCB_HEADER_SIZE;
+    while (fcb_read_entry(active, off, &entry)) {
+        off = fcb_next(&entry);
+    }
+    return 0;
+}
+
+// read callback of the settings handlers
+static ssize_t read_value(const struct fcb_entry *entry, size_t name_len, void *dst, size_t len) {
+    size_t value_len = entry->len - name_len - 1;
+    len = MIN(len, value_len);
+    if (flash_area_read(&storage_area, entry->off + name_len + 1, dst, len)) {
+        return -EIO;
+    }
+    return (ssize_t) len;
+}
+
+// settings_name_steq(): true if name starts with key followed by '/' or '=', next points after the '/'
+static bool name_steq(const char *name, const char *key, const char **next) {
+    while (*key && *key == *name) {
+        key++;
+        name++;
+    }
+    if (*key) {
+        return false;
+    }
+    *next = (*name == '/') ? name + 1 : NULL;
+    return *name == '/' || *name == '=' || *name == '\0';
+}
+
+static int hex_byte(const char *s) {
+    int v = 0;
+    for (int i = 0; i < 2; ++i) {
+        char c = s[i];
+        v = v * 16 + ((c >= '0' && c <= '9') ? c - '0' : (c >= 'a' && c <= 'f') ? c - 'a' + 10 : -256);
+    }
+    return v;
+}
+
+// the "bt" handler of the host (bt/id, bt/irk, bt/keys/<addr><type>)
+static int bt_set(const char *next, const struct fcb_entry *entry, size_t name_len) {
+    const char *rest;
+    if (name_steq(next, "id", &rest)) {
+        u8_t id[7];
+        read_value(entry, name_len, id, sizeof(id));
+        bt_dev.id_addr[0].type = id[0];
+        memcpy(bt_dev.id_addr[0].a.val, id + 1, 6);
+        bt_dev.id_count = 1;
+        return 0;
+    }
+    if (name_steq(next, "irk", &rest)) {
+        return read_value(entry, name_len, bt_dev.irk[0], 16) == 16 ? 0 : -EINVAL;
+    }
+    if (name_steq(next, "keys", &rest) && rest) {
+        // bt_settings_decode_key()
+        bt_addr_le_t addr;
+        for (int i = 0; i < 6; ++i) {
+            int v = hex_byte(rest + 2 * i);
+            if (v < 0) {
+                return -EINVAL;
+            }
+            addr.a.val[5 - i] = (u8_t) v;
+        }
+        addr.type = (u8_t) (rest[12] - '0');
+        struct bt_keys *keys = bt_keys_get_addr(BT_ID_DEFAULT, &addr);
+        u8_t value[BT_KEYS_VALUE_LEN];
+        if (read_value(entry, name_len, value, sizeof(value)) != sizeof(value)) {
+            return -EINVAL;
+        }
+        keys->enc_size = value[0];
+        keys->flags = value[1];
+        keys->keys = (u16_t) (value[2] | (value[3] << 8));
+        memcpy(keys->ltk.val, value + BT_KEYS_LTK_OFF, 16);
+        memcpy(keys->irk.val, value + BT_KEYS_IRK_OFF, 16);
+        return 0;
+    }
+    return -ENOENT;
+}
+
+// the "space" handler of src/spaceauth.c
+static int space_set(const char *next, const struct fcb_entry *entry, size_t name_len) {
+    const char *rest;
+    if (name_steq(next, "key", &rest)) {
+        return read_value(entry, name_len, spacekey, sizeof(spacekey)) == sizeof(spacekey) ? 0 : -EINVAL;
+    }
+    return -ENOENT;
+}
+
+static const struct {
+    const char *name;
+    int (*set)(const char *next, const struct fcb_entry *entry, size_t name_len);
+} handlers[] = {{"bt", bt_set}, {"space", space_set}};
+
+// settings_line_load_cb(): name up to '=', handler lookup, value read by the handler
+static void settings_load_entry(const struct fcb_entry *entry) {
+    char name[READ_CHUNK + 1];
+    size_t n = MIN(entry->len, READ_CHUNK);
+    flash_area_read(&storage_area, entry->off, name, n);
+    name[n] = '\0';
+    char *eq = memchr(name, '=', n);
+    if (!eq) {
+        return;
+    }
+    *eq = '\0';
+    size_t name_len = (size_t) (eq - name);
+    for (size_t i = 0; i < ARRAY_SIZE(handlers); ++i) {
+        const char *next;
+        if (name_steq(name, handlers[i].name, &next) && next) {
+            handlers[i].set(next, entry, name_len);
+            return;
+        }
+    }
+}
+
+static int settings_load_emulated(void) {
+    // settings_subsys_init() with the FCB backend
+    int err = fcb_init_emulated();
+    if (err) {
+        return err;
+    }
+    // fcb_walk() from the oldest sector
+    for (size_t s = 0; s < STORAGE_SIZE / SECTOR_SIZE; ++s) {
+        if (!fcb_sector_valid(s)) {
+            continue;
+        }
+        struct fcb_entry entry;
+        size_t off = FCB_HEADER_SIZE;
+        while (fcb_read_entry(s, off, &entry)) {
+            settings_load_entry(&entry);
+            off = fcb_next(&entry);
+        }
+    }
+    return settings_commit();
+}
+
+static bool keys_loaded(void) {
+    return bt_dev.id_count == 1 && !memcmp(bt_dev.irk[0], coin_irk, sizeof(coin_irk)) &&
+           !memcmp(central_keys.ltk.val, ltk, sizeof(ltk)) &&
+           !memcmp(central_keys.irk.val, central_irk, sizeof(central_irk)) &&
+           !memcmp(spacekey, key, sizeof(key));
+}
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void run(const char *name, int (*load)(void), int boots) {
+    memset(&bt_dev, 0, sizeof(bt_dev));
+    memset(&central_keys, 0, sizeof(central_keys));
+    memset(spacekey, 0, sizeof(spacekey));
+    flash_reads = flash_bytes = commits = 0;
+    int err = load();
+    if (err || !keys_loaded()) {
+        printf("%-12s failed to load the keys (err %d)\n", name, err);
+        exit(1);
+    }
+    unsigned long reads = flash_reads, bytes = flash_bytes;
+    double start = now_ns();
+    for (int i = 0; i < boots; ++i) {
+        load();
+    }
+    double ns = (now_ns() - start) / boots;
+    printf("%-12s %10.2f %12lu %12lu\n", name, ns / 1000, reads, bytes);
+}
+
+int main(int argc, char **argv) {
+    int boots = 100000;
+    int stale = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:s:v")) != -1) {
+        switch (opt) {
+            case 'n':
+                boots = atoi(optarg);
+                break;
+            case 's':
+                stale = atoi(optarg);
+                break;
+            case 'v':
+                sim_log = 1;
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-n boots] [-s stale entries] [-v]\n", argv[0]);
+                return 1;
+        }
+    }
+    printf("key loading at boot, %d boots (host time, emulated flash)\n", boots);
+    printf("%-12s %10s %12s %12s\n", "path", "us/boot", "flash reads", "bytes read");
+    write_fcb_partition(stale);
+    run("settings/FCB", settings_load_emulated, boots);
+    write_key_record();
+    run("key record", keyrecord_load, boots);
+    return 0;
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <zephyr.h>
+
+typedef struct {
+    u8_t val[6];
+} bt_addr_t;
+
+typedef struct {
+    u8_t type;
+    bt_addr_t a;
+} bt_addr_le_t;
+
+#define BT_ID_DEFAULT 0
+
+static inline void bt_addr_le_copy(bt_addr_le_t *dst, const bt_addr_le_t *src) {
+    memcpy(dst, src, sizeof(*dst));
+}
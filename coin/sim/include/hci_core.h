@@ -0,0 +1,12 @@
+#pragma once
+// stand-in for the internal HCI core API of the Zephyr BLE host (subsys/bluetooth/host/hci_core.h)
+
+#include <bluetooth/bluetooth.h>
+
+struct bt_dev {
+    bt_addr_le_t id_addr[1];
+    u8_t id_count;
+    u8_t irk[1][16];
+};
+
+extern struct bt_dev bt_dev;
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <stdio.h>
+
+// set by the benchmark to print the log of the coin modules
+extern int sim_log;
+
+#define LOG_MODULE_REGISTER(name)
+#define SIM_LOG(...) do { if (sim_log) { printf(__VA_ARGS__); printf("\n"); } } while (0)
+#define LOG_ERR(...) SIM_LOG(__VA_ARGS__)
+#define LOG_WRN(...) SIM_LOG(__VA_ARGS__)
+#define LOG_INF(...) SIM_LOG(__VA_ARGS__)
+#define LOG_DBG(...) SIM_LOG(__VA_ARGS__)
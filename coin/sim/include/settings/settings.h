@@ -0,0 +1,6 @@
+#pragma once
+// stand-in for the settings API, the benchmark emulates the FCB backend itself
+
+#include <zephyr.h>
+
+int settings_commit(void);
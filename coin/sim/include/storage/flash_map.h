@@ -0,0 +1,17 @@
+#pragma once
+// stand-in for the flash map API, implemented by the benchmark on a RAM buffer
+
+#include <zephyr.h>
+
+// storage partition of the nrf52_coin board
+#define DT_FLASH_AREA_STORAGE_ID 4
+
+struct flash_area {
+    u8_t fa_id;
+    u32_t fa_off;
+    size_t fa_size;
+};
+
+int flash_area_open(u8_t id, const struct flash_area **fa);
+int flash_area_read(const struct flash_area *fa, off_t off, void *dst, size_t len);
+void flash_area_close(const struct flash_area *fa);
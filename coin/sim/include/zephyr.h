@@ -0,0 +1,22 @@
+#pragma once
+// minimal stand-in for the Zephyr API used by the host benchmark of the coin (implemented in sim/boot_bench.c)
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/types.h>
+
+typedef int8_t s8_t;
+typedef uint8_t u8_t;
+typedef uint16_t u16_t;
+typedef uint32_t u32_t;
+typedef int32_t s32_t;
+typedef int64_t s64_t;
+
+#define ARRAY_SIZE(array) (sizeof(array) / sizeof((array)[0]))
+#define ARG_UNUSED(x) (void)(x)
+#define MIN(a, b) (((a) < (b)) ? (a) : (b))
+#define __packed __attribute__((__packed__))
+#define BIT(n) (1UL << (n))
@@ -0,0 +1,161 @@
+#include <zephyr.h>
+#include <bluetooth/bluetooth.h>
+#include <bluetooth/conn.h>
+
+#include "adv.h"
+#include "energy.h"
+#ifdef CONFIG_COIN_TX_POWER
+#include "txpower.h"
+#endif
+
+#include <logging/log.h>
+
+LOG_MODULE_REGISTER(adv);
+
+typedef enum adv_phase_t {
+    ADV_FAST = 0,
+    ADV_SLOW,
+    ADV_IDLE
+} adv_phase_t;
+
+/*
+ * Estimated on-air time of one advertising event (3 channels) and the average spacing of events.
+ * ADV_IND: 1B preamble + 4B access address + 2B header + 6B address + 16B AD + 3B CRC = 32B = 256us @1M
+ * Undirected events are delayed by a random advDelay of 0..10ms (5ms on average).
+ * After each packet the radio listens for a connection request (T_IFS + access address, ~200us), with a TX and an RX
+ * ramp-up per channel.
+ */
+#define ADV_EVENT_RX_US (3 * 200)
+#define ADV_EVENT_RAMPS 6
+static const struct {
+    const char *name;
+    u32_t event_interval_us;
+    u32_t event_airtime_us;
+} phase_info[] = {
+        [ADV_FAST] = {"fast", 45000 + 5000, 3 * 256},
+        [ADV_SLOW] = {"slow", 125000 + 5000, 3 * 256},
+};
+
+// duration of the fast undirected phase
+static const int fast_adv_ms = 3000;
+
+// fast undirected advertising (30ms - 60ms)
+#define BT_LE_ADV_CONN_FAST BT_LE_ADV_PARAM(BT_LE_ADV_OPT_CONNECTABLE, \
+                                            BT_GAP_ADV_FAST_INT_MIN_1, \
+                                            BT_GAP_ADV_FAST_INT_MAX_1)
+// slow undirected advertising (100ms - 150ms, previous default)
+#define BT_LE_ADV_CONN_SLOW BT_LE_ADV_PARAM(BT_LE_ADV_OPT_CONNECTABLE, \
+                                            BT_GAP_ADV_FAST_INT_MIN_2, \
+                                            BT_GAP_ADV_FAST_INT_MAX_2)
+
+static adv_phase_t phase = ADV_IDLE;
+static s64_t phase_start_ms = 0;
+static u32_t phase_ms[ADV_IDLE] = {0};
+// TX power of each phase
+static s8_t phase_dbm[ADV_IDLE] = {0};
+static u8_t attempt = 0;
+
+static const struct bt_data *adv_data = NULL;
+static size_t adv_data_len = 0;
+
+static struct k_delayed_work phase_timer;
+
+// close bookkeeping of the current phase and enter the next one
+static void enter_phase(adv_phase_t next) {
+    s64_t now = k_uptime_get();
+    if (phase != ADV_IDLE) {
+        phase_ms[phase] += (u32_t) (now - phase_start_ms);
+    }
+    phase = next;
+    phase_start_ms = now;
+#ifdef CONFIG_COIN_TX_POWER
+    if (next != ADV_IDLE) {
+        phase_dbm[next] = txpower_advertising(attempt++);
+    }
+#endif
+}
+
+static void start_undirected(adv_phase_t next) {
+    int err;
+    enter_phase(next);
+    if (next == ADV_FAST) {
+        err = bt_le_adv_start(BT_LE_ADV_CONN_FAST, adv_data, adv_data_len, NULL, 0);
+        k_delayed_work_submit(&phase_timer, K_MSEC(fast_adv_ms));
+    } else {
+        err = bt_le_adv_start(BT_LE_ADV_CONN_SLOW, adv_data, adv_data_len, NULL, 0);
+    }
+    if (err) {
+        LOG_ERR("%s advertising failed to start (err %d)", phase_info[next].name, err);
+    } else {
+        LOG_INF("%s advertising", phase_info[next].name);
+    }
+}
+
+/**
+ * phase timer callback function
+ * switches from fast to slow undirected advertising
+ * @param work
+ */
+static void phase_timeout(struct k_work *work) {
+    ARG_UNUSED(work);
+    if (phase == ADV_FAST) {
+        bt_le_adv_stop();
+        start_undirected(ADV_SLOW);
+    }
+}
+
+void adv_start(const struct bt_data *ad, size_t ad_len) {
+    adv_data = ad;
+    adv_data_len = ad_len;
+    k_delayed_work_init(&phase_timer, phase_timeout);
+    LOG_INF("boot-to-advertising: %u ms", (u32_t) k_uptime_get());
+    start_undirected(ADV_FAST);
+}
+
+void adv_update_data(const struct bt_data *ad, size_t ad_len) {
+    adv_data = ad;
+    adv_data_len = ad_len;
+    if (phase == ADV_FAST || phase == ADV_SLOW) {
+        int err = bt_le_adv_update_data(adv_data, adv_data_len, NULL, 0);
+        if (err) {
+            LOG_ERR("advertising data update failed (err %d)", err);
+        }
+    }
+}
+
+static void log_stats(void) {
+    u32_t total_us = 0;
+    for (size_t i = 0; i < ARRAY_SIZE(phase_ms); ++i) {
+        u32_t events = phase_ms[i] * 1000U / phase_info[i].event_interval_us;
+        u32_t airtime_us = events * phase_info[i].event_airtime_us;
+        total_us += airtime_us;
+        energy_adv(phase_dbm[i], events, phase_info[i].event_airtime_us, ADV_EVENT_RX_US, ADV_EVENT_RAMPS);
+        LOG_INF("adv %s: %u ms, ~%u us airtime at %d dBm", phase_info[i].name, phase_ms[i], airtime_us, phase_dbm[i]);
+    }
+    LOG_INF("adv total: ~%u us airtime", total_us);
+}
+
+void adv_connected(struct bt_conn *conn, u8_t err) {
+    ARG_UNUSED(conn);
+    adv_phase_t old_phase = phase;
+    if (old_phase == ADV_IDLE) {
+        return;
+    }
+    k_delayed_work_cancel(&phase_timer);
+    enter_phase(ADV_IDLE);
+    if (!err) {
+        LOG_INF("button-to-connection latency: %u ms (%s advertising)",
+                (u32_t) k_uptime_get(), phase_info[old_phase].name);
+        log_stats();
+    }
+}
+
+void adv_stop(void) {
+    if (phase == ADV_IDLE) {
+        return;
+    }
+    k_delayed_work_cancel(&phase_timer);
+    bt_le_adv_stop();
+    enter_phase(ADV_IDLE);
+    log_stats();
+}
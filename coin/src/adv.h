@@ -0,0 +1,39 @@
+#pragma once
+
+#include <bluetooth/bluetooth.h>
+#include <bluetooth/conn.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Start the advertising sequence: fast undirected advertising, then slow undirected advertising until the device
+ * shuts down.
+ * @param ad advertising data used for the undirected phases
+ * @param ad_len number of elements in ad
+ */
+void adv_start(const struct bt_data *ad, size_t ad_len);
+
+/**
+ * Replace the advertising data, it is pushed to the controller if undirected advertising is running.
+ * @param ad advertising data used for the undirected phases
+ * @param ad_len number of elements in ad
+ */
+void adv_update_data(const struct bt_data *ad, size_t ad_len);
+
+/**
+ * Notify the advertising sequence about a (failed) connection.
+ * @param conn connection
+ * @param err error connecting
+ */
+void adv_connected(struct bt_conn *conn, u8_t err);
+
+/**
+ * Stop advertising and log time and estimated airtime spent in each phase.
+ */
+void adv_stop(void);
+
+#ifdef __cplusplus
+}
+#endif
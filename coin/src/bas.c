@@ -5,13 +5,21 @@
 #include <device.h>
 #include <gpio.h>
 #include <adc.h>
+#if defined(CONFIG_SOC_SERIES_NRF51X)
+#include <hal/nrf_adc.h>
+#else
 #include <hal/nrf_saadc.h>
+#endif
 
 #include <logging/log.h>
 
 LOG_MODULE_REGISTER(bas);
 
 static u8_t battery = 0U;
+// false until the first measurement of the wake is done
+static bool measured = false;
+// the level cannot be measured in this wake
+static bool failed = false;
 static struct device *adc_dev = NULL;
 
 #define ADC_DEVICE_NAME DT_ADC_0_NAME
@@ -20,10 +28,25 @@ static struct device *adc_dev = NULL;
 #define ADC_REFERENCE ADC_REF_INTERNAL
 #define ADC_ACQUISITION_TIME ADC_ACQ_TIME_DEFAULT
 #define ADC_1ST_CHANNEL_ID 0
+#if defined(CONFIG_SOC_SERIES_NRF51X)
+// ADC: 1/3 prescaling against the 1.2V band gap (3.6V full scale), no oversampling in the driver
+// battery detect is P0.01 (boards/arm/nrf51_coin/README.md), which is AIN2 of the nRF51822
+// the circuit in front of the pin is not documented, the percentage assumes the same as on the nRF52 coin (unchecked)
+#define ADC_1ST_CHANNEL_INPUT NRF_ADC_CONFIG_INPUT_2
+#define ADC_FULL_SCALE_MV 3600
+#define ADC_OVERSAMPLING false
+typedef nrf_adc_value_t adc_value_t;
+#else
+// SAADC: gain 1/3 against the 0.6V reference (1.8V full scale)
 #define ADC_1ST_CHANNEL_INPUT NRF_SAADC_INPUT_AIN0
+#define ADC_FULL_SCALE_MV 1800
+#define ADC_OVERSAMPLING true
+typedef nrf_saadc_value_t adc_value_t;
+#endif
 
 #define BAT_LOW 3
 #define BAT_PORT DT_ALIAS_LED0_GPIOS_CONTROLLER
+#define BATT_SAMPLES 4
 
 static const struct adc_channel_cfg m_1st_channel_cfg = {
         .gain = ADC_GAIN,
@@ -33,59 +56,121 @@ static const struct adc_channel_cfg m_1st_channel_cfg = {
         .input_positive = ADC_1ST_CHANNEL_INPUT,
 };
 
-static struct device *init_adc(void) {
-    int ret;
+static int init_adc(void) {
     adc_dev = device_get_binding(ADC_DEVICE_NAME);
-
     if (!adc_dev) {
         LOG_ERR("couldn't get ADC dev binding");
+        return -ENODEV;
     }
 
-    ret = adc_channel_setup(adc_dev, &m_1st_channel_cfg);
+    int ret = adc_channel_setup(adc_dev, &m_1st_channel_cfg);
     if (ret != 0) {
         LOG_ERR("adc channel config failed with code %i", ret);
+        adc_dev = NULL;
     }
-
-    return adc_dev;
+    return ret;
 }
 
-static u8_t get_batt_percentage() {
+static adc_value_t samples[BATT_SAMPLES] = {0};
+static struct k_poll_signal adc_signal;
+static struct k_work adc_done_work;
+static void (*done_cb)(u8_t level) = NULL;
+
+static void set_divider(bool enable) {
     struct device *dev = device_get_binding(BAT_PORT);
-    gpio_pin_configure(dev, BAT_LOW, GPIO_DIR_OUT);
-    gpio_pin_write(dev, BAT_LOW, 0);
-    nrf_saadc_value_t val = 0;
-    if (!adc_dev) {
-        LOG_ERR("OH NOES! NO ADC AVAILABLE!");
+    if (enable) {
+        gpio_pin_configure(dev, BAT_LOW, GPIO_DIR_OUT);
+        gpio_pin_write(dev, BAT_LOW, 0);
     } else {
-        int ret;
-        const struct adc_sequence sequence = {
-                .channels = BIT(ADC_1ST_CHANNEL_ID),
-                .buffer = &val,
-                .buffer_size = sizeof(nrf_saadc_value_t),
-                .resolution = ADC_RESOLUTION,
-                .oversampling = true,
-        };
-        ret = adc_read(adc_dev, &sequence);
-        if (ret != 0) {
-            LOG_ERR("ADC read failed with code %i", ret);
-        }
+        gpio_pin_configure(dev, BAT_LOW, GPIO_DIR_IN);
     }
-    gpio_pin_configure(dev, BAT_LOW, GPIO_DIR_IN);
+}
+
+// 0.3515625 (45/128) percent per LSB of the SAADC, in integers (no soft float library)
+static u8_t to_batt_percentage(s32_t val) {
+    s32_t batt_percentage = val * 45 * (ADC_FULL_SCALE_MV / 1800) / 128 - 200;
+    return batt_percentage < 0 ? 0 :
+           batt_percentage > 100 ? 100 :
+           (u8_t) batt_percentage;
+}
 
+/**
+ * finishes a measurement (runs in the system work queue)
+ * averages the samples, releases the resistor divider and reports the level
+ * @param work
+ */
+static void adc_done(struct k_work *work) {
+    ARG_UNUSED(work);
+    set_divider(false);
+    s32_t sum = 0;
+    for (size_t i = 0; i < BATT_SAMPLES; ++i) {
+        sum += samples[i];
+    }
+    s32_t val = sum / BATT_SAMPLES;
     LOG_INF("read ADC val: %i", val);
+    battery = to_batt_percentage(val);
+    measured = true;
+    if (done_cb) {
+        done_cb(battery);
+    }
+}
 
-    float batt_percentage_f = 0.3515625f * (float) val - 200;
-    u8_t batt_percentage =
-            batt_percentage_f < 0 ? 0 :
-            batt_percentage_f > 100 ? 100 :
-            (u8_t) batt_percentage_f;
-    return batt_percentage;
+// gets called in ISR context after every sampling of the sequence
+static enum adc_action adc_sample_cb(struct device *dev, const struct adc_sequence *sequence,
+                                     u16_t sampling_index) {
+    ARG_UNUSED(dev);
+    ARG_UNUSED(sequence);
+    if (sampling_index == BATT_SAMPLES - 1) {
+        k_work_submit(&adc_done_work);
+    }
+    return ADC_ACTION_CONTINUE;
+}
+
+static const struct adc_sequence_options sequence_options = {
+        .interval_us = 0,
+        .callback = adc_sample_cb,
+        .extra_samplings = BATT_SAMPLES - 1,
+};
+
+static const struct adc_sequence sequence = {
+        .options = &sequence_options,
+        .channels = BIT(ADC_1ST_CHANNEL_ID),
+        .buffer = samples,
+        .buffer_size = sizeof(samples),
+        .resolution = ADC_RESOLUTION,
+        .oversampling = ADC_OVERSAMPLING,
+};
+
+// starts a measurement without waiting for it to finish, falls back to waiting for it
+static int start_measurement(void) {
+    if (!adc_dev) {
+        LOG_ERR("OH NOES! NO ADC AVAILABLE!");
+        return -ENODEV;
+    }
+    set_divider(true);
+    k_poll_signal_init(&adc_signal);
+    int ret = adc_read_async(adc_dev, &sequence, &adc_signal);
+    if (ret != 0) {
+        // the sampling callback finishes the measurement as well (about 100 us)
+        LOG_WRN("ADC async read failed with code %i, reading synchronously", ret);
+        ret = adc_read(adc_dev, &sequence);
+    }
+    if (ret != 0) {
+        LOG_ERR("ADC read failed with code %i", ret);
+        set_divider(false);
+    }
+    return ret;
 }
 
 static ssize_t read_blvl(struct bt_conn *conn, const struct bt_gatt_attr *attr,
                          void *buf, u16_t len, u16_t offset) {
-    battery = get_batt_percentage();
-
+    // served from the level measured at boot, the ADC is sampled at most once per wake
+    if (failed) {
+        return BT_GATT_ERR(BT_ATT_ERR_UNLIKELY);
+    }
+    if (!measured) {
+        return BT_GATT_ERR(BT_ATT_ERR_PROCEDURE_IN_PROGRESS);
+    }
     const char *value = (const char *) &battery;
 
     return bt_gatt_attr_read(conn, attr, buf, len, offset, value,
@@ -100,9 +185,15 @@ BT_GATT_SERVICE_DEFINE(bas_svc,
                                               BT_GATT_PERM_READ, read_blvl, NULL, &battery),
 );
 
-uint8_t bas_init() {
+int bas_init(void (*level_cb)(u8_t level)) {
     LOG_INF("initialize battery service");
-    init_adc();
-    battery = get_batt_percentage();
-    return battery;
+    done_cb = level_cb;
+    k_work_init(&adc_done_work, adc_done);
+    int err = init_adc();
+    if (!err) {
+        err = start_measurement();
+    }
+    // the level stays unknown, reads fail instead of waiting for it
+    failed = err != 0;
+    return err;
 }
@@ -5,11 +5,16 @@ extern "C" {
 #endif
 
 /**
- * Initialize Battery Service.
+ * Initialize Battery Service and start measuring the battery level in the background.
  * This implementation directly uses the ADC with the on-board resistor divider to measure battery level.
- * @return initially measured battery level
+ * The level is measured once per wake, GATT reads are served from that value
+ * (and fail with Procedure Already in Progress until it is measured).
+ * If the ADC cannot sample in the background, it is read synchronously. If that fails too, the level is unknown:
+ * level_cb is not called and GATT reads fail with Unlikely Error.
+ * @param level_cb gets called from the system work queue when the measurement is done
+ * @return 0 if the measurement was started or done, else error code of the ADC
  */
-uint8_t bas_init();
+int bas_init(void (*level_cb)(u8_t level));
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,102 @@
+#include <zephyr.h>
+#include <bluetooth/conn.h>
+
+#include "energy.h"
+
+#include <logging/log.h>
+
+LOG_MODULE_REGISTER(energy);
+
+/*
+ * Typical radio currents from the product specifications (1 Mbps, 3 V), in uA.
+ * The nRF52832 numbers depend on the regulator, the coin board runs the LDO unless BOARD_ENABLE_DCDC is set.
+ * These are estimates to compare TX power settings, not a measurement of the coin.
+ */
+static const struct {
+    s8_t dbm;
+    u16_t tx_ua;
+} tx_current[] = {
+#if defined(CONFIG_SOC_SERIES_NRF51X)
+        {4, 16000}, {0, 10500}, {-4, 9600}, {-8, 9200}, {-12, 8700}, {-16, 8400}, {-20, 8000}, {-30, 7000},
+#elif defined(CONFIG_SOC_DCDC_NRF52X)
+        {4, 7500}, {0, 5300}, {-4, 4200}, {-8, 3800}, {-12, 3500}, {-16, 3300}, {-20, 3200}, {-40, 2700},
+#else
+        {4, 16600}, {0, 11600}, {-4, 9300}, {-8, 8400}, {-12, 7700}, {-16, 7300}, {-20, 7000}, {-40, 5900},
+#endif
+};
+
+#if defined(CONFIG_SOC_SERIES_NRF51X)
+#define RX_CURRENT_UA 13000
+#elif defined(CONFIG_SOC_DCDC_NRF52X)
+#define RX_CURRENT_UA 5400
+#else
+#define RX_CURRENT_UA 11700
+#endif
+// the radio draws about the receive current while it ramps up (TXEN/RXEN to READY)
+#define RAMP_UP_US 140
+#define SUPPLY_MV 3000
+
+/*
+ * Connection event of the peripheral: receive the packet of the central (empty PDU, 80us, plus the window widening
+ * of the sleep clock), transmit the answer (empty PDU, 80us). The few data packets of a session are not counted.
+ */
+#define CONN_EVENT_RX_US 140
+#define CONN_EVENT_TX_US 80
+
+static u32_t adv_nj = 0;
+static u32_t conn_nj = 0;
+static s8_t conn_dbm = 0;
+static u32_t conn_interval_us = 0;
+static s64_t conn_since_ms = -1;
+
+static u32_t tx_ua(s8_t dbm) {
+    for (size_t i = 0; i < ARRAY_SIZE(tx_current); ++i) {
+        if (dbm >= tx_current[i].dbm) {
+            return tx_current[i].tx_ua;
+        }
+    }
+    return tx_current[ARRAY_SIZE(tx_current) - 1].tx_ua;
+}
+
+// energy in nJ of some events
+static u32_t events_nj(s8_t dbm, u32_t events, u32_t tx_us, u32_t rx_us, u32_t ramps) {
+    u64_t ua_us = (u64_t) tx_ua(dbm) * tx_us + (u64_t) RX_CURRENT_UA * (rx_us + ramps * RAMP_UP_US);
+    return (u32_t) (ua_us * events * SUPPLY_MV / 1000000U);
+}
+
+void energy_adv(s8_t dbm, u32_t events, u32_t tx_us, u32_t rx_us, u32_t ramps) {
+    adv_nj += events_nj(dbm, events, tx_us, rx_us, ramps);
+}
+
+// account the connection events since the last change
+static void account_conn(void) {
+    s64_t now = k_uptime_get();
+    if (conn_since_ms < 0 || !conn_interval_us) {
+        return;
+    }
+    u32_t events = (u32_t) (now - conn_since_ms) * 1000U / conn_interval_us;
+    conn_nj += events_nj(conn_dbm, events, CONN_EVENT_TX_US, CONN_EVENT_RX_US, 2);
+    // the rest of an interval is accounted with the next change
+    conn_since_ms += (s64_t) events * conn_interval_us / 1000U;
+}
+
+void energy_conn_start(struct bt_conn *conn) {
+    struct bt_conn_info info;
+    conn_interval_us = 0;
+    if (bt_conn_get_info(conn, &info) == 0) {
+        conn_interval_us = info.le.interval * 1250U;
+    }
+    conn_since_ms = k_uptime_get();
+}
+
+void energy_tx_power(s8_t dbm) {
+    account_conn();
+    conn_dbm = dbm;
+}
+
+void energy_conn_end(void) {
+    account_conn();
+    conn_since_ms = -1;
+    LOG_INF("radio energy: adv ~%u uJ, connection ~%u uJ, total ~%u uJ", adv_nj / 1000U, conn_nj / 1000U,
+            (adv_nj + conn_nj) / 1000U);
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <zephyr/types.h>
+#include <bluetooth/conn.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Account radio activity of the advertising phases.
+ * @param dbm TX power of the phase
+ * @param events number of advertising events
+ * @param tx_us transmit time of one event
+ * @param rx_us receive time of one event (listening for CONNECT_IND)
+ * @param ramps radio ramp-ups of one event
+ */
+void energy_adv(s8_t dbm, u32_t events, u32_t tx_us, u32_t rx_us, u32_t ramps);
+
+/**
+ * Start accounting the connection events of a connection.
+ * @param conn connection (for the connection interval)
+ */
+void energy_conn_start(struct bt_conn *conn);
+
+/**
+ * Change the TX power of the connection, the events so far are accounted at the previous power.
+ * @param dbm TX power
+ */
+void energy_tx_power(s8_t dbm);
+
+/**
+ * Account the remaining connection events and log the radio energy of this wake (estimate from the time in
+ * each state and typical currents of the product specification).
+ */
+void energy_conn_end(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,70 @@
+#include <zephyr.h>
+#include <settings/settings.h>
+#include <storage/flash_map.h>
+#include <sys/crc.h>
+
+#include <hci_core.h> //use of internal hci API for bt_dev
+#include <keys.h> //use of internal keys API for bt_keys
+
+#include "keyrecord.h"
+#include "spaceauth.h"
+
+#include <logging/log.h>
+
+LOG_MODULE_REGISTER(keyrecord);
+
+static int read_record(struct key_record *record) {
+    const struct flash_area *fap;
+    int err = flash_area_open(DT_FLASH_AREA_STORAGE_ID, &fap);
+    if (err) {
+        LOG_ERR("cannot open storage partition (err %d)", err);
+        return -EIO;
+    }
+    err = flash_area_read(fap, 0, record, sizeof(*record));
+    flash_area_close(fap);
+    if (err) {
+        LOG_ERR("cannot read key record (err %d)", err);
+        return -EIO;
+    }
+    if (record->magic != KEY_RECORD_MAGIC || record->version != KEY_RECORD_VERSION) {
+        LOG_ERR("no key record found");
+        return -EINVAL;
+    }
+    if (crc32_ieee((const u8_t *) record, offsetof(struct key_record, crc)) != record->crc) {
+        LOG_ERR("key record CRC check failed");
+        return -EINVAL;
+    }
+    return 0;
+}
+
+int keyrecord_load(void) {
+    struct key_record record;
+    int err = read_record(&record);
+    if (err) {
+        return err;
+    }
+
+    // identity (what the bt settings handler does for "bt/id" and "bt/irk")
+    bt_addr_le_copy(&bt_dev.id_addr[BT_ID_DEFAULT], &record.id_addr);
+    memcpy(bt_dev.irk[BT_ID_DEFAULT], record.id_irk, sizeof(record.id_irk));
+    bt_dev.id_count = 1;
+
+    // bond with the central (what the bt settings handler does for "bt/keys/<addr>")
+    struct bt_keys *keys = bt_keys_get_addr(BT_ID_DEFAULT, &record.central_addr);
+    if (!keys) {
+        LOG_ERR("no free slot for central keys");
+        return -ENOMEM;
+    }
+    keys->keys = BT_KEYS_IRK | BT_KEYS_LTK_P256;
+    keys->flags = BT_KEYS_AUTHENTICATED | BT_KEYS_SC;
+    keys->enc_size = BT_ENC_KEY_SIZE_MAX;
+    memcpy(keys->irk.val, record.central_irk, sizeof(record.central_irk));
+    memcpy(keys->ltk.val, record.ltk, sizeof(record.ltk));
+
+    space_auth_set_key(record.spacekey);
+    (void) memset(&record, 0, sizeof(record));
+
+    LOG_INF("loaded key record");
+    // let the bt settings handler finish the stack initialization
+    return settings_commit();
+}
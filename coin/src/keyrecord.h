@@ -0,0 +1,39 @@
+#pragma once
+
+#include <zephyr/types.h>
+#include <bluetooth/bluetooth.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define KEY_RECORD_MAGIC 0x4e494f43 /* "COIN" */
+#define KEY_RECORD_VERSION 1
+
+/**
+ * Fixed-layout key record at the start of the storage partition.
+ * Written by prod/gen_bond.py (--key-record), all values little endian.
+ */
+struct key_record {
+    u32_t magic;
+    u8_t version;
+    u8_t reserved[3];
+    bt_addr_le_t id_addr;
+    u8_t id_irk[16];
+    bt_addr_le_t central_addr;
+    u8_t central_irk[16];
+    u8_t ltk[16];
+    u8_t spacekey[32];
+    u32_t crc; /* CRC-32 (IEEE) of all previous bytes */
+} __packed;
+
+/**
+ * Load the BLE identity, the bond with the central and the spacekey from the key record.
+ * This replaces settings_load() and does not walk the settings storage.
+ * @return 0 on success, -EIO if the flash cannot be read, -EINVAL if the record is invalid.
+ */
+int keyrecord_load(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -16,6 +16,15 @@ LOG_MODULE_REGISTER(app);
 #include "bas.h"
 #include "spaceauth.h"
 #include "io.h"
+#include "adv.h"
+#include "session.h"
+#include "energy.h"
+#ifdef CONFIG_COIN_TX_POWER
+#include "txpower.h"
+#endif
+#ifdef CONFIG_COIN_KEY_RECORD
+#include "keyrecord.h"
+#endif
 
 /**
  * gets called when system enters a new power state
@@ -42,9 +51,13 @@ static const struct bt_data ad[] = {
         BT_DATA_BYTES(BT_DATA_UUID16_ALL, 0x00, 0x18, 0x01, 0x18, 0x0f, 0x18),
         BT_DATA(BT_DATA_SVC_DATA16, batt_adv_bytes, sizeof(batt_adv_bytes))
 };
+// the battery service data (last element) is only advertised once the level is measured
+static size_t ad_len = ARRAY_SIZE(ad) - 1;
 
 static void bt_ready(int err);
 
+static void battery_measured(u8_t level);
+
 static void connected(struct bt_conn *conn, u8_t err);
 
 static void disconnected(struct bt_conn *conn, u8_t reason);
@@ -59,13 +72,26 @@ static void bt_ready(int err) {
         return;
     }
 
+#ifdef CONFIG_COIN_KEY_RECORD
+    if (keyrecord_load() != 0) {
+#else
     if (settings_load() != 0) {
+#endif
         set_blink_intensity(BI_SOS);
         return;
     }
 
-    bt_le_adv_start(BT_LE_ADV_CONN, ad, ARRAY_SIZE(ad), NULL, 0);
-    // bt_foreach_bond(BT_ID_DEFAULT,connect_bonded, NULL);
+    adv_start(ad, ad_len);
+}
+
+/**
+ * gets called when the battery measurement started in main has finished
+ * @param level battery level in percent
+ */
+static void battery_measured(u8_t level) {
+    batt_adv_bytes[BATT_ADV_BYTES_BLVL_IDX] = level;
+    ad_len = ARRAY_SIZE(ad);
+    adv_update_data(ad, ad_len);
 }
 
 /**
@@ -74,6 +100,7 @@ static void bt_ready(int err) {
  * @param err error connecting
  */
 static void connected(struct bt_conn *conn, u8_t err) {
+    adv_connected(conn, err);
     if (err) {
         LOG_ERR("connection failed (err %u)", err);
         disconnected(NULL, 0);
@@ -84,6 +111,10 @@ static void connected(struct bt_conn *conn, u8_t err) {
         }
         default_conn = bt_conn_ref(conn);
         LOG_INF("connected");
+        energy_conn_start(conn);
+#ifdef CONFIG_COIN_TX_POWER
+        txpower_connected(conn);
+#endif
         int ret = bt_conn_set_security(conn, BT_SECURITY_L4);
         if (ret) {
             LOG_ERR("Kill connection: insufficient security %i", ret);
@@ -91,6 +122,7 @@ static void connected(struct bt_conn *conn, u8_t err) {
         } else {
             LOG_INF("bt_conn_security successful");
         }
+        session_advance(SESSION_CONNECTED);
         set_blink_intensity(BI_AGGRESSIVE);
     }
 }
@@ -105,12 +137,19 @@ static void connected(struct bt_conn *conn, u8_t err) {
 static void disconnected(struct bt_conn *conn, u8_t reason) {
     ARG_UNUSED(conn);
     LOG_INF("disconnected (reason %u)", reason);
+    adv_stop();
+    energy_conn_end();
+#ifdef CONFIG_COIN_TX_POWER
+    // also keeps the remembered advertising power in System OFF
+    txpower_disconnected(session_state() == SESSION_DONE);
+#endif
 
     if (default_conn) {
         bt_conn_unref(default_conn);
         default_conn = NULL;
     }
-    LOG_INF("going to sleep");
+    LOG_INF("going to sleep after %u ms awake (session %s)",
+            (u32_t) k_uptime_get(), session_state_name(session_state()));
     sys_pm_force_power_state(SYS_POWER_STATE_DEEP_SLEEP_1);
 }
 
@@ -120,14 +159,11 @@ static struct bt_conn_cb conn_callbacks = {
         .disconnected = disconnected,
 };
 
-static struct k_delayed_work shutdown_timer;
-
 /**
- * shutdown timer callback function
- * @param work
+ * gets called when the deadline of the current session state is reached
+ * (or after the grace period of a finished session)
  */
-static void shutdown(struct k_work *work) {
-    ARG_UNUSED(work);
+static void shutdown(void) {
     if (default_conn) {
         bt_conn_disconnect(default_conn, BT_HCI_ERR_REMOTE_USER_TERM_CONN);
     } else {
@@ -136,13 +172,20 @@ static void shutdown(struct k_work *work) {
 }
 
 void main(void) {
-    // set shutdown timer
-    k_delayed_work_init(&shutdown_timer, shutdown);
-    k_delayed_work_submit(&shutdown_timer, K_SECONDS(10));
+    // set up session deadlines
+    session_init(shutdown);
     // initialize own parts
     io_init();
-    batt_adv_bytes[BATT_ADV_BYTES_BLVL_IDX] = bas_init();
+    // battery is measured in parallel to the BLE stack bring-up
+    int err = bas_init(battery_measured);
+    if (err) {
+        LOG_ERR("battery measurement failed (err %d), the level is not advertised", err);
+    }
     space_auth_init();
+#ifdef CONFIG_COIN_TX_POWER
+    // TX power of the first advertising phase
+    txpower_init();
+#endif
 
     LOG_INF("turning BLE on");
     // enable the bluetooth stack
@@ -0,0 +1,69 @@
+#include <zephyr.h>
+
+#include "session.h"
+#include "io.h"
+
+#include <logging/log.h>
+
+LOG_MODULE_REGISTER(session);
+
+/*
+ * Deadline per state, counted from entering the state.
+ * The central needs the connection only until it has read the full response,
+ * so the coin shuts down shortly after that instead of waiting for the central to disconnect.
+ */
+static const struct {
+    const char *name;
+    int deadline_ms;
+} states[] = {
+        [SESSION_ADVERTISING] = {"advertising", 10000},
+        [SESSION_CONNECTED] = {"connected", 3000},   // security, discovery and challenge write
+        [SESSION_CHALLENGED] = {"challenged", 1000}, // indication confirmation
+        [SESSION_INDICATED] = {"indicated", 1000},   // read of the remaining response
+        [SESSION_DONE] = {"done", 100},              // grace period before disconnecting
+};
+
+static session_state_t state = SESSION_ADVERTISING;
+static void (*shutdown_cb)(void) = NULL;
+static struct k_delayed_work session_timer;
+
+/**
+ * session timer callback function
+ * @param work
+ */
+static void session_timeout(struct k_work *work) {
+    ARG_UNUSED(work);
+    if (state != SESSION_DONE) {
+        LOG_ERR("deadline of state '%s' reached", states[state].name);
+    }
+    if (shutdown_cb) {
+        shutdown_cb();
+    }
+}
+
+void session_init(void (*shutdown_fn)(void)) {
+    shutdown_cb = shutdown_fn;
+    state = SESSION_ADVERTISING;
+    k_delayed_work_init(&session_timer, session_timeout);
+    k_delayed_work_submit(&session_timer, K_MSEC(states[state].deadline_ms));
+}
+
+void session_advance(session_state_t next) {
+    if (next <= state) {
+        return;
+    }
+    state = next;
+    LOG_INF("session state '%s'", states[state].name);
+    if (state == SESSION_DONE) {
+        set_blink_intensity(BI_OFF);
+    }
+    k_delayed_work_submit(&session_timer, K_MSEC(states[state].deadline_ms));
+}
+
+session_state_t session_state(void) {
+    return state;
+}
+
+const char *session_state_name(session_state_t s) {
+    return states[s].name;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum session_state_t {
+    SESSION_ADVERTISING = 0,
+    SESSION_CONNECTED,
+    SESSION_CHALLENGED,
+    SESSION_INDICATED,
+    SESSION_DONE
+} session_state_t;
+
+/**
+ * Initialize the session state machine and arm the advertising deadline.
+ * Every state has its own deadline. When it expires, the given shutdown function is called.
+ * @param shutdown_fn function that ends the session (disconnect and/or sleep)
+ */
+void session_init(void (*shutdown_fn)(void));
+
+/**
+ * Advance the session to a new state and re-arm the deadline for it.
+ * Going back to an earlier state is ignored.
+ * @param state new state
+ */
+void session_advance(session_state_t state);
+
+/**
+ * @return current state of the session
+ */
+session_state_t session_state(void);
+
+/**
+ * @param state session state
+ * @return human-readable name of the state
+ */
+const char *session_state_name(session_state_t state);
+
+#ifdef __cplusplus
+}
+#endif
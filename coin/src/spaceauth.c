@@ -4,8 +4,12 @@
 
 #include "blake2.h"
 #include "spaceauth.h"
+#include "session.h"
 
 #include <logging/log.h>
+#ifdef CONFIG_CPU_CORTEX_M4
+#include <arch/arm/cortex_m/cmsis.h>
+#endif
 
 LOG_MODULE_REGISTER(spaceauth);
 
@@ -28,11 +32,67 @@ static uint8_t response[BLAKE2S_OUTBYTES] = {0};
 
 static u16_t ccc_value;
 
+#ifdef CONFIG_COIN_STREAM_HASH
+// state keyed with the spacekey, the key block is compressed with the first challenge bytes
+static blake2s_state keyed_state;
+// hash over the challenge bytes of the prepared writes, in order from offset 0
+static blake2s_state stream_state;
+static uint8_t streamed[BLAKE2S_BLOCKBYTES];
+static u16_t streamed_len = 0;
+static bool stream_valid = false;
+#endif
+
+/*
+ * Timing of the response: the kernel cycle counter runs at 32768 Hz (about 30 us steps),
+ * the DWT cycle counter of the Cortex-M4 counts CPU cycles. The nRF51 (Cortex-M0) has none.
+ */
+#ifdef CONFIG_CPU_CORTEX_M4
+static void cycles_init(void) {
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNT_ENA_Msk;
+}
+
+static u32_t cycles_get(void) {
+    return DWT->CYCCNT;
+}
+
+static u32_t cycles_to_us(u32_t cycles) {
+    return cycles / (SystemCoreClock / 1000000U);
+}
+#else
+static void cycles_init(void) {
+}
+
+static u32_t cycles_get(void) {
+    return k_cycle_get_32();
+}
+
+static u32_t cycles_to_us(u32_t cycles) {
+    return (u32_t) (SYS_CLOCK_HW_CYCLES_TO_NS(cycles) / 1000U);
+}
+#endif
+
+/**
+ * prepares the keyed hash state, called whenever the spacekey changes
+ */
+static void key_changed(void) {
+#ifdef CONFIG_COIN_STREAM_HASH
+    blake2s_init_key(&keyed_state, BLAKE2S_OUTBYTES, auth_key, BLAKE2S_KEYBYTES);
+    stream_valid = false;
+#endif
+}
+
 static void ccc_cfg_changed(const struct bt_gatt_attr *attr, u16_t value) {
     ARG_UNUSED(attr);
     ccc_value = value;
 }
 
+static void indicate_cb(struct bt_conn *conn, const struct bt_gatt_attr *attr,
+                        u8_t err);
+
+static struct bt_gatt_indicate_params ind_params = {.data=response, .len=BLAKE2S_OUTBYTES, .attr=NULL, .func=&indicate_cb};
+
 static void indicate_cb(struct bt_conn *conn, const struct bt_gatt_attr *attr,
                         u8_t err) {
     ARG_UNUSED(attr);
@@ -41,31 +101,41 @@ static void indicate_cb(struct bt_conn *conn, const struct bt_gatt_attr *attr,
         LOG_ERR("indication fail: %i", err);
     } else {
         LOG_INF("indication success");
+        // the central only reads the response if it did not fit into the indication
+        session_advance(ind_params.len < BLAKE2S_OUTBYTES ? SESSION_INDICATED : SESSION_DONE);
     }
 }
 
-static struct bt_gatt_indicate_params ind_params = {.data=response, .len=BLAKE2S_OUTBYTES, .attr=NULL, .func=&indicate_cb};
-
 static ssize_t write_challenge(struct bt_conn *conn,
                                const struct bt_gatt_attr *attr,
                                const void *buf, u16_t len,
                                u16_t offset, u8_t flags);
 
+// the challenge is also handed to write_challenge() while its fragments are prepared (streamed hash, timing)
+#define AUTH_CHALLENGE_PERM (BT_GATT_PERM_WRITE_AUTHEN | BT_GATT_PERM_WRITE_ENCRYPT | BT_GATT_PERM_PREPARE_WRITE)
+
+// cycle counter when the last fragment of the challenge was prepared, the response latency is measured from there
+static u32_t last_prepared = 0;
+static bool prepared = false;
+
 static ssize_t read_response(struct bt_conn *conn,
                              const struct bt_gatt_attr *attr,
                              void *buf, u16_t len,
                              u16_t offset) {
     const char *value = attr->user_data;
 
-    return bt_gatt_attr_read(conn, attr, buf, len, offset, value,
-                             BLAKE2S_OUTBYTES);
+    ssize_t ret = bt_gatt_attr_read(conn, attr, buf, len, offset, value,
+                                    BLAKE2S_OUTBYTES);
+    if (ret >= 0 && offset + ret == BLAKE2S_OUTBYTES && session_state() >= SESSION_CHALLENGED) {
+        session_advance(SESSION_DONE);
+    }
+    return ret;
 }
 
 BT_GATT_SERVICE_DEFINE(auth_svc,
                        BT_GATT_PRIMARY_SERVICE(&auth_service_uuid),
                        BT_GATT_CHARACTERISTIC(&auth_challenge_uuid.uuid, BT_GATT_CHRC_WRITE | BT_GATT_CHRC_AUTH,
-                                              BT_GATT_PERM_WRITE_AUTHEN | BT_GATT_PERM_WRITE_ENCRYPT,
-                                              NULL, write_challenge, challenge),
+                                              AUTH_CHALLENGE_PERM, NULL, write_challenge, challenge),
                        BT_GATT_CHARACTERISTIC(&auth_response_uuid.uuid, BT_GATT_CHRC_READ | BT_GATT_CHRC_INDICATE,
                                               BT_GATT_PERM_READ_AUTHEN | BT_GATT_PERM_READ_ENCRYPT,
                                               read_response, NULL, response),
@@ -75,34 +145,104 @@ BT_GATT_SERVICE_DEFINE(auth_svc,
 static const size_t INDICATION_PROTOCOL_OVERHEAD = 3;
 static const size_t AUTH_RESPONSE_CHR_VALUE_HANDLE = 4;
 
+#ifdef CONFIG_COIN_STREAM_HASH
+/**
+ * hashes a prepared fragment of the challenge while the next ones are still in flight
+ * the prepared writes of a long write arrive one per connection event, the write callbacks of the execute follow
+ * back to back. Fragments that are not in order from offset 0 end the stream, the response is then computed from
+ * the executed challenge.
+ * @param buf fragment
+ * @param len length of the fragment
+ * @param offset offset of the fragment
+ */
+static void stream_challenge(const void *buf, u16_t len, u16_t offset) {
+    if (offset == 0) {
+        stream_state = keyed_state;
+        streamed_len = 0;
+        stream_valid = true;
+    }
+    if (!stream_valid || offset != streamed_len) {
+        stream_valid = false;
+        return;
+    }
+    // BLAKE2s keeps the last block for the final compression, a 64 byte challenge is exactly that block:
+    // only the key block is compressed here (with the first bytes)
+    blake2s_update(&stream_state, buf, len);
+    memcpy(streamed + offset, buf, len);
+    streamed_len += len;
+}
+#endif
+
+/**
+ * computes the response to the complete challenge
+ * @return true if the streamed hash was used (only the final compression), false if the whole hash was computed
+ */
+static bool compute_response(void) {
+#ifdef CONFIG_COIN_STREAM_HASH
+    // the executed challenge has to be exactly the streamed one
+    bool streamed_ok = stream_valid && streamed_len == BLAKE2S_BLOCKBYTES &&
+                       memcmp(streamed, challenge, BLAKE2S_BLOCKBYTES) == 0;
+    stream_valid = false;
+    if (streamed_ok) {
+        blake2s_final(&stream_state, response, BLAKE2S_OUTBYTES);
+        return true;
+    }
+#endif
+    blake2s(response, BLAKE2S_OUTBYTES, challenge, BLAKE2S_BLOCKBYTES, auth_key, BLAKE2S_KEYBYTES);
+    return false;
+}
+
 static ssize_t write_challenge(struct bt_conn *conn,
                                const struct bt_gatt_attr *attr,
                                const void *buf, u16_t len,
                                u16_t offset, u8_t flags) {
     ARG_UNUSED(attr);
-    ARG_UNUSED(flags);
+    u32_t start = cycles_get();
     if (offset + len > BLAKE2S_BLOCKBYTES) {
         return BT_GATT_ERR(BT_ATT_ERR_INVALID_OFFSET);
     }
+    if (flags & BT_GATT_WRITE_FLAG_PREPARE) {
+        last_prepared = start;
+        prepared = true;
+#ifdef CONFIG_COIN_STREAM_HASH
+        stream_challenge(buf, len, offset);
+#endif
+        return 0;
+    }
 
     memcpy(challenge + offset, buf, len);
     LOG_INF("write challenge offset: %i, len: %i", offset, len);
 
     if (offset + len == BLAKE2S_BLOCKBYTES) {
-        blake2s(response, BLAKE2S_OUTBYTES, challenge, BLAKE2S_BLOCKBYTES, auth_key, BLAKE2S_KEYBYTES);
+        bool streamed_hash = compute_response();
+        u32_t hashed = cycles_get();
         if (ccc_value == BT_GATT_CCC_INDICATE) {
             ind_params.attr = &auth_svc.attrs[AUTH_RESPONSE_CHR_VALUE_HANDLE];
             u16_t mtu = bt_gatt_get_mtu(conn);
             ind_params.len = MIN(mtu - INDICATION_PROTOCOL_OVERHEAD, BLAKE2S_OUTBYTES);
+            if (bt_gatt_indicate(NULL, &ind_params) == 0) {
+                session_advance(SESSION_CHALLENGED);
+            }
+            u32_t sent = cycles_get();
             LOG_INF("connection has MTU: %u", mtu);
-            bt_gatt_indicate(NULL, &ind_params);
+            if (prepared) {
+                LOG_INF("response indicated %u us after the last fragment (%u us after execute, hash %u us, %s)",
+                        cycles_to_us(sent - last_prepared), cycles_to_us(sent - start),
+                        cycles_to_us(hashed - start), streamed_hash ? "streamed" : "full");
+            } else {
+                // short write without prepared fragments
+                LOG_INF("response indicated %u us after the write (hash %u us, %s)",
+                        cycles_to_us(sent - start), cycles_to_us(hashed - start), streamed_hash ? "streamed" : "full");
+            }
         }
+        prepared = false;
     }
 
     return len;
 }
 
-//settings stuff
+#ifndef CONFIG_COIN_KEY_RECORD
+//settings stuff (the key record is read by keyrecord.c instead)
 static int set(const char *key, size_t len_rd,
                settings_read_cb read_cb, void *cb_arg) {
     ARG_UNUSED(len_rd);
@@ -114,8 +254,10 @@ static int set(const char *key, size_t len_rd,
             ssize_t len = read_cb(cb_arg, auth_key, BLAKE2S_KEYBYTES);
             if (len != BLAKE2S_KEYBYTES) {
                 memset(auth_key, 0, BLAKE2S_KEYBYTES);
+                key_changed();
                 return (len < 0) ? len : -EINVAL;
             }
+            key_changed();
             LOG_INF("loaded spacekey");
             return 0;
         }
@@ -127,18 +269,29 @@ static struct settings_handler auth_settings = {
         .name = "space",
         .h_set = set,
 };
+#endif
+
+void space_auth_set_key(const uint8_t *key) {
+    memcpy(auth_key, key, BLAKE2S_KEYBYTES);
+    key_changed();
+}
 
 void space_auth_init(void) {
     LOG_INF("initialize space auth");
     int err;
 
+    cycles_init();
+    key_changed();
+
     err = settings_subsys_init();
     if (err) {
         LOG_ERR("settings_subsys_init failed (err %d)", err);
     }
 
+#ifndef CONFIG_COIN_KEY_RECORD
     err = settings_register(&auth_settings);
     if (err) {
         LOG_ERR("ps_settings_register failed (err %d)", err);
     }
+#endif
 }
@@ -11,6 +11,12 @@ extern "C" {
  */
 void space_auth_init(void);
 
+/**
+ * Set the 32 Byte key directly (bypassing the settings API).
+ * @param key spacekey
+ */
+void space_auth_set_key(const uint8_t *key);
+
 #ifdef __cplusplus
 }
 #endif
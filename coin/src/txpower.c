@@ -0,0 +1,267 @@
+#include <zephyr.h>
+#include <soc.h>
+#include <bluetooth/bluetooth.h>
+#include <bluetooth/conn.h>
+#include <bluetooth/hci.h>
+#include <bluetooth/hci_vs.h>
+#include <hci_core.h>      //use of internal hci API for 'bt_hci_cmd_send_sync()'
+#include <conn_internal.h> //handle of the connection for HCI Read RSSI
+
+#include "txpower.h"
+#include "energy.h"
+
+#include <logging/log.h>
+
+LOG_MODULE_REGISTER(txpower);
+
+/*
+ * The TX power is set with the Zephyr vendor command Write Tx Power Level (advertising and connection handle),
+ * the link is followed with the standard HCI Read RSSI. Both go through the public HCI interface, no controller
+ * internals are touched. The controller picks the closest level it supports and reports it.
+ * Not verified on hardware yet, CONFIG_COIN_TX_POWER is off by default.
+ */
+#ifndef BT_HCI_OP_VS_WRITE_TX_POWER_LEVEL
+// Zephyr vendor command, missing in the headers of older releases
+#define BT_HCI_OP_VS_WRITE_TX_POWER_LEVEL BT_OP(BT_OGF_VS, 0x000e)
+#define BT_HCI_VS_LL_HANDLE_TYPE_ADV 0x00
+#define BT_HCI_VS_LL_HANDLE_TYPE_CONN 0x02
+struct bt_hci_cp_vs_write_tx_power_level {
+    u8_t handle_type;
+    u16_t handle;
+    s8_t tx_power_level;
+} __packed;
+struct bt_hci_rp_vs_write_tx_power_level {
+    u8_t status;
+    u8_t handle_type;
+    u16_t handle;
+    s8_t selected_tx_power;
+} __packed;
+#endif
+
+static const s8_t levels[] = {
+#if defined(CONFIG_SOC_SERIES_NRF51X)
+        -30,
+#else
+        -40,
+#endif
+        -20, -16, -12, -8, -4, 0, 4,
+};
+
+#define CONTROL_INTERVAL_MS 200
+// the coin may be held elsewhere at the next wake
+#define ADV_MARGIN_DB 6
+// levels added for every further advertising phase
+#define ADV_ATTEMPT_STEPS 2
+#define TXPOWER_MAGIC 0x54585031 // "TXP1"
+
+static u8_t level = 0;
+static u8_t min_level = 0;
+static u8_t max_level = 0;
+// the controller does not support the vendor command, the default power stays
+static bool unsupported = false;
+
+static struct bt_conn *link = NULL;
+static struct k_delayed_work control_work;
+// RSSI of the central at the coin in 1/16 dB, 0 if not known yet
+static s16_t rssi_avg = 0;
+static u16_t changes = 0;
+
+// advertising level of the next wake, lives in RAM that is retained in System OFF
+static struct {
+    u32_t magic;
+    u8_t adv_level;
+    u8_t adv_level_inv;
+} persist __noinit;
+
+static int write_tx_power(u8_t handle_type, u16_t handle, s8_t dbm, s8_t *selected) {
+    struct bt_hci_cp_vs_write_tx_power_level *cp;
+    struct net_buf *rsp = NULL;
+    struct net_buf *buf = bt_hci_cmd_create(BT_HCI_OP_VS_WRITE_TX_POWER_LEVEL, sizeof(*cp));
+    if (!buf) {
+        return -ENOBUFS;
+    }
+    cp = net_buf_add(buf, sizeof(*cp));
+    cp->handle_type = handle_type;
+    cp->handle = sys_cpu_to_le16(handle);
+    cp->tx_power_level = dbm;
+    int err = bt_hci_cmd_send_sync(BT_HCI_OP_VS_WRITE_TX_POWER_LEVEL, buf, &rsp);
+    if (err) {
+        return err;
+    }
+    struct bt_hci_rp_vs_write_tx_power_level *rp = (void *) rsp->data;
+    u8_t status = rp->status;
+    *selected = rp->selected_tx_power;
+    net_buf_unref(rsp);
+    return status ? -EIO : 0;
+}
+
+/**
+ * sets the TX power of the advertiser (before an advertising phase) or of the connection
+ * must not be called from the BT RX thread (synchronous HCI command)
+ * @param l level
+ * @param conn connection, NULL for the advertiser
+ */
+static void set_level(u8_t l, struct bt_conn *conn) {
+    if (unsupported) {
+        return;
+    }
+    s8_t selected;
+    int err = conn ? write_tx_power(BT_HCI_VS_LL_HANDLE_TYPE_CONN, conn->handle, levels[l], &selected)
+                   : write_tx_power(BT_HCI_VS_LL_HANDLE_TYPE_ADV, 0, levels[l], &selected);
+    if (err) {
+        LOG_WRN("controller does not set the TX power (err %d), keeping its default", err);
+        unsupported = true;
+        return;
+    }
+    level = l;
+    energy_tx_power(selected);
+}
+
+static void set_adv_level(u8_t l) {
+    persist.magic = TXPOWER_MAGIC;
+    persist.adv_level = l;
+    persist.adv_level_inv = (u8_t) ~l;
+}
+
+// lowest level that reaches the central with the target RSSI (path loss is the same in both directions)
+static u8_t level_for(s16_t rssi16, s8_t margin) {
+    s16_t path_loss = CONFIG_COIN_TX_POWER_CENTRAL_DBM - rssi16 / 16;
+    s16_t needed = CONFIG_COIN_TX_POWER_TARGET_RSSI + path_loss + margin;
+    for (u8_t l = min_level; l < max_level; ++l) {
+        if (levels[l] >= needed) {
+            return l;
+        }
+    }
+    return max_level;
+}
+
+static int read_rssi(struct bt_conn *conn, s8_t *rssi) {
+    struct bt_hci_cp_read_rssi *cp;
+    struct net_buf *rsp = NULL;
+    struct net_buf *buf = bt_hci_cmd_create(BT_HCI_OP_READ_RSSI, sizeof(*cp));
+    if (!buf) {
+        return -ENOBUFS;
+    }
+    cp = net_buf_add(buf, sizeof(*cp));
+    cp->handle = sys_cpu_to_le16(conn->handle);
+    int err = bt_hci_cmd_send_sync(BT_HCI_OP_READ_RSSI, buf, &rsp);
+    if (err) {
+        return err;
+    }
+    struct bt_hci_rp_read_rssi *rp = (void *) rsp->data;
+    u8_t status = rp->status;
+    s8_t value = rp->rssi;
+    net_buf_unref(rsp);
+    if (status) {
+        return -EIO;
+    }
+    *rssi = value;
+    return 0;
+}
+
+/**
+ * control work function
+ * follows the RSSI: up at once, down one level per interval
+ * @param work
+ */
+static void control(struct k_work *work) {
+    ARG_UNUSED(work);
+    if (!link) {
+        return;
+    }
+    s8_t rssi;
+    // 127: not available
+    if (read_rssi(link, &rssi) == 0 && rssi != 127) {
+        rssi_avg = rssi_avg ? rssi_avg + (rssi * 16 - rssi_avg) / 4 : rssi * 16;
+    }
+
+    u8_t next = level;
+    if (rssi_avg) {
+        u8_t wanted = level_for(rssi_avg, 0);
+        if (wanted > level) {
+            next = wanted;
+        } else if (wanted < level) {
+            next = level - 1;
+        }
+    }
+    if (next != level) {
+        LOG_DBG("%d dBm -> %d dBm (RSSI %d)", levels[level], levels[next], rssi_avg / 16);
+        set_level(next, link);
+        changes++;
+    }
+    k_delayed_work_submit(&control_work, K_MSEC(CONTROL_INTERVAL_MS));
+}
+
+void txpower_init(void) {
+    for (u8_t l = 0; l < ARRAY_SIZE(levels); ++l) {
+        if (levels[l] <= CONFIG_COIN_TX_POWER_MIN) {
+            min_level = l;
+        }
+        if (levels[l] <= CONFIG_COIN_TX_POWER_MAX) {
+            max_level = l;
+        }
+    }
+    k_delayed_work_init(&control_work, control);
+    if (persist.magic != TXPOWER_MAGIC || persist.adv_level != (u8_t) ~persist.adv_level_inv ||
+        persist.adv_level < min_level || persist.adv_level > max_level) {
+        LOG_INF("no remembered TX power");
+        set_adv_level(max_level);
+    }
+    // the advertiser is set before every advertising phase
+    level = persist.adv_level;
+}
+
+s8_t txpower_advertising(u8_t attempt) {
+    set_level(MIN(persist.adv_level + attempt * ADV_ATTEMPT_STEPS, max_level), NULL);
+    // the controller default is 0 dBm
+    return unsupported ? 0 : levels[level];
+}
+
+void txpower_connected(struct bt_conn *conn) {
+    // called in the BT RX thread, the control work sets the power of the connection
+    link = bt_conn_ref(conn);
+    rssi_avg = 0;
+    changes = 0;
+    k_delayed_work_submit(&control_work, K_MSEC(CONTROL_INTERVAL_MS));
+}
+
+// keep the RAM of the remembered level powered in System OFF
+static void retain(const void *start, size_t len) {
+    u32_t end = (u32_t) start + len;
+#if defined(CONFIG_SOC_SERIES_NRF51X)
+    // RAM blocks of 8 KiB: OFFRAM0/1 in RAMON, OFFRAM2/3 in RAMONB
+    for (u32_t addr = (u32_t) start & ~0x1FFFU; addr < end; addr += 0x2000U) {
+        u32_t block = (addr - CONFIG_SRAM_BASE_ADDRESS) / 0x2000U;
+        if (block < 2) {
+            NRF_POWER->RAMON |= POWER_RAMON_OFFRAM0_Msk << block;
+        } else {
+            NRF_POWER->RAMONB |= POWER_RAMONB_OFFRAM2_Msk << (block - 2);
+        }
+    }
+#else
+    // RAM blocks of two 4 KiB sections
+    for (u32_t addr = (u32_t) start & ~0xFFFU; addr < end; addr += 0x1000U) {
+        u32_t section = (addr - CONFIG_SRAM_BASE_ADDRESS) / 0x1000U;
+        NRF_POWER->RAM[section / 2].POWERSET = (section % 2) ? POWER_RAM_POWERSET_S1RETENTION_Msk
+                                                             : POWER_RAM_POWERSET_S0RETENTION_Msk;
+    }
+#endif
+}
+
+void txpower_disconnected(bool success) {
+    k_delayed_work_cancel(&control_work);
+    if (link) {
+        bt_conn_unref(link);
+        link = NULL;
+    }
+    u8_t adv_level = persist.adv_level;
+    if (success && rssi_avg) {
+        adv_level = level_for(rssi_avg, ADV_MARGIN_DB);
+    } else if (!success) {
+        adv_level = MIN(adv_level + ADV_ATTEMPT_STEPS, max_level);
+    }
+    set_adv_level(adv_level);
+    LOG_INF("connection TX power %d dBm (%u changes, RSSI %d), advertising at %d dBm next time",
+            levels[level], changes, rssi_avg / 16, levels[adv_level]);
+    retain(&persist, sizeof(persist));
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <zephyr/types.h>
+#include <bluetooth/conn.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Restore the advertising TX power that worked at the last wake (kept in RAM that is retained in System OFF).
+ * After a cold boot, the coin starts at CONFIG_COIN_TX_POWER_MAX.
+ */
+void txpower_init(void);
+
+/**
+ * Set the TX power for the next advertising phase: the remembered level for the first attempt,
+ * two levels more for every further attempt, at most CONFIG_COIN_TX_POWER_MAX.
+ * @param attempt number of the advertising phase (0: first phase of the wake)
+ * @return TX power in dBm
+ */
+s8_t txpower_advertising(u8_t attempt);
+
+/**
+ * Start adjusting the TX power of the connection to the RSSI of the link.
+ * @param conn connection to the central
+ */
+void txpower_connected(struct bt_conn *conn);
+
+/**
+ * Stop adjusting and remember the advertising TX power for the next wake.
+ * Must be called before entering System OFF, it keeps the RAM of the remembered level powered.
+ * @param success true if the session was completed
+ */
+void txpower_disconnected(bool success);
+
+#ifdef __cplusplus
+}
+#endif
@@ -1,11 +1,36 @@
 #!/usr/bin/python3
 import argparse
 import binascii
+import copy
+import secrets
+import sys
+import time
 from textwrap import wrap
-from intelhex import IntelHex as IH
 
 parser = argparse.ArgumentParser(description='Analyze Zephyr FCB storage and print contents.')
 parser.add_argument('file', help='binary dump of the storage partition')
+parser.add_argument('--sector-size', type=lambda x: int(x, 0), default=0x1000,
+                    help='flash sector size (default: 0x1000)')
+parser.add_argument('--align', type=int, default=1, help='flash write alignment (default: 1)')
+parser.add_argument('--offset', type=lambda x: int(x, 0), default=0x32000,
+                    help='partition address in hex files (default: coin, 0x32000)')
+parser.add_argument('--size', type=lambda x: int(x, 0), default=0x6000,
+                    help='partition size in hex files (default: coin, 0x6000)')
+parser.add_argument('--central', action='store_true',
+                    help='partition of the central in hex files (0xf8000, 0x8000), e.g. from gen_bond.py --central')
+parser.add_argument('--export-coins', action='store_true',
+                    help='print the bonded coins as coins.txt lines (address, IRK, LTK, spacekey) instead')
+parser.add_argument('--all', action='store_true', help='print every entry instead of only the latest values')
+parser.add_argument('--simulate', type=int, default=0, metavar='CYCLES',
+                    help='simulate CYCLES coin add/del cycles on top of the dump')
+parser.add_argument('--synthesize', type=int, default=0, metavar='SECTORS',
+                    help='write a synthetic dump with SECTORS sectors to FILE instead of analyzing it')
+parser.add_argument('--coins', type=int, default=50, help='live coins in a synthetic dump (default: 50)')
+
+FCB_MAGIC = b'\xee\xee\xff\xc0'
+FCB_VERSION = 1
+FCB_HEADER_LEN = 8
+FCB_SCRATCH_CNT = 1  # settings_fcb keeps one sector free for compression
 
 
 def fcb_crc8(data):
@@ -19,28 +44,255 @@ def fcb_crc8(data):
     return val
 
 
-def read_items(storage):
-    items = []
-    assert storage[:4] == b'\xee\xee\xff\xc0', 'no magic sequence detected!'
-    print('FCB version: %u' % storage[4])
-    assert storage[5] == 0xFF, 'padding not detected'
-    print('FD ID: %u' % (storage[6] + storage[7] << 8))
-    off = 8
-    while off < len(storage) and storage[off] != 0xFF:
-        if storage[off] & 0x80:
-            length = (storage[off] & 0x7f) | (storage[off + 1] << 7)
-            data_end = off + 2 + length
+def align_up(n, align):
+    return (n + align - 1) // align * align
+
+
+# length of an entry in flash: length field, data and CRC, each padded to the write alignment
+def entry_flash_len(data_len, align):
+    len_len = 1 if data_len < 0x80 else 2
+    return align_up(len_len, align) + align_up(data_len, align) + align_up(1, align)
+
+
+# encode an entry the way fcb_append/fcb_append_finish write it
+def encode_entry(data, align):
+    assert len(data) < 0x4000
+    if len(data) < 0x80:
+        len_bytes = bytes([len(data)])
+    else:
+        len_bytes = bytes([(len(data) & 0x7f) | 0x80, len(data) >> 7])
+    crc = fcb_crc8(len_bytes + data)
+    pad = b'\xff'
+    return len_bytes + pad * (align_up(len(len_bytes), align) - len(len_bytes)) + \
+        data + pad * (align_up(len(data), align) - len(data)) + \
+        bytes([crc]) + pad * (align_up(1, align) - 1)
+
+
+# split a settings entry into name and value ("name=value", empty value means deleted)
+def split_setting(data):
+    data = bytes(data)
+    sep = data.find(b'=')
+    if sep < 0:
+        return data, b''
+    return data[:sep], data[sep + 1:]
+
+
+class Sector:
+    def __init__(self, index, fd_id=None):
+        self.index = index  # position in the partition
+        self.fd_id = fd_id  # None for erased sectors
+        self.entries = []  # (offset, flash_len, name, value)
+        self.used = FCB_HEADER_LEN if fd_id is not None else 0
+        self.crc_errors = 0
+
+
+# parse one sector; erased sectors and sectors without FCB magic yield fd_id None
+def read_sector(index, sector, align):
+    if sector[:4] != FCB_MAGIC:
+        return Sector(index)
+    fd_id = sector[6] | (sector[7] << 8)
+    s = Sector(index, fd_id)
+    mv = memoryview(sector)
+    off = FCB_HEADER_LEN
+    while off < len(sector) and sector[off] != 0xFF:
+        if sector[off] & 0x80:
+            if off + 1 >= len(sector):
+                break
+            length = (sector[off] & 0x7f) | (sector[off + 1] << 7)
+            len_len = 2
         else:
-            length = storage[off]
-            data_end = off + 1 + length
-        data = storage[off + 1: data_end]
-        crc = storage[data_end]
-        if crc == fcb_crc8(storage[off:data_end]):
-            items.append(data)
+            length = sector[off]
+            len_len = 1
+        data_start = off + align_up(len_len, align)
+        data_end = data_start + length
+        crc_off = data_start + align_up(length, align)
+        if crc_off >= len(sector):
+            break
+        flash_len = entry_flash_len(length, align)
+        if sector[crc_off] == fcb_crc8(bytes(mv[off:off + len_len]) + bytes(mv[data_start:data_end])):
+            name, value = split_setting(mv[data_start:data_end])
+            s.entries.append((off, flash_len, name, value))
         else:
-            print('CRC check failed!')
-        off = data_end + 1
-    return items
+            s.crc_errors += 1
+        off += flash_len
+    s.used = off
+    return s
+
+
+# read sector by sector, the dump does not have to fit into memory at once
+def read_sectors(f, sector_size, align):
+    index = 0
+    while True:
+        sector = f.read(sector_size)
+        if not sector:
+            return
+        yield read_sector(index, sector, align)
+        index += 1
+
+
+# order sectors from oldest to newest by their 16 bit id (ids wrap around)
+def order_sectors(sectors):
+    used = sorted((s for s in sectors if s.fd_id is not None), key=lambda s: s.fd_id)
+    if len(used) < 2:
+        return used
+    gaps = [((used[(i + 1) % len(used)].fd_id - used[i].fd_id) & 0xFFFF, i) for i in range(len(used))]
+    _, last = max(gaps)
+    return used[last + 1:] + used[:last + 1]
+
+
+class FcbState:
+    """FCB state as the settings subsystem sees it. Also used for the add/del simulation."""
+
+    def __init__(self, sectors, sector_size, align):
+        self.sector_size = sector_size
+        self.align = align
+        self.sectors = sectors  # all sectors by index
+        self.order = order_sectors(sectors)  # used sectors, oldest first
+        self.latest = {}  # name -> (sector index, offset)
+        for s in self.order:
+            for off, _, name, _ in s.entries:
+                self.latest[name] = (s.index, off)
+        self.compactions = 0
+
+    def is_live(self, sector, off, name, value):
+        return len(value) > 0 and self.latest.get(name) == (sector.index, off)
+
+    def live_dead(self, sector):
+        live = dead = 0
+        for off, flash_len, name, value in sector.entries:
+            if self.is_live(sector, off, name, value):
+                live += flash_len
+            else:
+                dead += flash_len
+        return live, dead
+
+    def free_sectors(self):
+        return len(self.sectors) - len(self.order)
+
+    def _next_sector(self):
+        # fcb_getnext_sector: sectors are used round robin
+        active = self.order[-1]
+        return self.sectors[(active.index + 1) % len(self.sectors)]
+
+    def _new_sector(self, use_scratch=False):
+        if self.free_sectors() <= (0 if use_scratch else FCB_SCRATCH_CNT):
+            return None
+        s = self._next_sector()
+        assert s.fd_id is None
+        s.fd_id = (self.order[-1].fd_id + 1) & 0xFFFF
+        s.used = FCB_HEADER_LEN
+        self.order.append(s)
+        return s
+
+    def _append(self, name, value, use_scratch=False):
+        data = name + b'=' + value
+        flash_len = entry_flash_len(len(data), self.align)
+        active = self.order[-1]
+        if active.used + flash_len > self.sector_size:
+            active = self._new_sector(use_scratch)
+            if active is None or active.used + flash_len > self.sector_size:
+                return False
+        active.entries.append((active.used, flash_len, name, value))
+        self.latest[name] = (active.index, active.used)
+        active.used += flash_len
+        return True
+
+    # settings_fcb_compress: copy live entries of the oldest sector into the scratch sector, erase it
+    def _compress(self):
+        oldest = self.order[0]
+        self._new_sector(use_scratch=True)
+        for off, _, name, value in oldest.entries:
+            if self.is_live(oldest, off, name, value):
+                if not self._append(name, value, use_scratch=True):
+                    return False
+        self.order.pop(0)
+        oldest.fd_id = None
+        oldest.entries = []
+        oldest.used = 0
+        self.compactions += 1
+        return True
+
+    # settings_fcb_save: compress up to sector count - 1 times to make room
+    def save(self, name, value):
+        if not self.order:
+            s = self.sectors[0]
+            s.fd_id = 0
+            s.used = FCB_HEADER_LEN
+            self.order.append(s)
+        for _ in range(len(self.sectors) - 1):
+            if self._append(name, value):
+                return True
+            if len(self.order) < 2 or not self._compress():
+                return False
+        return self._append(name, value)
+
+    def coin_add(self, addr):
+        ok = self.save(b'space/' + addr + b'1', secrets.token_bytes(32))
+        return ok and self.save(b'bt/keys/' + addr + b'1', b'\x10\x11"\x00' + secrets.token_bytes(48))
+
+    def coin_del(self, addr):
+        ok = self.save(b'bt/keys/' + addr + b'1', b'')
+        return ok and self.save(b'space/' + addr + b'1', b'')
+
+    def to_bytes(self):
+        out = bytearray(b'\xff' * self.sector_size * len(self.sectors))
+        for s in self.sectors:
+            if s.fd_id is None:
+                continue
+            base = s.index * self.sector_size
+            out[base:base + FCB_HEADER_LEN] = FCB_MAGIC + bytes([FCB_VERSION, 0xff, s.fd_id & 0xff, s.fd_id >> 8])
+            for off, _, name, value in s.entries:
+                e = encode_entry(name + b'=' + value, self.align)
+                out[base + off:base + off + len(e)] = e
+        return bytes(out)
+
+
+def random_addr():
+    return binascii.hexlify(secrets.token_bytes(6)).lower()
+
+
+# simulate coin add/del churn: report when compaction kicks in and when storage is exhausted
+def simulate(state, cycles):
+    sim = copy.deepcopy(state)
+    first_compaction = None
+    for i in range(cycles):
+        addr = random_addr()
+        if not (sim.coin_add(addr) and sim.coin_del(addr)):
+            print('storage exhausted after %u add/del cycles' % i)
+            break
+        if first_compaction is None and sim.compactions:
+            first_compaction = i + 1
+    else:
+        print('%u add/del cycles: %u compactions' % (cycles, sim.compactions))
+    if first_compaction:
+        print('first compaction at add/del cycle %u' % first_compaction)
+    else:
+        print('no compaction within %u add/del cycles' % cycles)
+
+    sim = copy.deepcopy(state)
+    adds = 0
+    while sim.coin_add(random_addr()):
+        adds += 1
+    print('%u more coins fit before storage is exhausted' % adds)
+
+
+def synthesize(path, n_sectors, sector_size, align, coins):
+    sectors = [Sector(i) for i in range(n_sectors)]
+    state = FcbState(sectors, sector_size, align)
+    state.save(b'bt/id', b'\x01' + secrets.token_bytes(6))
+    state.save(b'bt/irk', secrets.token_bytes(16))
+    live = [random_addr() for _ in range(coins)]
+    for addr in live:
+        if not state.coin_add(addr):
+            print('storage exhausted', file=sys.stderr)
+            sys.exit(-1)
+    # churn until the last sector is in use
+    while state.free_sectors() > FCB_SCRATCH_CNT:
+        addr = random_addr()
+        state.coin_add(addr)
+        state.coin_del(addr)
+    with open(path, 'wb') as f:
+        f.write(state.to_bytes())
 
 
 def read_setting(item):
@@ -85,21 +337,84 @@ def read_setting(item):
         print(':'.join(wrap(item[6:18].decode().upper(), 2)), 'type=' + bytes([item[18]]).decode(), end=' ')
         assert item[19] == b'='[0]
         print('spacekey=%s' % binascii.hexlify(item[20:52]).decode().upper())
+    elif item[-1:] == b'=':
+        print('deleted:', item[:-1].decode(errors='replace'))
     else:
         print(item)
 
 
-if __name__ == '__main__':
-    args = parser.parse_args()
+# coins.txt lines of the coins with bond and spacekey, sorted by address
+def export_coins(state):
+    keys = {}
+    spacekeys = {}
+    for s in state.order:
+        for off, _, name, value in s.entries:
+            if not state.is_live(s, off, name, value):
+                continue
+            if len(name) == 21 and name[:8] == b'bt/keys/' and len(value) == 52:
+                keys[name[8:20]] = (value[30:46], value[14:30])  # IRK, LTK
+            elif len(name) == 19 and name[:6] == b'space/' and len(value) == 32:
+                spacekeys[name[6:18]] = value
+    lines = []
+    for addr in sorted(keys.keys() & spacekeys.keys()):
+        irk, ltk = keys[addr]
+        lines.append('%s %s %s %s' % (':'.join(wrap(addr.decode().upper(), 2)), irk.hex().upper(),
+                                      ltk.hex().upper(), spacekeys[addr].hex().upper()))
+    return lines
+
+
+def open_storage(args):
     if args.file[-4:] == '.bin':
-        with open(args.file, "rb") as file:
-            storage = file.read()
+        return open(args.file, "rb")
     elif args.file[-4:] == '.hex':
+        import io
+        from intelhex import IntelHex as IH
         ih = IH(args.file)
-        storage = ih[0x32000:0x38000].tobinstr()
+        if args.central:
+            args.offset, args.size = 0xf8000, 0x8000
+        return io.BytesIO(ih[args.offset:args.offset + args.size].tobinstr())
     else:
         print("unrecognized file extension", file=sys.stderr)
         sys.exit(-1)
-    items = read_items(storage)
-    for i in items:
-        read_setting(i)
+
+
+if __name__ == '__main__':
+    args = parser.parse_args()
+    if args.synthesize:
+        synthesize(args.file, args.synthesize, args.sector_size, args.align, args.coins)
+        sys.exit(0)
+
+    start = time.perf_counter()
+    with open_storage(args) as f:
+        sectors = list(read_sectors(f, args.sector_size, args.align))
+    state = FcbState(sectors, args.sector_size, args.align)
+    elapsed = time.perf_counter() - start
+    if not state.order:
+        print('no FCB sector found!', file=sys.stderr)
+        sys.exit(-1)
+
+    if args.export_coins:
+        print('\n'.join(export_coins(state)))
+        sys.exit(0)
+
+    for s in state.order:
+        for off, _, name, value in s.entries:
+            if args.all or state.is_live(s, off, name, value):
+                read_setting(name + b'=' + value)
+
+    print('')
+    print('sector  id     used   live   dead  entries  crc errors')
+    total_live = total_dead = live_keys = 0
+    for s in state.order:
+        live_keys += sum(1 for off, _, name, value in s.entries if state.is_live(s, off, name, value))
+        live, dead = state.live_dead(s)
+        total_live += live
+        total_dead += dead
+        print('%6u  %5u  %5u  %5u  %5u  %7u  %10u' % (s.index, s.fd_id, s.used, live, dead, len(s.entries),
+                                                      s.crc_errors))
+    print('%u sectors (%u free), %u keys, %u live bytes, %u dead bytes (parsed in %.3fs)' % (
+        len(sectors), state.free_sectors(), live_keys, total_live,
+        total_dead, elapsed))
+
+    if args.simulate:
+        simulate(state, args.simulate)
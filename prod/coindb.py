@@ -0,0 +1,299 @@
+#!/usr/bin/python3
+import argparse
+import binascii
+import ctypes
+import ctypes.util
+import fcntl
+import hashlib
+import os
+import re
+import secrets
+import sqlite3
+import tempfile
+import time
+
+parser = argparse.ArgumentParser(description='Coin database shared by gen_bond.py and sync_central.py.')
+parser.add_argument('--bench', type=int, default=0, metavar='N', help='benchmark load and lookup time with N coins')
+
+# regex to parse address and IRK
+id_regex = r"^((?:[0-9a-fA-F]{2}\:){5}[0-9a-fA-F]{2})\s*(random|public){0,1}\s*([0-9a-fA-F]{32})"
+coin_regex = id_regex + r"\s*([0-9a-fA-F]{32})\s*([0-9a-fA-F]{64})"
+name_regex = r"^((?:[0-9a-fA-F]{2}\:){5}[0-9a-fA-F]{2})\s+(.+)"
+
+
+def str_to_addr(a):
+    hex_arr = a.split(":")
+    return bytes([int(b, 16) for b in hex_arr[::-1]])
+
+
+# parses a line of either the central.txt or coins.txt and extracts BLE address, address type and IRK
+def parse_id_line(line):
+    m = re.search(id_regex, line)
+    if m:
+        addr = str_to_addr(m.group(1))
+        addr_type = m.group(2)
+        if not addr_type:
+            addr_type = "random"
+        return addr, addr_type, binascii.unhexlify(m.group(3))
+    else:
+        raise ValueError("Could not parse line")
+
+
+def parse_coin_line(line):
+    m = re.search(coin_regex, line)
+    if m:
+        addr = str_to_addr(m.group(1))
+        addr_type = m.group(2)
+        if not addr_type:
+            addr_type = "random"
+        return addr, addr_type, binascii.unhexlify(m.group(3)), binascii.unhexlify(m.group(4)), binascii.unhexlify(
+            m.group(5))
+    else:
+        raise ValueError("Could not parse line")
+
+
+# spacekey of a coin in derived-key mode: BLAKE2s keyed with the master key over address and generation
+def derive_spacekey(master, addr, generation=0):
+    if isinstance(addr, str):
+        addr = str_to_addr(addr)
+    return hashlib.blake2s(bytes(addr[::-1]) + generation.to_bytes(4, 'little'), key=master).digest()
+
+
+# the central compares this with its master key to detect a missing or different one
+def master_fingerprint(master):
+    return hashlib.blake2s(master, digest_size=8).hexdigest().upper()
+
+
+# generation of a coin's spacekey, None if it is not derived from the master key
+def spacekey_generation(master, addr, spacekey, max_generation=16):
+    if isinstance(spacekey, str):
+        spacekey = binascii.unhexlify(spacekey)
+    for generation in range(max_generation):
+        if derive_spacekey(master, addr, generation) == spacekey:
+            return generation
+    return None
+
+
+# reads the master key of derived-key mode, creates one if asked to
+def read_master(path="master.txt", create=False):
+    if not os.path.exists(path):
+        if not create:
+            return None
+        with open(path, "w") as f:
+            f.write(secrets.token_hex(32).upper())
+        os.chmod(path, 0o600)
+    with open(path, "r") as f:
+        return binascii.unhexlify(f.read().strip())
+
+
+class _TailedFile:
+    """
+    Remembers how far a text file has been parsed, so only appended lines are parsed again.
+    Files that are not tailed are read completely whenever they change.
+    """
+
+    def __init__(self, path, tail=True):
+        self.path = path
+        self.tail = tail
+        self.inode = None
+        self.offset = 0
+        self.mtime = None
+
+    # returns (full, lines): full is True if the file was replaced or truncated and has to be parsed again
+    def read_new_lines(self):
+        try:
+            st = os.stat(self.path)
+        except FileNotFoundError:
+            full = self.inode is not None
+            self.inode, self.offset, self.mtime = None, 0, None
+            return full, []
+        if self.tail:
+            full = st.st_ino != self.inode or st.st_size < self.offset
+        else:
+            full = (st.st_ino, st.st_size, st.st_mtime_ns) != (self.inode, self.offset, self.mtime)
+        if full:
+            self.inode, self.offset = st.st_ino, 0
+        self.mtime = st.st_mtime_ns
+        if st.st_size == self.offset:
+            return full, []
+        with open(self.path, "rb") as f:
+            fcntl.flock(f, fcntl.LOCK_SH)
+            f.seek(self.offset)
+            data = f.read()
+        # only consume complete lines of tailed files, a partially written line is parsed next time
+        end = data.rfind(b'\n') + 1 if self.tail else len(data)
+        self.offset += end
+        return full, data[:end].decode(errors='ignore').splitlines()
+
+
+class _Inotify:
+    """Minimal inotify binding (Linux only), used to wake up when one of the database files changes."""
+    IN_MODIFY = 0x002
+    IN_CLOSE_WRITE = 0x008
+    IN_MOVED_TO = 0x080
+    IN_CREATE = 0x100
+    IN_NONBLOCK = 0o4000
+
+    def __init__(self, directories):
+        libc = ctypes.CDLL(ctypes.util.find_library('c'), use_errno=True)
+        self.fd = libc.inotify_init1(self.IN_NONBLOCK)
+        if self.fd < 0:
+            raise OSError(ctypes.get_errno(), 'inotify_init1 failed')
+        mask = self.IN_MODIFY | self.IN_CLOSE_WRITE | self.IN_MOVED_TO | self.IN_CREATE
+        for d in set(directories):
+            libc.inotify_add_watch(self.fd, os.fsencode(d), mask)
+
+    # drain pending events
+    def read(self):
+        try:
+            return len(os.read(self.fd, 4096)) > 0
+        except BlockingIOError:
+            return False
+
+    def close(self):
+        os.close(self.fd)
+
+
+class CoinDB:
+    """
+    In-memory index of coins.txt, central.txt and names.txt.
+    Coins are indexed by their address string (upper case). reload() only parses appended lines.
+    With a SQLite file, the parsed state is persisted so a restart does not have to parse coins.txt again.
+    """
+
+    def __init__(self, coins="coins.txt", central="central.txt", names="names.txt", sqlite=None):
+        self.coins = {}  # address -> (IRK, LTK, spacekey) as hex strings
+        self.identity = []
+        self.names = {}
+        self._coins_file = _TailedFile(coins)
+        self._central_file = _TailedFile(central, tail=False)
+        self._names_file = _TailedFile(names, tail=False)
+        self._inotify = None
+        self._sql = None
+        if sqlite:
+            self._sql = sqlite3.connect(sqlite)
+            self._sql_load()
+        self.reload()
+
+    def _sql_load(self):
+        c = self._sql
+        c.execute("CREATE TABLE IF NOT EXISTS coins (addr TEXT PRIMARY KEY, irk TEXT, ltk TEXT, spacekey TEXT)")
+        c.execute("CREATE TABLE IF NOT EXISTS files (path TEXT PRIMARY KEY, inode INTEGER, offset INTEGER)")
+        row = c.execute("SELECT inode, offset FROM files WHERE path = ?", (self._coins_file.path,)).fetchone()
+        if row:
+            self._coins_file.inode, self._coins_file.offset = row
+            self.coins = {a: (i, l, s) for a, i, l, s in c.execute("SELECT addr, irk, ltk, spacekey FROM coins")}
+
+    def _sql_store(self, full, new_coins):
+        c = self._sql
+        with c:
+            if full:
+                c.execute("DELETE FROM coins")
+            c.executemany("INSERT OR REPLACE INTO coins VALUES (?, ?, ?, ?)",
+                          [(a,) + v for a, v in new_coins.items()])
+            c.execute("INSERT OR REPLACE INTO files VALUES (?, ?, ?)",
+                      (self._coins_file.path, self._coins_file.inode, self._coins_file.offset))
+
+    # parse new lines of all files; returns the set of changed parts ("coins", "identity", "names")
+    def reload(self):
+        changed = set()
+        full, lines = self._coins_file.read_new_lines()
+        if full:
+            self.coins = {}
+        new_coins = {}
+        for line in lines:
+            m = re.search(coin_regex, line)
+            if m:
+                new_coins[m.group(1).upper()] = (m.group(3).upper(), m.group(4).upper(), m.group(5).upper())
+        if full or new_coins:
+            self.coins.update(new_coins)
+            changed.add("coins")
+            if self._sql:
+                self._sql_store(full, new_coins)
+
+        full, lines = self._central_file.read_new_lines()
+        if full:
+            for line in lines[:1]:
+                m = re.search(id_regex, line)
+                if m:
+                    self.identity = (m.group(1).upper(), m.group(3).upper())
+            changed.add("identity")
+
+        full, lines = self._names_file.read_new_lines()
+        if full:
+            self.names = {}
+        for line in lines:
+            m = re.match(name_regex, line)
+            if m:
+                self.names[m.group(1).upper()] = m.group(2)
+        if full or lines:
+            changed.add("names")
+        return changed
+
+    # KeykeeperDB compatibility: the files are tailed, so load() just picks up changes
+    def load(self):
+        self.reload()
+
+    def lookup(self, addr):
+        if isinstance(addr, bytes):
+            addr = ":".join("%02X" % b for b in addr[::-1])
+        return self.coins.get(addr.upper())
+
+    def addresses(self):
+        return [str_to_addr(a) for a in self.coins]
+
+    # file descriptor that becomes readable when one of the files changes (None without inotify)
+    def fileno(self):
+        if self._inotify is None:
+            try:
+                paths = [self._coins_file.path, self._central_file.path, self._names_file.path]
+                self._inotify = _Inotify([os.path.dirname(os.path.abspath(p)) for p in paths])
+            except (OSError, AttributeError, TypeError):
+                return None
+        return self._inotify.fd
+
+    # call when fileno() is readable (or periodically without inotify)
+    def poll(self):
+        if self._inotify:
+            self._inotify.read()
+        return self.reload()
+
+
+def _bench(n):
+    with tempfile.TemporaryDirectory() as d:
+        coins = os.path.join(d, "coins.txt")
+        central = os.path.join(d, "central.txt")
+        with open(central, "w") as f:
+            f.write("C0:11:22:33:44:55 " + secrets.token_hex(16).upper())
+        with open(coins, "w") as f:
+            for _ in range(n):
+                f.write("%s %s %s %s\n" % (":".join("%02X" % b for b in secrets.token_bytes(6)),
+                                           secrets.token_hex(16).upper(), secrets.token_hex(16).upper(),
+                                           secrets.token_hex(32).upper()))
+        start = time.perf_counter()
+        db = CoinDB(coins, central, os.path.join(d, "names.txt"))
+        print("load %u coins: %.1f ms" % (n, 1000 * (time.perf_counter() - start)))
+
+        addrs = list(db.coins)
+        start = time.perf_counter()
+        for a in addrs:
+            db.lookup(a)
+        print("lookup: %.2f us per coin" % (1e6 * (time.perf_counter() - start) / len(addrs)))
+
+        with open(coins, "a") as f:
+            f.write("C1:00:00:00:00:01 %s %s %s\n" % ("00" * 16, "00" * 16, "00" * 32))
+        start = time.perf_counter()
+        db.reload()
+        print("reload after appending 1 coin: %.2f ms" % (1000 * (time.perf_counter() - start)))
+
+        sqlite = os.path.join(d, "coins.sqlite")
+        CoinDB(coins, central, os.path.join(d, "names.txt"), sqlite=sqlite)
+        start = time.perf_counter()
+        db = CoinDB(coins, central, os.path.join(d, "names.txt"), sqlite=sqlite)
+        print("load %u coins from SQLite: %.1f ms" % (len(db.coins), 1000 * (time.perf_counter() - start)))
+
+
+if __name__ == '__main__':
+    args = parser.parse_args()
+    if args.bench:
+        _bench(args.bench)
@@ -0,0 +1,238 @@
+#!/usr/bin/python3
+import argparse
+import hashlib
+import os
+import pty
+import random
+import secrets
+import select
+import shutil
+import sys
+import tempfile
+import threading
+import time
+import tty
+
+parser = argparse.ArgumentParser(description='Stand-in centrals on pseudo terminals for testing sync_central.py.')
+parser.add_argument('--count', type=int, default=1, help='number of stand-in centrals')
+parser.add_argument('--latency', type=float, default=0.01,
+                    help='seconds per coin command, emulates the flash write (default: 0.01)')
+parser.add_argument('--unlock-interval', type=float, default=0, metavar='S',
+                    help='emit an authenticated coin every S seconds while scanning (default: never)')
+parser.add_argument('--bench', metavar='N,N,...', help='benchmark sync time with this many centrals per run')
+parser.add_argument('--coins', type=int, default=200, help='number of coins in the benchmark database')
+
+
+def _addr(a):
+    return bytes.fromhex(a.replace(':', ''))
+
+
+class FakeCentral:
+    """
+    Answers the shell commands sync_central.py uses like the central firmware does.
+    The port is a symlink to the current pseudo terminal: a reboot closes it and opens a new one,
+    like the USB serial of the central that disappears and comes back.
+    """
+
+    def __init__(self, port, latency=0.01, unlock_interval=0):
+        self.port = port
+        self.latency = latency
+        self.unlock_interval = unlock_interval
+        self.identity = None
+        self.coins = {}  # address -> (IRK, LTK, spacekey)
+        self.running = False
+        self.commands = 0
+        self._master = None
+        self._lock = threading.Lock()
+        self._open()
+        threading.Thread(target=self._run, daemon=True).start()
+
+    def _open(self):
+        self._master, slave = pty.openpty()
+        tty.setraw(slave)
+        name = os.ttyname(slave)
+        # the slave stays open, so the terminal survives the daemon closing it
+        self._slave = slave
+        tmp = self.port + '.tmp'
+        os.symlink(name, tmp)
+        os.replace(tmp, self.port)
+
+    def _reboot(self):
+        time.sleep(0.05)
+        os.close(self._master)
+        os.close(self._slave)
+        self.running = False
+        self._open()
+
+    def _write(self, line):
+        with self._lock:
+            os.write(self._master, (line + '\r\n').encode('ASCII'))
+
+    def _coin_digest(self, addr):
+        irk, ltk, spacekey = self.coins[addr]
+        return hashlib.blake2s(_addr(addr) + bytes.fromhex(irk + ltk + spacekey)).hexdigest().upper()
+
+    def _bucket_coins(self, bucket):
+        return {a: self._coin_digest(a) for a in sorted(self.coins) if int(a[-1], 16) == bucket}
+
+    def _digest(self, args):
+        self._write('ble: {}'.format('running' if self.running else 'stopped'))
+        if self.identity:
+            self._write('id: {}'.format(self.identity))
+        if args:
+            for addr, digest in self._bucket_coins(int(args[0])).items():
+                self._write('[{}] {}'.format(addr, digest))
+            return
+        buckets = []
+        for b in range(16):
+            h = hashlib.blake2s()
+            for d in self._bucket_coins(b).values():
+                h.update(bytes.fromhex(d))
+            buckets.append(h.digest())
+        self._write('digest: {}'.format(hashlib.blake2s(b''.join(buckets)).hexdigest().upper()))
+        for b in range(16):
+            self._write('bucket {}: {}'.format(b, buckets[b].hex().upper()))
+
+    # returns False if the central reboots
+    def _command(self, line):
+        self._write('uart:~$ ' + line)
+        args = line.split()
+        if not args:
+            return True
+        self.commands += 1
+        cmd = args[0] if args[0] != 'stats' else ' '.join(args[:2])
+        if cmd == 'reboot':
+            return False
+        if cmd == 'ble_start':
+            self.running = True
+            self._write('<inf> bt_hci_core: Identity: {} (random)'.format(self.identity))
+            return True
+        if cmd in ('coin', 'central_setup', 'settings') and self.running:
+            self._write('BLE stack already running!')
+            return True
+        if cmd == 'stats digest':
+            self._digest(args[2:])
+        elif cmd == 'coin' and args[1] == 'add' and len(args) == 6:
+            time.sleep(self.latency)
+            self.coins[args[2].upper()] = tuple(a.upper() for a in args[3:6])
+        elif cmd == 'coin' and args[1] == 'del':
+            time.sleep(self.latency)
+            self.coins.pop(args[2].upper(), None)
+        elif cmd == 'central_setup':
+            self.identity = args[1].upper()
+        elif cmd == 'settings' and args[1] == 'clear':
+            self.identity = None
+            self.coins = {}
+            self._write('Storage cleared, rebooting.')
+            return False
+        else:
+            self._write('unknown command')
+        self._write('done')
+        return True
+
+    def _unlock(self):
+        if not self.coins:
+            return
+        addr = random.choice(list(self.coins))
+        self._write('<inf> app: Connected: [{}]'.format(addr))
+        self._write('<inf> app: Battery Level: {}%'.format(random.randint(50, 100)))
+        self._write('<inf> app: KEY AUTHENTICATED. OPEN DOOR PLEASE.')
+        self._write('<inf> app: Disconnected: [{}] (reason 19)'.format(addr))
+
+    def _run(self):
+        buf = b''
+        last_unlock = time.monotonic()
+        while True:
+            data = b''
+            if select.select([self._master], [], [], 0.1)[0]:
+                data = os.read(self._master, 4096)
+            if self.running and self.unlock_interval and time.monotonic() - last_unlock > self.unlock_interval:
+                last_unlock = time.monotonic()
+                self._unlock()
+            buf += data
+            while b'\r' in buf:
+                line, _, buf = buf.partition(b'\r')
+                buf = buf.lstrip(b'\n')
+                if not self._command(line.decode(errors='ignore').strip()):
+                    self._reboot()
+                    buf = b''
+                    break
+
+
+def _coin_lines(count):
+    return ''.join('%s %s %s %s\n' % (':'.join('%02X' % b for b in secrets.token_bytes(6)),
+                                       secrets.token_hex(16).upper(), secrets.token_hex(16).upper(),
+                                       secrets.token_hex(32).upper()) for _ in range(count))
+
+
+# waits until every door reported scanning, returns the time since start
+def _wait_scanning(status, doors, start):
+    scanning = set()
+    for line in status:
+        if line.endswith('central connected and scanning\n'):
+            scanning.add(line[1:line.index(']')])
+            if scanning == doors:
+                return time.perf_counter() - start
+    raise EOFError('status pipe closed')
+
+
+def _bench(counts, coins, latency):
+    import asyncio
+    import sync_central
+    with tempfile.TemporaryDirectory() as d:
+        central_path = os.path.join(d, 'central.txt')
+        with open(central_path, 'w') as f:
+            f.write('C0:11:22:33:44:55 ' + secrets.token_hex(16).upper())
+        for n in counts:
+            run = tempfile.mkdtemp(dir=d)
+            coins_path = os.path.join(run, 'coins.txt')
+            with open(coins_path, 'w') as f:
+                f.write(_coin_lines(coins))
+            centrals = {'door%u' % i: FakeCentral(os.path.join(run, 'central%u' % i), latency) for i in range(n)}
+            db = sync_central.KeykeeperDB(coins=coins_path, central=central_path, names=os.path.join(run, 'names.txt'),
+                                          master=os.path.join(run, 'master.txt'))
+            pipein, pipeout = os.pipe()
+            daemon = sync_central.KeykeeperDaemon(db, pipeout, {door: c.port for door, c in centrals.items()})
+            loop = asyncio.new_event_loop()
+            task = loop.create_task(daemon.run_async())
+
+            def serve():
+                try:
+                    loop.run_until_complete(task)
+                except asyncio.CancelledError:
+                    pass
+                loop.close()
+
+            start = time.perf_counter()
+            thread = threading.Thread(target=serve, daemon=True)
+            thread.start()
+            with os.fdopen(pipein, 'r', encoding='utf8') as status:
+                initial = _wait_scanning(status, set(centrals), start)
+                # a change reboots every central and synchronizes the changed buckets
+                start = time.perf_counter()
+                with open(coins_path, 'a') as f:
+                    f.write(_coin_lines(10))
+                change = _wait_scanning(status, set(centrals), start)
+                loop.call_soon_threadsafe(task.cancel)
+                thread.join()
+            os.close(pipeout)
+            commands = sum(c.commands for c in centrals.values())
+            ok = all(len(c.coins) == coins + 10 for c in centrals.values())
+            print('%2u centrals, %u coins: initial sync %.2f s, 10 coins added %.2f s (%u commands%s)' % (
+                n, coins, initial, change, commands, '' if ok else ', NOT SYNCHRONIZED'))
+
+
+if __name__ == '__main__':
+    args = parser.parse_args()
+    if args.bench:
+        _bench([int(n) for n in args.bench.split(',')], args.coins, args.latency)
+        sys.exit(0)
+    directory = tempfile.mkdtemp(prefix='fake_central_')
+    for i in range(args.count):
+        c = FakeCentral(os.path.join(directory, 'central%u' % i), args.latency, args.unlock_interval)
+        print('--port door{}={}'.format(i, c.port))
+    try:
+        while True:
+            time.sleep(1)
+    except KeyboardInterrupt:
+        shutil.rmtree(directory, ignore_errors=True)
@@ -0,0 +1,103 @@
+#!/usr/bin/python3
+import argparse
+import datetime
+import os
+import re
+import struct
+import sys
+import time
+import zlib
+
+import serial
+
+from coindb import name_regex
+from fetch_trace import command
+
+parser = argparse.ArgumentParser(description='Fetch the access log of the central (accesslog dump) over serial.')
+parser.add_argument('file', nargs='?',
+                    help='log file, new records are appended (default: stdout); fetching continues after its last record')
+parser.add_argument('--port', default='/dev/serial/by-id/usb-ZEPHYR_N39_BLE_KEYKEEPER_0.01-if00',
+                    help='serial port of the central')
+parser.add_argument('--since', type=int, help='first sequence number (default: after the last one in the file)')
+parser.add_argument('--names', default='names.txt', help='names of the coins (default: names.txt)')
+parser.add_argument('--set-clock', action='store_true', help='set the log clock of the central to the host time')
+parser.add_argument('--timeout', type=float, default=5, help='read timeout in seconds (default: 5)')
+
+# struct accesslog_record in central-onchip/src/accesslog.h
+RECORD = struct.Struct('<IIB6sBbbHI')
+CLOCK_SET = 0x80
+RESULTS = ['ok', 'fail-connect', 'fail-security', 'fail-discovery', 'fail-validation']
+
+
+def decode(line, names):
+    raw = bytes.fromhex(line.split()[1])
+    seq, t, addr_type, addr, result, rssi, battery, latency, crc = RECORD.unpack(raw)
+    if crc != zlib.crc32(raw[:-4]):
+        return None
+    addr = ':'.join('%02X' % b for b in reversed(addr))
+    if result & CLOCK_SET:
+        when = datetime.datetime.fromtimestamp(t).isoformat(sep=' ')
+    else:
+        # seconds of the log clock, the host never set it
+        when = 'clock+%u' % t
+    result &= ~CLOCK_SET
+    return seq, '%u\t%s\t%s\t%s\t%s\t%d\t%s\t%u' % (
+        seq, when, addr, names.get(addr, '-'), RESULTS[result] if result < len(RESULTS) else str(result), rssi,
+        '-' if battery < 0 else '%u%%' % battery, latency)
+
+
+def last_seq(path):
+    last = -1
+    if path and os.path.exists(path):
+        with open(path) as f:
+            for line in f:
+                if line[:1].isdigit():
+                    last = int(line.split('\t', 1)[0])
+    return last
+
+
+def main():
+    args = parser.parse_args()
+    names = {}
+    if os.path.exists(args.names):
+        with open(args.names) as f:
+            for line in f:
+                m = re.match(name_regex, line)
+                if m:
+                    names[m.group(1).upper()] = m.group(2)
+    since = args.since if args.since is not None else last_seq(args.file) + 1
+    # the central is usually held by sync_central.py, stop it first
+    with serial.Serial(os.path.realpath(args.port), timeout=args.timeout) as central:
+        central.write(b'\r\n\r\n')
+        central.reset_input_buffer()
+        lines = command(central, 'accesslog dump {}'.format(since))
+        if args.set_clock:
+            command(central, 'accesslog clock {}'.format(int(time.time())))
+    summary = next((l for l in lines if l.startswith('accesslog:')), 'no access log')
+    records = []
+    damaged = 0
+    expected = since
+    gaps = 0
+    for line in lines:
+        if not line.startswith('log '):
+            continue
+        r = decode(line, names)
+        if not r:
+            damaged += 1
+            continue
+        # sequence numbers are skipped after a power loss of the central, for the records it lost
+        if r[0] > expected and records:
+            gaps += r[0] - expected
+        expected = r[0] + 1
+        records.append(r[1])
+    out = open(args.file, 'a') if args.file else sys.stdout
+    if records:
+        out.write('\n'.join(records) + '\n')
+    if args.file:
+        out.close()
+    print('%s\n%u records fetched, %u damaged, %u sequence numbers missing' % (summary, len(records), damaged, gaps),
+          file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()
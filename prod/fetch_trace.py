@@ -0,0 +1,55 @@
+#!/usr/bin/python3
+import argparse
+import os
+import re
+import sys
+
+import serial
+
+parser = argparse.ArgumentParser(description='Fetch the session trace of the central (trace dump) over serial.')
+parser.add_argument('file', nargs='?', help='output file (default: stdout)')
+parser.add_argument('--port', default='/dev/serial/by-id/usb-ZEPHYR_N39_BLE_KEYKEEPER_0.01-if00',
+                    help='serial port of the central')
+parser.add_argument('--clear', action='store_true', help='clear the trace after fetching it')
+parser.add_argument('--timeout', type=float, default=5, help='read timeout in seconds (default: 5)')
+
+# color codes of the shell
+ANSI_ESCAPE = re.compile(r'\x1B[@-_][0-?]*[ -/]*[@-~]')
+
+
+def command(central, cmd):
+    central.write('{}\r\n'.format(cmd).encode('ASCII'))
+    lines = []
+    echoed = False
+    while True:
+        raw = central.readline()
+        if not raw:
+            raise TimeoutError('no answer to "{}"'.format(cmd))
+        line = ANSI_ESCAPE.sub('', raw.decode(errors='ignore')).rstrip('\r\n')
+        if not echoed:
+            echoed = line.endswith(cmd)
+        elif line == 'done':
+            return lines
+        else:
+            lines.append(line)
+
+
+def main():
+    args = parser.parse_args()
+    # the central is usually held by sync_central.py, stop it first
+    with serial.Serial(os.path.realpath(args.port), timeout=args.timeout) as central:
+        central.write(b'\r\n\r\n')
+        central.reset_input_buffer()
+        lines = command(central, 'trace dump')
+        if args.clear:
+            command(central, 'trace clear')
+    trace = [l for l in lines if l.startswith('trace')]
+    out = open(args.file, 'w') if args.file else sys.stdout
+    out.write('\n'.join(trace) + '\n')
+    if args.file:
+        out.close()
+        print(trace[0] if trace else 'no trace', file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()
@@ -1,11 +1,36 @@
 #!/usr/bin/python3
+import argparse
 import secrets
-import re
 import fcntl
 import os
 import binascii
+import multiprocessing
+import struct
 import sys
+import time
+import zlib
 from intelhex import IntelHex
+from coindb import CoinDB, parse_id_line, derive_spacekey, read_master, str_to_addr
+
+parser = argparse.ArgumentParser(description='Generate keys for a new coin (or an existing one) and a hex file to flash.')
+parser.add_argument('addr', nargs='?', help='address of an existing coin in coins.txt to regenerate the hex file for')
+parser.add_argument('--key-record', action='store_true',
+                    help='store the keys as fixed key record instead of FCB settings (needs coin_keyrecord.hex)')
+parser.add_argument('--count', type=int, default=1, help='number of new coins to generate')
+parser.add_argument('--storage-only', action='store_true',
+                    help='only write the storage partition (storage_<addr>.hex), flash the firmware separately')
+parser.add_argument('--jobs', type=int, default=None, help='number of worker processes (default: number of CPUs)')
+parser.add_argument('--master', action='store_true',
+                    help='derive the spacekeys from the master key in master.txt (created on first use)')
+parser.add_argument('--generation', type=int, default=None, metavar='N',
+                    help='renew the spacekey of an existing coin with generation N of its derived key')
+parser.add_argument('--central', action='store_true',
+                    help='write central_<addr>.hex: central.hex with a settings partition holding the identity and '
+                         'all coins of coins.txt (with --storage-only: the partition only)')
+parser.add_argument('--board', choices=['nrf52_coin', 'nrf51_coin'], default='nrf52_coin',
+                    help='board of the coin (default: nrf52_coin); nrf51_coin needs --key-record and coin_nrf51.hex')
+parser.add_argument('--max-paired', type=int, default=50,
+                    help='CONFIG_BT_MAX_PAIRED of the central, more coins are not loaded (default: 50)')
 
 
 # generate human-readable colon-separated BLE address string
@@ -34,6 +59,13 @@ def fcb_crc8(data):
     return val
 
 
+# storage partition (address and length from DTS) and read-back protection (UICR) of the coin boards
+COIN_BOARDS = {
+    'nrf52_coin': {'storage': (0x32000, 0x6000), 'protect': (0x10001208, [0x00] * 4)},  # APPROTECT
+    'nrf51_coin': {'storage': (0x3e000, 0x2000), 'protect': (0x10001004, [0xff, 0x00])},  # RBPCONF.PALL
+}
+
+
 # generate FCB storage item from data
 def gen_storage_item(data):
     assert len(data) < 0x4000
@@ -46,7 +78,7 @@ def gen_storage_item(data):
 
 # generate storage partition
 def periph_storage_partition(periph_addr, periph_irk, central_addr, central_irk, ltk,
-                             spacekey):
+                             spacekey, size):
     magic_header = b'\xee\xee\xff\xc0\x01\xff\x00\x00'
     bt_id = b'bt/id=\x01' + bytes(periph_addr)
     bt_irk = b'bt/irk=' + bytes(periph_irk)
@@ -58,73 +90,97 @@ def periph_storage_partition(periph_addr, periph_irk, central_addr, central_irk,
         gen_storage_item(bt_irk) + \
         gen_storage_item(bt_keys) + \
         gen_storage_item(space_key)
-    return data + b'\xff' * (0x6000 - len(data))  # partition length from DTS
+    return data + b'\xff' * (size - len(data))
+
+
+# storage partition of the central (nrf52840_pca10059 DTS), FCB sectors are flash pages
+CENTRAL_STORAGE_ADDR = 0xf8000
+CENTRAL_STORAGE_SIZE = 0x8000
+FCB_SECTOR_SIZE = 0x1000
+
+
+# bt_keys entry of a bond: enc_size 16, flags authenticated|SC, keys IRK|LTK_P256, no rand/ediv, no RPA
+def bt_keys_item(addr, irk, ltk):
+    return b'bt/keys/' + binascii.hexlify(addr[::-1]) + b'1=\x10\x11"\x00' + b'\x00' * 10 + \
+        bytes(ltk) + bytes(irk) + b'\x00' * 6
+
+
+# generate the settings partition of the central with its identity and all coins, as `central_setup` and
+# `coin add` would write it, but compact: every key once and no deleted entries
+def central_storage_partition(central_addr, central_addr_type, central_irk, coins):
+    items = [b'bt/id=' + bytes([1 if central_addr_type == 'random' else 0]) + bytes(central_addr),
+             b'bt/irk=' + bytes(central_irk)]
+    for p_addr, p_irk, ltk, spacekey in sorted(coins, key=lambda c: c[0][::-1]):
+        items.append(bt_keys_item(p_addr, p_irk, ltk))
+        items.append(b'space/' + binascii.hexlify(p_addr[::-1]) + b'1=' + bytes(spacekey))
+    # entries do not cross sectors, the sector ids count up from 0
+    sectors = []
+    for item in map(gen_storage_item, items):
+        if not sectors or len(sectors[-1]) + len(item) > FCB_SECTOR_SIZE:
+            fd_id = len(sectors)
+            sectors.append(b'\xee\xee\xff\xc0\x01\xff' + bytes([fd_id & 0xff, fd_id >> 8]))
+        sectors[-1] += item
+    # settings_fcb keeps one sector free for compression
+    if len(sectors) > CENTRAL_STORAGE_SIZE // FCB_SECTOR_SIZE - 1:
+        raise ValueError('%u coins do not fit into the storage partition' % len(coins))
+    data = b''.join(s + b'\xff' * (FCB_SECTOR_SIZE - len(s)) for s in sectors)
+    return data + b'\xff' * (CENTRAL_STORAGE_SIZE - len(data))
+
+
+# creates the hex file of the central: central.hex merged with its settings partition, or the partition only
+def write_central_hex(central_addr, central_addr_type, central_irk, coins, storage_only):
+    storage = IntelHex()
+    storage[CENTRAL_STORAGE_ADDR:CENTRAL_STORAGE_ADDR + CENTRAL_STORAGE_SIZE] = list(
+        central_storage_partition(central_addr, central_addr_type, central_irk, coins))
+    addr_string = binascii.hexlify(central_addr[::-1]).decode()
+    if storage_only:
+        central = storage
+        path = "storage_central_%s.hex" % addr_string
+    else:
+        central = IntelHex("central.hex")
+        central.merge(storage, overlap="replace")
+        path = "central_%s.hex" % addr_string
+    central.tofile(path, format="hex")
+    return path
 
 
-# regex to parse address and IRK
-id_regex = r"^((?:[0-9a-fA-F]{2}\:){5}[0-9a-fA-F]{2})\s*(random|public){0,1}\s*([0-9a-fA-F]{32})"
-coin_regex = id_regex+r"\s*([0-9a-fA-F]{32})\s*([0-9a-fA-F]{64})"
+# generate storage partition holding a fixed-layout key record (see coin/src/keyrecord.h)
+KEY_RECORD_MAGIC = 0x4e494f43  # "COIN"
+KEY_RECORD_VERSION = 1
 
 
-# parses a line of either the central.txt or coins.txt and extracts BLE address, address type and IRK
-def parse_id_line(line):
-    m = re.search(id_regex, line)
-    if m:
-        a = m.group(1)
-        hex_arr = a.split(":")
-        addr = bytes([int(b, 16) for b in hex_arr[::-1]])
-        addr_type = m.group(2)
-        if not addr_type:
-            addr_type = "random"
-        return addr, addr_type, binascii.unhexlify(m.group(3))
-    else:
-        raise ValueError("Could not parse line")
+def periph_key_record(periph_addr, periph_irk, central_addr, central_irk, ltk,
+                      spacekey, size):
+    record = struct.pack('<IB3x', KEY_RECORD_MAGIC, KEY_RECORD_VERSION) + \
+        b'\x01' + bytes(periph_addr) + bytes(periph_irk) + \
+        b'\x01' + bytes(central_addr) + bytes(central_irk) + \
+        bytes(ltk) + bytes(spacekey)
+    data = record + struct.pack('<I', zlib.crc32(record))
+    return data + b'\xff' * (size - len(data))
 
 
 # reads existing ids from coins.txt into a list
 def read_ids(path="coins.txt"):
-    result = []
-    if not os.path.exists(path):
-        return result
-    with open(path, "r") as f:
-        fcntl.flock(f, fcntl.LOCK_EX | fcntl.LOCK_NB)
-        for line in f:
-            addr, foo, bar = parse_id_line(line)
-            result.append(addr)
-    return result
-
-
-def parse_coin_line(line):
-    m = re.search(coin_regex, line)
-    if m:
-        a = m.group(1)
-        hex_arr = a.split(":")
-        addr = bytes([int(b, 16) for b in hex_arr[::-1]])
-        addr_type = m.group(2)
-        if not addr_type:
-            addr_type = "random"
-        return addr, addr_type, binascii.unhexlify(m.group(3)), binascii.unhexlify(m.group(4)), binascii.unhexlify(m.group(5))
-    else:
-        raise ValueError("Could not parse line")
+    return CoinDB(coins=path).addresses()
 
 
 def read_coin_data(c_addr, path="coins.txt"):
-    if not os.path.exists(path):
+    coin = CoinDB(coins=path).lookup(c_addr)
+    if coin is None:
         return None
-    with open(path, "r") as f:
-        fcntl.flock(f, fcntl.LOCK_EX | fcntl.LOCK_NB)
-        for line in f:
-            addr, _, irk, ltk, spacekey = parse_coin_line(line)
-            if addr == c_addr:
-                return irk, ltk, spacekey
-    return None
+    return tuple(binascii.unhexlify(k) for k in coin)
 
 
 # appends a coin line to coins.txt (using flock for exclusive access)
 def append_id(line, path="coins.txt"):
+    append_ids([line], path)
+
+
+# appends several coin lines to coins.txt in one locked write
+def append_ids(lines, path="coins.txt"):
     with open(path, "a") as f:
         fcntl.flock(f, fcntl.LOCK_EX | fcntl.LOCK_NB)
-        f.write(line)
+        f.write("".join(lines))
 
 
 # reads central address and IRK if central.txt exists, otherwise initializes it
@@ -157,39 +213,115 @@ def gen_peripheral(addr_list):
     return peripheral_addr, peripheral_irk
 
 
+# generates a complete set of new coins with unique addresses and fresh keys
+# with a master key, the spacekeys are derived (generation 0) instead of random
+def gen_coins(count, addr_list, master=None):
+    addr_list = set(addr_list)
+    coins = []
+    for _ in range(count):
+        p_addr, p_irk = gen_peripheral(addr_list)
+        addr_list.add(p_addr)
+        ltk = secrets.token_bytes(16)
+        spacekey = derive_spacekey(master, p_addr) if master else secrets.token_bytes(32)
+        coins.append((p_addr, p_irk, ltk, spacekey))
+    return coins
+
+
+# parsed firmware image, passed to the worker processes by init_worker()
+base_image = None
+
+
+# sets the firmware image of a worker process (workers do not inherit globals with the spawn start method)
+def init_worker(image):
+    global base_image
+    base_image = image
+
+
+# creates the hex file of a single coin: merged with the firmware or storage partition only
+def write_coin_hex(job):
+    p_addr, p_irk, c_addr, c_irk, ltk, spacekey, key_record, storage_only, board = job
+    storage_addr, storage_size = COIN_BOARDS[board]['storage']
+    # create storage partition
+    if key_record:
+        storage_bytes = periph_key_record(
+            p_addr, p_irk, c_addr, c_irk, ltk, spacekey, storage_size)
+    else:
+        storage_bytes = periph_storage_partition(
+            p_addr, p_irk, c_addr, c_irk, ltk, spacekey, storage_size)
+
+    addr_string = binascii.hexlify(p_addr[::-1]).decode()
+
+    storage = IntelHex()
+    storage[storage_addr:storage_addr + storage_size] = list(storage_bytes)
+    if storage_only:
+        # the firmware is flashed once without protection, the protection comes with the keys
+        coin = storage
+        path = "storage_%s.hex" % addr_string
+    else:
+        # create merged hex file for easy programming
+        coin = IntelHex(base_image)
+        coin.merge(storage, overlap="replace")
+        path = "coin_%s.hex" % addr_string
+    protect_addr, protect_bytes = COIN_BOARDS[board]['protect']
+    coin[protect_addr:protect_addr + len(protect_bytes)] = protect_bytes  # enable Access Port Protection
+    coin.tofile(path, format="hex")
+    return path
+
+
 if __name__ == '__main__':
+    args = parser.parse_args()
+    if args.board == 'nrf51_coin' and not args.key_record:
+        sys.exit("the nRF51 coin has no settings storage, use --key-record")
     c_addr, c_addr_type, c_irk = gen_central()
+    print("central: " + addr_to_str(c_addr))
+
+    if args.central:
+        # the central gets all coins, nothing is generated
+        coins = [(str_to_addr(a),) + tuple(binascii.unhexlify(k) for k in keys) for a, keys in CoinDB().coins.items()]
+        if len(coins) > args.max_paired:
+            sys.exit("%u coins, but the central keeps only %u bonds (--max-paired)" % (len(coins), args.max_paired))
+        try:
+            path = write_central_hex(c_addr, c_addr_type, c_irk, coins, args.storage_only)
+        except ValueError as e:
+            sys.exit(str(e))
+        print("wrote %s with %u coins" % (path, len(coins)))
+        sys.exit(0)
 
     # prepare IDs
-    if len(sys.argv) == 2:
-        hex_arr = sys.argv[1].split(":")
+    if args.addr:
+        hex_arr = args.addr.split(":")
         p_addr = bytes([int(b, 16) for b in hex_arr[::-1]])
         p_irk, ltk, spacekey = read_coin_data(p_addr)
-        print("central: " + addr_to_str(c_addr))
         print("existing peripheral: " + addr_to_str(p_addr))
+        if args.generation is not None:
+            # the new line replaces the old one, sync_central.py sets the generation on the central
+            master = read_master()
+            if master is None:
+                sys.exit("--generation needs master.txt")
+            spacekey = derive_spacekey(master, p_addr, args.generation)
+            append_id(coin_line(p_addr, p_irk, ltk, spacekey))
+            print("generation: %u" % args.generation)
+        coins = [(p_addr, p_irk, ltk, spacekey)]
     else:
-        p_addr, p_irk = gen_peripheral(read_ids())
-        # prepare keys
-        ltk = secrets.token_bytes(16)
-        spacekey = secrets.token_bytes(32)
-        # write coin line
-        append_id(coin_line(p_addr, p_irk, ltk, spacekey))
-        print("central: " + addr_to_str(c_addr))
-        print("new peripheral: " + addr_to_str(p_addr))
-
-    # create storage partition
-    storage_bytes = periph_storage_partition(
-        p_addr, p_irk, c_addr, c_irk, ltk, spacekey)
-
-    addr_string = binascii.hexlify(p_addr[::-1]).decode()
-
-    # create merged hex file for easy programming
-    storage = IntelHex()
-    storage[0x32000:0x38000] = list(
-        storage_bytes)  # partition address from DTS
-    # storage.tofile("storage_%s.hex" % addr_string, format="hex")
-    coin = IntelHex("coin.hex")
-    coin.merge(storage, overlap="replace")
-    coin[0x10001208:0x10001208 + 4] = [0x00] * \
-        4  # enable Access Port Protection
-    coin.tofile("coin_%s.hex" % addr_string, format="hex")
+        coins = gen_coins(args.count, read_ids(), read_master(create=True) if args.master else None)
+        # write all coin lines at once
+        append_ids([coin_line(*c) for c in coins])
+        for c in coins:
+            print("new peripheral: " + addr_to_str(c[0]))
+
+    start = time.perf_counter()
+    if not args.storage_only:
+        # parse the firmware only once for all coins
+        if args.board == 'nrf51_coin':
+            base_image = IntelHex("coin_nrf51.hex")
+        else:
+            base_image = IntelHex("coin_keyrecord.hex" if args.key_record else "coin.hex")
+    jobs = [(p_addr, p_irk, c_addr, c_irk, ltk, spacekey, args.key_record, args.storage_only, args.board)
+            for p_addr, p_irk, ltk, spacekey in coins]
+    if len(jobs) > 1:
+        with multiprocessing.Pool(args.jobs, initializer=init_worker, initargs=(base_image,)) as pool:
+            pool.map(write_coin_hex, jobs)
+    else:
+        for job in jobs:
+            write_coin_hex(job)
+    print("wrote %u hex file(s) in %.2fs" % (len(jobs), time.perf_counter() - start))
@@ -0,0 +1,60 @@
+#!/usr/bin/python3
+import argparse
+import sys
+from coindb import CoinDB, str_to_addr
+
+parser = argparse.ArgumentParser(description='Generate the coins of the swarm emulator (coin-swarm/swarm_coins.inc) '
+                                             'from coins.txt and central.txt.')
+parser.add_argument('output', nargs='?', default='../coin-swarm/swarm_coins.inc', help='output file')
+parser.add_argument('--count', type=int, default=10, help='number of coins (at most CONFIG_BT_ID_MAX, default: 10)')
+parser.add_argument('--wrong-key', type=int, default=0, metavar='N', help='number of coins answering with a wrong key')
+parser.add_argument('--stall', type=int, default=0, metavar='N', help='number of coins never answering the challenge')
+parser.add_argument('--slow', type=int, default=0, metavar='N', help='number of coins answering late')
+
+FAULTS = ['SWARM_FAULT_WRONG_KEY', 'SWARM_FAULT_STALL', 'SWARM_FAULT_SLOW']
+
+
+def c_bytes(data):
+    return '{' + ', '.join('0x%02x' % b for b in data) + '}'
+
+
+# bt_addr_le_t initializer, random static address (little endian like in the stack)
+def c_addr(addr):
+    return '{.type = BT_ADDR_LE_RANDOM, .a = {.val = %s}}' % c_bytes(str_to_addr(addr))
+
+
+def main():
+    args = parser.parse_args()
+    db = CoinDB()
+    if not db.identity:
+        sys.exit('central.txt not found')
+    faulty = args.wrong_key + args.stall + args.slow
+    if faulty > args.count or args.count > len(db.coins):
+        sys.exit('not enough coins in coins.txt')
+    # the faulty coins are the last ones
+    faults = ['SWARM_FAULT_NONE'] * (args.count - faulty) + \
+        [FAULTS[0]] * args.wrong_key + [FAULTS[1]] * args.stall + [FAULTS[2]] * args.slow
+    lines = ['// generated by prod/gen_swarm.py, do not edit',
+             'const struct swarm_central swarm_central = {',
+             '        .addr = %s,' % c_addr(db.identity[0]),
+             '        .irk = %s,' % c_bytes(bytes.fromhex(db.identity[1])),
+             '};',
+             '',
+             'const struct swarm_coin swarm_coins[] = {']
+    for addr, fault in zip(sorted(db.coins)[:args.count], faults):
+        irk, ltk, spacekey = db.coins[addr]
+        lines += ['        { // %s' % addr,
+                  '                .addr = %s,' % c_addr(addr),
+                  '                .irk = %s,' % c_bytes(bytes.fromhex(irk)),
+                  '                .ltk = %s,' % c_bytes(bytes.fromhex(ltk)),
+                  '                .spacekey = %s,' % c_bytes(bytes.fromhex(spacekey)),
+                  '                .fault = %s,' % fault,
+                  '        },']
+    lines += ['};', '']
+    with open(args.output, 'w') as f:
+        f.write('\n'.join(lines))
+    print('%u coins (%u faulty) written to %s' % (args.count, faulty, args.output))
+
+
+if __name__ == '__main__':
+    main()
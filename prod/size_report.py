@@ -0,0 +1,158 @@
+#!/usr/bin/python3
+import argparse
+import collections
+import re
+import sys
+
+parser = argparse.ArgumentParser(description='Report ROM and RAM of a firmware image per module from its linker map '
+                                             '(build/<image>/zephyr/zephyr.map) against the budget of the nRF51822.')
+parser.add_argument('map', help='linker map file')
+parser.add_argument('--baseline', help='linker map of another build, the difference per module is reported')
+parser.add_argument('--files', action='store_true', help='report per object file instead of per module')
+# nrf51_coin DTS: the image ends at the storage partition, nRF51822 QFAA has 16 KiB RAM
+parser.add_argument('--rom-budget', type=lambda x: int(x, 0), default=0x3e000,
+                    help='ROM budget in bytes (default: 0x3e000, flash below the storage partition of nrf51_coin)')
+parser.add_argument('--ram-budget', type=lambda x: int(x, 0), default=0x4000,
+                    help='RAM budget in bytes (default: 0x4000, nRF51822 QFAA)')
+parser.add_argument('--check', action='store_true', help='exit with an error if the image exceeds the budget')
+
+# output sections that are not loaded onto the chip
+NOT_LOADED = ('.debug', '.comment', '.ARM.attributes', '.stab', '.line', '.note', '.gnu', '/DISCARD/')
+
+# input section line, long section names put the address on the next line
+INPUT = re.compile(r'^ (\S+)?\s+0x([0-9a-f]+)\s+0x([0-9a-f]+)(?:\s+(.*))?$')
+CONTINUED = re.compile(r'^\s+0x[0-9a-f]+\s+0x[0-9a-f]+')
+OUTPUT = re.compile(r'^(\S+)\s+0x([0-9a-f]+)\s+0x([0-9a-f]+)(?:\s+load address 0x([0-9a-f]+))?')
+MEMORY = re.compile(r'^(\S+)\s+0x([0-9a-f]+)\s+0x([0-9a-f]+)')
+OBJECT = re.compile(r'(?:.*/)?([^/(]+)\((.+)\)$')
+
+# object files of libzephyr.a by subsystem (most subsystems are compiled into it)
+ZEPHYR_PREFIXES = [('log_', 'logging'), ('shell', 'shell'), ('settings', 'settings'), ('fcb', 'fcb'),
+                   ('printk', 'printk'), ('prf', 'printk'), ('crc', 'lib/crc'), ('tc_', 'tinycrypt')]
+
+
+def module(obj, files):
+    m = OBJECT.match(obj)
+    if not m:
+        # object file outside of a library (generated tables, linker stubs)
+        return obj.rsplit('/', 1)[-1].replace('.obj', '') if files else 'zephyr (generated)'
+    lib, member = m.group(1), m.group(2).replace('.obj', '')
+    if lib == 'libapp.a':
+        return 'app/' + member
+    if lib == 'libzephyr.a':
+        if files:
+            return 'zephyr/' + member
+        return next((name for prefix, name in ZEPHYR_PREFIXES if member.startswith(prefix)), 'zephyr (other)')
+    if lib in ('libc.a', 'libgcc.a', 'libm.a'):
+        # toolchain libraries
+        name = lib[:-2]
+    else:
+        name = lib[3:-2] if lib.startswith('lib') and lib.endswith('.a') else lib
+    name = name.replace('subsys__', '').replace('__', '/')
+    return name + '/' + member if files else name
+
+
+def parse(path, files):
+    """returns {module: [rom, ram]} of a GNU ld map file"""
+    sizes = collections.defaultdict(lambda: [0, 0])
+    regions = []
+    rom = ram = False
+    pending = pending_out = None
+    in_memory = in_map = False
+    with open(path) as f:
+        for line in f:
+            line = line.rstrip('\n')
+            if line.startswith('Memory Configuration'):
+                in_memory = True
+                continue
+            if line.startswith('Linker script and memory map'):
+                in_memory = False
+                in_map = True
+                continue
+            if in_memory:
+                m = MEMORY.match(line)
+                if m and m.group(1) != 'Name':
+                    regions.append((m.group(1), int(m.group(2), 16), int(m.group(3), 16)))
+                continue
+            if not in_map:
+                continue
+            m = OUTPUT.match(line)
+            if not m and pending_out and CONTINUED.match(line):
+                # output section name alone on the line
+                m = OUTPUT.match(pending_out + line)
+            if m or (line and not line[0].isspace()):
+                pending = None
+                pending_out = None if m else line.strip()
+                name = line.split()[0] if line[0] != ' ' else m.group(1)
+                if name.startswith(NOT_LOADED) or not m:
+                    rom = ram = False
+                    continue
+                vma = int(m.group(2), 16)
+                region = next((r[0] for r in regions if r[1] <= vma < r[1] + r[2] and r[0] != '*default*'), '')
+                in_ram = 'RAM' in region.upper()
+                # initialized data is copied from flash
+                rom = not in_ram or m.group(4) is not None
+                ram = in_ram
+                continue
+            if not (rom or ram):
+                continue
+            m = INPUT.match(line)
+            if not m:
+                # section name alone on the line, its address and size follow
+                stripped = line.strip()
+                pending = stripped if stripped and not stripped.startswith('*') and ' ' not in stripped else None
+                continue
+            section = m.group(1) or pending
+            pending = None
+            size = int(m.group(3), 16)
+            if section == '*fill*':
+                key = '(fill)'
+            elif not size or section is None or not m.group(4) or m.group(4).startswith('0x'):
+                continue
+            else:
+                key = module(m.group(4).strip(), files)
+            if rom:
+                sizes[key][0] += size
+            if ram:
+                sizes[key][1] += size
+    return sizes
+
+
+def kib(n):
+    return '%.1f' % (n / 1024)
+
+
+def main():
+    args = parser.parse_args()
+    sizes = parse(args.map, args.files)
+    base = parse(args.baseline, args.files) if args.baseline else None
+    names = sorted(set(sizes) | set(base or ()), key=lambda k: (-sizes[k][0] if k in sizes else 0, k))
+    header = '%-40s %9s %9s' % ('module', 'ROM', 'RAM')
+    if base is not None:
+        header += ' %9s %9s' % ('ROM diff', 'RAM diff')
+    print(header)
+    for name in names:
+        rom, ram = sizes[name] if name in sizes else (0, 0)
+        line = '%-40s %9u %9u' % (name, rom, ram)
+        if base is not None:
+            b_rom, b_ram = base[name] if name in base else (0, 0)
+            line += ' %+9d %+9d' % (rom - b_rom, ram - b_ram)
+        print(line)
+    rom = sum(s[0] for s in sizes.values())
+    ram = sum(s[1] for s in sizes.values())
+    line = '%-40s %9u %9u' % ('total', rom, ram)
+    if base is not None:
+        line += ' %+9d %+9d' % (rom - sum(s[0] for s in base.values()), ram - sum(s[1] for s in base.values()))
+    print(line)
+    over = False
+    for what, used, budget in (('ROM', rom, args.rom_budget), ('RAM', ram, args.ram_budget)):
+        left = budget - used
+        over |= left < 0
+        print('%s: %s of %s KiB (%u%%), %s %s KiB' % (what, kib(used), kib(budget), used * 100 // budget,
+                                                     'free' if left >= 0 else 'OVER BUDGET by', kib(abs(left))))
+    if args.check and over:
+        sys.exit('image does not fit the budget')
+
+
+if __name__ == "__main__":
+    main()
@@ -1,7 +1,11 @@
 #!/usr/bin/python3
+import argparse
+import glob
 import re
 import aioserial
 import asyncio
+import hashlib
+from coindb import CoinDB, read_master, master_fingerprint, spacekey_generation
 import multiprocessing
 import serial.serialutil
 import os
@@ -9,35 +13,72 @@ import sys
 import time
 from enum import IntEnum
 
+parser = argparse.ArgumentParser(description='Synchronize the coin database to all attached centrals and print their events.')
+parser.add_argument('--port', action='append', metavar='[DOOR=]PORT',
+                    help='serial port of a central, repeatable (default: every attached keykeeper dongle)')
 
-class KeykeeperDB:
-    def __init__(self):
-        self.coins = {}
-        self.identity = []
-        self.names = {}
-        self.load()
-
-    def load(self, coins="coins.txt", central="central.txt", names="names.txt"):
-        coin_list = []
-        identity = None
-        with open(coins, "r") as f:
-            for line in f:
-                m = re.match(r"(.{17})\s+(.{32})\s+(.{32})\s+(.{64})", line)
-                if m:
-                    self.coins[m.group(1)] = m.groups()[1:]
-        with open(central, "r") as f:
-            line = f.readline()
-            m = re.match(r"(.{17})\s+(.{32})", line)
-            if m:
-                self.identity = m.groups()
+# USB product string of the central (CONFIG_USB_DEVICE_PRODUCT)
+KEYKEEPER_PRODUCT = 'N39 BLE KEYKEEPER'
+
+
+# every dongle has the same USB serial number, so /dev/serial/by-id only links one of them
+# returns {door: port} with the USB port path (stable per socket) as door name
+def discover_centrals():
+    centrals = {}
+    for tty in sorted(glob.glob('/sys/class/tty/ttyACM*')):
+        interface = os.path.realpath(os.path.join(tty, 'device'))
         try:
-            with open(names, "r") as f:
-                for line in f:
-                    m = re.match(r"(.{17})\s+(.+)", line)
-                    if m:
-                        self.names[m.group(1)] = m.group(2)
-        except:
-            pass
+            with open(os.path.join(interface, '..', 'product')) as f:
+                product = f.read().strip()
+        except OSError:
+            continue
+        if product == KEYKEEPER_PRODUCT:
+            centrals[os.path.basename(interface).split(':')[0]] = '/dev/' + os.path.basename(tty)
+    return centrals
+
+
+class KeykeeperDB(CoinDB):
+    def __init__(self, master="master.txt", **kwargs):
+        self._bucket_coins = {}
+        super().__init__(**kwargs)
+        # master key of derived-key mode, None if spacekeys are only random
+        self.master = read_master(master)
+
+    # the digests are shared by all centrals, compute them once per change
+    def reload(self):
+        changed = super().reload()
+        if "coins" in changed:
+            self._bucket_coins = {}
+        return changed
+
+    # coins are assigned to digest buckets by the last 4 bits of their address
+    @staticmethod
+    def bucket(addr):
+        return int(addr[-1], 16)
+
+    # digest of addr|IRK|LTK|spacekey as computed by the central (see central-onchip/src/digest.h)
+    def coin_digest(self, addr):
+        irk, ltk, spacekey = self.coins[addr]
+        record = bytes.fromhex(addr.replace(':', '') + irk + ltk + spacekey)
+        return hashlib.blake2s(record).hexdigest().upper()
+
+    def bucket_coins(self, bucket):
+        if bucket not in self._bucket_coins:
+            self._bucket_coins[bucket] = {a: self.coin_digest(a) for a in sorted(self.coins)
+                                          if self.bucket(a) == bucket}
+        return self._bucket_coins[bucket]
+
+    def bucket_digests(self):
+        digests = []
+        for b in range(16):
+            h = hashlib.blake2s()
+            for d in self.bucket_coins(b).values():
+                h.update(bytes.fromhex(d))
+            digests.append(h.hexdigest().upper())
+        return digests
+
+    def digest(self):
+        return hashlib.blake2s(b''.join(bytes.fromhex(d) for d in self.bucket_digests())).hexdigest().upper()
 
 
 class StatusType(IntEnum):
@@ -51,15 +92,23 @@ class StatusType(IntEnum):
 
 class Coin:
     def __init__(self):
-        self.battery_level = 0
+        # None until an advertisement with the battery level was seen (the coin sends it once it is measured)
+        self.battery_level = None
         self.address = "00:00:00:00:00:00"
 
 
 class KeykeeperSerialMgr:
-    def __init__(self, db, status_pipe):
+    def __init__(self, db, status_pipe, port, door=None):
         self.config_mode = True
         self.db = db
         self.status_pipe = status_pipe
+        self.port = port
+        self.door = door or os.path.basename(port)
+        self.central_serial = None
+
+    # all centrals share the status pipe, every message is one tagged line (atomic write)
+    def _status(self, message):
+        os.write(self.status_pipe, '[{}] status: {}\n'.format(self.door, message).encode('utf8'))
 
     # read line and remove color codes
     async def _serial_fetch_line(self):
@@ -89,49 +138,103 @@ class KeykeeperSerialMgr:
                 return k, m.groups()
         return None, None
 
-    # read registered bonds
-    async def _request_bonds(self):
-        bonds = []
-        self.central_serial.write(b'stats bonds\r\n')
+    # read digest of the coin table (and its buckets) or the coin digests of one bucket
+    async def _request_digest(self, bucket=None):
+        result = {'running': False, 'identity': None, 'keystore': None, 'master': None, 'digest': None, 'buckets': {},
+                  'coins': {}}
+        cmd = 'stats digest\r\n' if bucket is None else 'stats digest {}\r\n'.format(bucket)
+        self.central_serial.write(cmd.encode('ASCII'))
         line = None
-        while not (line and line.endswith('stats bonds\r\n')):
+        while not (line and line.endswith(cmd)):
             line = await self._serial_fetch_line()
-            # print(line, end='', flush=True)
-        while line != 'done\r\n':
-            line = await self._serial_fetch_line()
-            bond = re.match(r"\[(.{17})\] keys: 34, flags: 17\r\n", line)
-            if bond:
-                bonds.append(bond.groups())
-        return bonds
-
-    # read registered spacekeys (only first byte)
-    async def _request_spacekeys(self):
-        spacekeys = []
-        self.central_serial.write(b'stats spacekey\r\n')
-        line = None
-        while not (line and line.endswith('stats spacekey\r\n')):
-            line = await self._serial_fetch_line()
-            # print(line, end='', flush=True)
         while line != 'done\r\n':
             line = await self._serial_fetch_line()
-            spacekey = re.match(r"\[(.{17})\] : ([A-F0-9]{2})\.\.\.\r\n", line)
-            if spacekey:
-                spacekeys.append(spacekey.groups())
-        return spacekeys
-
-    # read settings
-    async def _read_settings(self):
-        self.central_serial.write(b'settings load\r\n')
-        line = None
-        k = None
-        while k != StatusType.IDENTITY:
-            line = await self._serial_fetch_line()
-            # print(line, end='', flush=True)
-            k, v = self._parse_status(line)
-            if 'bt_hci_core: Read Static Addresses command not available' in line:
+            m = re.match(r"ble: (running|stopped)\r\n", line)
+            if m:
+                result['running'] = m.group(1) == 'running'
+            m = re.match(r"id: (.{17})\r\n", line)
+            if m:
+                result['identity'] = m.group(1)
+            m = re.match(r"keystore: (\d+)\r\n", line)
+            if m:
+                result['keystore'] = int(m.group(1))
+            m = re.match(r"master: ([A-F0-9]{16}|none)\r\n", line)
+            if m:
+                result['master'] = m.group(1)
+            m = re.match(r"digest: ([A-F0-9]{64})\r\n", line)
+            if m:
+                result['digest'] = m.group(1)
+            m = re.match(r"bucket (\d+): ([A-F0-9]{64})\r\n", line)
+            if m:
+                result['buckets'][int(m.group(1))] = m.group(2)
+            m = re.match(r"\[(.{17})\] ([A-F0-9]{64})\r\n", line)
+            if m:
+                result['coins'][m.group(1)] = m.group(2)
+        return result
+
+    # derived-key mode: a central that prints its master fingerprint gets only the bonds of derived coins
+    async def _add_coin(self, state, cmd, addr):
+        irk, ltk, spacekey = self.db.coins[addr]
+        generation = None
+        if state['master'] is not None and self.db.master:
+            generation = spacekey_generation(self.db.master, addr, spacekey)
+        if generation is None:
+            self.central_serial.write('{} {} {} {} {}\r\n'.format(cmd, addr, irk, ltk, spacekey).encode('ASCII'))
+        else:
+            if generation:
+                self.central_serial.write('space gen {} {}\r\n'.format(addr, generation).encode('ASCII'))
+                await self._wait_until_done()
+            self.central_serial.write('{} {} {} {}\r\n'.format(cmd, addr, irk, ltk).encode('ASCII'))
+        await self._wait_until_done()
+
+    async def _sync_master(self, state):
+        if state['master'] is not None and self.db.master and state['master'] != master_fingerprint(self.db.master):
+            self.central_serial.write('space master {}\r\n'.format(self.db.master.hex().upper()).encode('ASCII'))
+            await self._wait_until_done()
+            # derived spacekeys changed, so did the digests
+            state.update(await self._request_digest())
+
+    # only transfer the buckets that differ
+    async def _sync_coins(self, state):
+        db_buckets = self.db.bucket_digests()
+        for b in range(16):
+            if state['buckets'].get(b) == db_buckets[b]:
+                continue
+            central_coins = (await self._request_digest(b))['coins']
+            db_coins = self.db.bucket_coins(b)
+            for addr, digest in central_coins.items():
+                if db_coins.get(addr) != digest:
+                    self.central_serial.write(
+                        'coin del {}\r\n'.format(addr).encode('ASCII'))
+                    await self._wait_until_done()
+            for addr, digest in db_coins.items():
+                if central_coins.get(addr) != digest:
+                    await self._add_coin(state, 'coin add', addr)
+
+    # the flash key store is sorted: deletions are done in place, anything else rewrites the whole store
+    async def _sync_keystore(self, state):
+        db_buckets = self.db.bucket_digests()
+        deleted = []
+        for b in range(16):
+            if state['buckets'].get(b) == db_buckets[b]:
+                continue
+            central_coins = (await self._request_digest(b))['coins']
+            db_coins = self.db.bucket_coins(b)
+            if any(central_coins.get(addr) != digest for addr, digest in db_coins.items()):
+                deleted = None
                 break
-            if k == StatusType.IDENTITY:
-                self.identity = v[0].upper()
+            deleted += [addr for addr in central_coins if addr not in db_coins]
+        if deleted is not None:
+            for addr in deleted:
+                self.central_serial.write('keystore del {}\r\n'.format(addr).encode('ASCII'))
+                await self._wait_until_done()
+            return
+        self.central_serial.write(b'keystore erase\r\n')
+        await self._wait_until_done()
+        for addr in sorted(self.db.coins):
+            await self._add_coin(state, 'keystore add', addr)
+        self.central_serial.write(b'keystore commit\r\n')
+        await self._wait_until_done()
 
     async def _wait_until_done(self):
         line = None
@@ -144,51 +247,44 @@ class KeykeeperSerialMgr:
     async def _manage_serial(self):
         # clear old state
         self.identity = None
-        self.bonds = None
-        self.spacekeys = None
 
         if self.config_mode:
-            os.write(self.status_pipe, str(
-                "status: synchronizing database").encode('utf8'))
-            # just load settings, don't start scanning
-            await self._read_settings()
-            # read coin data from device
-            self.bonds = await self._request_bonds()
-            self.spacekeys = await self._request_spacekeys()
-            if self.identity != self.db.identity[0]:
-                if self.identity:
-                    self.central_serial.write(b'settings clear\r\n')
-                    await self._wait_until_done()
-                else:
+            self._status("synchronizing database")
+            # one round trip if nothing changed
+            state = await self._request_digest()
+            identity_ok = state['identity'] == self.db.identity[0]
+            master_ok = state['master'] is None or not self.db.master or \
+                state['master'] == master_fingerprint(self.db.master)
+            if identity_ok and master_ok and state['digest'] == self.db.digest():
+                self.config_mode = False
+                if not state['running']:
+                    self.central_serial.write(b'ble_start\r\n')
+                self._status("central connected and scanning")
+            elif state['running']:
+                # coins can only be changed while the BLE stack is stopped
+                self.central_serial.write(b'reboot\r\n')
+                await self._wait_until_done()
+            elif not identity_ok and state['identity']:
+                # settings clear reboots the central, the database is synchronized after reconnecting
+                self.central_serial.write(b'settings clear\r\n')
+                await self._wait_until_done()
+            else:
+                if not identity_ok:
                     self.central_serial.write('central_setup {} {}\r\n'.format(
                         *self.db.identity).encode('ASCII'))
                     await self._wait_until_done()
-            if len(self.bonds) != len(self.spacekeys):
-                self.central_serial.write(b'settings clear\r\n')
-            is_present = {c: False for c in self.db.coins.keys()}
-            for bond, skey in zip(self.bonds, self.spacekeys):
-                if bond[0] != skey[0]:
-                    self.central_serial.write(b'settings clear\r\n')
-                    await self._wait_until_done()
-                if bond[0] not in self.db.coins or skey[1] != self.db.coins[bond[0]][2][:2]:
-                    self.central_serial.write(
-                        'coin del {}\r\n'.format(bond[0]).encode('ASCII'))
-                    await self._wait_until_done()
+                await self._sync_master(state)
+                if state['keystore'] is not None:
+                    await self._sync_keystore(state)
                 else:
-                    is_present[bond[0]] = True
-            for addr, present in is_present.items():
-                if not present:
-                    self.central_serial.write('coin add {} {} {} {}\r\n'.format(
-                        addr, *self.db.coins[addr]).encode('ASCII'))
-                    await self._wait_until_done()
-            self.config_mode = False
-            self.central_serial.write(b'reboot\r\n')
-            await self._wait_until_done()
+                    await self._sync_coins(state)
+                self.config_mode = False
+                self.central_serial.write(b'ble_start\r\n')
+                self._status("central connected and scanning")
         else:
             # start BLE stack
             self.central_serial.write(b'ble_start\r\n')
-            os.write(self.status_pipe, str(
-                "status: central connected and scanning").encode('utf8'))
+            self._status("central connected and scanning")
 
         # main event loop
         while True:
@@ -198,12 +294,13 @@ class KeykeeperSerialMgr:
             if k == StatusType.IDENTITY:
                 self.identity = v[0].upper()
             if k == StatusType.AUTHENTICATED:
+                level = self.current_coin.battery_level
+                battery = "?" if level is None else "{}%".format(level)
                 if self.current_coin.address in self.db.names:
-                    os.write(self.status_pipe, str("status: {}'s coin ({}%🔋) authenticated".format(
-                        self.db.names[self.current_coin.address], self.current_coin.battery_level)).encode('utf8'))
+                    self._status("{}'s coin ({}🔋) authenticated".format(
+                        self.db.names[self.current_coin.address], battery))
                 else:
-                    os.write(self.status_pipe, str("status: {} ({}%🔋) authenticated".format(
-                        self.current_coin.address, self.current_coin.battery_level)).encode('utf8'))
+                    self._status("{} ({}🔋) authenticated".format(self.current_coin.address, battery))
             elif k == StatusType.BATTERY_LEVEL:
                 self.current_coin.battery_level = v[0]
             elif k == StatusType.CONNECTED:
@@ -211,41 +308,110 @@ class KeykeeperSerialMgr:
             elif k == StatusType.DISCONNECTED:
                 self.current_coin = Coin()
 
-    # main loop with reconnecting
+    # called when the database changed: coins can only be changed while the BLE stack is stopped
+    def resync(self):
+        if self.config_mode:
+            return  # already synchronizing, the next round trip compares the digests again
+        self.config_mode = True
+        self._status("database changed")
+        try:
+            self.central_serial.write(b'reboot\r\n')
+        except (serial.serialutil.SerialException, AttributeError):
+            pass  # synchronized after reconnecting
+
+    # main loop with reconnecting, returns when the port is gone
     async def run_async(self):
         self.current_coin = Coin()
-
-        first_start = True
         while True:
             try:
-                self.central_serial = aioserial.AioSerial(
-                    port=os.path.realpath('/dev/serial/by-id/usb-ZEPHYR_N39_BLE_KEYKEEPER_0.01-if00'))
+                self.central_serial = aioserial.AioSerial(port=os.path.realpath(self.port))
                 self.central_serial.write(b'\r\n\r\n')
-                if first_start:
-                    self.central_serial.write(b'reboot\r\n')
-                    first_start = False
-                    await self._wait_until_done()
-
-                else:
-                    await self._manage_serial()
+                await self._manage_serial()
             except serial.serialutil.SerialException:
-                os.write(self.status_pipe, str(
-                    "status: connecting to central").encode('utf8'))
+                if self.central_serial:
+                    self.central_serial.close()
+                self.central_serial = None
+                self.config_mode = True
+                if not os.path.exists(self.port):
+                    self._status("central removed")
+                    return
+                self._status("connecting to central")
+                await asyncio.sleep(1)
+
+
+class KeykeeperDaemon:
+    """
+    Drives every central from its own task, all fed from one database.
+    Database changes are synchronized to all centrals in parallel, their events are merged into the status pipe.
+    """
+
+    def __init__(self, db, status_pipe, ports=None):
+        self.db = db
+        self.status_pipe = status_pipe
+        self.ports = ports  # {door: port}, None to discover attached dongles
+        self.mgrs = {}  # door -> (KeykeeperSerialMgr, task)
+
+    # start a task for every new central (dongles can be plugged in while running)
+    async def _discover(self):
+        while True:
+            for door, port in (self.ports or discover_centrals()).items():
+                if door not in self.mgrs or self.mgrs[door][1].done():
+                    mgr = KeykeeperSerialMgr(self.db, self.status_pipe, port, door)
+                    self.mgrs[door] = (mgr, asyncio.ensure_future(mgr.run_async()))
+            await asyncio.sleep(2)
+
+    # reload the database when its files change, resynchronize the centrals if coins or identity changed
+    async def _watch_db(self):
+        changed_event = asyncio.Event()
+        fd = self.db.fileno()
+        if fd is not None:
+            asyncio.get_running_loop().add_reader(fd, changed_event.set)
+        while True:
+            if fd is not None:
+                await changed_event.wait()
+                changed_event.clear()
+            else:
                 await asyncio.sleep(1)
+            changed = self.db.poll()
+            if changed & {"coins", "identity"}:
+                for mgr, _ in self.mgrs.values():
+                    mgr.resync()
+
+    async def run_async(self):
+        watch = asyncio.ensure_future(self._watch_db())
+        try:
+            await self._discover()
+        finally:
+            tasks = [watch] + [task for _, task in self.mgrs.values()]
+            for task in tasks:
+                task.cancel()
+            await asyncio.gather(*tasks, return_exceptions=True)
 
     def run(self):
         asyncio.run(self.run_async())
 
 
-def _run_serialmgr():
+def parse_ports(ports):
+    if not ports:
+        return None
+    result = {}
+    for p in ports:
+        door, _, port = p.rpartition('=')
+        result[door or os.path.basename(port)] = port
+    return result
+
+
+def _run_daemon(ports):
     db = KeykeeperDB()
     pipein, pipeout = os.pipe()
-    k = KeykeeperSerialMgr(db, pipeout)
+    k = KeykeeperDaemon(db, pipeout, ports)
     p = multiprocessing.Process(target=k.run, daemon=True)
     p.start()
-    while True:
-        print(os.read(pipein, 100).decode('utf8'))
+    with os.fdopen(pipein, 'r', encoding='utf8') as status:
+        for line in status:
+            print(line, end='', flush=True)
 
 
 if __name__ == "__main__":
-    _run_serialmgr()
+    args = parser.parse_args()
+    _run_daemon(parse_ports(args.port))